@@ -53,4 +53,16 @@ then
   else
     exec bash
   fi
+elif [[ $- == *i* && "$LD_PRELOAD$DYLD_INSERT_LIBRARIES" == *$AI_CLI_LIB* ]]
+then
+  # Pass the exit status of each command to the library, which can
+  # speculatively query for a fix of failed ones
+  __ai_cli_prompt_command()
+  {
+    AI_CLI_LAST_STATUS=$?
+    return $AI_CLI_LAST_STATUS
+  }
+  if [[ "$PROMPT_COMMAND" != *__ai_cli_prompt_command* ]] ; then
+    PROMPT_COMMAND="__ai_cli_prompt_command${PROMPT_COMMAND:+;$PROMPT_COMMAND}"
+  fi
 fi
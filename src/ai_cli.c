@@ -19,21 +19,31 @@
 
 #define _GNU_SOURCE
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <wchar.h>
 #include <dlfcn.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 
+#include "async.h"
+#include "backend.h"
+#include "candidates.h"
 #include "config.h"
+#include "context.h"
+#include "log.h"
+#include "reload.h"
+#include "router.h"
+#include "session.h"
+#include "speculate.h"
 #include "support.h"
+#include "trace.h"
+#include "usage.h"
 
-#include "fetch_anthropic.h"
-#include "fetch_hal.h"
-#include "fetch_llamacpp.h"
-#include "fetch_openai.h"
+#include "fetch_local.h"
 
 /*
  * Dynamically obtained pointer to readline(3) variables..
@@ -43,15 +53,158 @@
 static char **rl_line_buffer_ptr;
 static int *rl_end_ptr;
 static int *rl_point_ptr;
+static Keymap emacs_standard_keymap_ptr;
 static Keymap vi_movement_keymap_ptr;
+static Keymap vi_insertion_keymap_ptr;
 static int *history_length_ptr;
+static int *history_base_ptr;
+static rl_hook_func_t **rl_event_hook_ptr;
+static rl_voidfunc_t **rl_redisplay_function_ptr;
+static FILE **rl_outstream_ptr;
+static char **rl_prompt_ptr;
+static rl_hook_func_t **rl_startup_hook_ptr;
+
+// Bash function returning the value of a shell variable
+static char *(*get_string_value_ptr)(const char *name);
 
 // Loaded configuration
 static config_t config;
 
 // API fetch function, e.g. acl_fetch_openai or acl_fetch_llamacpp
+static fetch_t fetch;
+
+// Routing of queries to model tiers, each tier's fetch and configuration
+static router_t router;
+static fetch_t tier_fetch[MAX_TIERS];
+static config_t *tier_config[MAX_TIERS];
+static config_t tier_config_copy[MAX_TIERS];
+
+// Hooks that were in place before those for background queries
+static rl_hook_func_t *prev_event_hook;
+static rl_voidfunc_t *prev_redisplay;
+static rl_hook_func_t *prev_startup_hook;
+
+// Inline suggestion (ghost text) shown dimmed after the cursor
+static char *ghost;		// Text shown
+static char *ghost_line;	// Edit buffer contents to which it applies
+static char *ghost_response;	// Corresponding response
+static bool ghost_replaces;	// Accepting replaces the edit buffer
+static bool ghost_shown;	// Ghost text is on the screen
 
-static char * (*fetch)(config_t *config, const char *prompt, int history_length);
+// Edit buffer state for debouncing background queries
+static char *last_line;		// Contents at the last redisplay
+static int last_point;		// Cursor position at the last redisplay
+static double last_change;	// Time of the last change (ms)
+static char *requested_line;	// Contents of the last background query
+
+// Speculative query for fixing the last failed command
+static char *speculation_prompt;	// Its prompt; NULL if none
+static char *speculation_response;	// Its response, once available
+static fetch_t speculation_fetch;	// Backend through which it is made
+
+/*
+ * Return the fetch function for the specified API, after loading
+ * its backend and verifying the configuration values it requires.
+ * Return NULL on error.
+ */
+static fetch_t
+api_fetch(const char *api)
+{
+	return acl_backend_load(&config, api);
+}
+
+/*
+ * Set the fetch functions of the configured API and, if route is
+ * true, set up afresh the router and its tiers.
+ * Return false on error.
+ */
+static bool
+backends_load(bool route)
+{
+	if ((fetch = api_fetch(config.general_api)) == NULL)
+		return false;
+	if (route) {
+		acl_router_free(&router);
+		if (config.router_tiers_set
+		    && !acl_router_init(&router, config.router_tiers))
+			return false;
+	}
+	for (int i = 0; i < router.n; i++) {
+		// Backends may keep the configuration passed to them
+		tier_config[i] = acl_router_config(&router, i, &config,
+		    &tier_config_copy[i]);
+		if ((tier_fetch[i] = acl_backend_load(tier_config[i],
+		    router.tiers[i].api)) == NULL)
+			return false;
+	}
+	return true;
+}
+
+// Shut down the loaded backends whose configuration section changed
+static void
+backends_unload_changed(void)
+{
+	if (acl_reload_changed(config.general_api))
+		acl_backend_unload(config.general_api);
+	for (int i = 0; i < router.n; i++)
+		if (acl_reload_changed(router.tiers[i].api))
+			acl_backend_unload(router.tiers[i].api);
+}
+
+/*
+ * Apply the changes made to the configuration files since the last
+ * query.  The new configuration replaces the old one while no query
+ * is in flight, and only the state derived from the changed sections,
+ * such as backends' prepared headers and endpoints, is set up anew.
+ * Key bindings and hooks keep their values until the program restarts.
+ */
+static void
+reload_config(void)
+{
+	if (!acl_reload_pending())
+		return;
+
+	// Background queries use the configuration
+	acl_async_cancel_wait();
+	config_t fresh = {0};
+	if (!acl_reload_read(&fresh))
+		return;
+	if (!fresh.prompt_system || !fresh.general_api_set) {
+		fprintf(stderr, "\nai_cli: Missing [general] api or [prompt] "
+		    "system; keeping the previous configuration.\n");
+		acl_config_free(&fresh);
+		acl_reload_revert();
+		return;
+	}
+
+	config_t old = config;
+	backends_unload_changed();
+	config = fresh;
+	backends_unload_changed();
+	if (!backends_load(acl_reload_changed("router"))) {
+		fprintf(stderr, "\nai_cli: Keeping the previous "
+		    "configuration.\n");
+		backends_unload_changed();
+		config = old;
+		backends_unload_changed();
+		acl_reload_revert();
+		backends_load(true);
+		acl_config_free(&fresh);
+		return;
+	}
+	// Detached context providers may still be reading the old values
+	acl_context_wait();
+	acl_config_free(&old);
+
+	if (acl_reload_changed("general"))
+		acl_log_initialize(&config);
+	if (acl_reload_changed("usage"))
+		acl_usage_initialize(&config);
+	if (acl_reload_changed("trace"))
+		acl_trace_initialize(&config);
+	if (config.general_verbose)
+		fprintf(stderr, "\nConfiguration reloaded\n");
+}
 
 /*
  * Add the specified prompt to the RL history, as a comment if the
@@ -80,35 +233,579 @@ add_commented_prompt_to_history(const char *prompt)
 	return strlen(config.prompt_comment);
 }
 
+/*
+ * Return true if a history line entered after the history had
+ * the specified length is the specified response, as it was
+ * inserted in the edit buffer.
+ */
+static bool
+response_executed(const char *response, int since)
+{
+	HIST_ENTRY **list = history_list();
+	if (!list)
+		return false;
+
+	size_t prefix_len = config.general_response_prefix_set ?
+	    strlen(config.general_response_prefix) : 0;
+	for (int i = since; i < *history_length_ptr; i++) {
+		const char *line = list[i]->line;
+
+		if (prefix_len) {
+			if (strncmp(line, config.general_response_prefix, prefix_len) != 0
+			    || line[prefix_len] != ' ')
+				continue;
+			line += prefix_len + 1;
+		}
+		if (strcmp(line, response) == 0)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Replace the edit buffer's contents with the specified response.
+ * If new_line is true, start a new line, leaving the prompt visible.
+ */
+static void
+show_response(const char *response, bool new_line)
+{
+	if (new_line) {
+		rl_crlf();
+		rl_on_new_line();
+	}
+	rl_delete_text(0, *rl_end_ptr);
+	*rl_point_ptr = 0;
+	if (config.general_response_prefix_set) {
+		rl_insert_text(config.general_response_prefix);
+		rl_insert_text(" ");
+	}
+	rl_insert_text(response);
+}
+
+// Return true if the ghost text applies to the current edit buffer
+static bool
+ghost_applies(void)
+{
+	return ghost && strcmp(*rl_line_buffer_ptr, ghost_line) == 0
+	    && *rl_point_ptr == *rl_end_ptr;
+}
+
+static FILE *
+outstream(void)
+{
+	return *rl_outstream_ptr ? *rl_outstream_ptr : stdout;
+}
+
+// Remove the ghost text from the screen
+static void
+erase_ghost(void)
+{
+	if (!ghost_shown)
+		return;
+	fputs("\033[K", outstream());
+	fflush(outstream());
+	ghost_shown = false;
+}
+
+// Forget the ghost text, removing it from the screen
+static void
+clear_ghost(void)
+{
+	erase_ghost();
+	free(ghost);
+	free(ghost_line);
+	free(ghost_response);
+	ghost = ghost_line = ghost_response = NULL;
+}
+
+/*
+ * Set the ghost text for the specified prompt and response.
+ * A response extending the prompt is shown as its completion;
+ * other responses are shown as replacements.
+ */
+static void
+set_ghost(const char *prompt, const char *response)
+{
+	clear_ghost();
+	size_t len = strlen(prompt);
+	ghost_line = acl_safe_strdup(prompt);
+	ghost_response = acl_safe_strdup(response);
+	ghost_replaces = strncmp(response, prompt, len) != 0;
+	if (ghost_replaces)
+		acl_safe_asprintf(&ghost, "  => %s", response);
+	else
+		ghost = acl_safe_strdup(response + len);
+}
+
+/*
+ * Return the number of screen columns occupied by the multibyte
+ * character at s, setting *len to its length in bytes.
+ * An invalid sequence is taken as a single byte of one column.
+ */
+static int
+char_width(const char *s, mbstate_t *state, size_t *len)
+{
+	wchar_t wc;
+
+	*len = mbrtowc(&wc, s, MB_CUR_MAX, state);
+	if (*len == (size_t)-1 || *len == (size_t)-2) {
+		memset(state, 0, sizeof(*state));
+		*len = 1;
+		return 1;
+	}
+	if (*len == 0)
+		*len = 1;
+	int width = wcwidth(wc);
+	return width < 0 ? 0 : width;
+}
+
+// Return the number of screen columns occupied by the string s
+static int
+string_width(const char *s)
+{
+	mbstate_t state = {0};
+	int width = 0;
+	size_t len;
+
+	for (; *s; s += len)
+		width += char_width(s, &state, &len);
+	return width;
+}
+
+/*
+ * Return the number of screen columns occupied by the last line of
+ * the prompt, ignoring invisible characters and escape sequences.
+ */
+static int
+prompt_width(void)
+{
+	mbstate_t state = {0};
+	int width = 0;
+	bool invisible = false;
+	size_t len;
+
+	for (const char *p = *rl_prompt_ptr; p && *p; p += len) {
+		len = 1;
+		if (*p == RL_PROMPT_START_IGNORE)
+			invisible = true;
+		else if (*p == RL_PROMPT_END_IGNORE)
+			invisible = false;
+		else if (*p == '\n')
+			width = 0;
+		else if (*p == '\033' && p[1] == '[') {
+			for (p += 2; *p && !isalpha((unsigned char)*p); p++)
+				;
+			if (!*p)
+				break;
+		} else if (!invisible)
+			width += char_width(p, &state, &len);
+	}
+	return width;
+}
+
+/*
+ * Show the ghost text after the cursor, if it applies to the edit
+ * buffer, truncating it to the screen's width.
+ * Widths are measured in screen columns, as multibyte and wide
+ * characters occupy a number of them different from their bytes.
+ */
+static void
+draw_ghost(void)
+{
+	if (!ghost_applies() || !*ghost)
+		return;
+
+	int rows, cols;
+	rl_get_screen_size(&rows, &cols);
+	int space = cols - 1 - (prompt_width() + string_width(ghost_line))
+	    % cols;
+	mbstate_t state = {0};
+	int width = 0;
+	size_t len = 0, n;
+	for (; ghost[len]; len += n) {
+		int w = char_width(ghost + len, &state, &n);
+		if (width + w > space)
+			break;
+		width += w;
+	}
+	if (width <= 0)
+		return;
+	fprintf(outstream(), "\033[2m%.*s\033[0m\033[%dD", (int)len, ghost,
+	    width);
+	fflush(outstream());
+	ghost_shown = true;
+}
+
+/*
+ * Handle the completion of a background query.  If it is the
+ * speculative one, keep its response and return true.
+ * Otherwise return false, leaving the ownership of the arguments
+ * to the caller.
+ */
+static bool
+speculation_completed(char *prompt, char *response)
+{
+	if (!speculation_prompt || strcmp(prompt, speculation_prompt) != 0)
+		return false;
+	acl_speculate_record(&config, SPECULATE_COMPLETED, 0);
+	free(speculation_response);
+	speculation_response = response;
+	free(prompt);
+	return true;
+}
+
+// Obtain the response of a completed speculative query
+static void
+collect_speculation(void)
+{
+	char *prompt;
+	char *response = acl_async_result(&prompt);
+
+	if (response && !speculation_completed(prompt, response)) {
+		free(prompt);
+		free(response);
+	}
+}
+
+// Abandon the speculative query, cancelling it if it is in flight
+static void
+abandon_speculation(void)
+{
+	if (!speculation_prompt)
+		return;
+	if (!speculation_response)
+		collect_speculation();
+	if (!speculation_response) {
+		acl_async_cancel();
+		acl_speculate_record(&config, SPECULATE_CANCELLED,
+		    acl_speculate_tokens(&config, speculation_prompt));
+	}
+	free(speculation_prompt);
+	free(speculation_response);
+	speculation_prompt = speculation_response = NULL;
+}
+
+/*
+ * Fetch function of speculative queries, which marks their usage
+ * so that it counts toward the speculation budget.
+ */
+static char *
+speculative_fetch(config_t *query_config, const char *prompt,
+    int history_length)
+{
+	acl_usage_mark(SPECULATE_MARK);
+	char *response = speculation_fetch(query_config, prompt,
+	    history_length);
+	acl_usage_mark(NULL);
+	return response;
+}
+
+/*
+ * Readline startup hook, called before reading each line.
+ * If the previous command failed, as reported by the shell's
+ * activation hook, start a speculative query for fixing it.
+ */
+static int
+speculate_startup(void)
+{
+	abandon_speculation();
+	reload_config();
+
+	const char *status = get_string_value_ptr("AI_CLI_LAST_STATUS");
+	HIST_ENTRY **list = history_list();
+	int length = *history_length_ptr;
+	const char *command = list && length > 0 ? list[length - 1]->line : NULL;
+	// Only a command that entered the history can be identified
+	bool added = acl_speculate_new_entry(*history_base_ptr + length - 1,
+	    command);
+	if (status && atoi(status) != 0 && added
+	    && acl_speculate_allowed(&config)
+	    && acl_usage_budget(&config) == BUDGET_OK) {
+		char *prompt = acl_speculate_prompt(command, atoi(status));
+		speculation_fetch = fetch;
+		if (acl_async_start(speculative_fetch, &config, prompt,
+		    length)) {
+			acl_speculate_record(&config, SPECULATE_ISSUED, 0);
+			speculation_prompt = prompt;
+		} else
+			free(prompt);
+	}
+	return prev_startup_hook ? prev_startup_hook() : 0;
+}
+
+/*
+ * Readline redisplay function when background queries are enabled.
+ * Redraw the ghost text and note changes to the edit buffer.
+ */
+static void
+background_redisplay(void)
+{
+	erase_ghost();
+	prev_redisplay();
+
+	if (!last_line || strcmp(last_line, *rl_line_buffer_ptr) != 0
+	    || last_point != *rl_point_ptr) {
+		free(last_line);
+		last_line = acl_safe_strdup(*rl_line_buffer_ptr);
+		last_point = *rl_point_ptr;
+		last_change = acl_now_ms();
+		// The user is typing something unrelated to the failed command
+		if (**rl_line_buffer_ptr)
+			abandon_speculation();
+		// The query for the previous contents is no longer useful
+		if (!speculation_prompt)
+			acl_async_cancel();
+	}
+	draw_ghost();
+}
+
+/*
+ * Readline event hook, called while waiting for keyboard input.
+ * Show completed background queries and start one after the user
+ * has stopped typing for the configured time.
+ */
+static int
+autosuggest_event(void)
+{
+	if (prev_event_hook)
+		prev_event_hook();
+
+	char *prompt;
+	char *response = acl_async_result(&prompt);
+	if (response && speculation_completed(prompt, response))
+		return 0;
+	if (response) {
+		set_ghost(prompt, response);
+		free(prompt);
+		free(response);
+		draw_ghost();
+		return 0;
+	}
+
+	const char *line = *rl_line_buffer_ptr;
+	int delay = config.autosuggest_delay_set ? config.autosuggest_delay : 500;
+	if (*line && *rl_point_ptr == *rl_end_ptr
+	    && acl_now_ms() - last_change >= delay
+	    && (!requested_line || strcmp(requested_line, line) != 0)
+	    && !acl_async_busy()) {
+		reload_config();
+		if (acl_usage_budget(&config) == BUDGET_OK
+		    && acl_async_start(fetch, &config, line,
+		    *history_length_ptr)) {
+			free(requested_line);
+			requested_line = acl_safe_strdup(line);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Accept the inline suggestion, completing or replacing the edit
+ * buffer's contents.  Without a suggestion move forward a character.
+ */
+static int
+accept_suggestion(int count, int key)
+{
+	if (!ghost_applies())
+		return rl_forward_char(count, key);
+
+	erase_ghost();
+	if (ghost_replaces) {
+		add_commented_prompt_to_history(*rl_line_buffer_ptr);
+		show_response(ghost_response, false);
+		rl_free_undo_list();
+	} else
+		rl_insert_text(ghost_response + strlen(ghost_line));
+	clear_ghost();
+	return 0;
+}
+
+/*
+ * Accept the line, removing the ghost text shown from the screen
+ * and abandoning the background queries.
+ * Without ghost text the key keeps its usual function.
+ */
+static int
+autosuggest_accept_line(int count, int key)
+{
+	if (!ghost_shown)
+		return rl_newline(count, key);
+	clear_ghost();
+	abandon_speculation();
+	acl_async_cancel();
+	return rl_newline(count, key);
+}
+
+// Candidate responses of the last query and the one shown
+static char *candidates[MAX_CANDIDATES];
+static int ncandidates;
+static int current_candidate;
+
+// Return true if the edit buffer contains the candidate being shown
+static bool
+candidate_shown(void)
+{
+	if (ncandidates == 0)
+		return false;
+
+	const char *line = *rl_line_buffer_ptr;
+	if (config.general_response_prefix_set) {
+		size_t len = strlen(config.general_response_prefix);
+		if (strncmp(line, config.general_response_prefix, len) != 0
+		    || line[len] != ' ')
+			return false;
+		line += len + 1;
+	}
+	return strcmp(line, candidates[current_candidate]) == 0;
+}
+
+// Discard the candidate responses of the last query
+static void
+free_candidates(void)
+{
+	for (int i = 0; i < ncandidates; i++)
+		free(candidates[i]);
+	ncandidates = current_candidate = 0;
+}
+
 /*
  * The user has has asked for AI to be queried on the typed text
  * Replace the user's text with the queried on
+ * If the edit buffer still contains a response of a query with
+ * multiple candidates, replace it with the next candidate.
  */
 static int
 query_ai(int count, int key)
 {
-	static char *prev_response;
+	static int prev_tier = -1;
+	static int prev_history_length;
 
-	if (prev_response) {
-		free(prev_response);
-		prev_response = NULL;
+	if (ncandidates > 1 && candidate_shown()) {
+		current_candidate = (current_candidate + 1) % ncandidates;
+		show_response(candidates[current_candidate], false);
+		rl_free_undo_list();
+		return 0;
 	}
 
+	if (ncandidates) {
+		if (prev_tier != -1)
+			acl_router_record_acceptance(&router, &config, prev_tier,
+			    response_executed(candidates[current_candidate],
+			    prev_history_length));
+		free_candidates();
+	}
+
+	// Use the response prefetched for fixing a failed command
+	if (speculation_prompt && **rl_line_buffer_ptr == '\0') {
+		if (!speculation_response) {
+			acl_async_wait();
+			collect_speculation();
+		}
+		if (speculation_response) {
+			acl_speculate_record(&config, SPECULATE_USED, 0);
+			add_commented_prompt_to_history(speculation_prompt);
+			show_response(speculation_response, true);
+			candidates[ncandidates++] = speculation_response;
+			free(speculation_prompt);
+			speculation_prompt = speculation_response = NULL;
+			prev_tier = -1;
+			rl_free_undo_list();
+			return 0;
+		}
+	}
+
+	if (config.autosuggest_enabled || speculation_prompt) {
+		clear_ghost();
+		abandon_speculation();
+		acl_async_cancel_wait();
+	}
+
+	reload_config();
+
+	TRACE_BEGIN("query");
+	double query_start = TRACE_NOW();
+
+	// Gather the environment while the query is being set up
+	acl_context_start(&config);
+
 	int comment_len = add_commented_prompt_to_history(*rl_line_buffer_ptr);
-	char *response = fetch(&config, *rl_line_buffer_ptr + comment_len,
+	// Copy, because the edit buffer can change before the query ends
+	char *prompt = acl_safe_strdup(*rl_line_buffer_ptr + comment_len);
+	PROBE_QUERY_START("query", config.program_name, prompt);
+
+	fetch_t query_fetch = fetch;
+	config_t *query_config = &config;
+	int tier = -1;
+	if (router.n) {
+		double route_start = TRACE_NOW();
+		tier = acl_router_select(&router, &config, prompt);
+		query_fetch = tier_fetch[tier];
+		query_config = tier_config[tier];
+		TRACE_SPAN("route", route_start);
+	}
+
+	// Beyond the daily budgets use a cheaper model or only local answers
+	config_t degraded;
+	switch (acl_usage_budget(&config)) {
+	case BUDGET_HARD:
+		if (config.general_verbose)
+			fprintf(stderr, "\nDaily hard budget spent; "
+			    "answering locally\n");
+		query_fetch = acl_fetch_local;
+		break;
+	case BUDGET_SOFT:
+		query_config = acl_usage_degrade(query_config, &degraded,
+		    acl_backend_name(query_fetch));
+		break;
+	case BUDGET_OK:
+		break;
+	}
+
+	// Show an instant local suggestion while the remote one is obtained
+	char *preview = NULL;
+	double preview_start = TRACE_NOW();
+	if (config.local_preview && query_fetch != acl_fetch_local
+	    && (preview = acl_local_suggest(&config, prompt)) != NULL) {
+		show_response(preview, true);
+		rl_redisplay();
+	}
+	if (config.local_preview)
+		TRACE_SPAN("preview", preview_start);
+
+	double start = acl_now_ms();
+	acl_candidates_clear();
+	// Serialized with the queries of any library sessions
+	char *response = acl_query_sync(query_fetch, query_config, prompt,
 	    *history_length_ptr);
-	if (!response)
+	double insert_start = TRACE_NOW();
+	if (response) {
+		if (tier != -1)
+			acl_router_record_latency(&router, &config, tier,
+			    acl_now_ms() - start);
+		ncandidates = acl_candidates_collect(response, candidates);
+		acl_candidates_rank(&config, candidates, ncandidates,
+		    *history_length_ptr);
+		if (config.local_preview && query_fetch != acl_fetch_local)
+			acl_local_learn(&config, prompt, candidates[0]);
+		free(preview);
+		show_response(candidates[0], !preview);
+	} else if (preview) {
+		// Fall back to the local suggestion
+		candidates[ncandidates++] = preview;
+	} else {
+		TRACE_END(query_fetch, "error");
+		PROBE_QUERY_END("query", query_fetch, config.program_name, "error",
+		    query_start);
+		free(prompt);
 		return -1;
-	rl_crlf();
-	rl_on_new_line();
-	rl_delete_text(0, *rl_end_ptr);
-	*rl_point_ptr = 0;
-	if (config.general_response_prefix_set) {
-		rl_insert_text(config.general_response_prefix);
-		rl_insert_text(" ");
 	}
-	rl_insert_text(response);
-	prev_response = response;
+	TRACE_SPAN("insert", insert_start);
+	TRACE_END(query_fetch, response ? "ok" : "error");
+	PROBE_QUERY_END("query", query_fetch, config.program_name,
+	    response ? "ok" : "error", query_start);
+	free(prompt);
+	prev_tier = tier;
+	prev_history_length = *history_length_ptr;
 	/*
 	 * The readline_internal_teardown() function will restore
 	 * the original history line iff the line being edited
@@ -121,7 +818,6 @@ query_ai(int count, int key)
 	return 0;
 }
 
-
 /*
  * This is called when the dynamic library is loaded.
  * If the program is linked with readline(3),
@@ -163,44 +859,38 @@ setup(void)
 	// Obtain remaining variable symbols
 	rl_end_ptr = dlsym(RTLD_DEFAULT, "rl_end");
 	rl_point_ptr = dlsym(RTLD_DEFAULT, "rl_point");
+	emacs_standard_keymap_ptr = dlsym(RTLD_DEFAULT, "emacs_standard_keymap");
 	vi_movement_keymap_ptr = dlsym(RTLD_DEFAULT, "vi_movement_keymap");
+	vi_insertion_keymap_ptr = dlsym(RTLD_DEFAULT, "vi_insertion_keymap");
 	history_length_ptr = dlsym(RTLD_DEFAULT, "history_length");
+	history_base_ptr = dlsym(RTLD_DEFAULT, "history_base");
+	rl_event_hook_ptr = dlsym(RTLD_DEFAULT, "rl_event_hook");
+	rl_redisplay_function_ptr = dlsym(RTLD_DEFAULT, "rl_redisplay_function");
+	rl_outstream_ptr = dlsym(RTLD_DEFAULT, "rl_outstream");
+	rl_prompt_ptr = dlsym(RTLD_DEFAULT, "rl_prompt");
+	rl_startup_hook_ptr = dlsym(RTLD_DEFAULT, "rl_startup_hook");
+	get_string_value_ptr = dlsym(RTLD_DEFAULT, "get_string_value");
 
+	double config_start = TRACE_NOW();
 	acl_read_config(&config);
+	PROBE_CONFIG_LOAD(config.program_name, config_start);
 
 	if (!config.prompt_system) {
 		fprintf(stderr, "No default ai-cli configuration loaded.  Installation problem?\n");
 		return;
 	}
 
-// Require a given configuration value
-#define REQUIRE(section, value) do { \
-	if (!config.section ## _ ## value ## _set) { \
-		fprintf(stderr, "Missing %s value in [%s] configuration section.\n", #value, #section); \
-		return; \
-	} \
-} while (0);
-
-	REQUIRE(general, api);
-
-	if (strcmp(config.general_api, "openai") == 0) {
-		fetch = acl_fetch_openai;
-		REQUIRE(openai, key);
-		REQUIRE(openai, endpoint);
-	} else if (strcmp(config.general_api, "anthropic") == 0) {
-		fetch = acl_fetch_anthropic;
-		REQUIRE(anthropic, key);
-		REQUIRE(anthropic, endpoint);
-		REQUIRE(anthropic, version);
-	} else if (strcmp(config.general_api, "hal") == 0) {
-		fetch = acl_fetch_hal;
-	} else if (strcmp(config.general_api, "llamacpp") == 0) {
-		fetch = acl_fetch_llamacpp;
-		REQUIRE(llamacpp, endpoint);
-	} else {
-		fprintf(stderr, "Unsupported API: [%s].\n", config.general_api);
+	if (!config.general_api_set) {
+		fprintf(stderr, "Missing api value in [general] configuration section.\n");
 		return;
 	}
+	acl_log_initialize(&config);
+	acl_usage_initialize(&config);
+	acl_trace_initialize(&config);
+	if (!backends_load(true))
+		return;
+	acl_reload_watch();
+
 	if (config.general_verbose)
 		fprintf(stderr, "API set to %s\n", config.general_api);
 
@@ -217,4 +907,42 @@ setup(void)
 		rl_bind_keyseq(config.binding_emacs, query_ai);
 	if (config.binding_vi)
 		rl_bind_key_in_map(*config.binding_vi, query_ai, vi_movement_keymap_ptr);
+
+	// Background queries need hooks that editline lacks
+	bool hooks = rl_event_hook_ptr && rl_redisplay_function_ptr
+	    && rl_outstream_ptr && rl_prompt_ptr && rl_startup_hook_ptr
+	    && dlsym(RTLD_DEFAULT, "rl_bind_keyseq");
+	// Only Bash provides the exit status of failed commands
+	bool speculate = config.speculate_enabled && hooks && history_base_ptr
+	    && get_string_value_ptr && strcmp(config.program_name, "bash") == 0;
+
+	if ((config.autosuggest_enabled && hooks) || speculate) {
+		prev_redisplay = *rl_redisplay_function_ptr;
+		*rl_redisplay_function_ptr = background_redisplay;
+	}
+
+	if (speculate) {
+		prev_startup_hook = *rl_startup_hook_ptr;
+		*rl_startup_hook_ptr = speculate_startup;
+	}
+
+	// Show suggestions while typing
+	if (config.autosuggest_enabled && hooks) {
+		prev_event_hook = *rl_event_hook_ptr;
+		*rl_event_hook_ptr = autosuggest_event;
+		// Call the event hook every 50ms while waiting for input
+		rl_set_keyboard_input_timeout(50000);
+
+		rl_add_defun("accept-ai-suggestion", accept_suggestion, -1);
+		if (config.autosuggest_key)
+			rl_bind_keyseq(config.autosuggest_key, accept_suggestion);
+		// Only in the keymaps used for typing text
+		Keymap maps[] = {emacs_standard_keymap_ptr,
+		    vi_insertion_keymap_ptr};
+		for (size_t i = 0; i < sizeof(maps) / sizeof(maps[0]); i++)
+			if (maps[i]) {
+				rl_bind_key_in_map('\r', autosuggest_accept_line, maps[i]);
+				rl_bind_key_in_map('\n', autosuggest_accept_line, maps[i]);
+			}
+	}
 }
@@ -0,0 +1,62 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Interface for programs embedding the library's query engine
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Queries performed in the background for a host program
+typedef struct acl_session acl_session_t;
+
+// Progress of a query, as reported to its callback
+typedef enum {
+	ACL_QUERY_PARTIAL,	// The response received so far
+	ACL_QUERY_DONE,		// The complete response
+	ACL_QUERY_FAILED,	// No response could be obtained
+	ACL_QUERY_CANCELLED,	// The query was cancelled
+} acl_status_t;
+
+/*
+ * Function called by acl_session_process with a query's progress.
+ * Each query ends with exactly one call that isn't ACL_QUERY_PARTIAL.
+ * The response is NULL unless the status is ACL_QUERY_PARTIAL or
+ * ACL_QUERY_DONE, and is valid only during the call.
+ * The arg is the one passed to acl_query_async.
+ */
+typedef void (*acl_callback_t)(acl_session_t *session, int query,
+    acl_status_t status, const char *response, void *arg);
+
+acl_session_t *acl_session_new(void);
+void acl_session_free(acl_session_t *session);
+int acl_session_fd(acl_session_t *session);
+int acl_session_process(acl_session_t *session);
+bool acl_session_busy(acl_session_t *session);
+void acl_session_wait(acl_session_t *session);
+int acl_query_async(acl_session_t *session, const char *prompt, int context,
+    acl_callback_t callback, void *arg);
+void acl_query_cancel(acl_session_t *session, int query);
+
+#ifdef __cplusplus
+}
+#endif
@@ -22,11 +22,33 @@
 
 #include "CuTest.h"
 
+CuSuite* cu_async_suite();
+CuSuite* cu_backend_suite();
+CuSuite* cu_balance_suite();
+CuSuite* cu_candidates_suite();
 CuSuite* cu_config_suite();
+CuSuite* cu_context_suite();
+CuSuite* cu_context_program_suite();
+CuSuite* cu_doctor_suite();
 CuSuite* cu_fetch_anthropic_suite();
+CuSuite* cu_fetch_hal_suite();
+CuSuite* cu_fetch_llama_inproc_suite();
+CuSuite* cu_fetch_local_suite();
+CuSuite* cu_fetch_ollama_suite();
 CuSuite* cu_fetch_openai_suite();
 CuSuite* cu_fetch_llamacpp_suite();
+CuSuite* cu_fetch_replay_suite();
+CuSuite* cu_http_suite();
+CuSuite* cu_log_suite();
+CuSuite* cu_mock_server_suite();
+CuSuite* cu_reload_suite();
+CuSuite* cu_router_suite();
+CuSuite* cu_session_suite();
+CuSuite* cu_speculate_suite();
+CuSuite* cu_stats_suite();
 CuSuite* cu_support_suite();
+CuSuite* cu_trace_suite();
+CuSuite* cu_usage_suite();
 
 void
 run_all_tests(void)
@@ -34,11 +56,33 @@ run_all_tests(void)
 	CuString *output = CuStringNew();
 	CuSuite* suite = CuSuiteNew();
 
+	CuSuiteAddSuite(suite, cu_async_suite());
+	CuSuiteAddSuite(suite, cu_backend_suite());
+	CuSuiteAddSuite(suite, cu_balance_suite());
+	CuSuiteAddSuite(suite, cu_candidates_suite());
 	CuSuiteAddSuite(suite, cu_config_suite());
+	CuSuiteAddSuite(suite, cu_context_suite());
+	CuSuiteAddSuite(suite, cu_context_program_suite());
+	CuSuiteAddSuite(suite, cu_doctor_suite());
 	CuSuiteAddSuite(suite, cu_fetch_anthropic_suite());
+	CuSuiteAddSuite(suite, cu_fetch_hal_suite());
+	CuSuiteAddSuite(suite, cu_fetch_llama_inproc_suite());
+	CuSuiteAddSuite(suite, cu_fetch_local_suite());
+	CuSuiteAddSuite(suite, cu_fetch_ollama_suite());
 	CuSuiteAddSuite(suite, cu_fetch_openai_suite());
 	CuSuiteAddSuite(suite, cu_fetch_llamacpp_suite());
+	CuSuiteAddSuite(suite, cu_fetch_replay_suite());
+	CuSuiteAddSuite(suite, cu_http_suite());
+	CuSuiteAddSuite(suite, cu_log_suite());
+	CuSuiteAddSuite(suite, cu_mock_server_suite());
+	CuSuiteAddSuite(suite, cu_reload_suite());
+	CuSuiteAddSuite(suite, cu_router_suite());
+	CuSuiteAddSuite(suite, cu_session_suite());
+	CuSuiteAddSuite(suite, cu_speculate_suite());
+	CuSuiteAddSuite(suite, cu_stats_suite());
 	CuSuiteAddSuite(suite, cu_support_suite());
+	CuSuiteAddSuite(suite, cu_trace_suite());
+	CuSuiteAddSuite(suite, cu_usage_suite());
 
 	CuSuiteRun(suite);
 	CuSuiteSummary(suite, output);
@@ -0,0 +1,132 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Background queries of the readline integration.
+ *  They are performed through a session, one at a time, and only the
+ *  response of the last completed query is kept.
+ *  Cancelled queries are aborted at the transport level and their
+ *  results discarded.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include "async.h"
+#include "config.h"
+#include "session.h"
+#include "support.h"
+
+// Session created for the first query
+static acl_session_t *session;
+
+static char *query_prompt;	// Prompt of the query in progress
+
+// Result of the last completed query
+static char *response;
+static char *response_prompt;
+
+// Keep the response of the completed query
+static void
+completed(acl_session_t *s, int query, acl_status_t status, const char *text,
+    void *arg)
+{
+	if (status == ACL_QUERY_PARTIAL)
+		return;
+	if (status == ACL_QUERY_DONE) {
+		free(response);
+		free(response_prompt);
+		response = acl_safe_strdup(text);
+		response_prompt = query_prompt;
+	} else
+		free(query_prompt);
+	query_prompt = NULL;
+}
+
+/*
+ * Start obtaining in the background a response to the specified prompt
+ * through the given fetch function.
+ * Return false if another query is still being processed.
+ */
+bool
+acl_async_start(fetch_t fetch, config_t *config, const char *prompt,
+    int history_length)
+{
+	if (!session)
+		session = acl_session_open(config, fetch);
+	if (!session)
+		return false;
+
+	acl_session_process(session);
+	if (query_prompt)
+		return false;
+	query_prompt = acl_safe_strdup(prompt);
+	acl_query_start(session, fetch, config, prompt, history_length,
+	    completed, NULL);
+	return true;
+}
+
+/*
+ * Cancel any query waiting or being processed in the background.
+ * The worker remains busy until the transport notices the cancellation.
+ */
+void
+acl_async_cancel(void)
+{
+	if (session)
+		acl_query_cancel(session, 0);
+}
+
+// Wait for any background query to complete
+void
+acl_async_wait(void)
+{
+	if (session)
+		acl_session_wait(session);
+}
+
+/*
+ * Cancel any background query and wait for the worker to become idle,
+ * so that the caller can use the backends without contention.
+ */
+void
+acl_async_cancel_wait(void)
+{
+	acl_async_cancel();
+	acl_async_wait();
+}
+
+// Return true if a background query is waiting or being processed
+bool
+acl_async_busy(void)
+{
+	return session && acl_session_busy(session);
+}
+
+/*
+ * Return the response of the last completed background query, or NULL
+ * if none is available.  Set prompt to the corresponding prompt.
+ * Both strings are dynamically allocated and owned by the caller.
+ */
+char *
+acl_async_result(char **prompt)
+{
+	if (session)
+		acl_session_process(session);
+	char *result = response;
+	*prompt = response_prompt;
+	response = response_prompt = NULL;
+	return result;
+}
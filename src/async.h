@@ -0,0 +1,34 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Background queries
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "config.h"
+#include "support.h"
+
+bool acl_async_start(fetch_t fetch, config_t *config, const char *prompt,
+    int history_length);
+void acl_async_cancel(void);
+void acl_async_cancel_wait(void);
+void acl_async_wait(void);
+bool acl_async_busy(void);
+char *acl_async_result(char **prompt);
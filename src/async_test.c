@@ -0,0 +1,88 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test background queries.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "async.h"
+#include "support.h"
+
+// Respond by upper-casing the prompt
+static char *
+fetch_upper(config_t *config, const char *prompt, int history_length)
+{
+	char *response = acl_safe_strdup(prompt);
+	for (char *p = response; *p; p++)
+		if (*p >= 'a' && *p <= 'z')
+			*p -= 'a' - 'A';
+	return response;
+}
+
+// Respond only after the query is cancelled
+static char *
+fetch_slow(config_t *config, const char *prompt, int history_length)
+{
+	while (!acl_cancelled())
+		usleep(1000);
+	return acl_safe_strdup(prompt);
+}
+
+static void
+test_result(CuTest* tc)
+{
+	static config_t config;
+	char *prompt;
+
+	CuAssertTrue(tc, acl_async_start(fetch_upper, &config, "ls", 0));
+	while (acl_async_busy())
+		usleep(1000);
+	char *response = acl_async_result(&prompt);
+	CuAssertStrEquals(tc, "LS", response);
+	CuAssertStrEquals(tc, "ls", prompt);
+	free(response);
+	free(prompt);
+	CuAssertTrue(tc, acl_async_result(&prompt) == NULL);
+}
+
+static void
+test_cancel(CuTest* tc)
+{
+	static config_t config;
+	char *prompt;
+
+	CuAssertTrue(tc, acl_async_start(fetch_slow, &config, "ls", 0));
+	// Only one query at a time
+	CuAssertTrue(tc, !acl_async_start(fetch_upper, &config, "pwd", 0));
+	acl_async_cancel_wait();
+	CuAssertTrue(tc, !acl_async_busy());
+	CuAssertTrue(tc, acl_async_result(&prompt) == NULL);
+}
+
+CuSuite*
+cu_async_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_result);
+	SUITE_ADD_TEST(suite, test_cancel);
+
+	return suite;
+}
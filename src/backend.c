@@ -0,0 +1,180 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Loading of query backends.
+ *  Backends other than the built-in ones are separate modules,
+ *  which are mapped only when their API is used.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "config.h"
+#include "support.h"
+
+// Maximum number of backends used; the router can use several
+#define MAX_BACKENDS 16
+
+static const backend_t *loaded[MAX_BACKENDS];
+static int nloaded;
+
+/*
+ * Load from the directory of the specified library file the module
+ * providing the backend for the API as the named symbol.
+ * Return the backend, or NULL after reporting an error.
+ */
+static const backend_t *
+load_module(const char *library, const char *api, const char *symbol)
+{
+	const char *slash = library ? strrchr(library, '/') : NULL;
+	char *path;
+	if (slash)
+		acl_safe_asprintf(&path, "%.*s/ai_cli_%s." DLL_EXTENSION,
+		    (int)(slash - library), library, api);
+	else
+		acl_safe_asprintf(&path, "./ai_cli_%s." DLL_EXTENSION, api);
+
+	const backend_t *b = NULL;
+	void *handle;
+	if (access(path, F_OK) != 0)
+		fprintf(stderr, "Unsupported API: [%s].\n", api);
+	// Library functions, e.g. those of libcurl, are bound on use
+	else if (!(handle = dlopen(path, RTLD_LAZY | RTLD_LOCAL)))
+		fprintf(stderr, "Cannot load backend: %s\n", dlerror());
+	else if (!(b = dlsym(handle, symbol))) {
+		fprintf(stderr, "%s does not define %s.\n", path, symbol);
+		dlclose(handle);
+	}
+	free(path);
+	return b;
+}
+
+// Return true if backend b, loaded for the named API, can be used
+bool
+acl_backend_compatible(const backend_t *b, const char *api)
+{
+	if (b->abi != ACL_BACKEND_ABI || b->config_size != sizeof(config_t)) {
+		fprintf(stderr, "Backend for API [%s] was built for a different ai-cli version.\n", api);
+		return false;
+	}
+	if (!b->fetch || strcmp(b->name, api) != 0) {
+		fprintf(stderr, "Invalid backend for API [%s].\n", api);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Return the fetch function of the backend for the specified API,
+ * loading and initializing the backend if needed.
+ * Return NULL after reporting an error if the backend is unavailable.
+ */
+fetch_t
+acl_backend_load(config_t *config, const char *api)
+{
+	for (int i = 0; i < nloaded; i++)
+		if (strcmp(loaded[i]->name, api) == 0)
+			return loaded[i]->fetch;
+
+	// The name becomes part of a symbol and a file name
+	for (const char *p = api; *p; p++)
+		if (!isalnum((unsigned char)*p) && *p != '_') {
+			fprintf(stderr, "Unsupported API: [%s].\n", api);
+			return NULL;
+		}
+	if (!*api || nloaded == MAX_BACKENDS) {
+		fprintf(stderr, "Unsupported API: [%s].\n", api);
+		return NULL;
+	}
+
+	/*
+	 * Backends are looked up among and modules bind to this library's
+	 * symbols, which are global when it is preloaded, but not when a
+	 * program loads it.
+	 */
+	Dl_info info;
+	const char *library = dladdr((void *)acl_backend_load, &info) ?
+	    info.dli_fname : NULL;
+	if (library)
+		dlopen(library, RTLD_LAZY | RTLD_NOLOAD | RTLD_GLOBAL);
+
+	char *symbol;
+	acl_safe_asprintf(&symbol, "acl_backend_%s", api);
+	const backend_t *b = dlsym(RTLD_DEFAULT, symbol);
+	bool module = !b;
+	if (module)
+		b = load_module(library, api, symbol);
+	free(symbol);
+
+	if (!b || !acl_backend_compatible(b, api))
+		return NULL;
+	if (b->init && !b->init(config))
+		return NULL;
+	if (config->general_verbose)
+		fprintf(stderr, "Loaded %s backend for API %s\n",
+		    module ? "module" : "built-in", api);
+	loaded[nloaded++] = b;
+	return b->fetch;
+}
+
+// Return the API name of a loaded backend's fetch function
+const char *
+acl_backend_name(fetch_t fetch)
+{
+	for (int i = 0; i < nloaded; i++)
+		if (loaded[i]->fetch == fetch)
+			return loaded[i]->name;
+	return "unknown";
+}
+
+/*
+ * Shut down the loaded backend for the specified API, so that it is
+ * initialized again with the then current configuration when next
+ * loaded.  Its fetch function must no longer be in use.
+ */
+void
+acl_backend_unload(const char *api)
+{
+	for (int i = 0; i < nloaded; i++)
+		if (strcmp(loaded[i]->name, api) == 0) {
+			if (loaded[i]->shutdown)
+				loaded[i]->shutdown();
+			loaded[i] = loaded[--nloaded];
+			return;
+		}
+}
+
+/*
+ * Shut down all loaded backends, so that they are initialized again
+ * when next loaded.  Their fetch functions must no longer be in use.
+ * Modules stay mapped, because threads they started may still run.
+ */
+void
+acl_backend_shutdown(void)
+{
+	for (int i = 0; i < nloaded; i++)
+		if (loaded[i]->shutdown)
+			loaded[i]->shutdown();
+	nloaded = 0;
+}
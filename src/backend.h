@@ -0,0 +1,100 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Query backend interface
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "config.h"
+#include "support.h"
+
+/*
+ * Version of the backend interface.
+ * Increment it when backend_t or config_t change incompatibly.
+ */
+#define ACL_BACKEND_ABI 2
+
+/*
+ * A query backend.  The backend for the API named api is the
+ * object acl_backend_api, which is either linked into the library
+ * or provided by the module ai_cli_api.so, found in the library's
+ * directory.  Modules can call the library's functions.
+ */
+typedef struct {
+	int abi;		// ACL_BACKEND_ABI of the backend's build
+	size_t config_size;	// sizeof(config_t) of the backend's build
+	const char *name;	// API name, e.g. "openai"
+	/*
+	 * Optional: verify the configuration and prepare for queries.
+	 * Return false if the backend cannot be used.
+	 */
+	bool (*init)(config_t *config);
+	// Return a dynamically allocated response to a prompt, or NULL
+	fetch_t fetch;
+	// Optional: release the resources used for queries
+	void (*shutdown)(void);
+
+	/*
+	 * The following optional entries expose the steps of fetch
+	 * to tools, such as benchmarks, and to other transports.
+	 * Set request to the body of the request for the prompt, with the
+	 * history_length entries of the history(3) list as context.
+	 * Return the length of its prefix that is the same across queries.
+	 */
+	size_t (*build_request)(config_t *config, const char *prompt,
+	    int history_length, string_t *request);
+	// Return the dynamically allocated text of a response, or NULL
+	char *(*parse_response)(const char *response);
+	// Return the state of a new stream of a streamed response
+	void *(*stream_new)(void);
+	// Process a chunk of the stream; return false if no more is needed
+	bool (*stream_chunk)(const char *data, size_t len, void *stream);
+	// Return the dynamically allocated text or NULL; free the stream
+	char *(*stream_end)(void *stream);
+} backend_t;
+
+/*
+ * Define the backend for the specified API.
+ * Set optional entries through designated initializers, e.g.
+ * .parse_response = get_response_content.
+ */
+#define ACL_BACKEND(api, init_fn, fetch_fn, shutdown_fn, ...) \
+	const backend_t acl_backend_ ## api = { \
+		.abi = ACL_BACKEND_ABI, .config_size = sizeof(config_t), \
+		.name = #api, .init = init_fn, .fetch = fetch_fn, \
+		.shutdown = shutdown_fn, __VA_ARGS__ \
+	}
+
+// Require a given configuration value in an init function
+#define REQUIRE(config, section, value) do { \
+	if (!config->section ## _ ## value ## _set) { \
+		fprintf(stderr, "Missing %s value in [%s] configuration section.\n", #value, #section); \
+		return false; \
+	} \
+} while (0)
+
+bool acl_backend_compatible(const backend_t *b, const char *api);
+
+fetch_t acl_backend_load(config_t *config, const char *api);
+const char *acl_backend_name(fetch_t fetch);
+void acl_backend_unload(const char *api);
+void acl_backend_shutdown(void);
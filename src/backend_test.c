@@ -0,0 +1,124 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test the loading of query backends.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "CuTest.h"
+#include "backend.h"
+#include "config.h"
+#include "fetch_hal.h"
+
+extern const backend_t acl_backend_hal;
+extern const backend_t acl_backend_ollama;
+extern const backend_t acl_backend_openai;
+
+static void
+test_compatible(CuTest* tc)
+{
+	backend_t b = acl_backend_hal;
+
+	CuAssertTrue(tc, acl_backend_compatible(&b, "hal"));
+	CuAssertTrue(tc, !acl_backend_compatible(&b, "openai"));
+	b.abi = ACL_BACKEND_ABI + 1;
+	CuAssertTrue(tc, !acl_backend_compatible(&b, "hal"));
+	b = acl_backend_hal;
+	b.config_size--;
+	CuAssertTrue(tc, !acl_backend_compatible(&b, "hal"));
+	b = acl_backend_hal;
+	b.fetch = NULL;
+	CuAssertTrue(tc, !acl_backend_compatible(&b, "hal"));
+}
+
+static void
+test_load(CuTest* tc)
+{
+	config_t config = {"bash"};
+
+	// The unit tests link all backends
+	CuAssertTrue(tc, acl_backend_load(&config, "hal") == acl_fetch_hal);
+	CuAssertTrue(tc, acl_backend_load(&config, "hal") == acl_fetch_hal);
+	CuAssertTrue(tc, acl_backend_load(&config, "nonexistent") == NULL);
+	CuAssertTrue(tc, acl_backend_load(&config, "../hal") == NULL);
+	CuAssertTrue(tc, acl_backend_load(&config, "") == NULL);
+	// Required configuration values are missing
+	CuAssertTrue(tc, acl_backend_load(&config, "openai") == NULL);
+	acl_backend_shutdown();
+}
+
+static void
+test_unload(CuTest* tc)
+{
+	config_t config = {"bash"};
+
+	CuAssertTrue(tc, acl_backend_load(&config, "hal") == acl_fetch_hal);
+	// A loaded backend isn't initialized again
+	config.hal_latency = "invalid";
+	config.hal_latency_set = true;
+	CuAssertTrue(tc, acl_backend_load(&config, "hal") == acl_fetch_hal);
+	// An unloaded one is, with the current configuration
+	acl_backend_unload("hal");
+	acl_backend_unload("openai");
+	CuAssertTrue(tc, acl_backend_load(&config, "hal") == NULL);
+	config.hal_latency = "fixed:0";
+	CuAssertTrue(tc, acl_backend_load(&config, "hal") == acl_fetch_hal);
+	acl_backend_shutdown();
+}
+
+static void
+test_entries(CuTest* tc)
+{
+	const backend_t *b = &acl_backend_openai;
+	config_t config = {"bash", .prompt_system = "Use %s."};
+	string_t request;
+
+	b->build_request(&config, "list files", 0, &request);
+	CuAssertPtrNotNull(tc, strstr(request.ptr, "\"list files\""));
+	free(request.ptr);
+	char *text = b->parse_response("{\"choices\": [{\"message\": "
+	    "{\"content\": \"ls\"}}]}");
+	CuAssertStrEquals(tc, "ls", text);
+	free(text);
+
+	b = &acl_backend_ollama;
+	void *stream = b->stream_new();
+	const char *line = "{\"message\":{\"content\":\"\\nls -l\"}}\n"
+	    "{\"message\":{\"content\":\"\"},\"done\":true}\n";
+	CuAssertTrue(tc, !b->stream_chunk(line, strlen(line), stream));
+	text = b->stream_end(stream);
+	CuAssertStrEquals(tc, "ls -l", text);
+	free(text);
+
+	// Backends without the entries leave them NULL
+	CuAssertTrue(tc, acl_backend_hal.build_request == NULL);
+}
+
+CuSuite*
+cu_backend_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_compatible);
+	SUITE_ADD_TEST(suite, test_load);
+	SUITE_ADD_TEST(suite, test_unload);
+	SUITE_ADD_TEST(suite, test_entries);
+
+	return suite;
+}
@@ -0,0 +1,265 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Load balancing across multiple API endpoints
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "balance.h"
+#include "config.h"
+#include "support.h"
+
+// Virtual nodes per endpoint on the consistent hashing ring
+#define RING_POINTS 64
+
+// Weight of the newest sample in the latency moving average
+#define EWMA_ALPHA 0.3
+
+// Maximum number of endpoints; they are tracked in a 64-bit mask
+#define MAX_ENDPOINTS 64
+#define MAX_ENDPOINTS_STRING "64"
+
+static int
+ring_point_compare(const void *a, const void *b)
+{
+	uint64_t ha = ((const ring_point_t *)a)->hash;
+	uint64_t hb = ((const ring_point_t *)b)->hash;
+
+	return ha < hb ? -1 : ha > hb;
+}
+
+/*
+ * Initialize the balancer b with the endpoints listed (separated by
+ * commas or spaces) in endpoint_list, using the named strategy.
+ * Return false, leaving b without endpoints and setting error to a
+ * description of the problem, if the configuration is invalid.
+ */
+bool
+acl_balancer_init(balancer_t *b, const char *endpoint_list,
+    const char *strategy, int eject_failures, int eject_time,
+    const char **error)
+{
+	memset(b, 0, sizeof(*b));
+
+	if (!strategy || strcmp(strategy, "least-outstanding") == 0)
+		b->strategy = BALANCE_LEAST_OUTSTANDING;
+	else if (strcmp(strategy, "ewma") == 0)
+		b->strategy = BALANCE_EWMA;
+	else if (strcmp(strategy, "hash") == 0)
+		b->strategy = BALANCE_HASH;
+	else {
+		*error = "unknown balancing strategy";
+		return false;
+	}
+
+	b->eject_failures = eject_failures > 0 ? eject_failures : 1;
+	b->eject_time = eject_time;
+
+	char *list = acl_safe_strdup(endpoint_list ? endpoint_list : "");
+	char *saveptr;
+	for (char *url = strtok_r(list, ", \t", &saveptr); url;
+	    url = strtok_r(NULL, ", \t", &saveptr)) {
+		if (b->n == MAX_ENDPOINTS) {
+			free(list);
+			acl_balancer_free(b);
+			*error = "more than " MAX_ENDPOINTS_STRING
+			    " endpoints specified";
+			return false;
+		}
+		b->endpoints = realloc(b->endpoints, (b->n + 1) * sizeof(endpoint_t));
+		if (!b->endpoints)
+			acl_errorf("memory allocation failed.");
+		memset(&b->endpoints[b->n], 0, sizeof(endpoint_t));
+		b->endpoints[b->n++].url = acl_safe_strdup(url);
+	}
+	free(list);
+	if (b->n == 0) {
+		*error = "no endpoint specified";
+		return false;
+	}
+
+	b->nring = b->n * RING_POINTS;
+	b->ring = calloc(b->nring, sizeof(ring_point_t));
+	if (!b->ring)
+		acl_errorf("memory allocation failed.");
+	for (int i = 0; i < b->n; i++)
+		for (int j = 0; j < RING_POINTS; j++) {
+			char *point;
+			int len = acl_safe_asprintf(&point, "%s#%d", b->endpoints[i].url, j);
+			b->ring[i * RING_POINTS + j].hash = acl_hash(point, len);
+			b->ring[i * RING_POINTS + j].endpoint = i;
+			free(point);
+		}
+	qsort(b->ring, b->nring, sizeof(ring_point_t), ring_point_compare);
+	return true;
+}
+
+/*
+ * Return true if the [llamacpp] section configures a valid balancer,
+ * reporting the problem otherwise.
+ */
+bool
+acl_balancer_check(const config_t *config)
+{
+	balancer_t b;
+	const char *error;
+
+	if (!acl_balancer_init(&b, config->llamacpp_endpoint,
+	    config->llamacpp_balance, config->llamacpp_eject_failures,
+	    config->llamacpp_eject_time, &error)) {
+		fprintf(stderr, "Invalid [llamacpp] configuration: %s.\n",
+		    error);
+		return false;
+	}
+	acl_balancer_free(&b);
+	return true;
+}
+
+// Release the resources of b, leaving it without endpoints
+void
+acl_balancer_free(balancer_t *b)
+{
+	for (int i = 0; i < b->n; i++)
+		free(b->endpoints[i].url);
+	free(b->endpoints);
+	free(b->ring);
+	memset(b, 0, sizeof(*b));
+}
+
+// Return true if endpoint i can be used at time now
+static bool
+available(balancer_t *b, int i, uint64_t skip, time_t now)
+{
+	return !(skip & (1ULL << i)) && b->endpoints[i].ejected_until <= now;
+}
+
+// Return the cost of sending a request to endpoint e
+static double
+cost(balancer_t *b, endpoint_t *e)
+{
+	if (b->strategy == BALANCE_EWMA)
+		return e->ewma_latency * (e->outstanding + 1);
+	return e->outstanding;
+}
+
+/*
+ * Return the index of the endpoint to use for the next request,
+ * skipping those whose bit is set in skip.
+ * The key is used for consistent hashing; it should cover the
+ * static prefix of the request, so that requests sharing it are
+ * served by the same endpoint.
+ * If all endpoints are ejected, return the one that will be readmitted
+ * first.  Return -1 if all endpoints are skipped.
+ */
+static int
+select_endpoint(balancer_t *b, const char *key, size_t key_len,
+    uint64_t skip, time_t now)
+{
+	int best = -1;
+
+	if (b->strategy == BALANCE_HASH && key) {
+		uint64_t h = acl_hash(key, key_len);
+		int lo = 0, hi = b->nring;
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if (b->ring[mid].hash < h)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (int k = 0; k < b->nring; k++) {
+			int i = b->ring[(lo + k) % b->nring].endpoint;
+			if (available(b, i, skip, now))
+				return i;
+		}
+	} else {
+		// Start from a rotating position to spread ties
+		for (int k = 0; k < b->n; k++) {
+			int i = (b->next + k) % b->n;
+			if (!available(b, i, skip, now))
+				continue;
+			if (best == -1 || cost(b, &b->endpoints[i]) < cost(b, &b->endpoints[best]))
+				best = i;
+		}
+		if (best != -1) {
+			b->next = (best + 1) % b->n;
+			return best;
+		}
+	}
+
+	// All remaining endpoints are ejected; fail open
+	for (int i = 0; i < b->n; i++) {
+		if (skip & (1ULL << i))
+			continue;
+		if (best == -1 || b->endpoints[i].ejected_until < b->endpoints[best].ejected_until)
+			best = i;
+	}
+	return best;
+}
+
+/*
+ * Select the endpoint to use for a request and account for it as
+ * outstanding until acl_balancer_release is called.
+ * See select_endpoint for the meaning of the arguments; skip is a
+ * bit mask of endpoints already tried for this request.
+ */
+int
+acl_balancer_select(balancer_t *b, const char *key, size_t key_len,
+    uint64_t skip, time_t now)
+{
+	int i = select_endpoint(b, key, key_len, skip, now);
+	if (i != -1)
+		b->endpoints[i].outstanding++;
+	return i;
+}
+
+/*
+ * Record the outcome of a request made to endpoint i.
+ * Successful requests update the endpoint's latency estimate;
+ * consecutive failures eject the endpoint for the configured time.
+ */
+void
+acl_balancer_release(balancer_t *b, int i, bool success, double latency_ms,
+    time_t now)
+{
+	endpoint_t *e = &b->endpoints[i];
+
+	if (e->outstanding > 0)
+		e->outstanding--;
+	if (success) {
+		e->failures = 0;
+		if (e->ewma_latency == 0)
+			e->ewma_latency = latency_ms;
+		else
+			e->ewma_latency = EWMA_ALPHA * latency_ms +
+			    (1 - EWMA_ALPHA) * e->ewma_latency;
+	} else if (++e->failures >= b->eject_failures)
+		e->ejected_until = now + b->eject_time;
+}
+
+// Release endpoint i after a cancelled request, without recording an outcome
+void
+acl_balancer_cancel(balancer_t *b, int i)
+{
+	if (b->endpoints[i].outstanding > 0)
+		b->endpoints[i].outstanding--;
+}
@@ -0,0 +1,72 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Load balancing across multiple API endpoints
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "config.h"
+
+// Strategies for selecting among multiple endpoints
+typedef enum {
+	BALANCE_LEAST_OUTSTANDING,	// Fewest of the process's requests in flight
+	BALANCE_EWMA,			// Lowest smoothed latency
+	BALANCE_HASH,			// Consistent hashing on a request key
+} balance_strategy_t;
+
+// State of a single endpoint
+typedef struct {
+	char *url;
+	int outstanding;		// This process's requests in flight
+	double ewma_latency;		// Smoothed latency (ms); 0 if unknown
+	int failures;			// Consecutive failures
+	time_t ejected_until;		// Avoid endpoint until this time
+} endpoint_t;
+
+// Consistent hashing ring point
+typedef struct {
+	uint64_t hash;
+	int endpoint;
+} ring_point_t;
+
+typedef struct {
+	endpoint_t *endpoints;
+	int n;
+	balance_strategy_t strategy;
+	int eject_failures;		// Consecutive failures before ejection
+	int eject_time;			// Seconds an ejected endpoint is avoided
+	ring_point_t *ring;		// Sorted consistent hashing ring
+	int nring;
+	int next;			// Round-robin tie breaker
+} balancer_t;
+
+bool acl_balancer_init(balancer_t *b, const char *endpoint_list,
+    const char *strategy, int eject_failures, int eject_time,
+    const char **error);
+int acl_balancer_select(balancer_t *b, const char *key, size_t key_len,
+    uint64_t skip, time_t now);
+void acl_balancer_release(balancer_t *b, int i, bool success,
+    double latency_ms, time_t now);
+void acl_balancer_cancel(balancer_t *b, int i);
+void acl_balancer_free(balancer_t *b);
+bool acl_balancer_check(const config_t *config);
@@ -0,0 +1,169 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test endpoint load balancing.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "CuTest.h"
+#include "balance.h"
+#include "support.h"
+
+static const char endpoints[] = "http://a:8080/completion, http://b:8080/completion http://c:8080/completion";
+
+static void
+test_endpoint_list(CuTest* tc)
+{
+	balancer_t b;
+	const char *error;
+
+	CuAssertTrue(tc, acl_balancer_init(&b, endpoints, NULL, 3, 30, &error));
+	CuAssertIntEquals(tc, 3, b.n);
+	CuAssertStrEquals(tc, "http://a:8080/completion", b.endpoints[0].url);
+	CuAssertStrEquals(tc, "http://c:8080/completion", b.endpoints[2].url);
+	CuAssertIntEquals(tc, BALANCE_LEAST_OUTSTANDING, b.strategy);
+}
+
+static void
+test_invalid(CuTest* tc)
+{
+	balancer_t b;
+	const char *error = NULL;
+	string_t many;
+
+	CuAssertTrue(tc, !acl_balancer_init(&b, endpoints, "random", 3, 30, &error));
+	CuAssertStrEquals(tc, "unknown balancing strategy", error);
+	CuAssertTrue(tc, !acl_balancer_init(&b, " , ", NULL, 3, 30, &error));
+	CuAssertStrEquals(tc, "no endpoint specified", error);
+	CuAssertIntEquals(tc, 0, b.n);
+
+	acl_string_init(&many, "");
+	for (int i = 0; i < 65; i++)
+		acl_string_appendf(&many, "http://h%d ", i);
+	CuAssertTrue(tc, !acl_balancer_init(&b, many.ptr, NULL, 3, 30, &error));
+	CuAssertStrEquals(tc, "more than 64 endpoints specified", error);
+	CuAssertIntEquals(tc, 0, b.n);
+	free(many.ptr);
+}
+
+static void
+test_least_outstanding(CuTest* tc)
+{
+	balancer_t b;
+	const char *error;
+
+	CuAssertTrue(tc, acl_balancer_init(&b, endpoints, "least-outstanding", 3, 30, &error));
+	int first = acl_balancer_select(&b, NULL, 0, 0, 0);
+	int second = acl_balancer_select(&b, NULL, 0, 0, 0);
+	int third = acl_balancer_select(&b, NULL, 0, 0, 0);
+	CuAssertTrue(tc, first != second && second != third && first != third);
+
+	// Releasing one makes it the only one with no outstanding requests
+	acl_balancer_release(&b, second, true, 10, 0);
+	CuAssertIntEquals(tc, second, acl_balancer_select(&b, NULL, 0, 0, 0));
+}
+
+static void
+test_ewma(CuTest* tc)
+{
+	balancer_t b;
+	const char *error;
+
+	CuAssertTrue(tc, acl_balancer_init(&b, endpoints, "ewma", 3, 30, &error));
+	for (int i = 0; i < 3; i++) {
+		int e = acl_balancer_select(&b, NULL, 0, 1ULL << ((i + 1) % 3) | 1ULL << ((i + 2) % 3), 0);
+		CuAssertIntEquals(tc, i, e);
+		acl_balancer_release(&b, e, true, i == 1 ? 50 : 400, 0);
+	}
+	for (int i = 0; i < 5; i++) {
+		int e = acl_balancer_select(&b, NULL, 0, 0, 0);
+		CuAssertIntEquals(tc, 1, e);
+		acl_balancer_release(&b, e, true, 50, 0);
+	}
+}
+
+static void
+test_hash(CuTest* tc)
+{
+	balancer_t b;
+	const char *error;
+	const char prefix[] = "You are an assistant who provides commands";
+
+	CuAssertTrue(tc, acl_balancer_init(&b, endpoints, "hash", 3, 30, &error));
+	int e = acl_balancer_select(&b, prefix, strlen(prefix), 0, 0);
+	for (int i = 0; i < 10; i++) {
+		acl_balancer_release(&b, e, true, 10, 0);
+		CuAssertIntEquals(tc, e, acl_balancer_select(&b, prefix, strlen(prefix), 0, 0));
+	}
+
+	// Skipping the preferred endpoint moves to another one
+	int other = acl_balancer_select(&b, prefix, strlen(prefix), 1ULL << e, 0);
+	CuAssertTrue(tc, other != e && other != -1);
+
+	// Skipping all endpoints fails
+	CuAssertIntEquals(tc, -1, acl_balancer_select(&b, prefix, strlen(prefix), 7, 0));
+}
+
+static void
+test_ejection(CuTest* tc)
+{
+	balancer_t b;
+	const char *error;
+
+	CuAssertTrue(tc, acl_balancer_init(&b, "http://a http://b", "least-outstanding", 2, 30, &error));
+
+	// One failure keeps the endpoint in rotation
+	int e = acl_balancer_select(&b, NULL, 0, 2, 100);
+	CuAssertIntEquals(tc, 0, e);
+	acl_balancer_release(&b, e, false, 0, 100);
+	CuAssertIntEquals(tc, 0, b.endpoints[0].ejected_until);
+
+	// The second consecutive failure ejects it
+	e = acl_balancer_select(&b, NULL, 0, 2, 100);
+	acl_balancer_release(&b, e, false, 0, 100);
+	for (int i = 0; i < 4; i++) {
+		e = acl_balancer_select(&b, NULL, 0, 0, 110);
+		CuAssertIntEquals(tc, 1, e);
+		acl_balancer_release(&b, e, true, 10, 110);
+	}
+
+	// Fail open when no other endpoint is available
+	CuAssertIntEquals(tc, 0, acl_balancer_select(&b, NULL, 0, 2, 110));
+	acl_balancer_release(&b, 0, false, 0, 110);
+
+	// Readmitted after the ejection time
+	acl_balancer_release(&b, acl_balancer_select(&b, NULL, 0, 0, 200), true, 10, 200);
+	acl_balancer_release(&b, acl_balancer_select(&b, NULL, 0, 0, 200), true, 10, 200);
+	CuAssertIntEquals(tc, 0, b.endpoints[0].failures);
+}
+
+CuSuite*
+cu_balance_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_endpoint_list);
+	SUITE_ADD_TEST(suite, test_invalid);
+	SUITE_ADD_TEST(suite, test_least_outstanding);
+	SUITE_ADD_TEST(suite, test_ewma);
+	SUITE_ADD_TEST(suite, test_hash);
+	SUITE_ADD_TEST(suite, test_ejection);
+
+	return suite;
+}
@@ -0,0 +1,247 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Multiple candidate responses.
+ *  Backends that obtain more than one response for a query add the
+ *  additional ones here.  The candidates are then ranked locally
+ *  through cheap signals, so that the user can cycle through them
+ *  without further requests.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <readline/history.h>
+
+#include "candidates.h"
+#include "support.h"
+#include "unit_test.h"
+
+// Number of recent history entries examined for similarity
+#define HISTORY_WINDOW 200
+
+// Maximum number of words of a command compared for similarity
+#define MAX_WORDS 16
+
+// Additional responses obtained by the current thread's query
+static __thread char *extra[MAX_CANDIDATES];
+static __thread int nextra;
+
+// Shell built-in commands, which do not resolve through the PATH
+static const char *builtins[] = {
+	".", ":", "[", "alias", "bg", "cd", "declare", "echo", "eval",
+	"exec", "exit", "export", "fg", "for", "history", "if", "jobs",
+	"kill", "let", "local", "popd", "printf", "pushd", "read", "set",
+	"source", "test", "time", "type", "ulimit", "umask", "unalias",
+	"unset", "until", "wait", "while", NULL
+};
+
+// Return the number of candidate responses to obtain for each query
+int
+acl_candidates_wanted(config_t *config)
+{
+	if (!config->general_candidates_set || config->general_candidates < 1)
+		return 1;
+	if (config->general_candidates > MAX_CANDIDATES)
+		return MAX_CANDIDATES;
+	return config->general_candidates;
+}
+
+// Add a response obtained in addition to the one returned by a backend
+void
+acl_candidates_add(const char *text)
+{
+	if (text && nextra < MAX_CANDIDATES - 1)
+		extra[nextra++] = acl_safe_strdup(text);
+}
+
+// Return the additional response i of the current thread, or NULL
+const char *
+acl_candidates_extra(int i)
+{
+	return i < nextra ? extra[i] : NULL;
+}
+
+// Discard the additional responses obtained by the current thread
+void
+acl_candidates_clear(void)
+{
+	for (int i = 0; i < nextra; i++)
+		free(extra[i]);
+	nextra = 0;
+}
+
+/*
+ * Store into candidates the specified response (whose ownership is
+ * transferred) followed by the distinct additional responses.
+ * Return the number of candidates stored; at most MAX_CANDIDATES.
+ */
+int
+acl_candidates_collect(char *response, char **candidates)
+{
+	int n = 0;
+
+	candidates[n++] = response;
+	for (int i = 0; i < nextra; i++) {
+		bool seen = false;
+		for (int j = 0; j < n; j++)
+			if (strcmp(candidates[j], extra[i]) == 0)
+				seen = true;
+		if (seen)
+			free(extra[i]);
+		else
+			candidates[n++] = extra[i];
+	}
+	nextra = 0;
+	return n;
+}
+
+// Return true if the named command is a built-in or found in the PATH
+static bool
+command_resolves(const char *name)
+{
+	if (strchr(name, '/'))
+		return access(name, X_OK) == 0;
+
+	for (const char **b = builtins; *b; b++)
+		if (strcmp(*b, name) == 0)
+			return true;
+
+	const char *path = getenv("PATH");
+	if (!path)
+		return false;
+	char *dirs = acl_safe_strdup(path);
+	char *saveptr;
+	bool found = false;
+	for (char *dir = strtok_r(dirs, ":", &saveptr); dir && !found;
+	    dir = strtok_r(NULL, ":", &saveptr)) {
+		char *file;
+		acl_safe_asprintf(&file, "%s/%s", dir, name);
+		found = access(file, X_OK) == 0;
+		free(file);
+	}
+	free(dirs);
+	return found;
+}
+
+/*
+ * Store into words the hashes of up to MAX_WORDS whitespace-separated
+ * words of s.  Return the number of words stored.
+ */
+static int
+word_hashes(const char *s, uint64_t *words)
+{
+	int n = 0;
+
+	while (n < MAX_WORDS) {
+		while (isspace((unsigned char)*s))
+			s++;
+		if (!*s)
+			break;
+		const char *start = s;
+		while (*s && !isspace((unsigned char)*s))
+			s++;
+		words[n++] = acl_hash(start, s - start);
+	}
+	return n;
+}
+
+// Return the similarity (Dice coefficient) of two word hash lists
+static double
+similarity(const uint64_t *a, int na, const uint64_t *b, int nb)
+{
+	int common = 0;
+
+	for (int i = 0; i < na; i++)
+		for (int j = 0; j < nb; j++)
+			if (a[i] == b[j]) {
+				common++;
+				break;
+			}
+	return na + nb ? 2.0 * common / (na + nb) : 0;
+}
+
+/*
+ * Return a score for the specified candidate; higher is better.
+ * Responses that are comments (typically refusals) are penalized;
+ * shell commands whose first word resolves to a command are favored;
+ * commands similar to those recently entered in the history are favored.
+ */
+STATIC double
+candidate_score(config_t *config, const char *candidate, int history_length)
+{
+	double score = 0;
+
+	if (config->prompt_comment_set && strncmp(candidate,
+	    config->prompt_comment, strlen(config->prompt_comment)) == 0)
+		return -1;
+
+	if (strcmp(config->program_name, "bash") == 0
+	    || strcmp(config->program_name, "sh") == 0) {
+		const char *start = candidate + strspn(candidate, " \t");
+		char *name = acl_range_strdup(start, start + strcspn(start, " \t;|&"));
+		if (command_resolves(name))
+			score += 1;
+		free(name);
+	}
+
+	uint64_t cwords[MAX_WORDS], hwords[MAX_WORDS];
+	int nc = word_hashes(candidate, cwords);
+	double best = 0;
+	HIST_ENTRY **list = history_list();
+	for (int i = history_length - 1;
+	    list && i >= 0 && i >= history_length - HISTORY_WINDOW; i--) {
+		int nh = word_hashes(list[i]->line, hwords);
+		double s = similarity(cwords, nc, hwords, nh);
+		if (s > best)
+			best = s;
+	}
+	return score + best;
+}
+
+/*
+ * Order the n candidates by decreasing score.
+ * Candidates with equal scores retain the backend's order.
+ */
+void
+acl_candidates_rank(config_t *config, char **candidates, int n,
+    int history_length)
+{
+	double score[MAX_CANDIDATES];
+
+	if (n < 2)
+		return;
+	for (int i = 0; i < n; i++)
+		score[i] = candidate_score(config, candidates[i], history_length);
+
+	// Stable insertion sort
+	for (int i = 1; i < n; i++) {
+		char *c = candidates[i];
+		double s = score[i];
+		int j;
+		for (j = i; j > 0 && score[j - 1] < s; j--) {
+			candidates[j] = candidates[j - 1];
+			score[j] = score[j - 1];
+		}
+		candidates[j] = c;
+		score[j] = s;
+	}
+}
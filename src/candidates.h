@@ -0,0 +1,39 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Multiple candidate responses
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+// Maximum number of candidate responses obtained for a query
+#define MAX_CANDIDATES 8
+
+#if defined(UNIT_TEST)
+double candidate_score(config_t *config, const char *candidate,
+    int history_length);
+#endif
+
+int acl_candidates_wanted(config_t *config);
+void acl_candidates_add(const char *text);
+const char *acl_candidates_extra(int i);
+void acl_candidates_clear(void);
+int acl_candidates_collect(char *response, char **candidates);
+void acl_candidates_rank(config_t *config, char **candidates, int n,
+    int history_length);
@@ -0,0 +1,84 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test multiple candidate responses.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <readline/history.h>
+
+#include "CuTest.h"
+#include "candidates.h"
+#include "support.h"
+
+static void
+test_score(CuTest* tc)
+{
+	config_t config = {"bash"};
+
+	config.prompt_comment = "#";
+	config.prompt_comment_set = true;
+	// Refusals are ranked last
+	CuAssertTrue(tc, candidate_score(&config, "# Sorry", 0) < 0);
+	// Resolvable commands are favored
+	CuAssertTrue(tc, candidate_score(&config, "ls -l", 0) >= 1);
+	CuAssertTrue(tc, candidate_score(&config, "cd /tmp", 0) >= 1);
+	CuAssertTrue(tc, candidate_score(&config, "no-such-command-xyzzy -l", 0) < 1);
+
+	// Commands similar to those in the history are favored
+	clear_history();
+	add_history("git log --oneline");
+	CuAssertTrue(tc, candidate_score(&config, "xyzzy log --oneline", 1) > 0.5);
+	clear_history();
+}
+
+static void
+test_rank(CuTest* tc)
+{
+	config_t config = {"bash"};
+	char *candidates[MAX_CANDIDATES];
+
+	config.prompt_comment = "#";
+	config.prompt_comment_set = true;
+	acl_candidates_add("ls -S");
+	acl_candidates_add("# Cannot do");
+	acl_candidates_add("ls -S");
+	int n = acl_candidates_collect(acl_safe_strdup("xyzzy -S"), candidates);
+	CuAssertIntEquals(tc, 3, n);
+	acl_candidates_rank(&config, candidates, n, 0);
+	CuAssertStrEquals(tc, "ls -S", candidates[0]);
+	CuAssertStrEquals(tc, "xyzzy -S", candidates[1]);
+	CuAssertStrEquals(tc, "# Cannot do", candidates[2]);
+	for (int i = 0; i < n; i++)
+		free(candidates[i]);
+
+	// The number of candidates is bounded
+	config.general_candidates = 100;
+	config.general_candidates_set = true;
+	CuAssertIntEquals(tc, MAX_CANDIDATES, acl_candidates_wanted(&config));
+}
+
+CuSuite*
+cu_candidates_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_score);
+	SUITE_ADD_TEST(suite, test_rank);
+
+	return suite;
+}
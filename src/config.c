@@ -20,10 +20,12 @@
 
 #define _GNU_SOURCE
 
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "config.h"
 #include "support.h"
@@ -53,6 +55,47 @@ static const char env_prompt_prefix[] = "AI_CLI_prompt_";
 static const char user_env_prefix[] = "user_";
 static const char assistant_env_prefix[] = "assistant_";
 
+/*
+ * When set, configuration errors are reported without terminating
+ * the process, and error_reported is set.
+ */
+static __thread bool recover_errors;
+static __thread bool error_reported;
+
+// Report a configuration error; terminate unless recovering errors
+static void
+config_errorf(const char *format, ...)
+{
+	va_list args;
+
+	fprintf(stderr, "\nai_cli: ");
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fputc('\n', stderr);
+	if (!recover_errors)
+		exit(EXIT_FAILURE);
+	error_reported = true;
+}
+
+/*
+ * Return a copy of the string s, owned by config, so that it is
+ * freed with it.
+ */
+static char *
+config_strdup(config_t *config, const char *s)
+{
+	char **strings = realloc(config->strings,
+	    (config->nstrings + 1) * sizeof(char *));
+	if (!strings)
+		acl_errorf("memory allocation failed.");
+	config->strings = strings;
+	return strings[config->nstrings++] = acl_safe_strdup(s);
+}
+
+// String values are owned by the configuration being set
+#define STRDUP(value) config_strdup(pconfig, value)
+
 // Return true if the specified string starts with the given prefix
 STATIC bool
 starts_with(const char *string, const char *prefix)
@@ -138,25 +181,57 @@ fixed_matcher(config_t *pconfig, const char* section,
 	} while(0)
 
 	// In section, key alphabetic order
-	MATCH(anthropic, endpoint, acl_safe_strdup);
-	MATCH(anthropic, key, acl_safe_strdup);
+	MATCH(anthropic, endpoint, STRDUP);
+	MATCH(anthropic, key, STRDUP);
 	MATCH(anthropic, max_tokens, atoi);
-	MATCH(anthropic, model, acl_safe_strdup);
+	MATCH(anthropic, model, STRDUP);
 	MATCH(anthropic, temperature, atof);
 	MATCH(anthropic, top_k, atoi);
 	MATCH(anthropic, top_p, atof);
-	MATCH(anthropic, version, acl_safe_strdup);
-
-	MATCH(binding, emacs, acl_safe_strdup);
-	MATCH(binding, vi, acl_safe_strdup);
-
-	MATCH(general, api, acl_safe_strdup);
-	MATCH(general, logfile, acl_safe_strdup);
-	MATCH(general, response_prefix, acl_safe_strdup);
+	MATCH(anthropic, version, STRDUP);
+
+	MATCH(autosuggest, delay, acl_strtocard);
+	MATCH(autosuggest, enabled, strtobool);
+	MATCH(autosuggest, key, STRDUP);
+
+	MATCH(binding, emacs, STRDUP);
+	MATCH(binding, vi, STRDUP);
+
+	MATCH(context, git_budget, acl_strtocard);
+	MATCH(context, ls_budget, acl_strtocard);
+	MATCH(context, ls_entries, acl_strtocard);
+	MATCH(context, program_budget, acl_strtocard);
+	MATCH(context, providers, STRDUP);
+	MATCH(context, tokens, acl_strtocard);
+
+	MATCH(general, api, STRDUP);
+	MATCH(general, builtin_http, strtobool);
+	MATCH(general, candidates, acl_strtocard);
+	MATCH(general, log_compress, strtobool);
+	MATCH(general, log_max_files, acl_strtocard);
+	MATCH(general, log_max_size, acl_strtocard);
+	MATCH(general, logfile, STRDUP);
+	MATCH(general, response_prefix, STRDUP);
 	MATCH(general, timestamp, strtobool);
 	MATCH(general, verbose, strtobool);
 
-	MATCH(llamacpp, endpoint, acl_safe_strdup);
+	MATCH(hal, failure, atof);
+	MATCH(hal, latency, STRDUP);
+	MATCH(hal, response_size, acl_strtocard);
+	MATCH(hal, seed, acl_strtocard);
+	MATCH(hal, token_rate, atof);
+
+	MATCH(llama_inproc, library, STRDUP);
+	MATCH(llama_inproc, model, STRDUP);
+	MATCH(llama_inproc, n_ctx, acl_strtocard);
+	MATCH(llama_inproc, n_predict, acl_strtocard);
+	MATCH(llama_inproc, n_threads, acl_strtocard);
+	MATCH(llama_inproc, temperature, atof);
+
+	MATCH(llamacpp, balance, STRDUP);
+	MATCH(llamacpp, eject_failures, atoi);
+	MATCH(llamacpp, eject_time, atoi);
+	MATCH(llamacpp, endpoint, STRDUP);
 	MATCH(llamacpp, frequency_penalty, atof);
 	MATCH(llamacpp, mirostat, atoi);
 	MATCH(llamacpp, mirostat_eta, atof);
@@ -174,13 +249,48 @@ fixed_matcher(config_t *pconfig, const char* section,
 	MATCH(llamacpp, top_p, atof);
 	MATCH(llamacpp, typical_p, atof);
 
-	MATCH(openai, endpoint, acl_safe_strdup);
-	MATCH(openai, key, acl_safe_strdup);
-	MATCH(openai, model, acl_safe_strdup);
+	MATCH(local, entries, acl_strtocard);
+	MATCH(local, file, STRDUP);
+	MATCH(local, preview, strtobool);
+
+	MATCH(ollama, endpoint, STRDUP);
+	MATCH(ollama, keep_alive, STRDUP);
+	MATCH(ollama, model, STRDUP);
+	MATCH(ollama, num_ctx, acl_strtocard);
+	MATCH(ollama, num_predict, acl_strtocard);
+	MATCH(ollama, preload, strtobool);
+	MATCH(ollama, temperature, atof);
+
+	MATCH(openai, endpoint, STRDUP);
+	MATCH(openai, key, STRDUP);
+	MATCH(openai, model, STRDUP);
 	MATCH(openai, temperature, atof);
 
 	MATCH(prompt, context, acl_strtocard);
-	MATCH(prompt, system, acl_safe_strdup);
+	MATCH(prompt, system, STRDUP);
+
+	MATCH(replay, api, STRDUP);
+	MATCH(replay, file, STRDUP);
+	MATCH(replay, latency, strtobool);
+	MATCH(replay, mode, STRDUP);
+
+	MATCH(router, min_acceptance, atof);
+	MATCH(router, short_prompt, acl_strtocard);
+	MATCH(router, slo, acl_strtocard);
+	MATCH(router, tiers, STRDUP);
+
+	MATCH(speculate, budget, acl_strtocard);
+	MATCH(speculate, enabled, strtobool);
+
+	MATCH(trace, chrome, STRDUP);
+	MATCH(trace, file, STRDUP);
+
+	MATCH(usage, enabled, strtobool);
+	MATCH(usage, file, STRDUP);
+	MATCH(usage, hard_budget, atof);
+	MATCH(usage, prices, STRDUP);
+	MATCH(usage, soft_budget, atof);
+	MATCH(usage, soft_model, STRDUP);
 
 	return 0;
 }
@@ -208,9 +318,9 @@ fixed_program_matcher(config_t *pconfig, const char* name, const char* value)
 			return 1; \
 		} \
 	} while (0)
-        MATCH_PROGRAM(comment, acl_safe_strdup);
+        MATCH_PROGRAM(comment, STRDUP);
         MATCH_PROGRAM(context, acl_strtocard);
-        MATCH_PROGRAM(system, acl_safe_strdup);
+        MATCH_PROGRAM(system, STRDUP);
 
 	return 0;
 }
@@ -232,8 +342,10 @@ config_handler(void* user, const char* section, const char* name,
 	if (fixed_matcher(pconfig, section, name, value))
 		return 1;
 
-	if (!starts_with(section, prompt_ini_prefix))
-		acl_errorf("Unknown configuration section [%s], name `%s'.", section, name);
+	if (!starts_with(section, prompt_ini_prefix)) {
+		config_errorf("Unknown configuration section [%s], name `%s'.", section, name);
+		return 0;
+	}
 
 	/*
 	 * A program specific section. It can provide user or assistant
@@ -259,18 +371,22 @@ config_handler(void* user, const char* section, const char* name,
 
 	if (starts_with(name, user_ini_prefix)) {
 		int n = prompt_number(name, user_ini_prefix);
-		if (n == -1)
-			acl_errorf("Invalid prompt number, section [%s], name `%s', value `%s'.", section, name, value);
-		pconfig->prompt_user[n] = strdup(value);
+		if (n == -1) {
+			config_errorf("Invalid prompt number, section [%s], name `%s', value `%s'.", section, name, value);
+			return 0;
+		}
+		pconfig->prompt_user[n] = STRDUP(value);
 		return 1;
 	} else if (starts_with(name, assistant_ini_prefix)) {
 		int n = prompt_number(name, assistant_ini_prefix);
-		if (n == -1)
-			acl_errorf("Invalid prompt number, section [%s], name `%s', value `%s'.", section, name, value);
-		pconfig->prompt_assistant[n] = strdup(value);
+		if (n == -1) {
+			config_errorf("Invalid prompt number, section [%s], name `%s', value `%s'.", section, name, value);
+			return 0;
+		}
+		pconfig->prompt_assistant[n] = STRDUP(value);
 		return 1;
 	}
-	acl_errorf("Unknown configuration section [%s], name `%s'.", section, name);
+	config_errorf("Unknown configuration section [%s], name `%s'.", section, name);
 	return 0;  /* unknown section/name, error */
 }
 
@@ -306,8 +422,10 @@ env_override(config_t *config)
 			continue;
 		// E.g. sqlite3 or gitconfig (which will be named git-config)
 		char *program_name = prompt_id(entry);
-		if (!program_name)
-			acl_errorf("Missing program identifier in prompt environment variable %s", entry);
+		if (!program_name) {
+			config_errorf("Missing program identifier in prompt environment variable %s", entry);
+			continue;
+		}
 
 		// Skip matching of programs other than ours
 		if (strcmp(program_name, config->program_name) != 0) {
@@ -318,25 +436,28 @@ env_override(config_t *config)
 		char *prompt_name_begin = entry + sizeof(env_prompt_prefix) +
 			strlen(program_name);
 		const char *prompt_name_end = strchr(prompt_name_begin, '=');
-		if (!prompt_name_end)
-			acl_errorf("Missing value in prompt environment variable %s", entry);
+		if (!prompt_name_end) {
+			config_errorf("Missing value in prompt environment variable %s", entry);
+			free(program_name);
+			continue;
+		}
 		char *prompt_name = acl_range_strdup(prompt_name_begin, prompt_name_end);
 		const char *prompt_value = prompt_name_end + 1;
 
 		if (starts_with(prompt_name, user_env_prefix)) {
 			int n = prompt_number(prompt_name, user_env_prefix);
 			if (n == -1)
-				acl_errorf("Invalid prompt value in environment variable %s", entry);
+				config_errorf("Invalid prompt value in environment variable %s", entry);
 			else
-				config->prompt_user[n] = strdup(prompt_value);
+				config->prompt_user[n] = config_strdup(config, prompt_value);
 		} else if (starts_with(prompt_name, assistant_env_prefix)) {
 			int n = prompt_number(prompt_name, assistant_env_prefix);
 			if (n == -1)
-				acl_errorf("Invalid prompt value in environment variable %s", entry);
+				config_errorf("Invalid prompt value in environment variable %s", entry);
 			else
-				config->prompt_assistant[n] = strdup(prompt_value);
+				config->prompt_assistant[n] = config_strdup(config, prompt_value);
 		} else if (!fixed_program_matcher(config, prompt_name, prompt_value))
-			acl_errorf("Invalid name in environment variable %s", entry);
+			config_errorf("Invalid name in environment variable %s", entry);
 		free(program_name);
 		free(prompt_name);
 	}
@@ -350,40 +471,87 @@ ini_checked_parse(const char* filename, ini_handler handler, config_t *config)
 	int val = ini_parse(filename, handler, config);
 	// When unable to open file val is -1, which we ignore
 	if (val > 0)
-		acl_errorf("%s:%d:1: Initialization file error", filename, val);
+		config_errorf("%s:%d:1: Initialization file error", filename, val);
 }
 
+// Configuration files, from the least to the most specific
+static char *config_files[MAX_CONFIG_FILES + 1];
+
 /*
- * Read the configuration file from diverse directories into config.
+ * Return a NULL-terminated array of the absolute paths of the
+ * configuration files read, from the least to the most specific.
+ * Relative paths are resolved against the working directory of the
+ * first call, so that the same files are read again after a cd.
  */
-void
-acl_read_config(config_t *config)
+const char * const *
+acl_config_files(void)
 {
-	config->program_name = acl_short_program_name();
+	if (config_files[0])
+		return (const char * const *)config_files;
+
+	int n = 0;
+	config_files[n++] = acl_safe_strdup("/usr/share/ai-cli/config");
+	config_files[n++] = acl_safe_strdup("/usr/local/share/ai-cli/config");
 
-	ini_checked_parse("/usr/share/ai-cli/config", config_handler, config);
-	ini_checked_parse("/usr/local/share/ai-cli/config", config_handler, config);
-	ini_checked_parse("ai-cli-config", config_handler, config);
+	char *cwd = getcwd(NULL, 0);
+	const char *dir = cwd ? cwd : ".";
+	acl_safe_asprintf(&config_files[n++], "%s/%s", dir, "ai-cli-config");
 
 	// $HOME/.aicliconfig
 	char *home_dir;
 	if ((home_dir = getenv("HOME")) != NULL) {
-		char *home_config;
-
-		acl_safe_asprintf(&home_config, "%s/%s", home_dir, "share/ai-cli/config");
-		ini_checked_parse(home_config, config_handler, config);
-		free(home_config);
-
-		acl_safe_asprintf(&home_config, "%s/%s", home_dir, hidden_config_name);
-		ini_checked_parse(home_config, config_handler, config);
-		free(home_config);
+		acl_safe_asprintf(&config_files[n++], "%s/%s", home_dir,
+		    "share/ai-cli/config");
+		acl_safe_asprintf(&config_files[n++], "%s/%s", home_dir,
+		    hidden_config_name);
 	}
 
 	// .aicliconfig
-	ini_checked_parse(hidden_config_name, config_handler, config);
+	acl_safe_asprintf(&config_files[n++], "%s/%s", dir, hidden_config_name);
+	free(cwd);
+	return (const char * const *)config_files;
+}
+
+/*
+ * Read the configuration file from diverse directories into config.
+ * Errors terminate the process.
+ */
+void
+acl_read_config(config_t *config)
+{
+	config->program_name = acl_short_program_name();
+
+	for (const char * const *f = acl_config_files(); *f; f++)
+		ini_checked_parse(*f, config_handler, config);
 	env_override(config);
 }
 
+/*
+ * Read the configuration into config, which should be zeroed,
+ * reporting any errors.
+ * Return false if the configuration has errors.
+ */
+bool
+acl_read_config_checked(config_t *config)
+{
+	recover_errors = true;
+	error_reported = false;
+	acl_read_config(config);
+	recover_errors = false;
+	return !error_reported;
+}
+
+// Free the strings of the configuration values
+void
+acl_config_free(config_t *config)
+{
+	for (int i = 0; i < config->nstrings; i++)
+		free(config->strings[i]);
+	free(config->strings);
+	config->strings = NULL;
+	config->nstrings = 0;
+}
+
 #if defined(UNIT_TEST)
 /*
  * Read the configuration file from the specified file path into config.
@@ -411,3 +579,37 @@ acl_system_role_get(config_t *config)
 	acl_safe_asprintf(&system_role, config->prompt_system, config->program_name);
 	return system_role;
 }
+
+/*
+ * Set in config the model used by the specified API.
+ * Return false if the API has no model option.
+ */
+bool
+acl_config_model_set(config_t *config, const char *api, const char *model)
+{
+	if (strcmp(api, "anthropic") == 0) {
+		config->anthropic_model = model;
+		config->anthropic_model_set = true;
+	} else if (strcmp(api, "ollama") == 0) {
+		config->ollama_model = model;
+		config->ollama_model_set = true;
+	} else if (strcmp(api, "openai") == 0) {
+		config->openai_model = model;
+		config->openai_model_set = true;
+	} else
+		return false;
+	return true;
+}
+
+// Return the model used by the specified API, or NULL if it has none
+const char *
+acl_config_model_get(config_t *config, const char *api)
+{
+	if (strcmp(api, "anthropic") == 0)
+		return config->anthropic_model;
+	else if (strcmp(api, "ollama") == 0)
+		return config->ollama_model;
+	else if (strcmp(api, "openai") == 0)
+		return config->openai_model;
+	return NULL;
+}
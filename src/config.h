@@ -45,18 +45,55 @@ typedef struct {
 	double anthropic_top_p;
 	const char *anthropic_version;	// API version, e.g. 2023-06-01
 
+	// Inline suggestions shown while typing
+	int autosuggest_delay;		// Idle time before a query (ms)
+	bool autosuggest_enabled;
+	const char *autosuggest_key;	// Sequence accepting a suggestion
+
 	// Single character for invoking AI help in Vi mode
 	const char *binding_vi;
 	// Character sequence for invoking AI help in Emacs mode
 	const char *binding_emacs;
 
+	// Shell environment context supplied with the prompts
+	int context_git_budget;		// Time allowed for git status (ms)
+	int context_ls_budget;		// Time allowed for listing (ms)
+	int context_ls_entries;		// Maximum listed directory entries
+	int context_program_budget;	// Time allowed for program state (ms)
+	const char *context_providers;	// Enabled providers, e.g. cwd git ls
+	int context_tokens;		// Maximum tokens of program state
+
 	const char *general_api;	// API to use
+	bool general_builtin_http;	// Use built-in client for local servers
+	int general_candidates;		// Responses obtained per query
+	bool general_log_compress;	// Compress rotated log files
+	int general_log_max_files;	// Rotated log files kept
+	int general_log_max_size;	// Rotate the log beyond this size (kB)
 	const char *general_logfile;	// File to log requests and responses
 	const char *general_response_prefix; // Added in pasted responses
 	bool general_timestamp;		// Timestamp log entries
 	bool general_verbose;		// Verbose program operation
 
-	const char *llamacpp_endpoint;		// API endpoint URL
+	// Synthetic load of the HAL test backend
+	double hal_failure;		// Probability of a failed query
+	const char *hal_latency;	// Response time distribution
+	int hal_response_size;		// Response length (bytes)
+	int hal_seed;			// Seed of the random draws
+	double hal_token_rate;		// Streamed tokens per second
+
+	// Balancing among multiple endpoints
+	// In-process llama.cpp inference
+	const char *llama_inproc_library;	// Shared library to load
+	const char *llama_inproc_model;		// GGUF model file
+	int llama_inproc_n_ctx;			// Context size (tokens)
+	int llama_inproc_n_predict;		// Maximum generated tokens
+	int llama_inproc_n_threads;		// Threads; 0 for the default
+	double llama_inproc_temperature;	// 0 for greedy sampling
+
+	const char *llamacpp_balance;		// Strategy (e.g. ewma)
+	int llamacpp_eject_failures;		// Failures before ejection
+	int llamacpp_eject_time;		// Seconds of ejection
+	const char *llamacpp_endpoint;		// API endpoint URL(s)
 	// Other llama.cpp parameters in the order documented in
 	// https://github.com/ggerganov/llama.cpp/blob/master/examples/server/README.md
 	double llamacpp_temperature;
@@ -76,6 +113,20 @@ typedef struct {
 	double llamacpp_mirostat_eta;
 	int llamacpp_seed;
 
+	// Local history-based suggestions
+	int local_entries;		// Maximum number of learned commands
+	const char *local_file;		// Memory-mapped model file
+	bool local_preview;		// Show while a remote query is in flight
+
+	// Ollama native API
+	const char *ollama_endpoint;	// API endpoint URL
+	const char *ollama_keep_alive;	// Time the model stays loaded
+	const char *ollama_model;	// Model to use (e.g. llama3.2)
+	int ollama_num_ctx;		// Context size (tokens)
+	int ollama_num_predict;		// Maximum generated tokens
+	bool ollama_preload;		// Load the model at startup
+	double ollama_temperature;
+
 	const char *openai_endpoint;	// API endpoint URL
 	const char *openai_key;		// API key
 	const char *openai_model;	// Model to use (e.g. gpt-3.5)
@@ -90,6 +141,34 @@ typedef struct {
 	const char *prompt_user[NPROMPTS];
 	const char *prompt_assistant[NPROMPTS];
 
+	// Recording and replaying of responses
+	const char *replay_api;		// Backend whose responses are recorded
+	const char *replay_file;	// Cassette file
+	bool replay_latency;		// Reproduce the recorded latency
+	const char *replay_mode;	// record or replay
+
+	// Routing of queries to model tiers
+	double router_min_acceptance;	// Escalate tiers accepted less often
+	int router_short_prompt;	// Length of a simple prompt
+	int router_slo;			// Latency service level objective (ms)
+	const char *router_tiers;	// APIs from fastest to most capable
+
+	// Speculative queries for fixing failed commands
+	int speculate_budget;		// Daily token budget
+	bool speculate_enabled;
+
+	// Per-query latency tracing
+	const char *trace_chrome;	// Chrome trace event file
+	const char *trace_file;		// JSON lines file
+
+	// Token usage accounting and budgets
+	bool usage_enabled;
+	const char *usage_file;		// Ledger file
+	double usage_hard_budget;	// Daily USD beyond which only local
+	const char *usage_prices;	// Model USD prices per million tokens
+	double usage_soft_budget;	// Daily USD beyond which soft_model
+	const char *usage_soft_model;	// Cheaper model used beyond the soft budget
+
 	// All the above parameters; set to true is set by configuration
 	// All listed in section, key alphabetic order
 	bool anthropic_endpoint_set;
@@ -101,15 +180,46 @@ typedef struct {
 	bool anthropic_top_p_set;
 	bool anthropic_version_set;
 
+	bool autosuggest_delay_set;
+	bool autosuggest_enabled_set;
+	bool autosuggest_key_set;
+
 	bool binding_emacs_set;
 	bool binding_vi_set;
 
+	bool context_git_budget_set;
+	bool context_ls_budget_set;
+	bool context_ls_entries_set;
+	bool context_program_budget_set;
+	bool context_providers_set;
+	bool context_tokens_set;
+
 	bool general_api_set;
+	bool general_builtin_http_set;
+	bool general_candidates_set;
+	bool general_log_compress_set;
+	bool general_log_max_files_set;
+	bool general_log_max_size_set;
 	bool general_logfile_set;
 	bool general_response_prefix_set;
 	bool general_timestamp_set;
 	bool general_verbose_set;
 
+	bool hal_failure_set;
+	bool hal_latency_set;
+	bool hal_response_size_set;
+	bool hal_seed_set;
+	bool hal_token_rate_set;
+
+	bool llama_inproc_library_set;
+	bool llama_inproc_model_set;
+	bool llama_inproc_n_ctx_set;
+	bool llama_inproc_n_predict_set;
+	bool llama_inproc_n_threads_set;
+	bool llama_inproc_temperature_set;
+	bool llamacpp_balance_set;
+	bool llamacpp_eject_failures_set;
+	bool llamacpp_eject_time_set;
 	bool llamacpp_endpoint_set;
 	bool llamacpp_frequency_penalty_set;
 	bool llamacpp_mirostat_eta_set;
@@ -128,6 +238,17 @@ typedef struct {
 	bool llamacpp_top_p_set;
 	bool llamacpp_typical_p_set;
 
+	bool local_entries_set;
+	bool local_file_set;
+	bool local_preview_set;
+
+	bool ollama_endpoint_set;
+	bool ollama_keep_alive_set;
+	bool ollama_model_set;
+	bool ollama_num_ctx_set;
+	bool ollama_num_predict_set;
+	bool ollama_preload_set;
+	bool ollama_temperature_set;
 	bool openai_endpoint_set;
 	bool openai_key_set;
 	bool openai_model_set;
@@ -136,12 +257,48 @@ typedef struct {
 	bool prompt_comment_set;
 	bool prompt_context_set;
 	bool prompt_system_set;
+
+	bool replay_api_set;
+	bool replay_file_set;
+	bool replay_latency_set;
+	bool replay_mode_set;
+
+	bool router_min_acceptance_set;
+	bool router_short_prompt_set;
+	bool router_slo_set;
+	bool router_tiers_set;
+
+	bool speculate_budget_set;
+	bool speculate_enabled_set;
+
+	bool trace_chrome_set;
+	bool trace_file_set;
+
+	bool usage_enabled_set;
+	bool usage_file_set;
+	bool usage_hard_budget_set;
+	bool usage_prices_set;
+	bool usage_soft_budget_set;
+	bool usage_soft_model_set;
+
+	// Strings allocated for the values, freed by acl_config_free
+	char **strings;
+	int nstrings;
 } config_t;
 
+// Maximum number of configuration files read
+#define MAX_CONFIG_FILES 6
+
 void acl_read_config(config_t *config);
+bool acl_read_config_checked(config_t *config);
+void acl_config_free(config_t *config);
+const char * const *acl_config_files(void);
 
 #if defined(UNIT_TEST)
 void read_file_config(config_t *config, const char *file_path);
 #endif
 
 char *acl_system_role_get(config_t *config);
+bool acl_config_model_set(config_t *config, const char *api,
+    const char *model);
+const char *acl_config_model_get(config_t *config, const char *api);
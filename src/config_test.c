@@ -20,6 +20,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include "CuTest.h"
 #include "config.h"
@@ -112,6 +113,31 @@ test_system_role_get(CuTest* tc)
 	free(system_role);
 }
 
+void
+test_read_config_checked(CuTest* tc)
+{
+	config_t config = {0};
+
+	CuAssertTrue(tc, acl_read_config_checked(&config));
+	CuAssertTrue(tc, config.prompt_system != NULL);
+	CuAssertTrue(tc, config.nstrings > 0);
+	acl_config_free(&config);
+	CuAssertIntEquals(tc, 0, config.nstrings);
+
+	// Errors are reported without terminating the process
+	FILE *f = fopen(".aicliconfig", "w");
+	fputs("[general]\nno_such_name = 1\n", f);
+	fclose(f);
+	config = (config_t){0};
+	CuAssertTrue(tc, !acl_read_config_checked(&config));
+	acl_config_free(&config);
+	unlink(".aicliconfig");
+
+	config = (config_t){0};
+	CuAssertTrue(tc, acl_read_config_checked(&config));
+	acl_config_free(&config);
+}
+
 void
 test_starts_with(CuTest* tc)
 {
@@ -144,6 +170,7 @@ cu_config_suite(void)
 	SUITE_ADD_TEST(suite, test_read_overloaded_config);
 	SUITE_ADD_TEST(suite, test_read_env_added_config);
 	SUITE_ADD_TEST(suite, test_system_role_get);
+	SUITE_ADD_TEST(suite, test_read_config_checked);
 
 	return suite;
 }
@@ -0,0 +1,562 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Environment context supplied with the prompts.
+ *  Each context provider runs in its own thread, so that providers
+ *  run in parallel with each other and with the setup of the query.
+ *  Results are cached under a key that changes when the underlying
+ *  state changes, and a provider that exceeds its time budget is
+ *  left out of the request, completing in the background for
+ *  the benefit of later queries.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "context.h"
+#include "probes.h"
+#include "support.h"
+#include "unit_test.h"
+
+extern char **environ;
+
+#if defined(__APPLE__)
+#define st_mtim st_mtimespec
+#endif
+
+// Default time budgets (ms)
+#define DEFAULT_GIT_BUDGET 100
+#define DEFAULT_LS_BUDGET 50
+
+// Default maximum number of directory entries listed
+#define DEFAULT_LS_ENTRIES 50
+
+// Maximum number of git status lines supplied
+#define MAX_GIT_LINES 50
+
+// Descriptor through which commands report their exit status
+#define STATUS_FD 3
+
+/*
+ * Return a key identifying the state of the file at path.
+ * The file's contents are assumed to change only with its inode,
+ * or modification time.
+ */
+char *
+acl_stat_key(const char *path)
+{
+	struct stat st;
+	char *key;
+
+	if (stat(path, &st) == -1)
+		return NULL;
+	acl_safe_asprintf(&key, "%s:%ju:%ju:%jd.%09ld", path,
+	    (uintmax_t)st.st_dev, (uintmax_t)st.st_ino,
+	    (intmax_t)st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+	return key;
+}
+
+/*
+ * Run the specified command, returning up to max_lines lines of its
+ * standard output in dynamically allocated memory, or NULL on failure.
+ * The command runs under a shell, which reports its exit status through
+ * a pipe, because the host program may reap the spawned processes,
+ * as Bash's SIGCHLD handler does.
+ */
+STATIC char *
+command_output(char *const argv[], int max_lines)
+{
+	int fd[2], status_fd[2];
+	if (pipe(fd) == -1)
+		return NULL;
+	if (pipe(status_fd) == -1) {
+		close(fd[0]);
+		close(fd[1]);
+		return NULL;
+	}
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, fd[1], STDOUT_FILENO);
+	posix_spawn_file_actions_addclose(&actions, fd[0]);
+	posix_spawn_file_actions_addclose(&actions, fd[1]);
+	posix_spawn_file_actions_addclose(&actions, status_fd[0]);
+	posix_spawn_file_actions_adddup2(&actions, status_fd[1], STATUS_FD);
+	if (status_fd[1] != STATUS_FD)
+		posix_spawn_file_actions_addclose(&actions, status_fd[1]);
+	posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null",
+	    O_WRONLY, 0);
+
+	// sh -c '"$@"; echo $? >&3' sh argv...
+	int argc = 0;
+	while (argv[argc])
+		argc++;
+	char *sh_argv[argc + 5];
+	sh_argv[0] = "sh";
+	sh_argv[1] = "-c";
+	sh_argv[2] = "\"$@\"; echo $? >&3";	// STATUS_FD
+	sh_argv[3] = "sh";
+	memcpy(sh_argv + 4, argv, argc * sizeof(char *));
+	sh_argv[argc + 4] = NULL;
+
+	pid_t pid;
+	int err = posix_spawn(&pid, "/bin/sh", &actions, NULL, sh_argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	close(fd[1]);
+	close(status_fd[1]);
+	if (err != 0) {
+		close(fd[0]);
+		close(status_fd[0]);
+		return NULL;
+	}
+
+	FILE *f = fdopen(fd[0], "r");
+	string_t result;
+	acl_string_init(&result, "");
+	char *line = NULL;
+	size_t size = 0;
+	int lines = 0;
+	while (getline(&line, &size, f) != -1)
+		if (lines++ < max_lines)
+			acl_string_append(&result, line);
+	if (lines > max_lines)
+		acl_string_appendf(&result, "(%d more lines)\n", lines - max_lines);
+	free(line);
+	fclose(f);
+
+	char status[16];
+	ssize_t n;
+	while ((n = read(status_fd[0], status, sizeof(status) - 1)) == -1
+	    && errno == EINTR)
+		;
+	close(status_fd[0]);
+	// The host may already have reaped the shell
+	while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
+		;
+	if (n > 0)
+		status[n] = '\0';
+	if (n <= 0 || strcmp(status, "0\n") != 0) {
+		free(result.ptr);
+		return NULL;
+	}
+	return result.ptr;
+}
+
+// Current directory
+static char *
+cwd_key(config_t *config, const char *dir)
+{
+	return acl_safe_strdup(dir);
+}
+
+static char *
+cwd_compute(config_t *config, const char *dir)
+{
+	char *result;
+
+	acl_safe_asprintf(&result, "Current directory: %s\n", dir);
+	return result;
+}
+
+static int
+cwd_budget(config_t *config)
+{
+	return 0;
+}
+
+/*
+ * Return the directory holding the HEAD and index of the repository
+ * whose .git entry, with the specified path and status, is in dir,
+ * or NULL if it cannot be determined.
+ * In worktrees and submodules .git is a file whose "gitdir:" line
+ * gives the directory's path, which may be relative to dir.
+ */
+static char *
+git_directory(const char *dir, const char *git_path, const struct stat *st)
+{
+	if (S_ISDIR(st->st_mode))
+		return acl_safe_strdup(git_path);
+
+	FILE *f = fopen(git_path, "r");
+	if (!f)
+		return NULL;
+	char line[PATH_MAX + 16];
+	char *result = NULL;
+	if (fgets(line, sizeof(line), f)
+	    && strncmp(line, "gitdir: ", 8) == 0) {
+		char *target = line + 8;
+		target[strcspn(target, "\r\n")] = '\0';
+		if (*target == '/')
+			result = acl_safe_strdup(target);
+		else if (*target)
+			acl_safe_asprintf(&result, "%s/%s", dir, target);
+	}
+	fclose(f);
+	return result;
+}
+
+/*
+ * Git working tree status, keyed by the repository's HEAD and index
+ * files, which Git updates when switching branches and when
+ * refreshing the status of the working tree.
+ */
+STATIC char *
+git_key(config_t *config, const char *dir)
+{
+	char *path = acl_safe_strdup(dir);
+
+	for (;;) {
+		char *git_path;
+		acl_safe_asprintf(&git_path, "%s/.git", path);
+		struct stat st;
+		if (stat(git_path, &st) == 0) {
+			char *git_dir = git_directory(path, git_path, &st);
+			free(git_path);
+			free(path);
+			if (!git_dir)
+				return NULL;
+			char *index, *head;
+			acl_safe_asprintf(&index, "%s/index", git_dir);
+			acl_safe_asprintf(&head, "%s/HEAD", git_dir);
+			free(git_dir);
+			char *index_key = acl_stat_key(index);
+			char *head_key = acl_stat_key(head);
+			free(index);
+			free(head);
+			// The output's paths are relative to the directory
+			char *key = NULL;
+			if (index_key && head_key)
+				acl_safe_asprintf(&key, "%s:%s:%s", dir,
+				    index_key, head_key);
+			free(index_key);
+			free(head_key);
+			return key;
+		}
+		free(git_path);
+		char *slash = strrchr(path, '/');
+		if (!slash || slash == path)
+			break;
+		*slash = '\0';
+	}
+	free(path);
+	return NULL;
+}
+
+static char *
+git_compute(config_t *config, const char *dir)
+{
+	char *argv[] = {"git", "-C", (char *)dir, "status", "--porcelain",
+	    NULL};
+	char *status = command_output(argv, MAX_GIT_LINES);
+	char *result;
+
+	if (!status)
+		return NULL;
+	if (*status)
+		acl_safe_asprintf(&result, "Output of git status --porcelain:\n%s",
+		    status);
+	else
+		result = acl_safe_strdup("The Git working tree is clean.\n");
+	free(status);
+	return result;
+}
+
+static int
+git_budget(config_t *config)
+{
+	return config->context_git_budget_set ? config->context_git_budget :
+	    DEFAULT_GIT_BUDGET;
+}
+
+// Directory listing, keyed by the directory's modification time
+static char *
+ls_key(config_t *config, const char *dir)
+{
+	return acl_stat_key(dir);
+}
+
+static int
+string_compare(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static char *
+ls_compute(config_t *config, const char *dir)
+{
+	DIR *d = opendir(dir);
+	if (!d)
+		return NULL;
+
+	char **names = NULL;
+	size_t n = 0;
+	struct dirent *e;
+	while ((e = readdir(d)) != NULL) {
+		if (e->d_name[0] == '.')
+			continue;
+		names = realloc(names, (n + 1) * sizeof(char *));
+		if (!names)
+			acl_errorf("memory allocation failed.");
+		acl_safe_asprintf(&names[n++], "%s%s", e->d_name,
+		    e->d_type == DT_DIR ? "/" : "");
+	}
+	closedir(d);
+	qsort(names, n, sizeof(char *), string_compare);
+
+	size_t max = config->context_ls_entries_set ?
+	    config->context_ls_entries : DEFAULT_LS_ENTRIES;
+	string_t result;
+	acl_string_init(&result, "Directory contents:");
+	for (size_t i = 0; i < n; i++) {
+		if (i < max)
+			acl_string_appendf(&result, " %s", names[i]);
+		free(names[i]);
+	}
+	if (n > max)
+		acl_string_appendf(&result, " (%zu more entries)", n - max);
+	acl_string_append(&result, "\n");
+	free(names);
+	return result.ptr;
+}
+
+static int
+ls_budget(config_t *config)
+{
+	return config->context_ls_budget_set ? config->context_ls_budget :
+	    DEFAULT_LS_BUDGET;
+}
+
+static const provider_t cwd_provider = {"cwd", NULL, cwd_key, cwd_compute, cwd_budget};
+static const provider_t git_provider = {"git", NULL, git_key, git_compute, git_budget};
+static const provider_t ls_provider = {"ls", NULL, ls_key, ls_compute, ls_budget};
+
+static const provider_t *providers[] = {
+	&cwd_provider,
+	&git_provider,
+	&ls_provider,
+	&acl_gdb_frame_provider,
+	&acl_psql_schema_provider,
+	&acl_sqlite3_schema_provider,
+};
+
+#define NPROVIDERS (sizeof(providers) / sizeof(providers[0]))
+
+// Cached and in-progress results of each provider
+static struct {
+	char *wanted;		// Key for the current query; NULL if none
+	char *key;		// Key of the cached value
+	char *value;		// Cached value
+	bool running;		// A thread is computing a value
+} state[NPROVIDERS];
+
+// Protects the state and the following variables
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static bool started;		// Providers started for the next request
+static double start_ms;		// Time they were started
+
+// Arguments of a provider thread
+typedef struct {
+	config_t *config;
+	int provider;
+	char *dir;
+	char *key;
+} job_t;
+
+// Compute and cache a provider's value
+static void *
+run_provider(void *arg)
+{
+	job_t *job = arg;
+	char *value = providers[job->provider]->compute(job->config, job->dir);
+
+	pthread_mutex_lock(&lock);
+	free(state[job->provider].key);
+	free(state[job->provider].value);
+	state[job->provider].key = job->key;
+	state[job->provider].value = value;
+	state[job->provider].running = false;
+	pthread_cond_broadcast(&done_cond);
+	pthread_mutex_unlock(&lock);
+
+	free(job->dir);
+	free(job);
+	return NULL;
+}
+
+/*
+ * Return true if the specified provider applies to the program
+ * and its name appears in the configured list.
+ */
+static bool
+provider_enabled(config_t *config, const provider_t *provider)
+{
+	const char *p = config->context_providers;
+	const char *name = provider->name;
+	size_t len = strlen(name);
+
+	if (provider->program && strcmp(provider->program, config->program_name) != 0)
+		return false;
+
+	while (p && (p = strstr(p, name)) != NULL) {
+		if ((p == config->context_providers || strchr(", \t", p[-1]))
+		    && (p[len] == '\0' || strchr(", \t", p[len])))
+			return true;
+		p += len;
+	}
+	return false;
+}
+
+/*
+ * Start gathering the context for the next request, in the
+ * background for providers whose cached value is stale.
+ */
+void
+acl_context_start(config_t *config)
+{
+	char dir[PATH_MAX];
+
+	if (!config->context_providers_set || !getcwd(dir, sizeof(dir)))
+		return;
+
+	pthread_mutex_lock(&lock);
+	if (started) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	started = true;
+	start_ms = acl_now_ms();
+	for (size_t i = 0; i < NPROVIDERS; i++) {
+		const provider_t *p = providers[i];
+		free(state[i].wanted);
+		state[i].wanted = NULL;
+		if (!provider_enabled(config, p))
+			continue;
+		char *key = p->key(config, dir);
+		if (!key)
+			continue;
+		state[i].wanted = key;
+		bool hit = state[i].key && strcmp(state[i].key, key) == 0;
+		PROBE_CONTEXT_CACHE(p->name, hit);
+		if (state[i].running || hit)
+			continue;
+
+		if (p->budget(config) == 0) {
+			free(state[i].key);
+			free(state[i].value);
+			state[i].key = acl_safe_strdup(key);
+			state[i].value = p->compute(config, dir);
+			continue;
+		}
+
+		job_t *job = malloc(sizeof(job_t));
+		if (!job)
+			acl_errorf("memory allocation failed.");
+		job->config = config;
+		job->provider = i;
+		job->dir = acl_safe_strdup(dir);
+		job->key = acl_safe_strdup(key);
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, run_provider, job) == 0) {
+			pthread_detach(thread);
+			state[i].running = true;
+		} else {
+			free(job->dir);
+			free(job->key);
+			free(job);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Return the context gathered for the current request in dynamically
+ * allocated memory, or NULL if none is available.
+ * Wait for each provider at most for its time budget.
+ */
+char *
+acl_context_get(config_t *config)
+{
+	acl_context_start(config);
+
+	pthread_mutex_lock(&lock);
+	if (!started) {
+		pthread_mutex_unlock(&lock);
+		return NULL;
+	}
+	string_t result;
+	acl_string_init(&result, "");
+	for (size_t i = 0; i < NPROVIDERS; i++) {
+		if (!state[i].wanted)
+			continue;
+
+		double deadline = start_ms + providers[i]->budget(config);
+		while (state[i].running && !(state[i].key
+		    && strcmp(state[i].key, state[i].wanted) == 0)) {
+			double remaining = deadline - acl_now_ms();
+			if (remaining <= 0)
+				break;
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			long long ns = ts.tv_nsec + (long long)(remaining * 1e6);
+			ts.tv_sec += ns / 1000000000;
+			ts.tv_nsec = ns % 1000000000;
+			pthread_cond_timedwait(&done_cond, &lock, &ts);
+		}
+
+		if (state[i].key && strcmp(state[i].key, state[i].wanted) == 0) {
+			if (state[i].value)
+				acl_string_append(&result, state[i].value);
+		} else if (config->general_verbose)
+			fprintf(stderr, "\nContext provider %s exceeded its budget\n",
+			    providers[i]->name);
+	}
+	started = false;
+	pthread_mutex_unlock(&lock);
+
+	if (*result.ptr)
+		return result.ptr;
+	free(result.ptr);
+	return NULL;
+}
+
+/*
+ * Wait for the providers computing values in the background, so that
+ * the configuration passed to them can be released.
+ */
+void
+acl_context_wait(void)
+{
+	pthread_mutex_lock(&lock);
+	for (size_t i = 0; i < NPROVIDERS; i++)
+		while (state[i].running)
+			pthread_cond_wait(&done_cond, &lock);
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,59 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Environment context supplied with the prompts
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+// A source of context
+typedef struct {
+	const char *name;
+	const char *program;	// Program to which it applies; NULL for all
+	/*
+	 * Return in dynamically allocated memory a key that changes
+	 * whenever the provider's result for the directory dir changes,
+	 * or NULL if the provider does not apply.
+	 * Must be fast; typically a few system calls.
+	 */
+	char *(*key)(config_t *config, const char *dir);
+	// Return the context in dynamically allocated memory, or NULL
+	char *(*compute)(config_t *config, const char *dir);
+	// Return the time budget in ms; 0 for computing synchronously
+	int (*budget)(config_t *config);
+} provider_t;
+
+// Providers of program-specific context
+extern const provider_t acl_gdb_frame_provider;
+extern const provider_t acl_psql_schema_provider;
+extern const provider_t acl_sqlite3_schema_provider;
+
+#if defined(UNIT_TEST)
+char *compress_items(config_t *config, const char *title, char **full,
+    char **brief, int n);
+char *sqlite_database(void);
+bool psql_ddl(const char *line);
+char *command_output(char *const argv[], int max_lines);
+char *git_key(config_t *config, const char *dir);
+#endif
+
+char *acl_stat_key(const char *path);
+void acl_context_start(config_t *config);
+char *acl_context_get(config_t *config);
+void acl_context_wait(void);
@@ -0,0 +1,644 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Program-specific context providers.
+ *  These obtain the state of the program hosting the library, such
+ *  as a database schema or a debugger's stack frame, through the
+ *  program's own libraries, which are located at runtime.
+ *  Their output is compressed to fit the configured token budget.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <readline/history.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include "context.h"
+#include "support.h"
+#include "unit_test.h"
+
+// Default time budget (ms) for program-specific providers
+#define DEFAULT_PROGRAM_BUDGET 200
+
+// Default number of tokens of each provider's output
+#define DEFAULT_TOKENS 500
+
+// Approximate number of characters per token
+#define CHARS_PER_TOKEN 4
+
+// Maximum number of tables whose description is cached
+#define MAX_TABLES 256
+
+static int
+program_budget(config_t *config)
+{
+	return config->context_program_budget_set ?
+	    config->context_program_budget : DEFAULT_PROGRAM_BUDGET;
+}
+
+/*
+ * Return in dynamically allocated memory a description of n items,
+ * preceded by the specified title, which fits in the configured
+ * token budget.  The full description of each item is used if
+ * possible, followed by the brief one, followed by a truncated list
+ * of brief descriptions.
+ */
+STATIC char *
+compress_items(config_t *config, const char *title, char **full, char **brief,
+    int n)
+{
+	size_t max = (config->context_tokens_set ? config->context_tokens :
+	    DEFAULT_TOKENS) * CHARS_PER_TOKEN;
+	string_t result;
+
+	for (char **items = full; ; items = brief) {
+		acl_string_init(&result, title);
+		int i;
+		for (i = 0; i < n; i++) {
+			size_t len = strlen(items[i]) + 1;
+			if (result.len + len > max)
+				break;
+			acl_string_appendf(&result, "%s\n", items[i]);
+		}
+		if (i == n)
+			return result.ptr;
+		if (items == brief) {
+			acl_string_appendf(&result, "(%d more)\n", n - i);
+			return result.ptr;
+		}
+		free(result.ptr);
+	}
+}
+
+/*
+ * Return the first symbol with the specified name, looking first in the
+ * program and its libraries and then in the specified library.
+ */
+static void *
+find_symbol(const char *library, const char *name)
+{
+	void *sym = dlsym(RTLD_DEFAULT, name);
+	if (sym)
+		return sym;
+	void *handle = dlopen(library, RTLD_LAZY | RTLD_GLOBAL);
+	return handle ? dlsym(handle, name) : NULL;
+}
+
+/*
+ * SQLite database schema.
+ * The database file opened by the sqlite3 shell is located among the
+ * process's open file descriptors and read through a separate
+ * read-only connection.  Only the tables whose definition changed
+ * are examined again.
+ */
+
+typedef struct sqlite3 sqlite3;
+typedef struct sqlite3_stmt sqlite3_stmt;
+
+#define SQLITE_OK 0
+#define SQLITE_ROW 100
+#define SQLITE_OPEN_READONLY 0x00000001
+
+static struct {
+	int (*open_v2)(const char *, sqlite3 **, int, const char *);
+	int (*close)(sqlite3 *);
+	int (*prepare_v2)(sqlite3 *, const char *, int, sqlite3_stmt **,
+	    const char **);
+	int (*bind_text)(sqlite3_stmt *, int, const char *, int,
+	    void (*)(void *));
+	int (*step)(sqlite3_stmt *);
+	const unsigned char *(*column_text)(sqlite3_stmt *, int);
+	int (*finalize)(sqlite3_stmt *);
+} sqlite;
+
+// Cached description of a table
+typedef struct {
+	uint64_t hash;		// Hash of its name and definition
+	char *full;		// Name, columns and their types
+	char *brief;		// Name and columns
+} table_t;
+
+static table_t tables[MAX_TABLES];
+static int ntables;
+
+/*
+ * Return in dynamically allocated memory the path of the first
+ * SQLite database opened by the process, or NULL if none is found.
+ */
+STATIC char *
+sqlite_database(void)
+{
+#if defined(__linux__)
+	DIR *d = opendir("/proc/self/fd");
+	if (!d)
+		return NULL;
+
+	char *result = NULL;
+	struct dirent *e;
+	while (!result && (e = readdir(d)) != NULL) {
+		char link[PATH_MAX], path[PATH_MAX];
+		snprintf(link, sizeof(link), "/proc/self/fd/%s", e->d_name);
+		ssize_t len = readlink(link, path, sizeof(path) - 1);
+		if (len <= 0 || path[0] != '/')
+			continue;
+		path[len] = '\0';
+
+		/*
+		 * Only read regular files: reading the terminal, such as
+		 * that of file descriptor 0, would block and consume input.
+		 */
+		int fd = open(path, O_RDONLY | O_NONBLOCK | O_NOCTTY);
+		if (fd == -1)
+			continue;
+		struct stat sb;
+		char header[16];
+		if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode)
+		    && read(fd, header, sizeof(header)) == sizeof(header)
+		    && memcmp(header, "SQLite format 3", sizeof(header)) == 0)
+			result = acl_safe_strdup(path);
+		close(fd);
+	}
+	closedir(d);
+	return result;
+#else
+	return NULL;
+#endif
+}
+
+static char *
+sqlite_key(config_t *config, const char *dir)
+{
+	char *db = sqlite_database();
+	if (!db)
+		return NULL;
+	char *key = acl_stat_key(db);
+	free(db);
+	return key;
+}
+
+// Return the description of the named table, reusing cached ones
+static table_t *
+sqlite_table(sqlite3 *db, const char *name, const char *sql)
+{
+	string_t key;
+	acl_string_init(&key, name);
+	acl_string_append(&key, sql);
+	uint64_t hash = acl_hash(key.ptr, key.len);
+	free(key.ptr);
+
+	for (int i = 0; i < ntables; i++)
+		if (tables[i].hash == hash)
+			return &tables[i];
+
+	sqlite3_stmt *stmt;
+	if (sqlite.prepare_v2(db, "SELECT name, type FROM pragma_table_info(?)",
+	    -1, &stmt, NULL) != SQLITE_OK)
+		return NULL;
+	sqlite.bind_text(stmt, 1, name, -1, NULL);
+	string_t full, brief;
+	acl_string_init(&full, name);
+	acl_string_init(&brief, name);
+	const char *sep = "(";
+	while (sqlite.step(stmt) == SQLITE_ROW) {
+		const char *column = (const char *)sqlite.column_text(stmt, 0);
+		const char *type = (const char *)sqlite.column_text(stmt, 1);
+		acl_string_appendf(&full, "%s%s %s", sep, column, type ? type : "");
+		acl_string_appendf(&brief, "%s%s", sep, column);
+		sep = ", ";
+	}
+	sqlite.finalize(stmt);
+	acl_string_append(&full, ")");
+	acl_string_append(&brief, ")");
+
+	// Replace the oldest entry when full
+	table_t *t;
+	if (ntables < MAX_TABLES)
+		t = &tables[ntables++];
+	else {
+		t = &tables[0];
+		free(t->full);
+		free(t->brief);
+		memmove(tables, tables + 1, (MAX_TABLES - 1) * sizeof(table_t));
+		t = &tables[MAX_TABLES - 1];
+	}
+	t->hash = hash;
+	t->full = full.ptr;
+	t->brief = brief.ptr;
+	return t;
+}
+
+static char *
+sqlite_compute(config_t *config, const char *dir)
+{
+	if (!sqlite.open_v2) {
+		const char *library = "libsqlite3." DLL_EXTENSION ".0";
+		sqlite.close = find_symbol(library, "sqlite3_close");
+		sqlite.prepare_v2 = find_symbol(library, "sqlite3_prepare_v2");
+		sqlite.bind_text = find_symbol(library, "sqlite3_bind_text");
+		sqlite.step = find_symbol(library, "sqlite3_step");
+		sqlite.column_text = find_symbol(library, "sqlite3_column_text");
+		sqlite.finalize = find_symbol(library, "sqlite3_finalize");
+		if (!sqlite.close || !sqlite.prepare_v2 || !sqlite.bind_text
+		    || !sqlite.step || !sqlite.column_text || !sqlite.finalize)
+			return NULL;
+		sqlite.open_v2 = find_symbol(library, "sqlite3_open_v2");
+		if (!sqlite.open_v2)
+			return NULL;
+	}
+
+	char *path = sqlite_database();
+	sqlite3 *db;
+	if (!path || sqlite.open_v2(path, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+		free(path);
+		return NULL;
+	}
+	free(path);
+
+	sqlite3_stmt *stmt;
+	if (sqlite.prepare_v2(db, "SELECT name, sql FROM sqlite_master "
+	    "WHERE type = 'table' AND name NOT LIKE 'sqlite_%' ORDER BY name",
+	    -1, &stmt, NULL) != SQLITE_OK) {
+		sqlite.close(db);
+		return NULL;
+	}
+
+	char *full[MAX_TABLES], *brief[MAX_TABLES];
+	int n = 0;
+	while (n < MAX_TABLES && sqlite.step(stmt) == SQLITE_ROW) {
+		const char *name = (const char *)sqlite.column_text(stmt, 0);
+		const char *sql = (const char *)sqlite.column_text(stmt, 1);
+		table_t *t = sqlite_table(db, name, sql ? sql : "");
+		if (!t)
+			continue;
+		full[n] = acl_safe_strdup(t->full);
+		brief[n++] = acl_safe_strdup(t->brief);
+	}
+	sqlite.finalize(stmt);
+	sqlite.close(db);
+
+	char *result = compress_items(config, "Database tables:\n", full, brief, n);
+	for (int i = 0; i < n; i++) {
+		free(full[i]);
+		free(brief[i]);
+	}
+	return result;
+}
+
+const provider_t acl_sqlite3_schema_provider = {
+	"schema", "sqlite3", sqlite_key, sqlite_compute, program_budget
+};
+
+/*
+ * PostgreSQL database schema.
+ * A separate read-only connection is established through libpq,
+ * using the connection options with which psql was invoked.
+ * The schema is obtained again after commands that can change it.
+ */
+
+typedef struct pg_conn PGconn;
+typedef struct pg_result PGresult;
+
+#define CONNECTION_OK 0
+#define PGRES_TUPLES_OK 2
+
+static struct {
+	PGconn *(*connectdbParams)(const char * const *, const char * const *, int);
+	int (*status)(const PGconn *);
+	PGresult *(*exec)(PGconn *, const char *);
+	int (*resultStatus)(const PGresult *);
+	int (*ntuples)(const PGresult *);
+	char *(*getvalue)(const PGresult *, int, int);
+	void (*clear)(PGresult *);
+	void (*finish)(PGconn *);
+} pq;
+
+// Keywords that modify a database schema
+static const char *ddl_keywords[] = {"alter", "create", "drop", "\\i", "\\ir",
+    "\\include", "\\include_relative", NULL};
+
+/*
+ * Return true if a statement in the specified psql input line starts
+ * with a keyword that modifies a database schema.
+ * Statements start at the beginning of the line and after semicolons
+ * outside string literals and quoted identifiers.
+ */
+STATIC bool
+psql_ddl(const char *line)
+{
+	bool statement_start = true;
+	char quote = '\0';
+
+	for (const char *p = line; *p; p++) {
+		if (quote) {
+			if (*p == quote)
+				quote = '\0';
+			continue;
+		}
+		if (*p == ';') {
+			statement_start = true;
+			continue;
+		}
+		if (isspace((unsigned char)*p))
+			continue;
+		if (statement_start)
+			for (const char **k = ddl_keywords; *k; k++) {
+				size_t len = strlen(*k);
+				if (strncasecmp(p, *k, len) == 0
+				    && !isalnum((unsigned char)p[len])
+				    && p[len] != '_')
+					return true;
+			}
+		statement_start = false;
+		if (*p == '\'' || *p == '"')
+			quote = *p;
+	}
+	return false;
+}
+
+static char *
+psql_key(config_t *config, const char *dir)
+{
+	HIST_ENTRY **list = history_list();
+	int changes = 0;
+
+	for (int i = 0; list && list[i]; i++)
+		if (psql_ddl(list[i]->line))
+			changes++;
+	char *key;
+	acl_safe_asprintf(&key, "ddl:%d", changes);
+	return key;
+}
+
+/*
+ * Set keywords and values to the connection options with which the
+ * program was invoked.  Return the number of options set.
+ */
+static int
+psql_options(char **args, int nargs, const char **keywords,
+    const char **values)
+{
+	int n = 0;
+	bool dbname_set = false;
+
+	for (int i = 1; i < nargs; i++) {
+		const char *a = args[i];
+		const char *keyword = NULL;
+		const char *value = NULL;
+
+		if (a[0] == '-' && a[1] && strchr("dhpU", a[1])) {
+			keyword = a[1] == 'd' ? "dbname" : a[1] == 'h' ? "host" :
+			    a[1] == 'p' ? "port" : "user";
+			value = a[2] ? a + 2 : i + 1 < nargs ? args[++i] : NULL;
+		} else if (strncmp(a, "--dbname=", 9) == 0) {
+			keyword = "dbname";
+			value = a + 9;
+		} else if (strncmp(a, "--host=", 7) == 0) {
+			keyword = "host";
+			value = a + 7;
+		} else if (strncmp(a, "--port=", 7) == 0) {
+			keyword = "port";
+			value = a + 7;
+		} else if (strncmp(a, "--username=", 11) == 0) {
+			keyword = "user";
+			value = a + 11;
+		} else if (a[0] != '-') {
+			// Positional arguments are the database and user names
+			keyword = dbname_set ? "user" : "dbname";
+			value = a;
+		}
+		if (!keyword || !value)
+			continue;
+		if (strcmp(keyword, "dbname") == 0)
+			dbname_set = true;
+		keywords[n] = keyword;
+		values[n++] = value;
+	}
+	return n;
+}
+
+static char *
+psql_compute(config_t *config, const char *dir)
+{
+	if (!pq.connectdbParams) {
+		const char *library = "libpq." DLL_EXTENSION ".5";
+		pq.status = find_symbol(library, "PQstatus");
+		pq.exec = find_symbol(library, "PQexec");
+		pq.resultStatus = find_symbol(library, "PQresultStatus");
+		pq.ntuples = find_symbol(library, "PQntuples");
+		pq.getvalue = find_symbol(library, "PQgetvalue");
+		pq.clear = find_symbol(library, "PQclear");
+		pq.finish = find_symbol(library, "PQfinish");
+		if (!pq.status || !pq.exec || !pq.resultStatus || !pq.ntuples
+		    || !pq.getvalue || !pq.clear || !pq.finish)
+			return NULL;
+		pq.connectdbParams = find_symbol(library, "PQconnectdbParams");
+		if (!pq.connectdbParams)
+			return NULL;
+	}
+
+	// Obtain the program's arguments
+	FILE *f = fopen("/proc/self/cmdline", "r");
+	if (!f)
+		return NULL;
+	char *args[64];
+	int nargs = 0;
+	char *arg = NULL;
+	size_t size = 0;
+	while (nargs < 64 && getdelim(&arg, &size, '\0', f) != -1) {
+		args[nargs++] = arg;
+		arg = NULL;
+		size = 0;
+	}
+	free(arg);
+	fclose(f);
+
+	const char *keywords[68], *values[68];
+	int n = psql_options(args, nargs, keywords, values);
+	keywords[n] = "connect_timeout";
+	values[n++] = "5";
+	keywords[n] = "options";
+	values[n++] = "-c default_transaction_read_only=on";
+	keywords[n] = "application_name";
+	values[n++] = "ai-cli";
+	keywords[n] = NULL;
+	values[n] = NULL;
+
+	PGconn *conn = pq.connectdbParams(keywords, values, 0);
+	for (int i = 0; i < nargs; i++)
+		free(args[i]);
+	if (pq.status(conn) != CONNECTION_OK) {
+		pq.finish(conn);
+		return NULL;
+	}
+
+	PGresult *res = pq.exec(conn, "SELECT table_schema || '.' || table_name, "
+	    "string_agg(column_name || ' ' || data_type, ', ' ORDER BY ordinal_position), "
+	    "string_agg(column_name, ', ' ORDER BY ordinal_position) "
+	    "FROM information_schema.columns "
+	    "WHERE table_schema NOT IN ('pg_catalog', 'information_schema') "
+	    "GROUP BY 1 ORDER BY 1");
+	char *result = NULL;
+	if (pq.resultStatus(res) == PGRES_TUPLES_OK) {
+		int rows = pq.ntuples(res);
+		char **full = calloc(rows + 1, sizeof(char *));
+		char **brief = calloc(rows + 1, sizeof(char *));
+		if (!full || !brief)
+			acl_errorf("memory allocation failed.");
+		for (int i = 0; i < rows; i++) {
+			acl_safe_asprintf(&full[i], "%s(%s)", pq.getvalue(res, i, 0),
+			    pq.getvalue(res, i, 1));
+			acl_safe_asprintf(&brief[i], "%s(%s)", pq.getvalue(res, i, 0),
+			    pq.getvalue(res, i, 2));
+		}
+		result = compress_items(config, "Database tables:\n", full, brief, rows);
+		for (int i = 0; i < rows; i++) {
+			free(full[i]);
+			free(brief[i]);
+		}
+		free(full);
+		free(brief);
+	}
+	pq.clear(res);
+	pq.finish(conn);
+	return result;
+}
+
+const provider_t acl_psql_schema_provider = {
+	"schema", "psql", psql_key, psql_compute, program_budget
+};
+
+/*
+ * Debugger stack frame.
+ * It is obtained through the Python interpreter embedded in gdb,
+ * synchronously, because gdb is not thread-safe.
+ * The frame is examined again after each entered command.
+ */
+
+typedef struct _object PyObject;
+
+#define Py_eval_input 258
+
+static struct {
+	int (*gil_ensure)(void);
+	void (*gil_release)(int);
+	PyObject *(*add_module)(const char *);
+	PyObject *(*module_dict)(PyObject *);
+	PyObject *(*run_string)(const char *, int, PyObject *, PyObject *, void *);
+	const char *(*as_utf8)(PyObject *);
+	void (*decref)(PyObject *);
+	void (*err_clear)(void);
+} py;
+
+static const char frame_expression[] =
+	"'\\n'.join(__import__('gdb').execute(c, to_string=True) "
+	"for c in ('frame', 'info args', 'info locals'))";
+
+// Return true if called from the program's main thread
+static bool
+main_thread(void)
+{
+#if defined(__linux__)
+	return syscall(SYS_gettid) == getpid();
+#else
+	return true;
+#endif
+}
+
+static char *
+gdb_key(config_t *config, const char *dir)
+{
+	HIST_ENTRY **list = history_list();
+	int n = 0;
+
+	if (!main_thread())
+		return NULL;
+	while (list && list[n])
+		n++;
+	char *key;
+	acl_safe_asprintf(&key, "commands:%d", n);
+	return key;
+}
+
+static char *
+gdb_compute(config_t *config, const char *dir)
+{
+	if (!py.run_string) {
+		py.gil_ensure = dlsym(RTLD_DEFAULT, "PyGILState_Ensure");
+		py.gil_release = dlsym(RTLD_DEFAULT, "PyGILState_Release");
+		py.add_module = dlsym(RTLD_DEFAULT, "PyImport_AddModule");
+		py.module_dict = dlsym(RTLD_DEFAULT, "PyModule_GetDict");
+		py.as_utf8 = dlsym(RTLD_DEFAULT, "PyUnicode_AsUTF8");
+		py.decref = dlsym(RTLD_DEFAULT, "Py_DecRef");
+		py.err_clear = dlsym(RTLD_DEFAULT, "PyErr_Clear");
+		if (!py.gil_ensure || !py.gil_release || !py.add_module
+		    || !py.module_dict || !py.as_utf8 || !py.decref
+		    || !py.err_clear)
+			return NULL;
+		py.run_string = dlsym(RTLD_DEFAULT, "PyRun_StringFlags");
+		if (!py.run_string)
+			return NULL;
+	}
+
+	int state = py.gil_ensure();
+	char *frame = NULL;
+	PyObject *globals = py.module_dict(py.add_module("__main__"));
+	PyObject *value = py.run_string(frame_expression, Py_eval_input,
+	    globals, globals, NULL);
+	if (value) {
+		frame = acl_safe_strdup(py.as_utf8(value));
+		py.decref(value);
+	} else
+		py.err_clear();	// E.g. no process is running
+	py.gil_release(state);
+	if (!frame)
+		return NULL;
+
+	// Lines of the frame, arguments, and locals
+	char *lines[MAX_TABLES];
+	int n = 0;
+	for (char *p = strtok(frame, "\n"); p && n < MAX_TABLES;
+	    p = strtok(NULL, "\n"))
+		if (*p)
+			lines[n++] = p;
+	char *result = compress_items(config, "Current debugger frame:\n", lines,
+	    lines, n);
+	free(frame);
+	return result;
+}
+
+static int
+gdb_budget(config_t *config)
+{
+	return 0;
+}
+
+const provider_t acl_gdb_frame_provider = {
+	"frame", "gdb", gdb_key, gdb_compute, gdb_budget
+};
@@ -0,0 +1,125 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test program-specific context providers.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "config.h"
+#include "context.h"
+
+static const char database_file[] = "test-context.db";
+static const char fifo_file[] = "test-context.fifo";
+
+static void
+test_compress_items(CuTest* tc)
+{
+	config_t config = {"sqlite3"};
+	char *full[] = {"t1(a INTEGER, b TEXT)", "t2(c REAL)"};
+	char *brief[] = {"t1(a, b)", "t2(c)"};
+	char *s;
+
+	s = compress_items(&config, "T:\n", full, brief, 2);
+	CuAssertStrEquals(tc, "T:\nt1(a INTEGER, b TEXT)\nt2(c REAL)\n", s);
+	free(s);
+
+	// Brief descriptions are used when the full ones do not fit
+	config.context_tokens = 5;
+	config.context_tokens_set = true;
+	s = compress_items(&config, "T:\n", full, brief, 2);
+	CuAssertStrEquals(tc, "T:\nt1(a, b)\nt2(c)\n", s);
+	free(s);
+
+	// Descriptions that do not fit are left out
+	config.context_tokens = 3;
+	s = compress_items(&config, "T:\n", full, brief, 2);
+	CuAssertStrEquals(tc, "T:\nt1(a, b)\n(1 more)\n", s);
+	free(s);
+}
+
+static void
+test_psql_ddl(CuTest* tc)
+{
+	CuAssertTrue(tc, psql_ddl("CREATE TABLE t (a int);"));
+	CuAssertTrue(tc, psql_ddl("  alter table t add b int"));
+	CuAssertTrue(tc, psql_ddl("select 1; Drop table t;"));
+	CuAssertTrue(tc, psql_ddl("\\i schema.sql"));
+	CuAssertTrue(tc, psql_ddl("\\ir schema.sql"));
+	// Keywords must be whole words starting a statement
+	CuAssertTrue(tc, !psql_ddl("SELECT created_at FROM t"));
+	CuAssertTrue(tc, !psql_ddl("select * from t where s = 'alter; drop'"));
+	CuAssertTrue(tc, !psql_ddl("created_at"));
+	CuAssertTrue(tc, !psql_ddl("\\d created"));
+	CuAssertTrue(tc, !psql_ddl(""));
+}
+
+static void
+test_sqlite_database(CuTest* tc)
+{
+#if defined(__linux__)
+	char *path;
+
+	path = sqlite_database();
+	CuAssertTrue(tc, path == NULL);
+
+	FILE *f = fopen(database_file, "w");
+	fwrite("SQLite format 3", 1, 16, f);
+	fclose(f);
+	int fd = open(database_file, O_RDONLY);
+	path = sqlite_database();
+	CuAssertTrue(tc, path != NULL);
+	CuAssertTrue(tc, strstr(path, database_file) != NULL);
+	free(path);
+
+	close(fd);
+	unlink(database_file);
+
+	// An interactive program's input isn't read
+	CuAssertTrue(tc, mkfifo(fifo_file, 0600) == 0);
+	fd = open(fifo_file, O_RDWR);
+	CuAssertIntEquals(tc, 16, write(fd, "SQLite format 3", 16));
+	int saved = dup(STDIN_FILENO);
+	dup2(fd, STDIN_FILENO);
+	path = sqlite_database();
+	dup2(saved, STDIN_FILENO);
+	close(saved);
+	char input[16];
+	CuAssertIntEquals(tc, 16, read(fd, input, sizeof(input)));
+	close(fd);
+	unlink(fifo_file);
+	CuAssertTrue(tc, path == NULL);
+#endif
+}
+
+CuSuite*
+cu_context_program_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_compress_items);
+	SUITE_ADD_TEST(suite, test_psql_ddl);
+	SUITE_ADD_TEST(suite, test_sqlite_database);
+
+	return suite;
+}
@@ -0,0 +1,188 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test environment context gathering.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "config.h"
+#include "context.h"
+
+static const char test_dir[] = "test-context.d";
+
+// Create an empty file
+static void
+touch(const char *name)
+{
+	FILE *f = fopen(name, "w");
+
+	if (f)
+		fclose(f);
+}
+
+static void
+remove_test_dir(void)
+{
+	char path[PATH_MAX];
+	const char *names[] = {"a.c", "b.c", "c.c", NULL};
+
+	for (const char **n = names; *n; n++) {
+		snprintf(path, sizeof(path), "%s/%s", test_dir, *n);
+		unlink(path);
+	}
+	rmdir(test_dir);
+}
+
+static void
+test_providers(CuTest* tc)
+{
+	config_t config = {"bash"};
+	char cwd[PATH_MAX];
+
+	// No context unless configured
+	CuAssertTrue(tc, acl_context_get(&config) == NULL);
+
+	remove_test_dir();
+	mkdir(test_dir, 0700);
+	CuAssertTrue(tc, getcwd(cwd, sizeof(cwd)) != NULL);
+	CuAssertTrue(tc, chdir(test_dir) == 0);
+	touch("b.c");
+	touch("a.c");
+
+	config.context_providers = "cwd,ls";
+	config.context_providers_set = true;
+	config.context_ls_budget = 5000;
+	config.context_ls_budget_set = true;
+	config.context_ls_entries = 1;
+	config.context_ls_entries_set = true;
+	char *context = acl_context_get(&config);
+	CuAssertTrue(tc, context != NULL);
+	CuAssertTrue(tc, strstr(context, "Current directory: ") != NULL);
+	CuAssertTrue(tc, strstr(context, "Directory contents: a.c (1 more entries)\n") != NULL);
+	free(context);
+
+	// Changes in the directory are reflected
+	touch("c.c");
+	config.context_ls_entries = 3;
+	context = acl_context_get(&config);
+	CuAssertTrue(tc, strstr(context, "Directory contents: a.c b.c c.c\n") != NULL);
+	free(context);
+
+	CuAssertTrue(tc, chdir(cwd) == 0);
+	remove_test_dir();
+}
+
+static void
+test_git_key(CuTest* tc)
+{
+	config_t config = {"bash"};
+	char cwd[PATH_MAX];
+
+	remove_test_dir();
+	mkdir(test_dir, 0700);
+	CuAssertTrue(tc, getcwd(cwd, sizeof(cwd)) != NULL);
+	CuAssertTrue(tc, chdir(test_dir) == 0);
+
+	// A worktree, whose .git file points to the repository's directory
+	mkdir("repo.git", 0700);
+	FILE *f = fopen(".git", "w");
+	CuAssertTrue(tc, f != NULL);
+	fputs("gitdir: repo.git\n", f);
+	fclose(f);
+	CuAssertTrue(tc, git_key(&config, ".") == NULL);
+	touch("repo.git/HEAD");
+	touch("repo.git/index");
+	char *key = git_key(&config, ".");
+	CuAssertTrue(tc, key != NULL);
+	CuAssertTrue(tc, strstr(key, "repo.git/index") != NULL);
+
+	// Updating the index changes the key
+	struct timespec times[2] = {{0, UTIME_OMIT}, {1, 0}};
+	CuAssertTrue(tc, utimensat(AT_FDCWD, "repo.git/index", times, 0) == 0);
+	char *new_key = git_key(&config, ".");
+	CuAssertTrue(tc, new_key != NULL);
+	CuAssertTrue(tc, strcmp(key, new_key) != 0);
+	free(key);
+	free(new_key);
+
+	unlink("repo.git/HEAD");
+	unlink("repo.git/index");
+	rmdir("repo.git");
+	unlink(".git");
+	CuAssertTrue(tc, chdir(cwd) == 0);
+	remove_test_dir();
+}
+
+// Reap terminated children, as Bash's SIGCHLD handler does
+static void
+reap(int sig)
+{
+	while (waitpid(-1, NULL, WNOHANG) > 0)
+		;
+}
+
+static void
+test_command_output(CuTest* tc)
+{
+	char *echo[] = {"echo", "a", "b c", NULL};
+	char *seq[] = {"seq", "5", NULL};
+	char *fail[] = {"false", NULL};
+	char *missing[] = {"nonexistent-command", NULL};
+	char *s;
+
+	s = command_output(echo, 10);
+	CuAssertStrEquals(tc, "a b c\n", s);
+	free(s);
+	s = command_output(seq, 2);
+	CuAssertStrEquals(tc, "1\n2\n(3 more lines)\n", s);
+	free(s);
+	CuAssertTrue(tc, command_output(fail, 10) == NULL);
+	CuAssertTrue(tc, command_output(missing, 10) == NULL);
+
+	// The exit status is obtained when the host reaps the command
+	struct sigaction sa = {.sa_handler = reap}, old;
+	sigaction(SIGCHLD, &sa, &old);
+	for (int i = 0; i < 10; i++) {
+		s = command_output(echo, 10);
+		CuAssertStrEquals(tc, "a b c\n", s);
+		free(s);
+		CuAssertTrue(tc, command_output(fail, 10) == NULL);
+	}
+	sigaction(SIGCHLD, &old, NULL);
+}
+
+CuSuite*
+cu_context_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_providers);
+	SUITE_ADD_TEST(suite, test_command_output);
+	SUITE_ADD_TEST(suite, test_git_key);
+
+	return suite;
+}
@@ -0,0 +1,875 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Diagnose the latency of queries: time the loading of the library and
+ *  its configuration, and the connection phases and the first response
+ *  byte of each configured backend's endpoint, size the request, and
+ *  suggest settings to change.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <curl/curl.h>
+#include <readline/history.h>
+
+#include "config.h"
+#include "doctor.h"
+#include "support.h"
+#include "unit_test.h"
+
+// Tokens generated by the probing requests
+#define PROBE_TOKENS 16
+
+// Thresholds beyond which settings are suggested
+#define SLOW_DNS_MS 50
+#define SLOW_CONFIG_MS 20
+#define SLOW_LIBRARY_MS 100
+#define SLOW_CONTEXT_MS 100
+#define SLOW_FIRST_BYTE_MS 1000
+#define LARGE_SYSTEM_BYTES 1000
+#define LARGE_NSHOT_BYTES 500
+#define LARGE_HISTORY_ENTRIES 10
+#define LARGE_CONTEXT_BYTES 4000
+
+/*
+ * Parse the specified endpoint URL into t.
+ * Supported are http[s]://host[:port][/path] and
+ * unix:socket-path[:/path] URLs.
+ * Return false if the URL isn't supported.
+ */
+STATIC bool
+target_parse(const char *url, target_t *t)
+{
+	memset(t, 0, sizeof(*t));
+
+	if (strncmp(url, "unix:", 5) == 0) {
+		const char *socket = url + 5;
+		const char *path = strstr(socket, ":/");
+		size_t len = path ? (size_t)(path - socket) : strlen(socket);
+		if (len == 0 || len >= sizeof(t->socket))
+			return false;
+		memcpy(t->socket, socket, len);
+		strcpy(t->host, "localhost");
+		snprintf(t->path, sizeof(t->path), "%s", path ? path + 1 : "/");
+		t->local = true;
+		return true;
+	}
+
+	const char *host;
+	if (strncmp(url, "http://", 7) == 0)
+		host = url + 7;
+	else if (strncmp(url, "https://", 8) == 0) {
+		host = url + 8;
+		t->tls = true;
+	} else
+		return false;
+
+	// Skip any user information; end at the port or the path
+	size_t len = strcspn(host, "/?#");
+	const char *at = memchr(host, '@', len);
+	if (at) {
+		len -= at + 1 - host;
+		host = at + 1;
+	}
+	if (*host == '[') {
+		const char *close = memchr(host, ']', len);
+		if (!close)
+			return false;
+		host++;
+		len = close - host;
+	} else {
+		const char *colon = memchr(host, ':', len);
+		if (colon)
+			len = colon - host;
+	}
+	if (len == 0 || len >= sizeof(t->host))
+		return false;
+	memcpy(t->host, host, len);
+
+	struct in_addr a4;
+	struct in6_addr a6;
+	t->ipv4_address = inet_pton(AF_INET, t->host, &a4) == 1;
+	t->ipv6_address = inet_pton(AF_INET6, t->host, &a6) == 1;
+	t->local = strcmp(t->host, "localhost") == 0
+	    || (t->ipv4_address && (ntohl(a4.s_addr) >> 24) == 127)
+	    || (t->ipv6_address && IN6_IS_ADDR_LOOPBACK(&a6));
+	return true;
+}
+
+// Write the string s to f as a JSON string
+static void
+json_put(FILE *f, const char *s)
+{
+	putc('"', f);
+	for (; *s; s++)
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < ' ')
+			fprintf(f, "\\u%04x", *s);
+		else
+			putc(*s, f);
+	putc('"', f);
+}
+
+/*
+ * Return an allocated streamed request of a few tokens for the prompt
+ * in the format of the specified API.
+ * Return NULL if the API isn't served over HTTP.
+ */
+STATIC char *
+probe_body(const config_t *config, const char *api, const char *prompt)
+{
+	const char *model;
+	char *body;
+	size_t size;
+
+	if (strcmp(api, "openai") == 0)
+		model = config->openai_model;
+	else if (strcmp(api, "anthropic") == 0)
+		model = config->anthropic_model;
+	else if (strcmp(api, "ollama") == 0)
+		model = config->ollama_model;
+	else if (strcmp(api, "llamacpp") == 0)
+		model = NULL;
+	else
+		return NULL;
+
+	FILE *f = open_memstream(&body, &size);
+	if (!f)
+		return NULL;
+	fputs("{\"stream\":true,", f);
+	if (model) {
+		fputs("\"model\":", f);
+		json_put(f, model);
+		putc(',', f);
+	}
+	if (strcmp(api, "llamacpp") == 0) {
+		fprintf(f, "\"n_predict\":%d,\"prompt\":", PROBE_TOKENS);
+		json_put(f, prompt);
+	} else {
+		if (strcmp(api, "ollama") == 0)
+			fprintf(f, "\"options\":{\"num_predict\":%d},",
+			    PROBE_TOKENS);
+		else
+			fprintf(f, "\"max_tokens\":%d,", PROBE_TOKENS);
+		fputs("\"messages\":[{\"role\":\"user\",\"content\":", f);
+		json_put(f, prompt);
+		fputs("}]", f);
+	}
+	fputs("}", f);
+	fclose(f);
+	return body;
+}
+
+/*
+ * Return the number of bytes of the last n lines of the specified
+ * history file, and set entries to their number.
+ */
+STATIC size_t
+history_tail(const char *path, int n, int *entries)
+{
+	FILE *f = fopen(path, "r");
+	size_t *len = calloc(n > 0 ? n : 1, sizeof(size_t));
+	char *line = NULL;
+	size_t allocated = 0, total = 0;
+	ssize_t read;
+	int count = 0;
+
+	*entries = 0;
+	if (!f || !len || n <= 0) {
+		if (f)
+			fclose(f);
+		free(len);
+		return 0;
+	}
+	// Keep the length of the last n lines in a circular buffer
+	while ((read = getline(&line, &allocated, f)) != -1) {
+		// Skip the timestamps bash can record
+		if (line[0] == '#' && line[1] >= '0' && line[1] <= '9')
+			continue;
+		len[count++ % n] = line[read - 1] == '\n' ? read - 1 : read;
+	}
+	*entries = count < n ? count : n;
+	for (int i = 0; i < *entries; i++)
+		total += len[i];
+	free(line);
+	free(len);
+	fclose(f);
+	return total;
+}
+
+// Append to f the suggestion formatted by fmt
+static void
+advise(FILE *f, int *count, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	fputs("* ", f);
+	vfprintf(f, fmt, args);
+	fputc('\n', f);
+	va_end(args);
+	(*count)++;
+}
+
+// Return the successful timing of p with the earliest first byte
+static const timing_t *
+fastest(const probe_t *p)
+{
+	const timing_t *best = NULL;
+
+	for (int i = 0; i < NFAMILIES; i++)
+		for (int j = 0; j < NVERSIONS; j++) {
+			const timing_t *t = &p->timing[i][j];
+			if (t->ok && (!best || t->first_byte < best->first_byte))
+				best = t;
+		}
+	return best;
+}
+
+// Return the error of the first failed timing of p
+static const char *
+first_error(const probe_t *p)
+{
+	for (int i = 0; i < NFAMILIES; i++)
+		for (int j = 0; j < NVERSIONS; j++)
+			if (p->timing[i][j].tried && !p->timing[i][j].ok)
+				return p->timing[i][j].error;
+	return "unknown error";
+}
+
+// Write to f suggestions about the endpoint probed in p
+static void
+suggest_probe(const config_t *config, const diagnosis_t *d,
+    const probe_t *p, FILE *f, int *count)
+{
+	const target_t *t = &p->target;
+	const timing_t *best = fastest(p);
+
+	if (p->query_cold < 0 && p->query_warm < 0 && !p->url)
+		advise(f, count, "Queries through the %s backend fail; "
+		    "set verbose = true in [general] to see why.", p->api);
+	if (!p->url)
+		return;
+	if (!best) {
+		advise(f, count, "The %s endpoint %s cannot be reached (%s); "
+		    "check the endpoint in [%s].", p->api, p->url,
+		    first_error(p), p->api);
+		return;
+	}
+
+	if (best->dns > SLOW_DNS_MS)
+		advise(f, count, "Resolving %s takes %.0f ms; use a caching "
+		    "name resolver, or an address in the [%s] endpoint.",
+		    t->host, best->dns, p->api);
+
+	const timing_t *v4 = &p->timing[FAMILY_IPV4][VERSION_HTTP1];
+	const timing_t *v6 = &p->timing[FAMILY_IPV6][VERSION_HTTP1];
+	if (v4->ok && v6->tried && !v6->ok)
+		advise(f, count, "IPv6 connections to %s fail, which can delay "
+		    "connecting; fix the IPv6 route or use an IPv4 address in "
+		    "the [%s] endpoint.", t->host, p->api);
+	else if (v4->ok && v6->ok && v6->connect - v6->dns >
+	    1.5 * (v4->connect - v4->dns) + 5)
+		advise(f, count, "IPv4 connects to %s faster than IPv6 "
+		    "(%.0f vs %.0f ms); use an IPv4 address in the [%s] "
+		    "endpoint.", t->host, v4->connect - v4->dns,
+		    v6->connect - v6->dns, p->api);
+
+	if (t->tls && !d->http2_supported)
+		advise(f, count, "The installed libcurl lacks HTTP/2 support, "
+		    "which %s may offer; install a libcurl built with nghttp2.",
+		    t->host);
+
+	if (t->local && (strcmp(p->api, "llamacpp") == 0
+	    || strcmp(p->api, "ollama") == 0)
+	    && config->general_builtin_http_set && !config->general_builtin_http)
+		advise(f, count, "Set builtin_http = true in [general] to reach "
+		    "the local %s server without libcurl.", p->api);
+
+	double slo = config->router_slo_set ? config->router_slo :
+	    SLOW_FIRST_BYTE_MS;
+	double first = best->warm_first_byte > 0 ? best->warm_first_byte :
+	    best->first_byte;
+	if (first > slo)
+		advise(f, count, "The first byte of %s responses arrives after "
+		    "%.0f ms; configure a faster model in [%s], or list a "
+		    "faster backend first in the [router] tiers.", p->api, first,
+		    p->api);
+
+	if (p->query_cold < 0)
+		advise(f, count, "Queries through the %s backend fail, although "
+		    "its endpoint responds; check the key and model in [%s].",
+		    p->api, p->api);
+}
+
+/*
+ * Write to f the settings suggested by the diagnosis d of the
+ * specified configuration.
+ * Return the number of suggestions.
+ */
+STATIC int
+suggest(const config_t *config, const diagnosis_t *d, FILE *f)
+{
+	int count = 0;
+
+	if (d->library_ms > SLOW_LIBRARY_MS)
+		advise(f, &count, "Loading the library takes %.0f ms, which "
+		    "delays each program's startup; check the backends listed "
+		    "in the [general] api and the [router] tiers.",
+		    d->library_ms);
+	if (d->config_ms > SLOW_CONFIG_MS)
+		advise(f, &count, "Reading the configuration takes %.0f ms; "
+		    "check for large configuration files or ones on slow "
+		    "file systems.", d->config_ms);
+
+	if (d->system_bytes > LARGE_SYSTEM_BYTES)
+		advise(f, &count, "The system prompt has %zu bytes; shorten "
+		    "the system entry of [prompt].", d->system_bytes);
+	if (d->nshot_bytes > LARGE_NSHOT_BYTES &&
+	    d->nshot_bytes > d->system_bytes)
+		advise(f, &count, "The %d n-shot prompt pairs have %zu bytes; "
+		    "remove some user-N and assistant-N entries of "
+		    "[prompt-%s].", d->nshot_pairs, d->nshot_bytes,
+		    config->program_name);
+	if (config->prompt_context > LARGE_HISTORY_ENTRIES)
+		advise(f, &count, "Lower the context entry of [prompt] from %d "
+		    "to supply fewer history commands.",
+		    config->prompt_context);
+	if (d->context_ms > SLOW_CONTEXT_MS)
+		advise(f, &count, "Gathering the environment context takes "
+		    "%.0f ms; lower the budgets in [context] or remove slow "
+		    "providers.", d->context_ms);
+	if (d->context_bytes > LARGE_CONTEXT_BYTES)
+		advise(f, &count, "The environment context has %zu bytes; "
+		    "lower the tokens or ls_entries of [context].",
+		    d->context_bytes);
+
+	for (int i = 0; i < d->nprobes; i++)
+		suggest_probe(config, d, &d->probe[i], f, &count);
+	return count;
+}
+
+#if !defined(UNIT_TEST)
+
+static const char *version_name[] = {"HTTP/1.1", "HTTP/2"};
+static const char *family_name[] = {"IPv4", "IPv6"};
+
+// Options
+static const char *prompt = "list files";
+static long timeout_ms = 15000;
+
+// Functions of the library
+static void (*read_config)(config_t *);
+static fetch_t (*backend_load)(config_t *, const char *);
+static char *(*system_role_get)(config_t *);
+static char *(*context_get)(config_t *);
+
+static double
+now_ms(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+// Discard the response data
+static size_t
+discard(void *data, size_t size, size_t nmemb, void *arg)
+{
+	return size * nmemb;
+}
+
+// Return the elapsed time in ms of the specified curl timing
+static double
+curl_ms(CURL *curl, CURLINFO info)
+{
+	curl_off_t us = 0;
+
+	curl_easy_getinfo(curl, info, &us);
+	return us / 1e3;
+}
+
+/*
+ * Post the probing request to the endpoint of p through the specified
+ * address family and HTTP version, recording the timings in t.
+ * The request is repeated over the established connection.
+ */
+static void
+probe_variant(const config_t *config, probe_t *p, int family, int version,
+    timing_t *t)
+{
+	const target_t *target = &p->target;
+
+	t->tried = true;
+	if ((family == FAMILY_IPV4 && target->ipv6_address)
+	    || (family == FAMILY_IPV6 && target->ipv4_address)) {
+		t->tried = false;
+		return;
+	}
+
+	char *body = probe_body(config, p->api, prompt);
+	struct curl_slist *headers = curl_slist_append(NULL,
+	    "Content-Type: application/json");
+	char *header = NULL;
+	if (strcmp(p->api, "openai") == 0 && config->openai_key) {
+		asprintf(&header, "Authorization: Bearer %s", config->openai_key);
+		headers = curl_slist_append(headers, header);
+	} else if (strcmp(p->api, "anthropic") == 0) {
+		if (config->anthropic_key) {
+			asprintf(&header, "x-api-key: %s", config->anthropic_key);
+			headers = curl_slist_append(headers, header);
+			free(header);
+		}
+		asprintf(&header, "anthropic-version: %s",
+		    config->anthropic_version ? config->anthropic_version :
+		    "2023-06-01");
+		headers = curl_slist_append(headers, header);
+	}
+	free(header);
+
+	CURL *curl = curl_easy_init();
+	if (*target->socket) {
+		char *url;
+		asprintf(&url, "http://localhost%s", target->path);
+		curl_easy_setopt(curl, CURLOPT_URL, url);
+		curl_easy_setopt(curl, CURLOPT_UNIX_SOCKET_PATH, target->socket);
+		free(url);
+	} else {
+		curl_easy_setopt(curl, CURLOPT_URL, p->url);
+		curl_easy_setopt(curl, CURLOPT_IPRESOLVE, family == FAMILY_IPV4 ?
+		    CURL_IPRESOLVE_V4 : CURL_IPRESOLVE_V6);
+	}
+	// HTTP/2 is negotiated; the reported version shows the outcome
+	curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, version == VERSION_HTTP1 ?
+	    CURL_HTTP_VERSION_1_1 : target->tls ? CURL_HTTP_VERSION_2TLS :
+	    CURL_HTTP_VERSION_2_0);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout_ms);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+	for (int warm = 0; warm < 2; warm++) {
+		CURLcode res = curl_easy_perform(curl);
+		long status = 0;
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+		if (res != CURLE_OK || status != 200) {
+			snprintf(t->error, sizeof(t->error), "%s",
+			    res != CURLE_OK ? curl_easy_strerror(res) :
+			    "HTTP status");
+			if (res == CURLE_OK)
+				snprintf(t->error, sizeof(t->error),
+				    "HTTP status %ld", status);
+			t->ok = false;
+			break;
+		}
+		if (warm) {
+			t->warm_first_byte = curl_ms(curl,
+			    CURLINFO_STARTTRANSFER_TIME_T);
+			break;
+		}
+		t->ok = true;
+		t->dns = curl_ms(curl, CURLINFO_NAMELOOKUP_TIME_T);
+		t->connect = curl_ms(curl, CURLINFO_CONNECT_TIME_T);
+		t->tls = curl_ms(curl, CURLINFO_APPCONNECT_TIME_T);
+		t->first_byte = curl_ms(curl, CURLINFO_STARTTRANSFER_TIME_T);
+		t->total = curl_ms(curl, CURLINFO_TOTAL_TIME_T);
+		curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &t->version);
+	}
+	curl_easy_cleanup(curl);
+	curl_slist_free_all(headers);
+	free(body);
+}
+
+// Probe the endpoint of p through all address families and HTTP versions
+static void
+probe_endpoint(const config_t *config, diagnosis_t *d, probe_t *p)
+{
+	if (!target_parse(p->url, &p->target)) {
+		snprintf(p->timing[0][0].error, sizeof(p->timing[0][0].error),
+		    "unsupported URL");
+		p->timing[0][0].tried = true;
+		return;
+	}
+	// Unix-domain sockets have no address family
+	int families = *p->target.socket ? 1 : NFAMILIES;
+	for (int i = 0; i < families; i++)
+		for (int j = 0; j < NVERSIONS; j++) {
+			timing_t *t = &p->timing[i][j];
+			if (j == VERSION_HTTP2 && !d->http2_supported) {
+				t->tried = true;
+				snprintf(t->error, sizeof(t->error),
+				    "not supported by libcurl");
+				continue;
+			}
+			probe_variant(config, p, i, j, t);
+		}
+}
+
+// Time two queries made through the library's backend for p's API
+static void
+query(config_t *config, probe_t *p)
+{
+	p->query_cold = p->query_warm = -1;
+	fetch_t fetch = backend_load(config, p->api);
+	if (!fetch)
+		return;
+	for (int i = 0; i < 2; i++) {
+		double start = now_ms();
+		char *response = fetch(config, prompt, 0);
+		if (!response)
+			return;
+		free(response);
+		*(i ? &p->query_warm : &p->query_cold) = now_ms() - start;
+	}
+}
+
+// Return the configured endpoint list of the specified API or NULL
+static const char *
+api_endpoints(const config_t *config, const char *api)
+{
+	if (strcmp(api, "openai") == 0)
+		return config->openai_endpoint;
+	if (strcmp(api, "anthropic") == 0)
+		return config->anthropic_endpoint;
+	if (strcmp(api, "llamacpp") == 0)
+		return config->llamacpp_endpoint;
+	if (strcmp(api, "ollama") == 0)
+		return config->ollama_endpoint;
+	return NULL;
+}
+
+// Add probes for each endpoint of the specified API, if not already added
+static void
+add_api(config_t *config, diagnosis_t *d, const char *api)
+{
+	for (int i = 0; i < d->nprobes; i++)
+		if (strcmp(d->probe[i].api, api) == 0)
+			return;
+
+	int first = d->nprobes;
+	const char *endpoints = api_endpoints(config, api);
+	char *list = strdup(endpoints ? endpoints : "");
+	char *saveptr;
+	for (char *url = strtok_r(list, ", \t", &saveptr); url;
+	    url = strtok_r(NULL, ", \t", &saveptr)) {
+		if (d->nprobes == MAX_PROBES)
+			break;
+		probe_t *p = &d->probe[d->nprobes++];
+		p->api = strdup(api);
+		p->url = strdup(url);
+		p->query_cold = p->query_warm = -1;
+		probe_endpoint(config, d, p);
+	}
+	free(list);
+
+	// Backends without endpoints are only queried
+	if (first == d->nprobes && d->nprobes < MAX_PROBES) {
+		probe_t *p = &d->probe[d->nprobes++];
+		p->api = strdup(api);
+	}
+	query(config, &d->probe[first]);
+}
+
+// Add the APIs listed in the specified string
+static void
+add_apis(config_t *config, diagnosis_t *d, const char *apis)
+{
+	char *list = strdup(apis);
+	char *saveptr;
+
+	for (char *api = strtok_r(list, ", \t", &saveptr); api;
+	    api = strtok_r(NULL, ", \t", &saveptr)) {
+		// Routing tiers can specify a model after the API
+		char *colon = strchr(api, ':');
+		if (colon)
+			*colon = '\0';
+		add_api(config, d, api);
+	}
+	free(list);
+}
+
+// Return the history file of the specified program
+static char *
+history_file(const char *program)
+{
+	static const struct {
+		const char *program;
+		const char *file;
+	} files[] = {
+		{"bash", ".bash_history"},
+		{"gdb", ".gdb_history"},
+		{"mysql", ".mysql_history"},
+		{"psql", ".psql_history"},
+		{"python3", ".python_history"},
+		{"sqlite3", ".sqlite_history"},
+	};
+	const char *home = getenv("HOME");
+	const char *name = ".history";
+	char *path;
+
+	if (strcmp(program, "bash") == 0 && getenv("HISTFILE"))
+		return strdup(getenv("HISTFILE"));
+	for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+		if (strcmp(program, files[i].program) == 0)
+			name = files[i].file;
+	asprintf(&path, "%s/%s", home ? home : ".", name);
+	return path;
+}
+
+// Measure the parts of the request sent for a query
+static void
+request_size(config_t *config, diagnosis_t *d)
+{
+	char *system_role = system_role_get(config);
+	d->system_bytes = strlen(system_role);
+	free(system_role);
+
+	for (int i = 0; i < NPROMPTS; i++) {
+		if (config->prompt_user[i])
+			d->nshot_bytes += strlen(config->prompt_user[i]);
+		if (config->prompt_assistant[i])
+			d->nshot_bytes += strlen(config->prompt_assistant[i]);
+		if (config->prompt_user[i] && config->prompt_assistant[i])
+			d->nshot_pairs++;
+	}
+
+	char *history = history_file(config->program_name);
+	d->history_bytes = history_tail(history, config->prompt_context,
+	    &d->history_entries);
+	free(history);
+
+	double start = now_ms();
+	char *context = context_get(config);
+	d->context_ms = now_ms() - start;
+	d->context_bytes = context ? strlen(context) : 0;
+	free(context);
+}
+
+/*
+ * Return the path of the library: the one next to this program
+ * when run from the build directory, or the installed one.
+ */
+static char *
+library_path(const char *argv0)
+{
+	static char path[PATH_MAX + 64];
+	char exe[PATH_MAX];
+
+#if defined(__linux__)
+	ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+	if (n > 0)
+		exe[n] = '\0';
+	else
+#endif
+		snprintf(exe, sizeof(exe), "%s", argv0);
+	char *slash = strrchr(exe, '/');
+	const char *dir = ".";
+	if (slash) {
+		*slash = '\0';
+		dir = exe;
+	}
+	snprintf(path, sizeof(path), "%s/ai_cli." DLL_EXTENSION, dir);
+	if (access(path, F_OK) != 0)
+		snprintf(path, sizeof(path), "%s/../lib/ai_cli." DLL_EXTENSION,
+		    dir);
+	return path;
+}
+
+// Print a size in bytes and approximate tokens
+static void
+print_size(const char *name, size_t bytes)
+{
+	printf("  %-32s %8zu %8zu\n", name, bytes, (bytes + 3) / 4);
+}
+
+static void
+print_timing(const char *name, const timing_t *t)
+{
+	if (!t->tried)
+		printf("  %-16s not applicable\n", name);
+	else if (!t->ok)
+		printf("  %-16s failed: %s\n", name, t->error);
+	else {
+		printf("  %-16s %8.3f %8.3f ", name, t->dns, t->connect);
+		if (t->tls > 0)
+			printf("%8.3f", t->tls);
+		else
+			printf("%8s", "-");
+		printf(" %8.3f %8.3f %8.3f %5s\n", t->first_byte, t->total,
+		    t->warm_first_byte, t->version == CURL_HTTP_VERSION_2_0 ?
+		    "2" : "1.1");
+	}
+}
+
+static void
+report(const config_t *config, const char *library, const diagnosis_t *d)
+{
+	printf("Program: %s\nLibrary: %s\n", config->program_name, library);
+	printf("Library load with configuration and backends: %.3f ms\n",
+	    d->library_ms);
+	printf("Configuration load: %.3f ms\n\n", d->config_ms);
+
+	printf("Request size%33s %8s\n", "Bytes", "~Tokens");
+	print_size("System prompt", d->system_bytes);
+	char name[64];
+	snprintf(name, sizeof(name), "N-shot prompts (%d pairs)",
+	    d->nshot_pairs);
+	print_size(name, d->nshot_bytes);
+	snprintf(name, sizeof(name), "History context (%d of %d)",
+	    d->history_entries, config->prompt_context);
+	print_size(name, d->history_bytes);
+	print_size("Environment context", d->context_bytes);
+	print_size("Total", d->system_bytes + d->nshot_bytes +
+	    d->history_bytes + d->context_bytes);
+	printf("Environment context gathered in %.3f ms\n", d->context_ms);
+
+	for (int i = 0; i < d->nprobes; i++) {
+		const probe_t *p = &d->probe[i];
+		printf("\nBackend %s%s%s\n", p->api, p->url ? ": " : "",
+		    p->url ? p->url : "");
+		if (p->url) {
+			printf("  %-16s %8s %8s %8s %8s %8s %8s %5s\n",
+			    "Cumulative ms", "DNS", "Connect", "TLS", "1st byte",
+			    "Total", "Warm 1st", "HTTP");
+			int families = *p->target.socket ? 1 : NFAMILIES;
+			for (int j = 0; j < families; j++)
+				for (int k = 0; k < NVERSIONS; k++) {
+					snprintf(name, sizeof(name), "%s %s",
+					    *p->target.socket ? "Unix" :
+					    family_name[j], version_name[k]);
+					print_timing(name, &p->timing[j][k]);
+				}
+		}
+		if (p->query_cold >= 0)
+			printf("  Library queries: first %.3f ms, "
+			    "subsequent %.3f ms\n", p->query_cold, p->query_warm);
+		else if (i == 0 || strcmp(p->api, d->probe[i - 1].api) != 0)
+			printf("  Library queries failed\n");
+	}
+
+	printf("\nSuggestions\n");
+	if (suggest(config, d, stdout) == 0)
+		printf("No changes suggested.\n");
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-a api] [-l library] [-p prompt] "
+	    "[-t timeout] [-x program]\n", name);
+	exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static config_t config;
+	static diagnosis_t d;
+	const char *apis = NULL, *library = NULL, *program = "bash";
+	int c;
+
+	while ((c = getopt(argc, argv, "a:l:p:t:x:")) != -1)
+		switch (c) {
+		case 'a':
+			apis = optarg;
+			break;
+		case 'l':
+			library = optarg;
+			break;
+		case 'p':
+			prompt = optarg;
+			break;
+		case 't':
+			timeout_ms = atof(optarg) * 1000;
+			break;
+		case 'x':
+			program = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	if (optind != argc)
+		usage(argv[0]);
+	if (!library)
+		library = library_path(argv[0]);
+
+	// The library configures itself for the named readline program
+#if defined(MACOS)
+	setprogname(program);
+#else
+	program_invocation_short_name = (char *)program;
+#endif
+	using_history();
+
+	double start = now_ms();
+	// The backend modules bind to the library's global symbols
+	void *handle = dlopen(library, RTLD_LAZY | RTLD_GLOBAL);
+	d.library_ms = now_ms() - start;
+	if (!handle) {
+		fprintf(stderr, "%s\n", dlerror());
+		return 1;
+	}
+	read_config = dlsym(handle, "acl_read_config");
+	backend_load = dlsym(handle, "acl_backend_load");
+	system_role_get = dlsym(handle, "acl_system_role_get");
+	context_get = dlsym(handle, "acl_context_get");
+	if (!read_config || !backend_load || !system_role_get || !context_get) {
+		fprintf(stderr, "%s\n", dlerror());
+		return 1;
+	}
+
+	start = now_ms();
+	read_config(&config);
+	d.config_ms = now_ms() - start;
+	if (!config.prompt_system) {
+		fprintf(stderr, "No default ai-cli configuration loaded.  "
+		    "Installation problem?\n");
+		return 1;
+	}
+
+	request_size(&config, &d);
+
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+	d.http2_supported = curl_version_info(CURLVERSION_NOW)->features &
+	    CURL_VERSION_HTTP2;
+	if (config.general_api_set)
+		add_apis(&config, &d, config.general_api);
+	if (config.router_tiers_set)
+		add_apis(&config, &d, config.router_tiers);
+	if (apis)
+		add_apis(&config, &d, apis);
+	if (d.nprobes == 0)
+		fprintf(stderr, "No backend configured in [general] api or "
+		    "specified with -a.\n");
+
+	report(&config, library, &d);
+	return 0;
+}
+#endif
@@ -0,0 +1,85 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Diagnose the latency of the configured backends
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "config.h"
+
+// Maximum number of endpoints probed
+#define MAX_PROBES 16
+
+// Parts of an endpoint URL that affect its connection
+typedef struct {
+	char host[256];		// Name or address; localhost for sockets
+	char socket[108];	// Unix-domain socket path
+	char path[256];		// Request path for Unix-domain sockets
+	bool tls;
+	bool local;		// On the loopback interface or a socket
+	bool ipv4_address;	// The host is an IPv4 address
+	bool ipv6_address;	// The host is an IPv6 address
+} target_t;
+
+// Address families and HTTP versions through which endpoints are probed
+enum family { FAMILY_IPV4, FAMILY_IPV6, NFAMILIES };
+enum version { VERSION_HTTP1, VERSION_HTTP2, NVERSIONS };
+
+// Times in ms from the start of a request
+typedef struct {
+	bool tried;
+	bool ok;
+	double dns, connect, tls, first_byte, total;
+	double warm_first_byte;	// Over the reused connection
+	long version;		// Negotiated CURL_HTTP_VERSION_* value
+	char error[128];	// Reason of the failure
+} timing_t;
+
+// Measurements of a backend's endpoint
+typedef struct {
+	const char *api;
+	const char *url;	// NULL for backends without an endpoint
+	target_t target;
+	timing_t timing[NFAMILIES][NVERSIONS];
+	// Queries through the library; negative if not made or failed
+	double query_cold, query_warm;
+} probe_t;
+
+// All measurements
+typedef struct {
+	double library_ms;	// Library load, including its configuration
+	double config_ms;
+	double context_ms;	// Gathering the environment context
+	size_t system_bytes, nshot_bytes, history_bytes, context_bytes;
+	int nshot_pairs, history_entries;
+	bool http2_supported;	// By the linked libcurl
+	probe_t probe[MAX_PROBES];
+	int nprobes;
+} diagnosis_t;
+
+#if defined(UNIT_TEST)
+bool target_parse(const char *url, target_t *t);
+char *probe_body(const config_t *config, const char *api,
+    const char *prompt);
+size_t history_tail(const char *path, int n, int *entries);
+int suggest(const config_t *config, const diagnosis_t *d, FILE *f);
+#endif
@@ -0,0 +1,199 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test the diagnosis of the configured backends' latency.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "doctor.h"
+
+static const char history_file[] = "test-doctor.history";
+
+static void
+test_target_parse(CuTest *tc)
+{
+	target_t t;
+
+	CuAssertTrue(tc, target_parse("https://api.openai.com/v1/chat", &t));
+	CuAssertStrEquals(tc, "api.openai.com", t.host);
+	CuAssertTrue(tc, t.tls);
+	CuAssertTrue(tc, !t.local);
+	CuAssertTrue(tc, !t.ipv4_address && !t.ipv6_address);
+
+	CuAssertTrue(tc, target_parse("http://127.0.0.1:8080/completion", &t));
+	CuAssertStrEquals(tc, "127.0.0.1", t.host);
+	CuAssertTrue(tc, !t.tls && t.local && t.ipv4_address);
+
+	CuAssertTrue(tc, target_parse("http://user@[::1]:11434/api/chat", &t));
+	CuAssertStrEquals(tc, "::1", t.host);
+	CuAssertTrue(tc, t.local && t.ipv6_address);
+
+	CuAssertTrue(tc, target_parse("http://localhost", &t));
+	CuAssertTrue(tc, t.local);
+	CuAssertTrue(tc, target_parse("http://10.0.0.1:8080", &t));
+	CuAssertTrue(tc, !t.local);
+
+	CuAssertTrue(tc, target_parse("unix:/run/llama.sock:/completion", &t));
+	CuAssertStrEquals(tc, "/run/llama.sock", t.socket);
+	CuAssertStrEquals(tc, "/completion", t.path);
+	CuAssertTrue(tc, t.local);
+	CuAssertTrue(tc, target_parse("unix:/run/llama.sock", &t));
+	CuAssertStrEquals(tc, "/", t.path);
+
+	CuAssertTrue(tc, !target_parse("ftp://example.com", &t));
+	CuAssertTrue(tc, !target_parse("http://", &t));
+	CuAssertTrue(tc, !target_parse("unix:", &t));
+}
+
+static void
+test_probe_body(CuTest *tc)
+{
+	config_t config = {
+		.openai_model = "gpt-4o",
+		.ollama_model = "llama3.2",
+	};
+	char *s;
+
+	s = probe_body(&config, "openai", "say \"hi\"");
+	CuAssertStrEquals(tc, "{\"stream\":true,\"model\":\"gpt-4o\","
+	    "\"max_tokens\":16,\"messages\":[{\"role\":\"user\","
+	    "\"content\":\"say \\\"hi\\\"\"}]}", s);
+	free(s);
+
+	s = probe_body(&config, "ollama", "ls");
+	CuAssertStrEquals(tc, "{\"stream\":true,\"model\":\"llama3.2\","
+	    "\"options\":{\"num_predict\":16},\"messages\":[{\"role\":\"user\","
+	    "\"content\":\"ls\"}]}", s);
+	free(s);
+
+	s = probe_body(&config, "llamacpp", "a\nb");
+	CuAssertStrEquals(tc, "{\"stream\":true,\"n_predict\":16,"
+	    "\"prompt\":\"a\\u000ab\"}", s);
+	free(s);
+
+	CuAssertPtrEquals(tc, NULL, probe_body(&config, "hal", "ls"));
+}
+
+static void
+test_history_tail(CuTest *tc)
+{
+	int entries;
+
+	FILE *f = fopen(history_file, "w");
+	fputs("#1712345678\nls\n#1712345679\nmake\ngit status\n", f);
+	fclose(f);
+
+	CuAssertIntEquals(tc, 14, history_tail(history_file, 2, &entries));
+	CuAssertIntEquals(tc, 2, entries);
+	CuAssertIntEquals(tc, 16, history_tail(history_file, 5, &entries));
+	CuAssertIntEquals(tc, 3, entries);
+	CuAssertIntEquals(tc, 0, history_tail(history_file, 0, &entries));
+	CuAssertIntEquals(tc, 0, entries);
+	unlink(history_file);
+
+	CuAssertIntEquals(tc, 0, history_tail(history_file, 3, &entries));
+	CuAssertIntEquals(tc, 0, entries);
+}
+
+// Return the suggestions for d as an allocated string
+static char *
+suggestions(const config_t *config, const diagnosis_t *d, int *count)
+{
+	char *s;
+	size_t size;
+
+	FILE *f = open_memstream(&s, &size);
+	*count = suggest(config, d, f);
+	fclose(f);
+	return s;
+}
+
+static void
+test_suggest(CuTest *tc)
+{
+	config_t config = {.program_name = "bash", .prompt_context = 3};
+	static diagnosis_t d;
+	int count;
+	char *s;
+
+	d.nprobes = 1;
+	d.probe[0].api = "llamacpp";
+	d.probe[0].url = "http://127.0.0.1:8080/completion";
+	target_parse(d.probe[0].url, &d.probe[0].target);
+	timing_t *t = &d.probe[0].timing[FAMILY_IPV4][VERSION_HTTP1];
+	*t = (timing_t){.tried = true, .ok = true, .dns = 0.1, .connect = 0.2,
+	    .first_byte = 20, .total = 30, .warm_first_byte = 10};
+	d.probe[0].query_cold = 40;
+	d.probe[0].query_warm = 20;
+
+	s = suggestions(&config, &d, &count);
+	CuAssertIntEquals(tc, 0, count);
+	CuAssertStrEquals(tc, "", s);
+	free(s);
+
+	// A slow, large request through a local server without the built-in client
+	config.general_builtin_http_set = true;
+	config.general_builtin_http = false;
+	config.prompt_context = 20;
+	t->warm_first_byte = 2000;
+	d.system_bytes = 400;
+	d.nshot_bytes = 900;
+	d.nshot_pairs = 3;
+	s = suggestions(&config, &d, &count);
+	CuAssertIntEquals(tc, 4, count);
+	CuAssertPtrNotNull(tc, strstr(s, "[prompt-bash]"));
+	CuAssertPtrNotNull(tc, strstr(s, "context entry of [prompt] from 20"));
+	CuAssertPtrNotNull(tc, strstr(s, "builtin_http = true"));
+	CuAssertPtrNotNull(tc, strstr(s, "[router] tiers"));
+	free(s);
+
+	// The SLO configures the acceptable latency
+	config.router_slo_set = true;
+	config.router_slo = 3000;
+	s = suggestions(&config, &d, &count);
+	CuAssertIntEquals(tc, 3, count);
+	free(s);
+
+	// An unreachable endpoint
+	config = (config_t){.program_name = "bash"};
+	d.nshot_bytes = 0;
+	*t = (timing_t){.tried = true, .error = "Connection refused"};
+	s = suggestions(&config, &d, &count);
+	CuAssertIntEquals(tc, 1, count);
+	CuAssertPtrNotNull(tc, strstr(s, "cannot be reached (Connection refused)"));
+	free(s);
+}
+
+CuSuite*
+cu_doctor_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_target_parse);
+	SUITE_ADD_TEST(suite, test_probe_body);
+	SUITE_ADD_TEST(suite, test_history_tail);
+	SUITE_ADD_TEST(suite, test_suggest);
+
+	return suite;
+}
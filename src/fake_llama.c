@@ -0,0 +1,178 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  A fake llama.cpp shim library for testing the in-process backend.
+ *  Each byte of the text is a token, and the model completes text
+ *  ending in "Assistant:" with a fixed command.
+ *  The number of evaluated tokens is counted, so that tests can
+ *  verify that the state of a cached prefix is reused.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+// The completion of the text ending in the cue
+static const char cue[] = "Assistant:";
+static const char reply[] = " ls -l\n";
+
+#define NVOCAB 256
+#define MAX_CTX 8192
+
+// Dummy handles returned to the caller
+static int model, context, vocab, memory;
+
+static int n_ctx;
+static bool (*abort_callback)(void *);
+static void *abort_data;
+static int32_t cache[MAX_CTX];	// Evaluated tokens
+static int ncache;
+static float logits[NVOCAB];
+
+// Number of tokens evaluated, and failures and delays to simulate
+int fake_llama_evaluated;
+bool fake_llama_fail;
+bool fake_llama_slow;
+
+void
+llama_backend_init(void)
+{
+}
+
+void *
+acl_llama_model_load(const char *path)
+{
+	return path ? &model : NULL;
+}
+
+void *
+acl_llama_context_new(void *m, uint32_t size, int32_t n_threads,
+    bool (*abort)(void *), void *data)
+{
+	if (size > MAX_CTX)
+		return NULL;
+	n_ctx = size;
+	ncache = 0;
+	abort_callback = abort;
+	abort_data = data;
+	return &context;
+}
+
+const void *
+llama_model_get_vocab(const void *m)
+{
+	return &vocab;
+}
+
+int32_t
+llama_vocab_n_tokens(const void *v)
+{
+	return NVOCAB;
+}
+
+int32_t
+llama_tokenize(const void *v, const char *text, int32_t len,
+    int32_t *tokens, int32_t n_max, bool add_special, bool parse_special)
+{
+	if (len > n_max)
+		return -len;
+	for (int i = 0; i < len; i++)
+		tokens[i] = (unsigned char)text[i];
+	return len;
+}
+
+int32_t
+llama_token_to_piece(const void *v, int32_t token, char *buf, int32_t len,
+    int32_t lstrip, bool special)
+{
+	if (len < 1)
+		return -1;
+	*buf = token;
+	return 1;
+}
+
+bool
+llama_vocab_is_eog(const void *v, int32_t token)
+{
+	return token == 0;
+}
+
+/*
+ * Evaluate the n specified tokens, setting the logits to favor the
+ * reply's character following the last cue.
+ */
+int32_t
+acl_llama_decode(void *c, int32_t *tokens, int32_t n)
+{
+	if (fake_llama_slow)
+		usleep(50000);
+	if (abort_callback && abort_callback(abort_data))
+		return 2;
+	if (fake_llama_fail || ncache + n > n_ctx)
+		return 1;
+	memcpy(cache + ncache, tokens, n * sizeof(int32_t));
+	ncache += n;
+	fake_llama_evaluated += n;
+
+	int len = strlen(cue);
+	int pos = ncache;
+	while (pos >= len) {
+		int i;
+		for (i = 0; i < len && cache[pos - len + i] == cue[i]; i++)
+			;
+		if (i == len)
+			break;
+		pos--;
+	}
+	int replied = ncache - pos;
+	memset(logits, 0, sizeof(logits));
+	if (pos >= len && replied < (int)strlen(reply))
+		logits[(unsigned char)reply[replied]] = 1;
+	return 0;
+}
+
+float *
+llama_get_logits_ith(void *c, int32_t i)
+{
+	return logits;
+}
+
+void *
+llama_get_memory(void *c)
+{
+	return &memory;
+}
+
+// Remove the cached tokens from position p0 onward
+bool
+llama_memory_seq_rm(void *m, int32_t seq, int32_t p0, int32_t p1)
+{
+	if (p0 < ncache)
+		ncache = p0;
+	return true;
+}
+
+void
+llama_free(void *c)
+{
+}
+
+void
+llama_model_free(void *m)
+{
+}
@@ -25,10 +25,15 @@
 #include <readline/history.h>
 #include <jansson.h>
 
+#include "backend.h"
 #include "config.h"
+#include "context.h"
+#include "log.h"
 #include "support.h"
+#include "trace.h"
 #include "fetch_anthropic.h"
 #include "unit_test.h"
+#include "usage.h"
 
 // HTTP headers
 static char *key_header;
@@ -51,6 +56,20 @@ anthropic_get_response_content(const char *json_response)
 		json_t *first_content = json_array_get(content, 0);
 		json_t *text = json_object_get(first_content, "text");
 		ret = acl_safe_strdup(json_string_value(text));
+
+		// Input tokens exclude those read from and written to the cache
+		json_t *usage = json_object_get(root, "usage");
+		usage_t u = {
+			.tokens_cached = json_integer_value(json_object_get(usage,
+			    "cache_read_input_tokens")),
+			.tokens_out = json_integer_value(json_object_get(usage,
+			    "output_tokens")),
+		};
+		u.tokens_in = json_integer_value(json_object_get(usage,
+		    "input_tokens")) + u.tokens_cached +
+		    json_integer_value(json_object_get(usage,
+		    "cache_creation_input_tokens"));
+		acl_usage_add(&u);
 	} else {
 		json_t *error = json_object_get(root, "error");
 		if (error) {
@@ -82,63 +101,51 @@ initialize(config_t *config)
 }
 
 /*
- * Fetch response from the anthropic API given the provided prompt.
- * Provide context in the form of n-shot prompts and history prompts.
+ * Build in request the JSON request for the provided prompt, with
+ * n-shot prompts, history prompts, and the shell environment as context.
+ * Return the length of its prefix that is the same across queries.
  */
-char *
-acl_fetch_anthropic(config_t *config, const char *prompt, int history_length)
+STATIC size_t
+anthropic_build_request(config_t *config, const char *prompt,
+    int history_length, string_t *request)
 {
-	CURLcode res;
-
-	if (!acl_curl && initialize(config) < 0)
-		return NULL;
-
-	if (config->general_verbose)
-		fprintf(stderr, "\nContacting Anthropic API...\n");
-
-	struct curl_slist *headers = NULL;
-	headers = curl_slist_append(headers, "content-type: application/json");
-	headers = curl_slist_append(headers, key_header);
-	headers = curl_slist_append(headers, version_header);
-
-	struct string json_response;
-	acl_string_init(&json_response, "");
+	acl_string_init(request, "{\n");
 
-	struct string json_request;
-	acl_string_init(&json_request, "{\n");
-
-	acl_string_appendf(&json_request, "  \"model\": %s,\n",
+	acl_string_appendf(request, "  \"model\": %s,\n",
 	    acl_json_escape(config->anthropic_model));
-	acl_string_appendf(&json_request, "  \"max_tokens\": %d,\n",
+	acl_string_appendf(request, "  \"max_tokens\": %d,\n",
 	    config->anthropic_max_tokens);
 
 	char *system_role = acl_system_role_get(config);
-	acl_string_appendf(&json_request, "  \"system\": %s,\n",
+	acl_string_appendf(request, "  \"system\": %s,\n",
 	    acl_json_escape(system_role));
 	free(system_role);
 
 	// Add configuration settings
 	if (config->anthropic_temperature_set)
-		acl_string_appendf(&json_request, "  \"temperature\": %g,\n", config->anthropic_temperature);
+		acl_string_appendf(request, "  \"temperature\": %g,\n", config->anthropic_temperature);
 	if (config->anthropic_top_k_set)
-		acl_string_appendf(&json_request, "  \"top_k\": %d,\n", config->anthropic_top_k);
+		acl_string_appendf(request, "  \"top_k\": %d,\n", config->anthropic_top_k);
 	if (config->anthropic_top_p_set)
-		acl_string_appendf(&json_request, "  \"top_p\": %g,\n", config->anthropic_top_p);
+		acl_string_appendf(request, "  \"top_p\": %g,\n", config->anthropic_top_p);
 
-	acl_string_append(&json_request, "  \"messages\": [\n");
+	acl_string_append(request, "  \"messages\": [\n");
 
 	// Add user and assistant n-shot prompts
 	for (int i = 0; i < NPROMPTS; i++) {
 		if (config->prompt_user[i])
-			acl_string_appendf(&json_request,
+			acl_string_appendf(request,
 			    "    {\"role\": \"user\", \"content\": %s},\n",
 			    acl_json_escape(config->prompt_user[i]));
 		if (config->prompt_assistant[i])
-			acl_string_appendf(&json_request,
+			acl_string_appendf(request,
 			    "    {\"role\": \"assistant\", \"content\": %s},\n",
 			    acl_json_escape(config->prompt_assistant[i]));
 	}
 
+	// The log records this static prefix once
+	size_t prefix_len = request->len;
+
 	// Add history prompts as context
 	bool context_explained = false;
 	for (int i = config->prompt_context - 1; i >= 0; --i) {
@@ -147,24 +154,73 @@ acl_fetch_anthropic(config_t *config, const char *prompt, int history_length)
 			continue;
 		if (!context_explained) {
 			context_explained = true;
-			acl_string_appendf(&json_request,
+			acl_string_appendf(request,
 			    "    {\"role\": \"user\", \"content\": \"Before my final prompt to which I expect a reply, I am also supplying you as context with one or more previously issued commands, to which you simply reply OK\"},\n");
-			acl_string_appendf(&json_request,
+			acl_string_appendf(request,
 			    "    {\"role\": \"assistant\", \"content\": \"OK\"},\n");
 		}
-		acl_string_appendf(&json_request,
+		acl_string_appendf(request,
 		    "    {\"role\": \"user\", \"content\": %s},\n",
 		    acl_json_escape(h->line));
-		acl_string_appendf(&json_request,
+		acl_string_appendf(request,
 		    "    {\"role\": \"assistant\", \"content\": \"OK\"},\n");
 	}
 
+	// Add the shell environment as context
+	double context_start = TRACE_NOW();
+	char *context = acl_context_get(config);
+	TRACE_SPAN("context", context_start);
+	if (context) {
+		char *content;
+		acl_safe_asprintf(&content, "This is my current environment, to which you simply reply OK.\n%s", context);
+		acl_string_appendf(request,
+		    "    {\"role\": \"user\", \"content\": %s},\n",
+		    acl_json_escape(content));
+		acl_string_appendf(request,
+		    "    {\"role\": \"assistant\", \"content\": \"OK\"},\n");
+		free(content);
+		free(context);
+	}
+
 	// Finally, add the user prompt
-	acl_string_appendf(&json_request,
+	acl_string_appendf(request,
 	    "    {\"role\": \"user\", \"content\": %s}\n", acl_json_escape(prompt));
-	acl_string_append(&json_request, "  ]\n}\n");
+	acl_string_append(request, "  ]\n}\n");
+	return prefix_len;
+}
 
-	acl_write_log(config, json_request.ptr);
+/*
+ * Fetch response from the anthropic API given the provided prompt.
+ * Provide context in the form of n-shot prompts and history prompts.
+ */
+char *
+acl_fetch_anthropic(config_t *config, const char *prompt, int history_length)
+{
+	CURLcode res;
+
+	if ((!key_header && initialize(config) < 0) || curl_initialize(config) < 0)
+		return NULL;
+
+	if (config->general_verbose)
+		fprintf(stderr, "\nContacting Anthropic API...\n");
+
+	double build_start = TRACE_NOW();
+
+	struct curl_slist *headers = NULL;
+	headers = curl_slist_append(headers, "content-type: application/json");
+	headers = curl_slist_append(headers, key_header);
+	headers = curl_slist_append(headers, version_header);
+
+	struct string json_response;
+	acl_string_init(&json_response, "");
+
+	struct string json_request;
+	size_t prefix_len = anthropic_build_request(config, prompt, history_length,
+	    &json_request);
+
+	acl_write_log_request(config, json_request.ptr, prefix_len);
+	TRACE_SPAN("build", build_start);
+	PROBE_REQUEST_BUILT("anthropic", json_request.ptr, build_start);
 
 	curl_easy_setopt(acl_curl, CURLOPT_URL, config->anthropic_endpoint);
 	curl_easy_setopt(acl_curl, CURLOPT_HTTPHEADER, headers);
@@ -172,7 +228,7 @@ acl_fetch_anthropic(config_t *config, const char *prompt, int history_length)
 	curl_easy_setopt(acl_curl, CURLOPT_WRITEDATA, &json_response);
 	curl_easy_setopt(acl_curl, CURLOPT_POSTFIELDS, json_request.ptr);
 
-	res = curl_easy_perform(acl_curl);
+	res = acl_curl_perform(config, anthropic_get_response_content);
 
 	if (res != CURLE_OK) {
 		free(json_request.ptr);
@@ -183,8 +239,35 @@ acl_fetch_anthropic(config_t *config, const char *prompt, int history_length)
 
 	acl_write_log(config, json_response.ptr);
 
+	double parse_start = TRACE_NOW();
 	char *text_response = anthropic_get_response_content(json_response.ptr);
+	TRACE_SPAN("parse", parse_start);
+	PROBE_RESPONSE_PARSED("anthropic", json_response.ptr, parse_start);
+	acl_usage_record(config, "anthropic", config->anthropic_model);
 	free(json_request.ptr);
 	free(json_response.ptr);
 	return text_response;
 }
+
+// Verify the configuration required for queries
+static bool
+init(config_t *config)
+{
+	REQUIRE(config, anthropic, key);
+	REQUIRE(config, anthropic, endpoint);
+	REQUIRE(config, anthropic, version);
+	return true;
+}
+
+// Release the prepared headers, so that they are built anew when next used
+static void
+release(void)
+{
+	free(key_header);
+	free(version_header);
+	key_header = version_header = NULL;
+}
+
+ACL_BACKEND(anthropic, init, acl_fetch_anthropic, release,
+    .build_request = anthropic_build_request,
+    .parse_response = anthropic_get_response_content);
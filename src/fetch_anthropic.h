@@ -19,9 +19,12 @@
  */
 
 #include "config.h"
+#include "support.h"
 
 #if defined(UNIT_TEST)
 char *anthropic_get_response_content(const char *json_response);
+size_t anthropic_build_request(config_t *config, const char *prompt,
+    int history_length, string_t *request);
 #endif
 
 char *acl_fetch_anthropic(config_t *config, const char *prompt, int history_length);
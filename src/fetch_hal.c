@@ -18,12 +18,166 @@
  *  limitations under the License.
  */
 
+#include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#include "backend.h"
 #include "config.h"
 #include "fetch_hal.h"
 #include "support.h"
+#include "unit_test.h"
+
+static const char quote[] = "# I'm sorry, Dave. I'm afraid I can't do that.";
+
+static hal_latency_t latency;
+
+// Random state of the draws, shared by the foreground and background queries
+static unsigned short xsubi[3];
+static pthread_mutex_t random_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Set l to the response time distribution specified as fixed:MS,
+ * lognormal:MEDIAN:SIGMA, bimodal:FAST:SLOW:P, or plain MS.
+ * Return false if the specification is invalid.
+ */
+STATIC bool
+hal_latency_parse(const char *spec, hal_latency_t *l)
+{
+	static const struct {
+		const char *name;
+		int type;
+		int nargs;
+	} dist[] = {
+		{"fixed:", HAL_FIXED, 1},
+		{"lognormal:", HAL_LOGNORMAL, 2},
+		{"bimodal:", HAL_BIMODAL, 3},
+	};
+	int nargs = 1;
+
+	l->type = HAL_FIXED;
+	for (size_t i = 0; i < sizeof(dist) / sizeof(dist[0]); i++)
+		if (strncmp(spec, dist[i].name, strlen(dist[i].name)) == 0) {
+			spec += strlen(dist[i].name);
+			l->type = dist[i].type;
+			nargs = dist[i].nargs;
+			break;
+		}
+
+	double v[3] = {0, 0, 0};
+	for (int i = 0; i < nargs; i++) {
+		char *end;
+		if (i > 0 && *spec++ != ':')
+			return false;
+		v[i] = strtod(spec, &end);
+		if (end == spec || v[i] < 0)
+			return false;
+		spec = end;
+	}
+	l->a = v[0];
+	l->b = v[1];
+	l->p = v[2];
+	return *spec == '\0' && l->p <= 1;
+}
+
+// Return a response time (ms) drawn from the specified distribution
+STATIC double
+hal_latency_sample(const hal_latency_t *l, unsigned short xsubi[3])
+{
+	switch (l->type) {
+	case HAL_FIXED:
+		return l->a;
+	case HAL_LOGNORMAL:
+		// Box-Muller transform of a standard normal variate
+		return l->a * exp(l->b * sqrt(-2 * log(1 - erand48(xsubi))) *
+		    cos(2 * M_PI * erand48(xsubi)));
+	case HAL_BIMODAL:
+		return erand48(xsubi) < l->p ? l->b : l->a;
+	}
+	return 0;
+}
+
+/*
+ * Return an allocated response of the specified size in bytes,
+ * formed by repeating HAL's answer, or the answer if size is 0.
+ */
+STATIC char *
+hal_response(int size)
+{
+	if (size <= 0)
+		return acl_safe_strdup(quote);
+
+	char *response = malloc(size + 1);
+	if (!response)
+		return NULL;
+	for (int i = 0; i < size; i += sizeof(quote)) {
+		int n = size - i < (int)sizeof(quote) ? size - i :
+		    (int)sizeof(quote);
+		memcpy(response + i, quote, n);
+		// Separate the repetitions with a space
+		if (n == sizeof(quote))
+			response[i + n - 1] = ' ';
+	}
+	response[size] = '\0';
+	return response;
+}
+
+// Return the number of whitespace-separated tokens in s
+STATIC int
+hal_tokens(const char *s)
+{
+	int n = 0;
+
+	for (;;) {
+		s += strspn(s, " \t\n");
+		if (!*s)
+			return n;
+		n++;
+		s += strcspn(s, " \t\n");
+	}
+}
+
+// Wait for the specified ms; return false if the query was cancelled
+static bool
+hal_wait(double ms)
+{
+	while (ms > 0) {
+		if (acl_cancelled())
+			return false;
+		double step = ms < 10 ? ms : 10;
+		usleep(step * 1000);
+		ms -= step;
+	}
+	return !acl_cancelled();
+}
+
+static bool
+init(config_t *config)
+{
+	if (config->general_verbose)
+		fprintf(stderr, "\nInitializing HAL, program name [%s] system prompt to use [%s]\n",
+		    acl_short_program_name(), config->prompt_system);
+
+	const char *spec = config->hal_latency_set ? config->hal_latency :
+	    "fixed:1000";
+	if (!hal_latency_parse(spec, &latency)) {
+		fprintf(stderr, "Invalid [hal] latency value %s.\n", spec);
+		return false;
+	}
+	if (config->hal_failure < 0 || config->hal_failure > 1) {
+		fprintf(stderr, "Invalid [hal] failure probability %g.\n",
+		    config->hal_failure);
+		return false;
+	}
+	// The default seed is fixed, so that runs are reproducible
+	xsubi[0] = 0x330e;
+	xsubi[1] = config->hal_seed & 0xffff;
+	xsubi[2] = (config->hal_seed >> 16) & 0xffff;
+	return true;
+}
 
 /*
  * Fetch response from the dummy HAL 9000 API.
@@ -31,20 +185,39 @@
  * https://en.wikiquote.org/wiki/2001:_A_Space_Odyssey_(film).
  * This endpoint can be used for testing the ai-cli-lib functionality
  * without the need to use a networked API.
+ * The response time, streaming rate, failures, and response size
+ * simulate the configured load.
  */
 char *
 acl_fetch_hal(config_t *config, const char *prompt, int history_length)
 {
-	static bool initialized;
-
-	if (!initialized) {
-		if (config->general_verbose)
-			fprintf(stderr, "\nInitializing HAL, program name [%s] system prompt to use [%s]\n",
-			    acl_short_program_name(), config->prompt_system);
-		initialized = true;
-	}
 	if (config->general_verbose)
 		fprintf(stderr, "\nHAL is processing...\n");
-	sleep(1); // Simulate processing latency
-	return acl_safe_strdup("# I'm sorry, Dave. I'm afraid I can't do that.");
+
+	pthread_mutex_lock(&random_mutex);
+	double ms = hal_latency_sample(&latency, xsubi);
+	bool failed = erand48(xsubi) < config->hal_failure;
+	pthread_mutex_unlock(&random_mutex);
+
+	// Time to the first token
+	if (!hal_wait(ms))
+		return NULL;
+	if (failed) {
+		acl_readline_printf("\nHAL invocation error: simulated failure\n");
+		return NULL;
+	}
+
+	char *response = hal_response(config->hal_response_size);
+	// Generate the remaining tokens at the configured rate
+	if (response && config->hal_token_rate > 0) {
+		int tokens = hal_tokens(response);
+		for (int i = 1; i < tokens; i++)
+			if (!hal_wait(1000 / config->hal_token_rate)) {
+				free(response);
+				return NULL;
+			}
+	}
+	return response;
 }
+
+ACL_BACKEND(hal, init, acl_fetch_hal, NULL);
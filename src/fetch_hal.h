@@ -18,6 +18,25 @@
  *  limitations under the License.
  */
 
+#pragma once
+
+#include <stdbool.h>
+
 #include "config.h"
 
+// A response time distribution
+typedef struct {
+	enum { HAL_FIXED, HAL_LOGNORMAL, HAL_BIMODAL } type;
+	double a;	// Fixed ms; lognormal median ms; bimodal fast ms
+	double b;	// Lognormal sigma; bimodal slow (tail) ms
+	double p;	// Bimodal probability of the slow mode
+} hal_latency_t;
+
+#if defined(UNIT_TEST)
+bool hal_latency_parse(const char *spec, hal_latency_t *l);
+double hal_latency_sample(const hal_latency_t *l, unsigned short xsubi[3]);
+char *hal_response(int size);
+int hal_tokens(const char *s);
+#endif
+
 char *acl_fetch_hal(config_t *config, const char *prompt, int history_length);
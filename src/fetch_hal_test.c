@@ -0,0 +1,150 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test the HAL backend's synthetic load.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "CuTest.h"
+#include "backend.h"
+#include "config.h"
+#include "fetch_hal.h"
+#include "support.h"
+
+extern const backend_t acl_backend_hal;
+
+static int
+compare_double(const void *a, const void *b)
+{
+	double da = *(const double *)a, db = *(const double *)b;
+
+	return da < db ? -1 : da > db;
+}
+
+static void
+test_latency(CuTest *tc)
+{
+	hal_latency_t l;
+	unsigned short xsubi[3] = {1, 2, 3};
+	double ms[10000];
+
+	CuAssertTrue(tc, hal_latency_parse("250", &l));
+	CuAssertDblEquals(tc, 250, hal_latency_sample(&l, xsubi), 0);
+	CuAssertTrue(tc, hal_latency_parse("fixed:0", &l));
+	CuAssertDblEquals(tc, 0, hal_latency_sample(&l, xsubi), 0);
+
+	// The median of the lognormal distribution is its first parameter
+	CuAssertTrue(tc, hal_latency_parse("lognormal:200:0.5", &l));
+	for (int i = 0; i < 10000; i++)
+		ms[i] = hal_latency_sample(&l, xsubi);
+	qsort(ms, 10000, sizeof(double), compare_double);
+	CuAssertDblEquals(tc, 200, ms[5000], 10);
+	CuAssertTrue(tc, ms[9900] > 500);
+
+	// One percent of the responses form the tail
+	CuAssertTrue(tc, hal_latency_parse("bimodal:100:5000:0.01", &l));
+	for (int i = 0; i < 10000; i++)
+		ms[i] = hal_latency_sample(&l, xsubi);
+	qsort(ms, 10000, sizeof(double), compare_double);
+	CuAssertDblEquals(tc, 100, ms[9850], 0);
+	CuAssertDblEquals(tc, 5000, ms[9950], 0);
+
+	CuAssertTrue(tc, !hal_latency_parse("", &l));
+	CuAssertTrue(tc, !hal_latency_parse("lognormal:200", &l));
+	CuAssertTrue(tc, !hal_latency_parse("bimodal:1:2:1.5", &l));
+	CuAssertTrue(tc, !hal_latency_parse("fixed:-1", &l));
+	CuAssertTrue(tc, !hal_latency_parse("uniform:1:2", &l));
+}
+
+static void
+test_response(CuTest *tc)
+{
+	char *r = hal_response(0);
+	CuAssertStrEquals(tc, "# I'm sorry, Dave. I'm afraid I can't do that.", r);
+	CuAssertIntEquals(tc, 10, hal_tokens(r));
+	free(r);
+
+	r = hal_response(5);
+	CuAssertStrEquals(tc, "# I'm", r);
+	free(r);
+
+	r = hal_response(1000);
+	CuAssertIntEquals(tc, 1000, strlen(r));
+	CuAssertTrue(tc, strncmp(r + 47, "# I'm sorry", 11) == 0);
+	free(r);
+
+	CuAssertIntEquals(tc, 0, hal_tokens(" \n"));
+}
+
+// Fetch n responses from HAL, returning the number of failures
+static int
+failures(CuTest *tc, config_t *config, int n)
+{
+	int failed = 0;
+
+	CuAssertTrue(tc, acl_backend_hal.init(config));
+	for (int i = 0; i < n; i++) {
+		char *r = acl_fetch_hal(config, "open the doors", 0);
+		if (r)
+			free(r);
+		else
+			failed++;
+	}
+	return failed;
+}
+
+static void
+test_fetch(CuTest *tc)
+{
+	config_t config = {"bash"};
+
+	config.hal_latency = "0";
+	config.hal_latency_set = true;
+	CuAssertIntEquals(tc, 0, failures(tc, &config, 10));
+
+	// Seeded runs are reproducible
+	config.hal_failure = 0.3;
+	int failed = failures(tc, &config, 100);
+	CuAssertTrue(tc, failed > 10 && failed < 50);
+	CuAssertIntEquals(tc, failed, failures(tc, &config, 100));
+	config.hal_seed = 42;
+	CuAssertTrue(tc, failed != failures(tc, &config, 100));
+
+	// Streaming 10 tokens at 1000 tokens/s takes about 9 ms
+	config.hal_failure = 0;
+	config.hal_token_rate = 1000;
+	double start = acl_now_ms();
+	CuAssertIntEquals(tc, 0, failures(tc, &config, 1));
+	CuAssertTrue(tc, acl_now_ms() - start >= 9);
+
+	config.hal_latency = "lognormal:1";
+	CuAssertTrue(tc, !acl_backend_hal.init(&config));
+}
+
+CuSuite*
+cu_fetch_hal_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_latency);
+	SUITE_ADD_TEST(suite, test_response);
+	SUITE_ADD_TEST(suite, test_fetch);
+
+	return suite;
+}
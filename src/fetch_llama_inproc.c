@@ -0,0 +1,537 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  In-process llama.cpp inference.
+ *  The llama.cpp library is loaded on first use and the model is
+ *  memory-mapped once per process; its read-only pages are shared
+ *  through the page cache with other processes using the same file.
+ *  A dedicated thread owns the inference context and keeps the
+ *  evaluated prompt tokens, so that the static system and n-shot
+ *  prefix (and any unchanged history) isn't evaluated again.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <readline/history.h>
+
+#include "backend.h"
+#include "config.h"
+#include "context.h"
+#include "fetch_llama_inproc.h"
+#include "support.h"
+#include "trace.h"
+#include "unit_test.h"
+
+// Defaults of the configuration options
+#define DEFAULT_LIBRARY "ai_cli_llama_shim." DLL_EXTENSION
+#define DEFAULT_N_CTX 2048
+#define DEFAULT_N_PREDICT 64
+
+// Tokens evaluated in each call to llama_decode
+#define BATCH_SIZE 512
+
+// Interval (ms) at which a waiting query checks for cancellation
+#define POLL_INTERVAL 100
+
+/*
+ * The llama.cpp C API (llama.h) is bound at run time, so that the
+ * library isn't needed for building ai-cli.
+ * The functions passing structures by value, whose layout changes
+ * across llama.cpp releases, are called through the shim library
+ * built from llama_shim.c against the installed llama.h.
+ * The other functions are looked up through the shim, which is linked
+ * with llama.cpp; those renamed since late 2024 under both names.
+ */
+typedef struct llama_model llama_model;
+typedef struct llama_context llama_context;
+typedef int32_t llama_token;
+
+static struct {
+	void (*backend_init)(void);
+	llama_model *(*model_load)(const char *);
+	llama_context *(*context_new)(llama_model *, uint32_t, int32_t,
+	    bool (*)(void *), void *);
+	const void *(*model_get_vocab)(const llama_model *);
+	int32_t (*vocab_n_tokens)(const void *);
+	int32_t (*tokenize)(const void *, const char *, int32_t,
+	    llama_token *, int32_t, bool, bool);
+	int32_t (*token_to_piece)(const void *, llama_token, char *, int32_t,
+	    int32_t, bool);
+	bool (*vocab_is_eog)(const void *, llama_token);
+	int32_t (*decode)(llama_context *, llama_token *, int32_t);
+	float *(*get_logits_ith)(llama_context *, int32_t);
+	void *(*get_memory)(llama_context *);
+	bool (*seq_rm)(void *, int32_t, int32_t, int32_t);
+	void (*free)(llama_context *);
+	void (*model_free)(llama_model *);
+} ll;
+
+// State owned by the inference thread
+static llama_model *model;
+static llama_context *ctx;
+static const void *vocab;	// Vocabulary or, in older versions, model
+static int n_ctx;
+static llama_token *cached;	// Tokens whose state is in the KV cache
+static int ncached;
+
+// Query passed to the inference thread, protected by lock
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static struct {
+	bool started;		// Inference thread is running
+	bool pending;		// Query waiting to be processed
+	bool done;		// Query processed
+	config_t *config;
+	char *prompt;
+	char *response;
+	char *error;		// Error message; dynamically allocated
+} q;
+
+/*
+ * Set to stop the query's evaluation and generation of tokens.
+ * Also set by SIGINT during a query of the interactive thread.
+ */
+static atomic_bool cancel;
+
+// Serializes queries from the interactive and background threads
+static pthread_mutex_t query_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Set the query's error to the specified formatted message
+static void
+set_error(const char *fmt, ...)
+{
+	va_list args;
+
+	free(q.error);
+	va_start(args, fmt);
+	if (vasprintf(&q.error, fmt, args) == -1)
+		acl_errorf("memory allocation failed.");
+	va_end(args);
+}
+
+// Return the first of the named symbols found in the library
+static void *
+find_symbol(void *handle, const char *name, const char *alternative)
+{
+	void *sym = dlsym(handle, name);
+	if (!sym && alternative)
+		sym = dlsym(handle, alternative);
+	return sym;
+}
+
+// Return true to abort llama.cpp's evaluation of a cancelled query
+static bool
+aborted(void *data)
+{
+	return atomic_load(&cancel);
+}
+
+/*
+ * Load the library and the model, and create the inference context.
+ * Return false on error, setting the query's error.
+ */
+static bool
+initialize(config_t *config)
+{
+	const char *library = config->llama_inproc_library_set ?
+	    config->llama_inproc_library : DEFAULT_LIBRARY;
+	void *h = dlopen(library, RTLD_NOW | RTLD_LOCAL);
+	if (!h) {
+		set_error("cannot load llama.cpp shim library: %s", dlerror());
+		return false;
+	}
+
+	ll.backend_init = find_symbol(h, "llama_backend_init", NULL);
+	ll.model_load = find_symbol(h, "acl_llama_model_load", NULL);
+	ll.context_new = find_symbol(h, "acl_llama_context_new", NULL);
+	ll.model_get_vocab = find_symbol(h, "llama_model_get_vocab", NULL);
+	ll.vocab_n_tokens = find_symbol(h, "llama_vocab_n_tokens", "llama_n_vocab");
+	ll.tokenize = find_symbol(h, "llama_tokenize", NULL);
+	ll.token_to_piece = find_symbol(h, "llama_token_to_piece", NULL);
+	ll.vocab_is_eog = find_symbol(h, "llama_vocab_is_eog", "llama_token_is_eog");
+	ll.decode = find_symbol(h, "acl_llama_decode", NULL);
+	ll.get_logits_ith = find_symbol(h, "llama_get_logits_ith", NULL);
+	ll.get_memory = find_symbol(h, "llama_get_memory", NULL);
+	ll.seq_rm = ll.get_memory ? find_symbol(h, "llama_memory_seq_rm", NULL) :
+	    find_symbol(h, "llama_kv_self_seq_rm", "llama_kv_cache_seq_rm");
+	ll.free = find_symbol(h, "llama_free", NULL);
+	ll.model_free = find_symbol(h, "llama_model_free", "llama_free_model");
+	if (!ll.backend_init || !ll.model_load || !ll.context_new
+	    || !ll.vocab_n_tokens || !ll.tokenize || !ll.token_to_piece
+	    || !ll.vocab_is_eog || !ll.decode
+	    || !ll.get_logits_ith || !ll.seq_rm || !ll.free || !ll.model_free) {
+		set_error("unsupported llama.cpp library version: %s", library);
+		return false;
+	}
+
+	ll.backend_init();
+	model = ll.model_load(config->llama_inproc_model);
+	if (!model) {
+		set_error("cannot load model %s", config->llama_inproc_model);
+		return false;
+	}
+	vocab = ll.model_get_vocab ? ll.model_get_vocab(model) : model;
+
+	n_ctx = config->llama_inproc_n_ctx_set ? config->llama_inproc_n_ctx
+	    : DEFAULT_N_CTX;
+	int n_threads = config->llama_inproc_n_threads_set ?
+	    config->llama_inproc_n_threads : 0;
+	ctx = ll.context_new(model, n_ctx, n_threads, aborted, NULL);
+	if (!ctx) {
+		set_error("cannot create a context for %s", config->llama_inproc_model);
+		ll.model_free(model);
+		model = NULL;
+		return false;
+	}
+	cached = malloc(n_ctx * sizeof(llama_token));
+	if (!cached)
+		acl_errorf("memory allocation failed.");
+	return true;
+}
+
+// Return the length of the common prefix of token sequences a and b
+STATIC int
+common_prefix(const llama_token *a, int na, const llama_token *b, int nb)
+{
+	int i;
+
+	for (i = 0; i < na && i < nb && a[i] == b[i]; i++)
+		;
+	return i;
+}
+
+/*
+ * Evaluate the n specified tokens, appending them to the cached ones.
+ * Return false on error.
+ */
+static bool
+evaluate(llama_token *tokens, int n)
+{
+	for (int i = 0; i < n; i += BATCH_SIZE) {
+		int len = n - i < BATCH_SIZE ? n - i : BATCH_SIZE;
+		if (ll.decode(ctx, tokens + i, len) != 0)
+			return false;
+		memcpy(cached + ncached, tokens + i, len * sizeof(llama_token));
+		ncached += len;
+	}
+	return true;
+}
+
+// Return the next token, sampled from the last evaluated token's logits
+static llama_token
+sample(config_t *config)
+{
+	static unsigned int seed;
+	const float *logits = ll.get_logits_ith(ctx, -1);
+	int n = ll.vocab_n_tokens(vocab);
+	llama_token best = 0;
+
+	for (int i = 1; i < n; i++)
+		if (logits[i] > logits[best])
+			best = i;
+	if (!config->llama_inproc_temperature_set
+	    || config->llama_inproc_temperature <= 0)
+		return best;
+
+	// Sample from the softmax distribution at the given temperature
+	double t = config->llama_inproc_temperature;
+	double sum = 0;
+	for (int i = 0; i < n; i++)
+		sum += exp((logits[i] - logits[best]) / t);
+	if (!seed)
+		seed = time(NULL);
+	double r = (double)rand_r(&seed) / RAND_MAX * sum;
+	for (int i = 0; i < n; i++) {
+		r -= exp((logits[i] - logits[best]) / t);
+		if (r <= 0)
+			return i;
+	}
+	return best;
+}
+
+/*
+ * Return the model's completion of the specified prompt up to the end
+ * of its line, or NULL on error, setting the query's error.
+ */
+static char *
+generate(config_t *config, const char *prompt)
+{
+	int len = strlen(prompt);
+	llama_token *tokens = malloc((len + 2) * sizeof(llama_token));
+	if (!tokens)
+		acl_errorf("memory allocation failed.");
+	int n = ll.tokenize(vocab, prompt, len, tokens, len + 2, true, false);
+
+	int n_predict = config->llama_inproc_n_predict_set ?
+	    config->llama_inproc_n_predict : DEFAULT_N_PREDICT;
+	if (n < 0 || n + n_predict > n_ctx) {
+		free(tokens);
+		set_error("prompt exceeds the context size of %d tokens", n_ctx);
+		return NULL;
+	}
+
+	// Keep the cached state of the common prefix; evaluate the rest
+	int keep = common_prefix(cached, ncached, tokens, n);
+	if (keep == n && n > 0)
+		keep--;		// The last token must be evaluated for its logits
+	void *memory = ll.get_memory ? ll.get_memory(ctx) : ctx;
+	ll.seq_rm(memory, 0, keep, -1);
+	ncached = keep;
+	bool ok = evaluate(tokens + keep, n - keep);
+	free(tokens);
+
+	string_t response;
+	acl_string_init(&response, "");
+	for (int i = 0; ok && i < n_predict; i++) {
+		if (atomic_load(&cancel))
+			break;
+
+		llama_token t = sample(config);
+		if (ll.vocab_is_eog(vocab, t))
+			break;
+		char piece[256];
+		int plen = ll.token_to_piece(vocab, t, piece, sizeof(piece) - 1, 0, false);
+		if (plen < 0)
+			break;
+		piece[plen] = '\0';
+		char *nl = strchr(piece, '\n');
+		if (nl)
+			*nl = '\0';
+		// Skip the whitespace following the "Assistant:" cue
+		acl_string_append(&response, response.len ? piece :
+		    piece + strspn(piece, " \t"));
+		if (nl)
+			break;
+		ok = evaluate(&t, 1);
+	}
+	if (!ok) {
+		// Reevaluate everything in the next query
+		ll.seq_rm(memory, 0, 0, -1);
+		ncached = 0;
+		if (!atomic_load(&cancel))
+			set_error("llama.cpp evaluation failed");
+		free(response.ptr);
+		return NULL;
+	}
+	return response.ptr;
+}
+
+// Inference thread: process the queries it is given
+static void *
+worker(void *arg)
+{
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (!q.pending)
+			pthread_cond_wait(&cond, &lock);
+		q.pending = false;
+		config_t *config = q.config;
+		pthread_mutex_unlock(&lock);
+
+		bool initialized = ctx || initialize(config);
+		char *response = initialized ? generate(config, q.prompt) : NULL;
+
+		pthread_mutex_lock(&lock);
+		q.response = response;
+		q.done = true;
+		pthread_cond_broadcast(&cond);
+	}
+	return NULL;
+}
+
+// Append the specified role's text line to the string s
+static void
+prompt_append(string_t *s, const char *role, const char *text)
+{
+	if (!text || !*text)
+		return;
+	acl_string_appendf(s, "%s: %s\n", role, text);
+}
+
+// Return the text of the prompt in dynamically allocated memory
+STATIC char *
+inproc_prompt(config_t *config, const char *prompt, int history_length)
+{
+	char *system_role = acl_system_role_get(config);
+	string_t s;
+
+	acl_string_init(&s, system_role);
+	acl_string_append(&s, "\n");
+	free(system_role);
+
+	// The static prefix comes first, so that its state can be reused
+	for (int i = 0; i < NPROMPTS; i++) {
+		prompt_append(&s, "User", config->prompt_user[i]);
+		prompt_append(&s, "Assistant", config->prompt_assistant[i]);
+	}
+
+	for (int i = config->prompt_context - 1; i >= 0; --i) {
+		HIST_ENTRY *h = history_get(history_length - 1 - i);
+		if (h)
+			prompt_append(&s, "Command", h->line);
+	}
+
+	double context_start = TRACE_NOW();
+	char *context = acl_context_get(config);
+	TRACE_SPAN("context", context_start);
+	if (context) {
+		// Fold the context's lines into a single one
+		for (char *p = context; *p; p++)
+			if (*p == '\n')
+				*p = ' ';
+		prompt_append(&s, "Context", context);
+		free(context);
+	}
+
+	prompt_append(&s, "User", prompt);
+	acl_string_append(&s, "Assistant:");
+	return s.ptr;
+}
+
+// Cancel the interactive thread's query on SIGINT
+static void
+interrupt(int sig)
+{
+	atomic_store(&cancel, true);
+}
+
+/*
+ * Fetch a response from the in-process model given the provided prompt.
+ * Provide context in the form of n-shot prompts and history prompts.
+ */
+char *
+acl_fetch_llama_inproc(config_t *config, const char *prompt, int history_length)
+{
+	double build_start = TRACE_NOW();
+	char *text = inproc_prompt(config, prompt, history_length);
+	TRACE_SPAN("build", build_start);
+
+	if (config->general_verbose)
+		fprintf(stderr, "\nRunning in-process llama.cpp inference...\n");
+
+	double inference_start = TRACE_NOW();
+	pthread_mutex_lock(&query_lock);
+	pthread_mutex_lock(&lock);
+	if (!q.started) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, worker, NULL) != 0) {
+			pthread_mutex_unlock(&lock);
+			pthread_mutex_unlock(&query_lock);
+			free(text);
+			acl_readline_printf("\nCannot start the inference thread.\n");
+			return NULL;
+		}
+		pthread_detach(thread);
+		q.started = true;
+	}
+	q.config = config;
+	q.prompt = text;
+	q.done = false;
+	q.pending = true;
+	atomic_store(&cancel, false);
+	pthread_cond_broadcast(&cond);
+
+	// Background queries are cancelled through their flag
+	bool interactive = !acl_cancel_flag;
+	struct sigaction sa, prev_sa;
+	if (interactive) {
+		sa.sa_handler = interrupt;
+		sa.sa_flags = 0;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGINT, &sa, &prev_sa);
+	}
+
+	// Wait for the response, passing on any cancellation
+	while (!q.done) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += POLL_INTERVAL * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&cond, &lock, &deadline);
+		if (acl_cancelled())
+			atomic_store(&cancel, true);
+	}
+	char *response = q.response;
+	char *error = q.error;
+	q.response = q.error = NULL;
+	bool cancelled = atomic_load(&cancel);
+	pthread_mutex_unlock(&lock);
+	if (interactive)
+		sigaction(SIGINT, &prev_sa, NULL);
+	pthread_mutex_unlock(&query_lock);
+	TRACE_SPAN("inference", inference_start);
+
+	free(text);
+	if (error) {
+		acl_readline_printf("\nIn-process llama.cpp inference failed: %s\n", error);
+		free(error);
+	}
+	if (cancelled) {
+		if (interactive)
+			acl_readline_printf("\nIn-process llama.cpp inference interrupted.\n");
+		free(response);
+		return NULL;
+	}
+	return response;
+}
+
+// Verify the configuration required for queries
+static bool
+init(config_t *config)
+{
+	REQUIRE(config, llama_inproc, model);
+	return true;
+}
+
+/*
+ * Free the model and its inference context.
+ * The next query loads them again.
+ */
+static void
+release(void)
+{
+	pthread_mutex_lock(&query_lock);
+	// Holding query_lock, the inference thread is idle
+	if (ctx)
+		ll.free(ctx);
+	if (model)
+		ll.model_free(model);
+	ctx = NULL;
+	model = NULL;
+	free(cached);
+	cached = NULL;
+	ncached = 0;
+	pthread_mutex_unlock(&query_lock);
+}
+
+ACL_BACKEND(llama_inproc, init, acl_fetch_llama_inproc, release);
@@ -0,0 +1,32 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  In-process llama.cpp inference
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "config.h"
+
+#if defined(UNIT_TEST)
+char *inproc_prompt(config_t *config, const char *prompt, int history_length);
+int common_prefix(const int32_t *a, int na, const int32_t *b, int nb);
+#endif
+
+char *acl_fetch_llama_inproc(config_t *config, const char *prompt, int history_length);
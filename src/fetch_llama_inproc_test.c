@@ -0,0 +1,167 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test in-process llama.cpp inference.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <dlfcn.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CuTest.h"
+#include "backend.h"
+#include "config.h"
+#include "fetch_llama_inproc.h"
+#include "support.h"
+
+extern const backend_t acl_backend_llama_inproc;
+
+static void
+test_inproc_prompt(CuTest* tc)
+{
+	config_t config = {"bash"};
+	char *s;
+
+	config.prompt_system = "Provide %s commands.";
+	config.prompt_user[0] = "List files";
+	config.prompt_assistant[0] = "ls";
+	s = inproc_prompt(&config, "Show the date", 0);
+	CuAssertStrEquals(tc, "Provide bash commands.\n"
+	    "User: List files\n"
+	    "Assistant: ls\n"
+	    "User: Show the date\n"
+	    "Assistant:", s);
+	free(s);
+}
+
+static void
+test_common_prefix(CuTest* tc)
+{
+	int32_t a[] = {1, 2, 3, 4};
+	int32_t b[] = {1, 2, 5};
+
+	CuAssertIntEquals(tc, 2, common_prefix(a, 4, b, 3));
+	CuAssertIntEquals(tc, 3, common_prefix(a, 3, a, 4));
+	CuAssertIntEquals(tc, 0, common_prefix(a, 0, b, 3));
+}
+
+// Fake llama.cpp library built for the tests
+static const char fake_library[] = "./fake_llama." DLL_EXTENSION;
+
+// Return the length of the common prefix of the prompts built for a and b
+static int
+prompt_prefix(config_t *config, const char *a, const char *b)
+{
+	char *pa = inproc_prompt(config, a, 0);
+	char *pb = inproc_prompt(config, b, 0);
+	int i;
+
+	for (i = 0; pa[i] && pa[i] == pb[i]; i++)
+		;
+	free(pa);
+	free(pb);
+	return i;
+}
+
+static void
+test_fetch_fake(CuTest* tc)
+{
+	config_t config = {"bash"};
+	char *s;
+
+	config.prompt_system = "Provide %s commands.";
+	config.llama_inproc_model = "test.gguf";
+	config.llama_inproc_library = fake_library;
+	config.llama_inproc_library_set = true;
+
+	void *h = dlopen(fake_library, RTLD_NOW | RTLD_LOCAL);
+	CuAssertPtrNotNull(tc, h);
+	int *evaluated = dlsym(h, "fake_llama_evaluated");
+	bool *fail = dlsym(h, "fake_llama_fail");
+	bool *slow = dlsym(h, "fake_llama_slow");
+	CuAssertTrue(tc, evaluated && fail && slow);
+
+	// The first query evaluates the prompt and the reply's tokens
+	char *text = inproc_prompt(&config, "list files", 0);
+	int prompt_len = strlen(text);
+	free(text);
+	*evaluated = 0;
+	s = acl_fetch_llama_inproc(&config, "list files", 0);
+	CuAssertStrEquals(tc, "ls -l", s);
+	free(s);
+	// The reply's leading space and command, but not its newline
+	int reply_len = strlen(" ls -l");
+	CuAssertIntEquals(tc, prompt_len + reply_len, *evaluated);
+
+	// Only the tokens following the common prefix are evaluated
+	int prefix = prompt_prefix(&config, "list files", "list all files");
+	text = inproc_prompt(&config, "list all files", 0);
+	prompt_len = strlen(text);
+	free(text);
+	*evaluated = 0;
+	s = acl_fetch_llama_inproc(&config, "list all files", 0);
+	CuAssertStrEquals(tc, "ls -l", s);
+	free(s);
+	CuAssertIntEquals(tc, prompt_len - prefix + reply_len, *evaluated);
+
+	// A repeated prompt evaluates its last token for its logits
+	*evaluated = 0;
+	s = acl_fetch_llama_inproc(&config, "list all files", 0);
+	CuAssertStrEquals(tc, "ls -l", s);
+	free(s);
+	CuAssertIntEquals(tc, 1 + reply_len, *evaluated);
+
+	// After a failed evaluation the whole prompt is evaluated again
+	*fail = true;
+	CuAssertTrue(tc, acl_fetch_llama_inproc(&config, "list all files",
+	    0) == NULL);
+	*fail = false;
+	*evaluated = 0;
+	s = acl_fetch_llama_inproc(&config, "list all files", 0);
+	CuAssertStrEquals(tc, "ls -l", s);
+	free(s);
+	CuAssertIntEquals(tc, prompt_len + reply_len, *evaluated);
+
+	// A cancelled query aborts the evaluation
+	static atomic_bool cancelled = true;
+	acl_cancel_flag = &cancelled;
+	*slow = true;
+	CuAssertTrue(tc, acl_fetch_llama_inproc(&config, "list files",
+	    0) == NULL);
+	*slow = false;
+	acl_cancel_flag = NULL;
+	s = acl_fetch_llama_inproc(&config, "list files", 0);
+	CuAssertStrEquals(tc, "ls -l", s);
+	free(s);
+
+	// Free the context, so that later queries start afresh
+	acl_backend_llama_inproc.shutdown();
+	dlclose(h);
+}
+
+CuSuite*
+cu_fetch_llama_inproc_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_inproc_prompt);
+	SUITE_ADD_TEST(suite, test_common_prefix);
+	SUITE_ADD_TEST(suite, test_fetch_fake);
+
+	return suite;
+}
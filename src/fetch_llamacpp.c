@@ -18,17 +18,33 @@
  *  limitations under the License.
  */
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <curl/curl.h>
 #include <readline/history.h>
 #include <jansson.h>
 
+#include "backend.h"
+#include "balance.h"
 #include "config.h"
+#include "context.h"
+#include "log.h"
 #include "support.h"
 #include "fetch_llamacpp.h"
+#include "http.h"
+#include "trace.h"
 #include "unit_test.h"
+#include "usage.h"
+
+/*
+ * Endpoints among which requests are distributed.
+ * The interactive and background threads share them through the lock.
+ */
+static balancer_t balancer;
+static pthread_mutex_t balancer_lock = PTHREAD_MUTEX_INITIALIZER;
 
 // Return the response content from a llama.cpp JSON response
 STATIC char *
@@ -44,6 +60,24 @@ llamacpp_get_response_content(const char *json_response)
 	char *ret;
 	json_t *content = json_object_get(root, "content");
 	if (content) {
+		// Prompt tokens not processed were found in the KV cache
+		json_t *timings = json_object_get(root, "timings");
+		usage_t u = {
+			.tokens_in = json_integer_value(json_object_get(root,
+			    "tokens_evaluated")),
+			.tokens_out = json_integer_value(json_object_get(root,
+			    "tokens_predicted")),
+			.timed_tokens = json_integer_value(json_object_get(timings,
+			    "predicted_n")),
+			.timed_ms = json_number_value(json_object_get(timings,
+			    "predicted_ms")),
+		};
+		json_t *processed = json_object_get(timings, "prompt_n");
+		if (processed && u.tokens_in > json_integer_value(processed))
+			u.tokens_cached = u.tokens_in -
+			    json_integer_value(processed);
+		acl_usage_add(&u);
+
 		const char assistant[] = "Assistant: ";
 		const char *response = json_string_value(content);
 
@@ -77,7 +111,15 @@ initialize(config_t *config)
 	if (config->general_verbose)
 		fprintf(stderr, "\nInitializing Llamacpp API, program name [%s] system prompt to use [%s]\n",
 		    acl_short_program_name(), config->prompt_system);
-	return curl_initialize(config);
+	const char *error;
+	if (!acl_balancer_init(&balancer, config->llamacpp_endpoint,
+	    config->llamacpp_balance, config->llamacpp_eject_failures,
+	    config->llamacpp_eject_time, &error)) {
+		acl_readline_printf("\nInvalid [llamacpp] configuration: %s.\n",
+		    error);
+		return -1;
+	}
+	return 0;
 }
 
 // Append the specified role's prompt to the string s and then the terminator
@@ -93,28 +135,53 @@ prompt_append(struct string *s, const char *role, const char *prompt)
 }
 
 /*
- * Fetch response from the llama.cpp API given the provided prompt.
- * Provide context in the form of n-shot prompts and history prompts.
+ * Post the request to the specified endpoint through libcurl,
+ * storing the server's reply in response.
+ * Return the response's status code, HTTP_FAILED with error set, or
+ * HTTP_CANCELLED.
  */
-char *
-acl_fetch_llamacpp(config_t *config, const char *prompt, int history_length)
+static int
+curl_post(config_t *config, const char *url, const char *request,
+    string_t *response, const char **error)
 {
-	CURLcode res;
-
-	if (!acl_curl && initialize(config) < 0)
-		return NULL;
+	static __thread struct curl_slist *headers;
 
-	if (config->general_verbose)
-		fprintf(stderr, "\nContacting Llamacpp API...\n");
+	if (curl_initialize(config) < 0) {
+		*error = "libcurl initialization failed";
+		return HTTP_FAILED;
+	}
+	if (!headers)
+		headers = curl_slist_append(NULL, "Content-Type: application/json");
 
-	struct curl_slist *headers = NULL;
-	headers = curl_slist_append(headers, "Content-Type: application/json");
+	curl_easy_setopt(acl_curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(acl_curl, CURLOPT_WRITEFUNCTION,
+	    (curl_write_callback)acl_string_write);
+	curl_easy_setopt(acl_curl, CURLOPT_WRITEDATA, response);
+	curl_easy_setopt(acl_curl, CURLOPT_POSTFIELDS, request);
+	curl_easy_setopt(acl_curl, CURLOPT_URL, url);
+	CURLcode res = acl_curl_perform(config, llamacpp_get_response_content);
+	if (res == CURLE_ABORTED_BY_CALLBACK)
+		return HTTP_CANCELLED;
+	if (res != CURLE_OK) {
+		*error = curl_easy_strerror(res);
+		return HTTP_FAILED;
+	}
 
-	struct string json_response;
-	acl_string_init(&json_response, "");
+	long status = 0;
+	curl_easy_getinfo(acl_curl, CURLINFO_RESPONSE_CODE, &status);
+	return status;
+}
 
-	struct string json_request;
-	acl_string_init(&json_request, "{\n");
+/*
+ * Build in request the JSON request for the provided prompt, with
+ * n-shot prompts, history prompts, and the shell environment as context.
+ * Return the length of its prefix that is the same across queries.
+ */
+STATIC size_t
+llamacpp_build_request(config_t *config, const char *prompt,
+    int history_length, string_t *request)
+{
+	acl_string_init(request, "{\n");
 
 	char *system_role = acl_system_role_get(config);
 	char *escaped = acl_json_escape(system_role);
@@ -122,82 +189,189 @@ acl_fetch_llamacpp(config_t *config, const char *prompt, int history_length)
 
 	// Remove trailing quote
 	escaped[strlen(escaped) - 1] = '\0';
-	acl_string_appendf(&json_request, "  \"prompt\": %s\\n", escaped);
+	acl_string_appendf(request, "  \"prompt\": %s\\n", escaped);
 
 
 	// Add user and assistant n-shot prompts
 	for (int i = 0; i < NPROMPTS; i++) {
-		prompt_append(&json_request, "User", config->prompt_user[i]);
-		prompt_append(&json_request, "Assistant", config->prompt_assistant[i]);
+		prompt_append(request, "User", config->prompt_user[i]);
+		prompt_append(request, "Assistant", config->prompt_assistant[i]);
 	}
 
+	/*
+	 * Requests sharing this prefix can reuse the server's KV cache,
+	 * and the log records it once.
+	 */
+	size_t prefix_len = request->len;
+
 	// Add history prompts as context
 	for (int i = config->prompt_context - 1; i >= 0; --i) {
 		HIST_ENTRY *h = history_get(history_length - 1 - i);
 		if (h == NULL)
 			continue;
-		prompt_append(&json_request, "Command", h->line);
+		prompt_append(request, "Command", h->line);
 	}
 
+	// Add the shell environment as context
+	double context_start = TRACE_NOW();
+	char *context = acl_context_get(config);
+	TRACE_SPAN("context", context_start);
+	prompt_append(request, "Context", context);
+	free(context);
+
 	// Finally, add the user prompt
-	prompt_append(&json_request, "User", prompt);
-	acl_string_append(&json_request, "\",\n");
+	prompt_append(request, "User", prompt);
+	acl_string_append(request, "\",\n");
 
 	// Add configuration settings
 	if (config->llamacpp_temperature_set)
-		acl_string_appendf(&json_request, "  \"temperature\": %g,\n", config->llamacpp_temperature);
+		acl_string_appendf(request, "  \"temperature\": %g,\n", config->llamacpp_temperature);
 	if (config->llamacpp_top_k_set)
-		acl_string_appendf(&json_request, "  \"top_k\": %d,\n", config->llamacpp_top_k);
+		acl_string_appendf(request, "  \"top_k\": %d,\n", config->llamacpp_top_k);
 	if (config->llamacpp_top_p_set)
-		acl_string_appendf(&json_request, "  \"top_p\": %g,\n", config->llamacpp_top_p);
+		acl_string_appendf(request, "  \"top_p\": %g,\n", config->llamacpp_top_p);
 	if (config->llamacpp_n_predict_set)
-		acl_string_appendf(&json_request, "  \"n_predict\": %d,\n", config->llamacpp_n_predict);
+		acl_string_appendf(request, "  \"n_predict\": %d,\n", config->llamacpp_n_predict);
 	if (config->llamacpp_n_keep_set)
-		acl_string_appendf(&json_request, "  \"n_keep\": %d,\n", config->llamacpp_n_keep);
+		acl_string_appendf(request, "  \"n_keep\": %d,\n", config->llamacpp_n_keep);
 	if (config->llamacpp_tfs_z_set)
-		acl_string_appendf(&json_request, "  \"tfs_z\": %g,\n", config->llamacpp_tfs_z);
+		acl_string_appendf(request, "  \"tfs_z\": %g,\n", config->llamacpp_tfs_z);
 	if (config->llamacpp_typical_p_set)
-		acl_string_appendf(&json_request, "  \"typical_p\": %g,\n", config->llamacpp_typical_p);
+		acl_string_appendf(request, "  \"typical_p\": %g,\n", config->llamacpp_typical_p);
 	if (config->llamacpp_repeat_penalty_set)
-		acl_string_appendf(&json_request, "  \"repeat_penalty\": %g,\n", config->llamacpp_repeat_penalty);
+		acl_string_appendf(request, "  \"repeat_penalty\": %g,\n", config->llamacpp_repeat_penalty);
 	if (config->llamacpp_repeat_last_n_set)
-		acl_string_appendf(&json_request, "  \"repeat_last_n\": %d,\n", config->llamacpp_repeat_last_n);
+		acl_string_appendf(request, "  \"repeat_last_n\": %d,\n", config->llamacpp_repeat_last_n);
 	if (config->llamacpp_penalize_nl_set)
-		acl_string_appendf(&json_request, "  \"penalize_nl\": %s,\n", config->llamacpp_penalize_nl ? "true" : "false");
+		acl_string_appendf(request, "  \"penalize_nl\": %s,\n", config->llamacpp_penalize_nl ? "true" : "false");
 	if (config->llamacpp_presence_penalty_set)
-		acl_string_appendf(&json_request, "  \"presence_penalty\": %g,\n", config->llamacpp_presence_penalty);
+		acl_string_appendf(request, "  \"presence_penalty\": %g,\n", config->llamacpp_presence_penalty);
 	if (config->llamacpp_frequency_penalty_set)
-		acl_string_appendf(&json_request, "  \"frequency_penalty\": %g,\n", config->llamacpp_frequency_penalty);
+		acl_string_appendf(request, "  \"frequency_penalty\": %g,\n", config->llamacpp_frequency_penalty);
 	if (config->llamacpp_mirostat_set)
-		acl_string_appendf(&json_request, "  \"mirostat\": %d,\n", config->llamacpp_mirostat);
+		acl_string_appendf(request, "  \"mirostat\": %d,\n", config->llamacpp_mirostat);
 	if (config->llamacpp_mirostat_tau_set)
-		acl_string_appendf(&json_request, "  \"mirostat_tau\": %g,\n", config->llamacpp_mirostat_tau);
+		acl_string_appendf(request, "  \"mirostat_tau\": %g,\n", config->llamacpp_mirostat_tau);
 	if (config->llamacpp_mirostat_eta_set)
-		acl_string_appendf(&json_request, "  \"mirostat_eta\": %g,\n", config->llamacpp_mirostat_eta);
+		acl_string_appendf(request, "  \"mirostat_eta\": %g,\n", config->llamacpp_mirostat_eta);
 	// End with a non-comma
-	acl_string_appendf(&json_request, "  \"stop\": []\n}\n");
+	acl_string_appendf(request, "  \"stop\": []\n}\n");
+	return prefix_len;
+}
 
-	acl_write_log(config, json_request.ptr);
+/*
+ * Fetch response from the llama.cpp API given the provided prompt.
+ * Provide context in the form of n-shot prompts and history prompts.
+ */
+char *
+acl_fetch_llamacpp(config_t *config, const char *prompt, int history_length)
+{
+	pthread_mutex_lock(&balancer_lock);
+	int initialized = balancer.n ? 0 : initialize(config);
+	pthread_mutex_unlock(&balancer_lock);
+	if (initialized < 0 || acl_json_initialize(config) < 0)
+		return NULL;
 
-	curl_easy_setopt(acl_curl, CURLOPT_URL, config->llamacpp_endpoint);
-	curl_easy_setopt(acl_curl, CURLOPT_HTTPHEADER, headers);
-	curl_easy_setopt(acl_curl, CURLOPT_WRITEFUNCTION, acl_string_write);
-	curl_easy_setopt(acl_curl, CURLOPT_WRITEDATA, &json_response);
-	curl_easy_setopt(acl_curl, CURLOPT_POSTFIELDS, json_request.ptr);
+	if (config->general_verbose)
+		fprintf(stderr, "\nContacting Llamacpp API...\n");
 
-	res = curl_easy_perform(acl_curl);
+	double build_start = TRACE_NOW();
 
-	if (res != CURLE_OK) {
+	struct string json_response;
+	acl_string_init(&json_response, "");
+
+	struct string json_request;
+	size_t prefix_len = llamacpp_build_request(config, prompt, history_length,
+	    &json_request);
+
+	acl_write_log_request(config, json_request.ptr, prefix_len);
+	TRACE_SPAN("build", build_start);
+	PROBE_REQUEST_BUILT("llamacpp", json_request.ptr, build_start);
+
+	// Try the available endpoints in turn until one responds
+	uint64_t tried = 0;
+	int endpoint;
+	int status = HTTP_FAILED;
+	const char *error = "no endpoint could be reached";
+	for (;;) {
+		pthread_mutex_lock(&balancer_lock);
+		endpoint = acl_balancer_select(&balancer, json_request.ptr,
+		    prefix_len, tried, time(NULL));
+		// Endpoints are only freed while no query is in flight
+		const char *url = endpoint == -1 ? NULL :
+		    balancer.endpoints[endpoint].url;
+		pthread_mutex_unlock(&balancer_lock);
+		if (endpoint == -1)
+			break;
+		tried |= 1ULL << endpoint;
+
+		json_response.len = 0;
+		json_response.ptr[0] = '\0';
+		double start = acl_now_ms();
+		if (acl_http_supported(config, url)) {
+			status = acl_http_post(config, url, json_request.ptr,
+			    &json_response, llamacpp_get_response_content);
+			error = "connection to the local server failed";
+		} else
+			status = curl_post(config, url, json_request.ptr,
+			    &json_response, &error);
+		if (status == HTTP_CANCELLED) {
+			pthread_mutex_lock(&balancer_lock);
+			acl_balancer_cancel(&balancer, endpoint);
+			pthread_mutex_unlock(&balancer_lock);
+			error = "query cancelled";
+			break;
+		}
+
+		// A saturated server (429) is avoided like a failed one
+		bool success = status != HTTP_FAILED && status < 500
+		    && status != 429;
+		pthread_mutex_lock(&balancer_lock);
+		acl_balancer_release(&balancer, endpoint, success,
+		    acl_now_ms() - start, time(NULL));
+		pthread_mutex_unlock(&balancer_lock);
+		if (success)
+			break;
+		if (config->general_verbose)
+			fprintf(stderr, "\nllama.cpp endpoint %s failed\n", url);
+	}
+
+	if (status == HTTP_FAILED || status == HTTP_CANCELLED) {
 		free(json_request.ptr);
-		acl_readline_printf("\nllama.cpp API call failed: %s\n",
-		    curl_easy_strerror(res));
+		free(json_response.ptr);
+		acl_readline_printf("\nllama.cpp API call failed: %s\n", error);
 		return NULL;
 	}
 
 	acl_write_log(config, json_response.ptr);
 
+	double parse_start = TRACE_NOW();
 	char *text_response = llamacpp_get_response_content(json_response.ptr);
+	TRACE_SPAN("parse", parse_start);
+	PROBE_RESPONSE_PARSED("llamacpp", json_response.ptr, parse_start);
+	acl_usage_record(config, "llamacpp", NULL);
 	free(json_request.ptr);
 	free(json_response.ptr);
 	return text_response;
 }
+
+// Verify the configuration required for queries
+static bool
+init(config_t *config)
+{
+	REQUIRE(config, llamacpp, endpoint);
+	return acl_balancer_check(config);
+}
+
+// Release the endpoints, so that they are set up anew when next used
+static void
+release(void)
+{
+	pthread_mutex_lock(&balancer_lock);
+	acl_balancer_free(&balancer);
+	pthread_mutex_unlock(&balancer_lock);
+}
+
+ACL_BACKEND(llamacpp, init, acl_fetch_llamacpp, release,
+    .build_request = llamacpp_build_request,
+    .parse_response = llamacpp_get_response_content);
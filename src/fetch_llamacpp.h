@@ -19,8 +19,11 @@
  */
 
 #include "config.h"
+#include "support.h"
 
 #if defined(UNIT_TEST)
 char *llamacpp_get_response_content(const char *json_response);
+size_t llamacpp_build_request(config_t *config, const char *prompt,
+    int history_length, string_t *request);
 #endif
 char *acl_fetch_llamacpp(config_t *config, const char *prompt, int history_length);
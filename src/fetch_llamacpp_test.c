@@ -18,8 +18,14 @@
  *  limitations under the License.
  */
 
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "CuTest.h"
+#include "config.h"
 #include "fetch_llamacpp.h"
+#include "usage.h"
 
 static const char json_response[] = "{"
 	"  \"content\": \"Assistant: shutdown -h now\","
@@ -75,8 +81,34 @@ static const char json_response[] = "{"
 static void
 test_response_parse(CuTest* tc)
 {
+	config_t config = {"bash"};
+
+	// Discard the usage of responses parsed by other tests
+	acl_usage_record(&config, "llamacpp", NULL);
+
 	const char *response = llamacpp_get_response_content(json_response);
 	CuAssertStrEquals(tc, "shutdown -h now", response);
+
+	// The response's token usage is accounted
+	config.usage_enabled = true;
+	config.usage_file = "test-llamacpp.ledger";
+	config.usage_file_set = true;
+	unlink(config.usage_file);
+	acl_usage_record(&config, "llamacpp", NULL);
+
+	ledger_entry_t e;
+	FILE *f = fopen(config.usage_file, "r");
+	char buffer[512];
+	size_t n = fread(buffer, 1, sizeof(buffer) - 1, f);
+	buffer[n] = '\0';
+	fclose(f);
+	CuAssertIntEquals(tc, 1, ledger_parse(buffer, &e, 1));
+	CuAssertIntEquals(tc, 198, e.usage.tokens_in);
+	CuAssertIntEquals(tc, 9, e.usage.tokens_out);
+	CuAssertIntEquals(tc, 136, e.usage.tokens_cached);
+	CuAssertIntEquals(tc, 8, e.usage.timed_tokens);
+	CuAssertTrue(tc, strstr(buffer, " 68.6\n") != NULL);
+	unlink(config.usage_file);
 }
 
 CuSuite*
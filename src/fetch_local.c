@@ -0,0 +1,494 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Local suggestions based on the user's command history.
+ *  Commands are indexed by the tokens of the (commented) prompts
+ *  that preceded them, or by their own tokens, in a fixed-size
+ *  memory-mapped file, so that a suggestion is available
+ *  in microseconds without any network access.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <readline/history.h>
+
+#include "backend.h"
+#include "config.h"
+#include "fetch_local.h"
+#include "support.h"
+#include "unit_test.h"
+
+static const char local_model_name[] = ".aicli-local";
+
+#define LOCAL_MAGIC 0x4c4c4341	// ACLL
+#define LOCAL_VERSION 1
+
+// Default number of commands kept
+#define DEFAULT_ENTRIES 4096
+
+// Longest command that is learned
+#define MAX_COMMAND 240
+
+// Minimum similarity between a prompt and an indexed one
+#define MIN_SCORE 0.5
+
+// A learned command and the prompt tokens it is associated with
+typedef struct {
+	uint32_t tokens[LOCAL_TOKENS];	// Sorted token hashes; 0 if unused
+	uint32_t uses;			// Number of times learned
+	uint32_t stamp;			// Logical time of last update
+	char command[MAX_COMMAND];
+} local_entry_t;
+
+// Layout of the memory-mapped file
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t capacity;		// Number of entries
+	uint32_t count;			// Number of used entries
+	uint32_t clock;			// Logical time of the last update
+	uint32_t padding;
+	uint64_t histfile_offset;	// Part of the history file learned
+	local_entry_t entries[];
+} local_model_t;
+
+static local_model_t *model;
+static size_t model_size;
+static uint32_t model_capacity;	// Entries that fit in the mapping
+static int model_fd = -1;
+
+// Words that carry no information regarding the command
+static const char *stop_words[] = {
+	"a", "an", "and", "are", "for", "from", "i", "in", "is", "it", "me",
+	"my", "of", "on", "please", "the", "to", "with", NULL
+};
+
+static bool
+stop_word(const char *word, size_t len)
+{
+	for (const char **w = stop_words; *w; w++)
+		if (strlen(*w) == len && memcmp(*w, word, len) == 0)
+			return true;
+	return false;
+}
+
+static int
+uint32_compare(const void *a, const void *b)
+{
+	uint32_t ua = *(const uint32_t *)a;
+	uint32_t ub = *(const uint32_t *)b;
+
+	return ua < ub ? -1 : ua > ub;
+}
+
+/*
+ * Split the string s into lowercase words, and store into tokens
+ * the sorted hashes of up to LOCAL_TOKENS distinct ones.
+ * Return the number of tokens stored.
+ */
+STATIC int
+tokenize(const char *s, uint32_t *tokens)
+{
+	int n = 0;
+	char word[64];
+
+	while (*s && n < LOCAL_TOKENS) {
+		size_t len = 0;
+		while (*s && !isalnum((unsigned char)*s))
+			s++;
+		while (*s && (isalnum((unsigned char)*s) || strchr("-_.", *s))) {
+			if (len < sizeof(word))
+				word[len++] = tolower((unsigned char)*s);
+			s++;
+		}
+		if (len == 0 || stop_word(word, len))
+			continue;
+
+		uint32_t h = (uint32_t)acl_hash(word, len);
+		if (h == 0)
+			h = 1;
+		bool seen = false;
+		for (int i = 0; i < n; i++)
+			if (tokens[i] == h)
+				seen = true;
+		if (!seen)
+			tokens[n++] = h;
+	}
+	qsort(tokens, n, sizeof(uint32_t), uint32_compare);
+	for (int i = n; i < LOCAL_TOKENS; i++)
+		tokens[i] = 0;
+	return n;
+}
+
+/*
+ * Return the similarity (Dice coefficient) between the query tokens q
+ * (nq of them) and those of entry e.
+ */
+static double
+similarity(const uint32_t *q, int nq, const local_entry_t *e)
+{
+	int i = 0, j = 0, common = 0, ne = 0;
+
+	while (ne < LOCAL_TOKENS && e->tokens[ne])
+		ne++;
+	while (i < nq && j < ne)
+		if (q[i] < e->tokens[j])
+			i++;
+		else if (q[i] > e->tokens[j])
+			j++;
+		else {
+			common++;
+			i++;
+			j++;
+		}
+	return nq + ne ? 2.0 * common / (nq + ne) : 0;
+}
+
+/*
+ * Return the number of used entries.
+ * Other processes share the mapped file, so its count is not trusted
+ * to lie within the mapping.
+ */
+static uint32_t
+used_entries(void)
+{
+	return model->count < model_capacity ? model->count : model_capacity;
+}
+
+/*
+ * Associate command with the tokens of prompt.
+ * When the model is full, the least recently updated entry is replaced.
+ */
+static void
+add_entry(const char *prompt, const char *command)
+{
+	uint32_t tokens[LOCAL_TOKENS];
+
+	if (strlen(command) >= MAX_COMMAND || tokenize(prompt, tokens) == 0)
+		return;
+
+	local_entry_t *e = NULL;
+	uint32_t count = used_entries();
+	for (uint32_t i = 0; i < count; i++)
+		if (memcmp(model->entries[i].tokens, tokens, sizeof(tokens)) == 0
+		    && strcmp(model->entries[i].command, command) == 0) {
+			e = &model->entries[i];
+			break;
+		}
+
+	if (!e) {
+		if (count < model_capacity) {
+			e = &model->entries[count];
+			model->count = count + 1;
+		} else {
+			e = &model->entries[0];
+			for (uint32_t i = 1; i < count; i++)
+				if (model->entries[i].stamp < e->stamp)
+					e = &model->entries[i];
+		}
+		memcpy(e->tokens, tokens, sizeof(tokens));
+		strcpy(e->command, command);
+		e->uses = 0;
+	}
+	e->uses++;
+	e->stamp = ++model->clock;
+}
+
+/*
+ * Learn from the specified history line.
+ * Commented lines are prompts; the command following a prompt is
+ * associated with it.  Other commands are associated with their
+ * own tokens.  The pending prompt is kept in *pending.
+ */
+static void
+learn_line(config_t *config, const char *line, char **pending)
+{
+	if (config->prompt_comment_set) {
+		size_t len = strlen(config->prompt_comment);
+		if (strncmp(line, config->prompt_comment, len) == 0) {
+			const char *p = line + len;
+			// Skip Bash history timestamps, such as #1712345678
+			if (strspn(p, "0123456789") == strlen(p))
+				return;
+			while (isspace((unsigned char)*p))
+				p++;
+			free(*pending);
+			*pending = *p ? acl_safe_strdup(p) : NULL;
+			return;
+		}
+	}
+	if (*line == '\0')
+		return;
+	add_entry(*pending ? *pending : line, line);
+	free(*pending);
+	*pending = NULL;
+}
+
+// Learn from the lines of the in-memory readline history
+static void
+learn_history_list(config_t *config)
+{
+	HIST_ENTRY **list = history_list();
+	char *pending = NULL;
+
+	for (int i = 0; list && list[i]; i++)
+		learn_line(config, list[i]->line, &pending);
+	free(pending);
+}
+
+/*
+ * Learn from the lines added to the history file since it was
+ * last processed.
+ */
+static void
+learn_history_file(config_t *config)
+{
+	const char *histfile = getenv("HISTFILE");
+	char *default_histfile = NULL;
+
+	if (!histfile && strcmp(config->program_name, "bash") == 0
+	    && getenv("HOME")) {
+		acl_safe_asprintf(&default_histfile, "%s/.bash_history",
+		    getenv("HOME"));
+		histfile = default_histfile;
+	}
+	FILE *f = histfile ? fopen(histfile, "r") : NULL;
+	free(default_histfile);
+	if (!f)
+		return;
+
+	struct stat st;
+	if (fstat(fileno(f), &st) == 0 && (uint64_t)st.st_size >= model->histfile_offset)
+		fseeko(f, model->histfile_offset, SEEK_SET);
+
+	char *line = NULL, *pending = NULL;
+	size_t size = 0;
+	ssize_t len;
+	while ((len = getline(&line, &size, f)) != -1) {
+		if (len > 0 && line[len - 1] == '\n')
+			line[len - 1] = '\0';
+		learn_line(config, line, &pending);
+	}
+	model->histfile_offset = ftello(f);
+	free(line);
+	free(pending);
+	fclose(f);
+}
+
+/*
+ * Open the model file at path and lock it exclusively.
+ * Retry if the file was replaced while waiting for the lock.
+ * Return its descriptor or -1 on error.
+ */
+static int
+open_locked(const char *path)
+{
+	for (;;) {
+		int fd = open(path, O_RDWR | O_CREAT, 0600);
+		if (fd == -1)
+			return -1;
+		flock(fd, LOCK_EX);
+
+		struct stat fd_st, path_st;
+		if (fstat(fd, &fd_st) == -1 || stat(path, &path_st) == -1
+		    || (fd_st.st_dev == path_st.st_dev
+		    && fd_st.st_ino == path_st.st_ino))
+			return fd;
+		close(fd);
+	}
+}
+
+/*
+ * Replace the model file at path with a zeroed one of the specified size.
+ * Other processes may have the existing file mapped, and truncating it
+ * would deliver them SIGBUS, so the new file is renamed over it.
+ * Return its descriptor, locked exclusively, or -1 on error.
+ */
+static int
+replace_model(const char *path, size_t size)
+{
+	char *tmp_path;
+	acl_safe_asprintf(&tmp_path, "%s.XXXXXX", path);
+
+	int fd = mkstemp(tmp_path);
+	if (fd != -1 && (flock(fd, LOCK_EX) == -1 || ftruncate(fd, size) == -1
+	    || rename(tmp_path, path) == -1)) {
+		unlink(tmp_path);
+		close(fd);
+		fd = -1;
+	}
+	free(tmp_path);
+	return fd;
+}
+
+/*
+ * Map the model file into memory, creating it if needed, and
+ * update it with any new history file lines.
+ * Return true on success.
+ */
+static bool
+open_model(config_t *config)
+{
+	if (model)
+		return true;
+
+	char *path;
+	if (config->local_file_set)
+		path = acl_safe_strdup(config->local_file);
+	else if (getenv("HOME"))
+		acl_safe_asprintf(&path, "%s/%s", getenv("HOME"), local_model_name);
+	else
+		return false;
+
+	uint32_t capacity = config->local_entries_set && config->local_entries > 0 ?
+	    config->local_entries : DEFAULT_ENTRIES;
+	model_size = sizeof(local_model_t) + capacity * sizeof(local_entry_t);
+
+	model_fd = open_locked(path);
+	// Recreate missing or incompatible models
+	local_model_t header;
+	struct stat st;
+	bool created = model_fd != -1
+	    && (pread(model_fd, &header, sizeof(header), 0) != sizeof(header)
+	    || header.magic != LOCAL_MAGIC || header.version != LOCAL_VERSION
+	    || header.capacity != capacity || header.count > capacity
+	    || fstat(model_fd, &st) == -1 || (size_t)st.st_size < model_size);
+	if (created) {
+		int fd = replace_model(path, model_size);
+		close(model_fd);
+		model_fd = fd;
+	}
+	if (model_fd == -1) {
+		if (config->general_verbose)
+			fprintf(stderr, "\nUnable to open %s\n", path);
+		free(path);
+		return false;
+	}
+	free(path);
+
+	if ((model = mmap(NULL, model_size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED, model_fd, 0)) == MAP_FAILED) {
+		model = NULL;
+		flock(model_fd, LOCK_UN);
+		close(model_fd);
+		return false;
+	}
+
+	model_capacity = capacity;
+	if (created) {
+		model->magic = LOCAL_MAGIC;
+		model->version = LOCAL_VERSION;
+		model->capacity = capacity;
+		learn_history_list(config);
+	}
+	learn_history_file(config);
+	flock(model_fd, LOCK_UN);
+	return true;
+}
+
+// Unmap the model file
+void
+acl_local_close(void)
+{
+	if (!model)
+		return;
+	munmap(model, model_size);
+	close(model_fd);
+	model = NULL;
+}
+
+/*
+ * Return the command best matching the specified prompt in dynamically
+ * allocated memory, or NULL if no suitable command is known.
+ * A prompt that is a prefix of a known command is completed to it.
+ */
+char *
+acl_local_suggest(config_t *config, const char *prompt)
+{
+	uint32_t tokens[LOCAL_TOKENS];
+	int n;
+
+	if (!open_model(config) || (n = tokenize(prompt, tokens)) == 0)
+		return NULL;
+
+	char *result = NULL;
+	flock(model_fd, LOCK_SH);
+	local_entry_t *best = NULL;
+	double best_score = MIN_SCORE;
+	uint32_t count = used_entries();
+	for (uint32_t i = 0; i < count; i++) {
+		local_entry_t *e = &model->entries[i];
+		double score = similarity(tokens, n, e);
+		if (score > best_score || (score == best_score && best
+		    && e->uses > best->uses)) {
+			best = e;
+			best_score = score;
+		}
+	}
+
+	if (!best) {
+		size_t len = strlen(prompt);
+		for (uint32_t i = 0; i < count; i++) {
+			local_entry_t *e = &model->entries[i];
+			if (len < MAX_COMMAND && strncmp(e->command, prompt, len) == 0
+			    && (!best || e->uses > best->uses))
+				best = e;
+		}
+	}
+	if (best)
+		result = acl_range_strdup(best->command, best->command
+		    + strnlen(best->command, MAX_COMMAND));
+	flock(model_fd, LOCK_UN);
+	return result;
+}
+
+// Associate the specified command with the given prompt
+void
+acl_local_learn(config_t *config, const char *prompt, const char *command)
+{
+	if (!open_model(config))
+		return;
+	flock(model_fd, LOCK_EX);
+	add_entry(prompt, command);
+	flock(model_fd, LOCK_UN);
+}
+
+/*
+ * Fetch a response from the local history-based model.
+ * This endpoint provides instant suggestions without network access.
+ */
+char *
+acl_fetch_local(config_t *config, const char *prompt, int history_length)
+{
+	if (config->general_verbose)
+		fprintf(stderr, "\nConsulting local history model...\n");
+	char *response = acl_local_suggest(config, prompt);
+	if (!response)
+		acl_readline_printf("\nNo local suggestion available.\n");
+	return response;
+}
+
+ACL_BACKEND(local, NULL, acl_fetch_local, NULL);
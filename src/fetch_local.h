@@ -0,0 +1,35 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Local suggestions based on the user's command history
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdint.h>
+
+#include "config.h"
+
+// Maximum number of distinct tokens kept for each prompt
+#define LOCAL_TOKENS 8
+
+#if defined(UNIT_TEST)
+int tokenize(const char *s, uint32_t *tokens);
+#endif
+
+char *acl_fetch_local(config_t *config, const char *prompt, int history_length);
+char *acl_local_suggest(config_t *config, const char *prompt);
+void acl_local_learn(config_t *config, const char *prompt, const char *command);
+void acl_local_close(void);
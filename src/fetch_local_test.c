@@ -0,0 +1,224 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test local history-based suggestions.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "config.h"
+#include "fetch_local.h"
+
+static const char model_file[] = "test-local.model";
+static const char history_file[] = "test-local.history";
+
+// Return a configuration for a small local model
+static config_t *
+local_config(void)
+{
+	static config_t config = {"bash"};
+
+	config.local_file = model_file;
+	config.local_file_set = true;
+	config.local_entries = 3;
+	config.local_entries_set = true;
+	config.prompt_comment = "#";
+	config.prompt_comment_set = true;
+	return &config;
+}
+
+static void
+test_tokenize(CuTest* tc)
+{
+	uint32_t a[LOCAL_TOKENS], b[LOCAL_TOKENS];
+
+	CuAssertIntEquals(tc, 2, tokenize("List the files", a));
+	CuAssertIntEquals(tc, 2, tokenize("files, list!", b));
+	CuAssertTrue(tc, a[0] == b[0] && a[1] == b[1] && a[2] == 0);
+	CuAssertIntEquals(tc, 1, tokenize("a b b b", a));
+	CuAssertIntEquals(tc, LOCAL_TOKENS, tokenize("1 2 3 4 5 6 7 8 9 10", a));
+}
+
+static void
+test_learn_suggest(CuTest* tc)
+{
+	config_t *config = local_config();
+	char *s;
+
+	unlink(model_file);
+	acl_local_learn(config, "list files by size", "ls -S");
+	acl_local_learn(config, "show disk usage", "du -sh .");
+
+	s = acl_local_suggest(config, "list the files by size");
+	CuAssertStrEquals(tc, "ls -S", s);
+	free(s);
+	CuAssertTrue(tc, acl_local_suggest(config, "shutdown the server") == NULL);
+
+	// Completion of command prefixes
+	s = acl_local_suggest(config, "du -s");
+	CuAssertStrEquals(tc, "du -sh .", s);
+	free(s);
+
+	// The least recently learned entry is replaced
+	acl_local_learn(config, "list files by size", "ls -S");
+	acl_local_learn(config, "current date", "date");
+	acl_local_learn(config, "current time", "date +%T");
+	CuAssertTrue(tc, acl_local_suggest(config, "show disk usage") == NULL);
+
+	// Persistence across mappings
+	acl_local_close();
+	s = acl_local_suggest(config, "size listing of files");
+	CuAssertStrEquals(tc, "ls -S", s);
+	free(s);
+	acl_local_close();
+	unlink(model_file);
+}
+
+static void
+test_learn_histfile(CuTest* tc)
+{
+	config_t *config = local_config();
+	char *s;
+
+	FILE *f = fopen(history_file, "w");
+	fputs("#1712345678\n# count lines in c files\nwc -l *.c\nmake\n", f);
+	fclose(f);
+	setenv("HISTFILE", history_file, 1);
+	unlink(model_file);
+
+	s = acl_local_suggest(config, "count c file lines");
+	CuAssertStrEquals(tc, "wc -l *.c", s);
+	free(s);
+	s = acl_local_suggest(config, "make");
+	CuAssertStrEquals(tc, "make", s);
+	free(s);
+
+	// Lines appended to the history file are learned incrementally
+	acl_local_close();
+	f = fopen(history_file, "a");
+	fputs("# show the current branch\ngit branch --show-current\n", f);
+	fclose(f);
+	s = acl_local_suggest(config, "show current git branch");
+	CuAssertStrEquals(tc, "git branch --show-current", s);
+	free(s);
+
+	acl_local_close();
+	unsetenv("HISTFILE");
+	unlink(history_file);
+	unlink(model_file);
+}
+
+static void
+test_capacity_change(CuTest* tc)
+{
+	config_t *config = local_config();
+	struct stat st;
+	char *s;
+
+	unlink(model_file);
+	acl_local_learn(config, "list files by size", "ls -S");
+	acl_local_close();
+
+	// Another process keeps the model mapped
+	FILE *f = fopen(model_file, "r");
+	CuAssertTrue(tc, f != NULL && fstat(fileno(f), &st) == 0);
+	size_t other_size = st.st_size;
+	char *other = mmap(NULL, other_size, PROT_READ, MAP_SHARED,
+	    fileno(f), 0);
+	fclose(f);
+	CuAssertTrue(tc, other != MAP_FAILED);
+
+	// Using a different capacity replaces the model
+	config->local_entries = 5;
+	CuAssertTrue(tc, acl_local_suggest(config, "list files by size") == NULL);
+	acl_local_close();
+	CuAssertIntEquals(tc, 0, stat(model_file, &st));
+	CuAssertTrue(tc, (size_t)st.st_size > other_size);
+
+	// The existing mapping remains accessible
+	CuAssertTrue(tc, memmem(other, other_size, "ls -S", 5) != NULL);
+	munmap(other, other_size);
+
+	acl_local_learn(config, "show disk usage", "du -sh .");
+	acl_local_close();
+	s = acl_local_suggest(config, "show disk usage");
+	CuAssertStrEquals(tc, "du -sh .", s);
+	free(s);
+	acl_local_close();
+	config->local_entries = 3;
+	unlink(model_file);
+}
+
+static void
+test_invalid_model(CuTest* tc)
+{
+	config_t *config = local_config();
+	struct stat st;
+	char *s;
+
+	unlink(model_file);
+	acl_local_learn(config, "list files by size", "ls -S");
+	acl_local_close();
+
+	// A count beyond the capacity replaces the model
+	FILE *f = fopen(model_file, "r+");
+	CuAssertPtrNotNull(tc, f);
+	uint32_t count = 1000000;
+	CuAssertTrue(tc, fseek(f, 3 * sizeof(uint32_t), SEEK_SET) == 0);
+	CuAssertTrue(tc, fwrite(&count, sizeof(count), 1, f) == 1);
+	fclose(f);
+	CuAssertTrue(tc, acl_local_suggest(config, "list files by size") == NULL);
+	acl_local_close();
+
+	// So does a truncated file
+	acl_local_learn(config, "list files by size", "ls -S");
+	acl_local_close();
+	CuAssertIntEquals(tc, 0, stat(model_file, &st));
+	CuAssertIntEquals(tc, 0, truncate(model_file, st.st_size / 2));
+	CuAssertTrue(tc, acl_local_suggest(config, "list files by size") == NULL);
+	acl_local_close();
+	CuAssertIntEquals(tc, 0, stat(model_file, &st));
+
+	acl_local_learn(config, "list files by size", "ls -S");
+	s = acl_local_suggest(config, "list files by size");
+	CuAssertStrEquals(tc, "ls -S", s);
+	free(s);
+	acl_local_close();
+	unlink(model_file);
+}
+
+CuSuite*
+cu_fetch_local_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_tokenize);
+	SUITE_ADD_TEST(suite, test_learn_suggest);
+	SUITE_ADD_TEST(suite, test_learn_histfile);
+	SUITE_ADD_TEST(suite, test_capacity_change);
+	SUITE_ADD_TEST(suite, test_invalid_model);
+
+	return suite;
+}
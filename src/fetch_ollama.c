@@ -0,0 +1,438 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Ollama API access.
+ *  The native chat API allows keeping the model loaded between
+ *  queries.  Responses are streamed, so that the transfer can stop
+ *  once the first line of the response has arrived, and so that
+ *  background queries can report the text received so far.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curl/curl.h>
+#include <readline/history.h>
+#include <jansson.h>
+
+#include "backend.h"
+#include "config.h"
+#include "context.h"
+#include "fetch_ollama.h"
+#include "http.h"
+#include "log.h"
+#include "support.h"
+#include "trace.h"
+#include "unit_test.h"
+#include "usage.h"
+
+// Return true if the string s contains a non-space character before end
+static bool
+has_text(const char *s, const char *end)
+{
+	for (; s < end; s++)
+		if (!isspace((unsigned char)*s))
+			return true;
+	return false;
+}
+
+// Process a line of the NDJSON response stream
+static void
+stream_line(stream_t *s, const char *line)
+{
+	json_error_t error;
+	json_t *root = json_loads(line, 0, &error);
+	if (!root) {
+		acl_safe_asprintf(&s->error, "JSON error: on line %d: %s",
+		    error.line, error.text);
+		s->done = true;
+		return;
+	}
+
+	json_t *e = json_object_get(root, "error");
+	if (e) {
+		s->error = acl_safe_strdup(json_is_string(e) ?
+		    json_string_value(e) : line);
+		s->done = true;
+	}
+	json_t *message = json_object_get(root, "message");
+	const char *content = json_string_value(json_object_get(message, "content"));
+	if (content) {
+		acl_string_append(&s->content, content);
+		// Only the response's first non-blank line is used
+		const char *text = s->content.ptr;
+		while (isspace((unsigned char)*text))
+			text++;
+		if (*text && strchr(text, '\n'))
+			s->done = true;
+		else if (*text && acl_partial)
+			acl_partial(text);
+	}
+	if (json_is_true(json_object_get(root, "done"))) {
+		// Durations are in nanoseconds
+		usage_t u = {
+			.tokens_in = json_integer_value(json_object_get(root,
+			    "prompt_eval_count")),
+			.tokens_out = json_integer_value(json_object_get(root,
+			    "eval_count")),
+			.timed_ms = json_number_value(json_object_get(root,
+			    "eval_duration")) / 1e6,
+		};
+		if (u.timed_ms)
+			u.timed_tokens = u.tokens_out;
+		acl_usage_add(&u);
+		s->done = true;
+	}
+	json_decref(root);
+}
+
+/*
+ * Process the specified data of the NDJSON response stream arg.
+ * Return false when no more data is needed.
+ */
+STATIC bool
+ollama_stream_write(const char *data, size_t len, void *arg)
+{
+	stream_t *s = arg;
+	const char *end = data + len;
+
+	while (!s->done && data < end) {
+		const char *nl = memchr(data, '\n', end - data);
+		const char *line_end = nl ? nl : end;
+		acl_string_write((void *)data, 1, line_end - data, &s->line);
+		data = line_end;
+		if (!nl)
+			break;
+		data++;
+		if (has_text(s->line.ptr, s->line.ptr + s->line.len))
+			stream_line(s, s->line.ptr);
+		s->line.len = 0;
+		s->line.ptr[0] = '\0';
+	}
+	return !s->done;
+}
+
+/*
+ * Process the last line of the NDJSON response stream s, which lacks
+ * a newline, as in the error responses of non-streamed requests.
+ */
+STATIC void
+ollama_stream_end(stream_t *s)
+{
+	if (!s->done && has_text(s->line.ptr, s->line.ptr + s->line.len))
+		stream_line(s, s->line.ptr);
+	s->line.len = 0;
+	s->line.ptr[0] = '\0';
+}
+
+// Return the state of a new response stream
+static void *
+stream_new(void)
+{
+	stream_t *s = calloc(1, sizeof(stream_t));
+	if (!s)
+		acl_errorf("memory allocation failed.");
+	acl_string_init(&s->line, "");
+	acl_string_init(&s->content, "");
+	return s;
+}
+
+// Return the first non-blank line of the specified content
+static char *
+first_line(const char *content)
+{
+	const char *start = content + strspn(content, " \t\r\n");
+	return acl_range_strdup(start, start + strcspn(start, "\r\n"));
+}
+
+/*
+ * Return the response text received by the stream arg, or NULL if
+ * an error was reported, and free the stream.
+ */
+static char *
+stream_end(void *arg)
+{
+	stream_t *s = arg;
+
+	ollama_stream_end(s);
+	char *text = s->error ? NULL : first_line(s->content.ptr);
+	free(s->line.ptr);
+	free(s->content.ptr);
+	free(s->error);
+	free(s);
+	return text;
+}
+
+// libcurl adapter of ollama_stream_write
+static size_t
+curl_stream_write(void *data, size_t size, size_t nmemb, void *arg)
+{
+	size_t bytes = size * nmemb;
+
+	// Returning a different count aborts the transfer
+	return ollama_stream_write(data, bytes, arg) ? bytes : 0;
+}
+
+/*
+ * Post the request to the configured endpoint, passing the streamed
+ * response to s.
+ * Return the response's status code, HTTP_FAILED with error set, or
+ * HTTP_CANCELLED.
+ */
+static int
+post(config_t *config, const char *request, stream_t *s, const char **error)
+{
+	const char *url = config->ollama_endpoint;
+
+	if (acl_http_supported(config, url)) {
+		*error = "connection to the local server failed";
+		return acl_http_post_stream(config, url, request,
+		    ollama_stream_write, s);
+	}
+
+	static __thread struct curl_slist *headers;
+	if (curl_initialize(config) < 0) {
+		*error = "libcurl initialization failed";
+		return HTTP_FAILED;
+	}
+	if (!headers)
+		headers = curl_slist_append(NULL, "Content-Type: application/json");
+	curl_easy_setopt(acl_curl, CURLOPT_URL, url);
+	curl_easy_setopt(acl_curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(acl_curl, CURLOPT_WRITEFUNCTION, curl_stream_write);
+	curl_easy_setopt(acl_curl, CURLOPT_WRITEDATA, s);
+	curl_easy_setopt(acl_curl, CURLOPT_POSTFIELDS, request);
+	CURLcode res = curl_easy_perform(acl_curl);
+	TRACE_CURL(acl_curl);
+	if (res == CURLE_ABORTED_BY_CALLBACK)
+		return HTTP_CANCELLED;
+	// A transfer stopped by the write function is complete
+	if (res != CURLE_OK && !(res == CURLE_WRITE_ERROR && s->done)) {
+		*error = curl_easy_strerror(res);
+		return HTTP_FAILED;
+	}
+	long status = 0;
+	curl_easy_getinfo(acl_curl, CURLINFO_RESPONSE_CODE, &status);
+	return status;
+}
+
+// Append to the request the settings common to all requests
+static void
+append_settings(config_t *config, string_t *request)
+{
+	acl_string_appendf(request, "  \"model\": %s,\n",
+	    acl_json_escape(config->ollama_model));
+	if (config->ollama_keep_alive_set) {
+		// Numbers are seconds; strings are durations, such as 30m
+		const char *k = config->ollama_keep_alive;
+		if (acl_strtocard(k) >= 0 || (k[0] == '-' && acl_strtocard(k + 1) >= 0))
+			acl_string_appendf(request, "  \"keep_alive\": %s,\n", k);
+		else
+			acl_string_appendf(request, "  \"keep_alive\": %s,\n",
+			    acl_json_escape(k));
+	}
+}
+
+/*
+ * Build in request the JSON request for the provided prompt, with
+ * n-shot prompts, history prompts, and the shell environment as context.
+ * Return the length of its prefix that is the same across queries.
+ */
+STATIC size_t
+ollama_build_request(config_t *config, const char *prompt,
+    int history_length, string_t *request)
+{
+	acl_string_init(request, "{\n");
+	append_settings(config, request);
+	acl_string_append(request, "  \"stream\": true,\n");
+
+	acl_string_append(request, "  \"options\": {");
+	const char *separator = "";
+	if (config->ollama_num_ctx_set) {
+		acl_string_appendf(request, "\"num_ctx\": %d",
+		    config->ollama_num_ctx);
+		separator = ", ";
+	}
+	if (config->ollama_num_predict_set) {
+		acl_string_appendf(request, "%s\"num_predict\": %d",
+		    separator, config->ollama_num_predict);
+		separator = ", ";
+	}
+	if (config->ollama_temperature_set)
+		acl_string_appendf(request, "%s\"temperature\": %g",
+		    separator, config->ollama_temperature);
+	acl_string_append(request, "},\n");
+
+	acl_string_append(request, "  \"messages\": [\n");
+
+	char *system_role = acl_system_role_get(config);
+	acl_string_appendf(request,
+	    "    {\"role\": \"system\", \"content\": %s},\n",
+	    acl_json_escape(system_role));
+	free(system_role);
+
+	// Add user and assistant n-shot prompts
+	for (int i = 0; i < NPROMPTS; i++) {
+		if (config->prompt_user[i])
+			acl_string_appendf(request,
+			    "    {\"role\": \"user\", \"content\": %s},\n",
+			    acl_json_escape(config->prompt_user[i]));
+		if (config->prompt_assistant[i])
+			acl_string_appendf(request,
+			    "    {\"role\": \"assistant\", \"content\": %s},\n",
+			    acl_json_escape(config->prompt_assistant[i]));
+	}
+
+	// The log records this static prefix once
+	size_t prefix_len = request->len;
+
+	// Add history prompts as context
+	for (int i = config->prompt_context - 1; i >= 0; --i) {
+		HIST_ENTRY *h = history_get(history_length - 1 - i);
+		if (h == NULL || h->line == NULL || h->line[0] == '\0')
+			continue;
+		acl_string_appendf(request,
+		    "    {\"role\": \"user\", \"content\": %s},\n",
+		    acl_json_escape(h->line));
+	}
+
+	// Add the shell environment as context
+	double context_start = TRACE_NOW();
+	char *context = acl_context_get(config);
+	TRACE_SPAN("context", context_start);
+	if (context) {
+		acl_string_appendf(request,
+		    "    {\"role\": \"system\", \"content\": %s},\n",
+		    acl_json_escape(context));
+		free(context);
+	}
+
+	// Finally, add the user prompt
+	acl_string_appendf(request,
+	    "    {\"role\": \"user\", \"content\": %s}\n", acl_json_escape(prompt));
+	acl_string_append(request, "  ]\n}\n");
+	return prefix_len;
+}
+
+/*
+ * Fetch response from the Ollama API given the provided prompt.
+ * Provide context in the form of n-shot prompts and history prompts.
+ */
+char *
+acl_fetch_ollama(config_t *config, const char *prompt, int history_length)
+{
+	if (acl_json_initialize(config) < 0)
+		return NULL;
+
+	if (config->general_verbose)
+		fprintf(stderr, "\nContacting Ollama API...\n");
+
+	double build_start = TRACE_NOW();
+	string_t json_request;
+	size_t prefix_len = ollama_build_request(config, prompt, history_length,
+	    &json_request);
+
+	acl_write_log_request(config, json_request.ptr, prefix_len);
+	TRACE_SPAN("build", build_start);
+	PROBE_REQUEST_BUILT("ollama", json_request.ptr, build_start);
+
+	stream_t s = {0};
+	acl_string_init(&s.line, "");
+	acl_string_init(&s.content, "");
+	const char *error = NULL;
+	int status = post(config, json_request.ptr, &s, &error);
+	free(json_request.ptr);
+	if (status != HTTP_FAILED && status != HTTP_CANCELLED)
+		ollama_stream_end(&s);
+	free(s.line.ptr);
+
+	char *text_response = NULL;
+	if (status == HTTP_FAILED)
+		acl_readline_printf("\nOllama API call failed: %s\n", error);
+	else if (s.error)
+		acl_readline_printf("\nOllama API invocation error: %s\n", s.error);
+	else if (status != HTTP_CANCELLED && status / 100 != 2)
+		acl_readline_printf("\nOllama API call failed with HTTP "
+		    "status %d\n", status);
+	else if (status != HTTP_CANCELLED) {
+		acl_write_log(config, s.content.ptr);
+		acl_usage_record(config, "ollama", config->ollama_model);
+		text_response = first_line(s.content.ptr);
+	}
+	free(s.error);
+	free(s.content.ptr);
+	return text_response;
+}
+
+// Thread loading the model in the background
+static void *
+preload(void *arg)
+{
+	static atomic_bool never_cancelled;
+	config_t *config = arg;
+
+	// Suppress messages, as for other background queries
+	acl_cancel_flag = &never_cancelled;
+	if (acl_json_initialize(config) < 0)
+		return NULL;
+
+	// A request without messages loads the model
+	string_t json_request;
+	acl_string_init(&json_request, "{\n");
+	append_settings(config, &json_request);
+	acl_string_append(&json_request, "  \"messages\": []\n}\n");
+
+	stream_t s = {0};
+	acl_string_init(&s.line, "");
+	acl_string_init(&s.content, "");
+	const char *error;
+	post(config, json_request.ptr, &s, &error);
+	acl_http_close();
+	free(json_request.ptr);
+	free(s.line.ptr);
+	free(s.content.ptr);
+	free(s.error);
+	return NULL;
+}
+
+/*
+ * Verify the configuration required for queries.
+ * If configured, have the server load the model in the background,
+ * so that the first query doesn't wait for it.
+ */
+static bool
+init(config_t *config)
+{
+	REQUIRE(config, ollama, endpoint);
+	REQUIRE(config, ollama, model);
+
+	pthread_t thread;
+	if (config->ollama_preload
+	    && pthread_create(&thread, NULL, preload, config) == 0)
+		pthread_detach(thread);
+	return true;
+}
+
+ACL_BACKEND(ollama, init, acl_fetch_ollama, NULL,
+    .build_request = ollama_build_request,
+    .stream_new = stream_new,
+    .stream_chunk = ollama_stream_write,
+    .stream_end = stream_end);
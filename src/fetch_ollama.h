@@ -0,0 +1,44 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Ollama API access
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "config.h"
+#include "support.h"
+
+// State of a streamed response
+typedef struct {
+	string_t line;		// Incomplete line received
+	string_t content;	// Message content received
+	char *error;		// Reported error
+	bool done;		// No more content is needed
+} stream_t;
+
+#if defined(UNIT_TEST)
+bool ollama_stream_write(const char *data, size_t len, void *arg);
+void ollama_stream_end(stream_t *s);
+size_t ollama_build_request(config_t *config, const char *prompt,
+    int history_length, string_t *request);
+#endif
+
+char *acl_fetch_ollama(config_t *config, const char *prompt, int history_length);
@@ -0,0 +1,199 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test the Ollama API access.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "config.h"
+#include "fetch_ollama.h"
+
+static const char socket_path[] = "test-ollama.sock";
+
+// Seconds after which the mock server exits
+#define MOCK_TIMEOUT 10
+
+// Response reported through acl_partial
+static char partial_response[64];
+
+static void
+record_partial(const char *response)
+{
+	snprintf(partial_response, sizeof(partial_response), "%s", response);
+}
+
+static void
+test_stream_write(CuTest* tc)
+{
+	stream_t s = {0};
+
+	acl_partial = record_partial;
+	acl_string_init(&s.line, "");
+	acl_string_init(&s.content, "");
+	CuAssertTrue(tc, ollama_stream_write("{\"message\":{\"content\":\"\\nls\"}}\n"
+	    "{\"message\":{\"con", 47, &s));
+	CuAssertStrEquals(tc, "\nls", s.content.ptr);
+	CuAssertStrEquals(tc, "ls", partial_response);
+	// The transfer stops once the first line is complete
+	CuAssertTrue(tc, !ollama_stream_write("tent\":\" -l\\nwc\"}}\n{", 19, &s));
+	CuAssertStrEquals(tc, "\nls -l\nwc", s.content.ptr);
+	CuAssertTrue(tc, s.done && !s.error);
+	CuAssertStrEquals(tc, "ls", partial_response);
+	acl_partial = NULL;
+	free(s.line.ptr);
+	free(s.content.ptr);
+
+	memset(&s, 0, sizeof(s));
+	acl_string_init(&s.line, "");
+	acl_string_init(&s.content, "");
+	CuAssertTrue(tc, !ollama_stream_write("{\"error\":\"model not found\"}\n", 28, &s));
+	CuAssertStrEquals(tc, "model not found", s.error);
+	free(s.error);
+	free(s.line.ptr);
+	free(s.content.ptr);
+
+	// Responses to failed requests lack a final newline
+	memset(&s, 0, sizeof(s));
+	acl_string_init(&s.line, "");
+	acl_string_init(&s.content, "");
+	CuAssertTrue(tc, ollama_stream_write("{\"error\":\"model not found\"}", 27, &s));
+	CuAssertTrue(tc, s.error == NULL);
+	ollama_stream_end(&s);
+	CuAssertStrEquals(tc, "model not found", s.error);
+	CuAssertIntEquals(tc, 0, s.line.len);
+	free(s.error);
+	free(s.line.ptr);
+	free(s.content.ptr);
+}
+
+/*
+ * Serve on the listening socket fd a single streamed chat response or,
+ * if missing_model is true, the error of a missing model.
+ */
+static void
+mock_server(int fd, bool missing_model)
+{
+	char request[65536];
+	size_t len = 0;
+	int c = accept(fd, NULL, NULL);
+	ssize_t n;
+
+	// Read until the JSON body's end
+	while ((n = read(c, request + len, sizeof(request) - len - 1)) > 0) {
+		len += n;
+		request[len] = '\0';
+		if (strstr(request, "]\n}\n"))
+			break;
+	}
+
+	bool ok = strstr(request, "POST /api/chat HTTP/1.1\r\n")
+	    && strstr(request, "\"keep_alive\": \"30m\"")
+	    && strstr(request, "\"num_predict\": 32")
+	    && strstr(request, "\"stream\": true");
+	const char *lines[] = {
+		"{\"message\":{\"role\":\"assistant\",\"content\":\"ls\"},\"done\":false}\n",
+		ok ? "{\"message\":{\"role\":\"assistant\",\"content\":\" -l\"},\"done\":false}\n" :
+		    "{\"error\":\"unexpected request\"}\n",
+		"{\"message\":{\"role\":\"assistant\",\"content\":\"\"},\"done\":true}\n",
+	};
+	if (missing_model) {
+		const char *body = "{\"error\":\"model \\\"test\\\" not found\"}";
+		dprintf(c, "HTTP/1.1 404 Not Found\r\n"
+		    "Content-Type: application/json\r\n"
+		    "Content-Length: %zu\r\n\r\n%s", strlen(body), body);
+		close(c);
+		return;
+	}
+	dprintf(c, "HTTP/1.1 200 OK\r\n"
+	    "Content-Type: application/x-ndjson\r\n"
+	    "Transfer-Encoding: chunked\r\n\r\n");
+	for (int i = 0; i < 3; i++)
+		dprintf(c, "%zx\r\n%s\r\n", strlen(lines[i]), lines[i]);
+	dprintf(c, "0\r\n\r\n");
+	close(c);
+}
+
+// Return the response obtained from a mock server
+static char *
+fetch_mock(CuTest* tc, bool missing_model)
+{
+	config_t config = {"bash"};
+	char endpoint[64];
+
+	unlink(socket_path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un sa = {.sun_family = AF_UNIX};
+	strcpy(sa.sun_path, socket_path);
+	CuAssertTrue(tc, bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0);
+	CuAssertTrue(tc, listen(fd, 1) == 0);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		// Don't outlive a failed test waiting for a connection
+		alarm(MOCK_TIMEOUT);
+		mock_server(fd, missing_model);
+		_exit(0);
+	}
+	close(fd);
+
+	snprintf(endpoint, sizeof(endpoint), "unix:%s:/api/chat", socket_path);
+	config.prompt_system = "Provide %s commands.";
+	config.ollama_endpoint = endpoint;
+	config.ollama_model = "test";
+	config.ollama_keep_alive = "30m";
+	config.ollama_keep_alive_set = true;
+	config.ollama_num_predict = 32;
+	config.ollama_num_predict_set = true;
+	char *response = acl_fetch_ollama(&config, "list files", 0);
+
+	// The server remains waiting if no connection was made
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	unlink(socket_path);
+	return response;
+}
+
+static void
+test_fetch_mock(CuTest* tc)
+{
+	char *response = fetch_mock(tc, false);
+	CuAssertStrEquals(tc, "ls -l", response);
+	free(response);
+
+	// An error response isn't taken as an empty suggestion
+	CuAssertTrue(tc, fetch_mock(tc, true) == NULL);
+}
+
+CuSuite*
+cu_fetch_ollama_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_stream_write);
+	SUITE_ADD_TEST(suite, test_fetch_mock);
+
+	return suite;
+}
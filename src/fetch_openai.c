@@ -25,9 +25,15 @@
 #include <readline/history.h>
 #include <jansson.h>
 
+#include "backend.h"
+#include "candidates.h"
 #include "config.h"
+#include "context.h"
+#include "log.h"
 #include "support.h"
+#include "trace.h"
 #include "unit_test.h"
+#include "usage.h"
 
 static char *authorization;
 
@@ -49,6 +55,23 @@ openai_get_response_content(const char *json_response)
 		json_t *message = json_object_get(first_choice, "message");
 		json_t *content = json_object_get(message, "content");
 		ret = acl_safe_strdup(json_string_value(content));
+		// Additional choices requested through n
+		for (size_t i = 1; i < json_array_size(choices); i++) {
+			message = json_object_get(json_array_get(choices, i), "message");
+			content = json_object_get(message, "content");
+			acl_candidates_add(json_string_value(content));
+		}
+		json_t *usage = json_object_get(root, "usage");
+		usage_t u = {
+			.tokens_in = json_integer_value(json_object_get(usage,
+			    "prompt_tokens")),
+			.tokens_out = json_integer_value(json_object_get(usage,
+			    "completion_tokens")),
+			.tokens_cached = json_integer_value(json_object_get(
+			    json_object_get(usage, "prompt_tokens_details"),
+			    "cached_tokens")),
+		};
+		acl_usage_add(&u);
 	} else {
 		json_t *error = json_object_get(root, "error");
 		if (error) {
@@ -79,38 +102,27 @@ initialize(config_t *config)
 }
 
 /*
- * Fetch response from the OpenAI API given the provided prompt.
- * Provide context in the form of n-shot prompts and history prompts.
+ * Build in request the JSON request for the provided prompt, with
+ * n-shot prompts, history prompts, and the shell environment as context.
+ * Return the length of its prefix that is the same across queries.
  */
-char *
-acl_fetch_openai(config_t *config, const char *prompt, int history_length)
+STATIC size_t
+openai_build_request(config_t *config, const char *prompt,
+    int history_length, string_t *request)
 {
-	CURLcode res;
-
-	if (!acl_curl && initialize(config) < 0)
-		return NULL;
-
-	if (config->general_verbose)
-		fprintf(stderr, "\nContacting OpenAI API...\n");
-
-	struct curl_slist *headers = NULL;
-	headers = curl_slist_append(headers, "Content-Type: application/json");
-	headers = curl_slist_append(headers, authorization);
-
-	struct string json_response;
-	acl_string_init(&json_response, "");
-
-	struct string json_request;
-	acl_string_init(&json_request, "{\n");
-	acl_string_appendf(&json_request, "  \"model\": %s,\n",
+	acl_string_init(request, "{\n");
+	acl_string_appendf(request, "  \"model\": %s,\n",
 	    acl_json_escape(config->openai_model));
-	acl_string_appendf(&json_request, "  \"temperature\": %g,\n",
+	acl_string_appendf(request, "  \"temperature\": %g,\n",
 	    config->openai_temperature);
+	if (acl_candidates_wanted(config) > 1)
+		acl_string_appendf(request, "  \"n\": %d,\n",
+		    acl_candidates_wanted(config));
 
-	acl_string_append(&json_request, "  \"messages\": [\n");
+	acl_string_append(request, "  \"messages\": [\n");
 
 	char *system_role = acl_system_role_get(config);
-	acl_string_appendf(&json_request,
+	acl_string_appendf(request,
 	    "    {\"role\": \"system\", \"content\": %s},\n",
 	    acl_json_escape(system_role));
 	free(system_role);
@@ -118,31 +130,77 @@ acl_fetch_openai(config_t *config, const char *prompt, int history_length)
 	// Add user and assistant n-shot prompts
 	for (int i = 0; i < NPROMPTS; i++) {
 		if (config->prompt_user[i])
-			acl_string_appendf(&json_request,
+			acl_string_appendf(request,
 			    "    {\"role\": \"user\", \"content\": %s},\n",
 			    acl_json_escape(config->prompt_user[i]));
 		if (config->prompt_assistant[i])
-			acl_string_appendf(&json_request,
+			acl_string_appendf(request,
 			    "    {\"role\": \"assistant\", \"content\": %s},\n",
 			    acl_json_escape(config->prompt_assistant[i]));
 	}
 
+	// The log records this static prefix once
+	size_t prefix_len = request->len;
+
 	// Add history prompts as context
 	for (int i = config->prompt_context - 1; i >= 0; --i) {
 		HIST_ENTRY *h = history_get(history_length - 1 - i);
 		if (h == NULL || h->line == NULL || h->line[0] == '\0')
 			continue;
-		acl_string_appendf(&json_request,
+		acl_string_appendf(request,
 		    "    {\"role\": \"user\", \"content\": %s},\n",
 		    acl_json_escape(h->line));
 	}
 
+	// Add the shell environment as context
+	double context_start = TRACE_NOW();
+	char *context = acl_context_get(config);
+	TRACE_SPAN("context", context_start);
+	if (context) {
+		acl_string_appendf(request,
+		    "    {\"role\": \"system\", \"content\": %s},\n",
+		    acl_json_escape(context));
+		free(context);
+	}
+
 	// Finally, add the user prompt
-	acl_string_appendf(&json_request,
+	acl_string_appendf(request,
 	    "    {\"role\": \"user\", \"content\": %s}\n", acl_json_escape(prompt));
-	acl_string_append(&json_request, "  ]\n}\n");
+	acl_string_append(request, "  ]\n}\n");
+	return prefix_len;
+}
+
+/*
+ * Fetch response from the OpenAI API given the provided prompt.
+ * Provide context in the form of n-shot prompts and history prompts.
+ */
+char *
+acl_fetch_openai(config_t *config, const char *prompt, int history_length)
+{
+	CURLcode res;
+
+	if ((!authorization && initialize(config) < 0) || curl_initialize(config) < 0)
+		return NULL;
 
-	acl_write_log(config, json_request.ptr);
+	if (config->general_verbose)
+		fprintf(stderr, "\nContacting OpenAI API...\n");
+
+	double build_start = TRACE_NOW();
+
+	struct curl_slist *headers = NULL;
+	headers = curl_slist_append(headers, "Content-Type: application/json");
+	headers = curl_slist_append(headers, authorization);
+
+	struct string json_response;
+	acl_string_init(&json_response, "");
+
+	struct string json_request;
+	size_t prefix_len = openai_build_request(config, prompt, history_length,
+	    &json_request);
+
+	acl_write_log_request(config, json_request.ptr, prefix_len);
+	TRACE_SPAN("build", build_start);
+	PROBE_REQUEST_BUILT("openai", json_request.ptr, build_start);
 
 	curl_easy_setopt(acl_curl, CURLOPT_URL, config->openai_endpoint);
 	curl_easy_setopt(acl_curl, CURLOPT_HTTPHEADER, headers);
@@ -151,6 +209,7 @@ acl_fetch_openai(config_t *config, const char *prompt, int history_length)
 	curl_easy_setopt(acl_curl, CURLOPT_POSTFIELDS, json_request.ptr);
 
 	res = curl_easy_perform(acl_curl);
+	TRACE_CURL(acl_curl);
 
 	if (res != CURLE_OK) {
 		free(json_request.ptr);
@@ -161,8 +220,33 @@ acl_fetch_openai(config_t *config, const char *prompt, int history_length)
 
 	acl_write_log(config, json_response.ptr);
 
+	double parse_start = TRACE_NOW();
 	char *text_response = openai_get_response_content(json_response.ptr);
+	TRACE_SPAN("parse", parse_start);
+	PROBE_RESPONSE_PARSED("openai", json_response.ptr, parse_start);
+	acl_usage_record(config, "openai", config->openai_model);
 	free(json_request.ptr);
 	free(json_response.ptr);
 	return text_response;
 }
+
+// Verify the configuration required for queries
+static bool
+init(config_t *config)
+{
+	REQUIRE(config, openai, key);
+	REQUIRE(config, openai, endpoint);
+	return true;
+}
+
+// Release the prepared header, so that it is built anew when next used
+static void
+release(void)
+{
+	free(authorization);
+	authorization = NULL;
+}
+
+ACL_BACKEND(openai, init, acl_fetch_openai, release,
+    .build_request = openai_build_request,
+    .parse_response = openai_get_response_content);
@@ -19,6 +19,12 @@
  */
 
 #include "config.h"
+#include "support.h"
+
+#if defined(UNIT_TEST)
+size_t openai_build_request(config_t *config, const char *prompt,
+    int history_length, string_t *request);
+#endif
 
 char *openai_get_response_content(const char *json_response);
 char *acl_fetch_openai(config_t *config, const char *prompt, int history_length);
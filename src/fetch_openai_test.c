@@ -18,7 +18,10 @@
  *  limitations under the License.
  */
 
+#include <stdlib.h>
+
 #include "CuTest.h"
+#include "candidates.h"
 #include "fetch_openai.h"
 
 static const char json_response[] = "{\n"
@@ -43,6 +46,14 @@ static const char json_response[] = "{\n"
 	"  }\n"
 	"}\n";
 
+static const char json_choices[] = "{\n"
+	"  \"choices\": [\n"
+	"    {\"index\": 0, \"message\": {\"role\": \"assistant\", \"content\": \"ls\"}},\n"
+	"    {\"index\": 1, \"message\": {\"role\": \"assistant\", \"content\": \"ls -l\"}},\n"
+	"    {\"index\": 2, \"message\": {\"role\": \"assistant\", \"content\": \"ls\"}}\n"
+	"  ]\n"
+	"}\n";
+
 static void
 test_response_parse(CuTest* tc)
 {
@@ -50,12 +61,28 @@ test_response_parse(CuTest* tc)
 	CuAssertStrEquals(tc, "help", response);
 }
 
+static void
+test_response_choices(CuTest* tc)
+{
+	char *candidates[MAX_CANDIDATES];
+
+	char *response = openai_get_response_content(json_choices);
+	CuAssertStrEquals(tc, "ls", response);
+	// Duplicate choices are removed
+	CuAssertIntEquals(tc, 2, acl_candidates_collect(response, candidates));
+	CuAssertStrEquals(tc, "ls", candidates[0]);
+	CuAssertStrEquals(tc, "ls -l", candidates[1]);
+	free(candidates[0]);
+	free(candidates[1]);
+}
+
 CuSuite*
 cu_fetch_openai_suite(void)
 {
 	CuSuite* suite = CuSuiteNew();
 
 	SUITE_ADD_TEST(suite, test_response_parse);
+	SUITE_ADD_TEST(suite, test_response_choices);
 
 	return suite;
 }
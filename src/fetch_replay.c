@@ -0,0 +1,415 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Record the responses of another backend in a cassette file,
+ *  and replay them offline, optionally with their recorded latency.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <readline/history.h>
+
+#include "backend.h"
+#include "candidates.h"
+#include "config.h"
+#include "context.h"
+#include "fetch_replay.h"
+#include "support.h"
+#include "trace.h"
+#include "unit_test.h"
+
+static const char cassette_name[] = ".aicli-cassette";
+
+static const char cassette_header[] = "# key ms response [candidate ...]\n";
+
+// Record mode: the backend whose responses are recorded
+static fetch_t recorded;
+static int record_fd = -1;
+
+// Replay mode: the mapped cassette and its index
+static char *map;
+static size_t map_size;
+static cassette_entry_t *entries;
+static size_t nentries;
+static pthread_mutex_t lookup_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Append to s the string str with its leading and trailing whitespace
+ * removed and its internal whitespace runs collapsed into a space.
+ */
+static void
+normalized_append(string_t *s, const char *str)
+{
+	bool space = false;
+
+	while (isspace((unsigned char)*str))
+		str++;
+	for (; *str; str++)
+		if (isspace((unsigned char)*str))
+			space = true;
+		else {
+			if (space)
+				acl_string_append(s, " ");
+			acl_string_write((void *)str, 1, 1, s);
+			space = false;
+		}
+	acl_string_append(s, "\n");
+}
+
+/*
+ * Return the key identifying a request: the hash of the program,
+ * the history entries provided as context, and the prompt.
+ * The shell environment context and the prompt configuration are
+ * excluded, so that changes to them can be evaluated on a recording.
+ */
+STATIC uint64_t
+request_key(config_t *config, const char *prompt, int history_length)
+{
+	string_t s;
+
+	acl_string_init(&s, "");
+	normalized_append(&s, config->program_name);
+	for (int i = config->prompt_context - 1; i >= 0; --i) {
+		HIST_ENTRY *h = history_get(history_length - 1 - i);
+		if (h == NULL || h->line == NULL || h->line[0] == '\0')
+			continue;
+		normalized_append(&s, h->line);
+	}
+	normalized_append(&s, prompt);
+	uint64_t key = acl_hash(s.ptr, s.len);
+	free(s.ptr);
+	return key;
+}
+
+// Append str to s escaping backslashes, tabs, and newlines
+STATIC void
+escape_append(string_t *s, const char *str)
+{
+	for (;;) {
+		size_t n = strcspn(str, "\\\t\n");
+		acl_string_write((void *)str, 1, n, s);
+		str += n;
+		if (!*str)
+			break;
+		acl_string_append(s, *str == '\\' ? "\\\\" :
+		    *str == '\t' ? "\\t" : "\\n");
+		str++;
+	}
+}
+
+// Return an allocated copy of the escaped string from begin to end
+STATIC char *
+unescape(const char *begin, const char *end)
+{
+	char *result = acl_range_strdup(begin, end);
+	char *out = result;
+
+	for (const char *p = result; *p; p++)
+		if (*p == '\\' && p[1]) {
+			p++;
+			*out++ = *p == 't' ? '\t' : *p == 'n' ? '\n' : *p;
+		} else
+			*out++ = *p;
+	*out = '\0';
+	return result;
+}
+
+static int
+compare_entry(const void *a, const void *b)
+{
+	const cassette_entry_t *ea = a, *eb = b;
+
+	if (ea->key != eb->key)
+		return ea->key < eb->key ? -1 : 1;
+	// Entries with the same key are replayed in recording order
+	return ea->fields < eb->fields ? -1 : ea->fields > eb->fields;
+}
+
+/*
+ * Index the cassette entries of the map of the specified size
+ * into an allocated array of entries sorted by key.
+ * Return the number of entries; comments and damaged lines are skipped.
+ */
+STATIC size_t
+cassette_index(const char *map, size_t size, cassette_entry_t **entries)
+{
+	size_t n = 0, allocated = 0;
+	const char *end = map + size;
+
+	*entries = NULL;
+	for (const char *line = map; line < end; ) {
+		const char *eol = memchr(line, '\n', end - line);
+		if (!eol)
+			break;	// Partially written last entry
+
+		char *fields;
+		uint64_t key = strtoull(line, &fields, 16);
+		if (*line != '#' && fields == line + 16 && *fields == '\t') {
+			if (n == allocated) {
+				allocated = allocated ? allocated * 2 : 256;
+				*entries = realloc(*entries,
+				    allocated * sizeof(**entries));
+				if (!*entries)
+					return 0;
+			}
+			(*entries)[n++] = (cassette_entry_t){key, fields + 1,
+			    eol, 0};
+		}
+		line = eol + 1;
+	}
+	qsort(*entries, n, sizeof(**entries), compare_entry);
+	return n;
+}
+
+/*
+ * Return the least replayed entry with the specified key, so that
+ * a request repeated in a session obtains its responses in turn.
+ * Return NULL if no entry has the key.
+ */
+STATIC cassette_entry_t *
+cassette_lookup(cassette_entry_t *entries, size_t n, uint64_t key)
+{
+	size_t lo = 0, hi = n;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (entries[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	cassette_entry_t *best = NULL;
+	for (size_t i = lo; i < n && entries[i].key == key; i++)
+		if (!best || entries[i].uses < best->uses)
+			best = &entries[i];
+	if (best)
+		best->uses++;
+	return best;
+}
+
+// Return the allocated path of the cassette file
+static char *
+cassette_path(config_t *config)
+{
+	char *path = NULL;
+
+	if (config->replay_file_set)
+		path = acl_safe_strdup(config->replay_file);
+	else if (getenv("HOME"))
+		acl_safe_asprintf(&path, "%s/%s", getenv("HOME"),
+		    cassette_name);
+	return path;
+}
+
+// Map the cassette file and index its entries
+static bool
+cassette_open(config_t *config)
+{
+	char *path = cassette_path(config);
+	if (!path) {
+		fprintf(stderr, "Missing file value in [replay] configuration section.\n");
+		return false;
+	}
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		fprintf(stderr, "Cannot open cassette %s.\n", path);
+		if (fd != -1)
+			close(fd);
+		free(path);
+		return false;
+	}
+	map_size = st.st_size;
+	map = map_size ? mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0)
+	    : NULL;
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "Cannot map cassette %s.\n", path);
+		map = NULL;
+		free(path);
+		return false;
+	}
+	nentries = map ? cassette_index(map, map_size, &entries) : 0;
+	if (config->general_verbose)
+		fprintf(stderr, "Replaying %zu responses from %s\n",
+		    nentries, path);
+	free(path);
+	return true;
+}
+
+// Load the recorded backend and open the cassette for appending
+static bool
+cassette_create(config_t *config)
+{
+	REQUIRE(config, replay, api);
+	if (strcmp(config->replay_api, "replay") == 0) {
+		fprintf(stderr, "The [replay] api cannot be replay.\n");
+		return false;
+	}
+	if (!(recorded = acl_backend_load(config, config->replay_api)))
+		return false;
+
+	char *path = cassette_path(config);
+	if (!path) {
+		fprintf(stderr, "Missing file value in [replay] configuration section.\n");
+		return false;
+	}
+	record_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+	    0600);
+	if (record_fd == -1) {
+		fprintf(stderr, "Cannot open cassette %s.\n", path);
+		free(path);
+		return false;
+	}
+	struct stat st;
+	if (fstat(record_fd, &st) == 0 && st.st_size == 0)
+		write(record_fd, cassette_header, sizeof(cassette_header) - 1);
+	free(path);
+	return true;
+}
+
+static bool
+init(config_t *config)
+{
+	const char *mode = config->replay_mode_set ? config->replay_mode :
+	    "replay";
+
+	if (strcmp(mode, "record") == 0)
+		return cassette_create(config);
+	if (strcmp(mode, "replay") == 0)
+		return cassette_open(config);
+	fprintf(stderr, "Unknown [replay] mode %s; use record or replay.\n",
+	    mode);
+	return false;
+}
+
+STATIC void
+replay_shutdown(void)
+{
+	if (record_fd != -1)
+		close(record_fd);
+	record_fd = -1;
+	recorded = NULL;
+	if (map)
+		munmap(map, map_size);
+	map = NULL;
+	free(entries);
+	entries = NULL;
+	nentries = 0;
+}
+
+/*
+ * Append to the cassette the response and the additional candidates
+ * obtained for the request with the specified key in ms.
+ * Each entry is written with a single append, so that concurrently
+ * recording processes do not interleave their entries.
+ */
+static void
+record(uint64_t key, double ms, const char *response)
+{
+	string_t s;
+
+	acl_string_init(&s, "");
+	acl_string_appendf(&s, "%016llx\t%.1f\t", (unsigned long long)key, ms);
+	escape_append(&s, response);
+	const char *extra;
+	for (int i = 0; (extra = acl_candidates_extra(i)) != NULL; i++) {
+		acl_string_append(&s, "\t");
+		escape_append(&s, extra);
+	}
+	acl_string_append(&s, "\n");
+	if (write(record_fd, s.ptr, s.len) != (ssize_t)s.len)
+		acl_readline_printf("\nCannot record the response.\n");
+	free(s.ptr);
+}
+
+// Wait for ms, allowing for cancellation; return false if cancelled
+static bool
+replay_wait(double ms)
+{
+	for (double waited = 0; waited < ms; waited += 10) {
+		if (acl_cancelled())
+			return false;
+		usleep(ms - waited < 10 ? (ms - waited) * 1000 : 10000);
+	}
+	return true;
+}
+
+/*
+ * In record mode, obtain a response from the configured backend
+ * and record it.  In replay mode, return the recorded response
+ * to the same request.
+ */
+char *
+acl_fetch_replay(config_t *config, const char *prompt, int history_length)
+{
+	uint64_t key = request_key(config, prompt, history_length);
+
+	if (recorded) {
+		double start = acl_now_ms();
+		char *response = recorded(config, prompt, history_length);
+		if (response)
+			record(key, acl_now_ms() - start, response);
+		return response;
+	}
+
+	// Gather the shell environment as a networked backend would
+	double context_start = TRACE_NOW();
+	free(acl_context_get(config));
+	TRACE_SPAN("context", context_start);
+
+	pthread_mutex_lock(&lookup_mutex);
+	cassette_entry_t *e = cassette_lookup(entries, nentries, key);
+	pthread_mutex_unlock(&lookup_mutex);
+	if (!e) {
+		acl_readline_printf("\nNo recorded response for this query.\n");
+		return NULL;
+	}
+
+	char *fields;
+	double ms = strtod(e->fields, &fields);
+	char *response = NULL;
+	for (const char *p = fields; p < e->end && *p == '\t'; ) {
+		const char *field_end = p + 1;
+		while (field_end < e->end && *field_end != '\t')
+			field_end++;
+		char *text = unescape(p + 1, field_end);
+		if (!response)
+			response = text;
+		else {
+			acl_candidates_add(text);
+			free(text);
+		}
+		p = field_end;
+	}
+
+	if (config->replay_latency && !replay_wait(ms)) {
+		acl_candidates_clear();
+		free(response);
+		return NULL;
+	}
+	return response;
+}
+
+ACL_BACKEND(replay, init, acl_fetch_replay, replay_shutdown);
@@ -0,0 +1,48 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Record and replay the responses of another backend
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "config.h"
+#include "support.h"
+
+// A recorded response in the mapped cassette file
+typedef struct {
+	uint64_t key;		// Hash of the normalized request
+	const char *fields;	// Latency and responses, tab-separated
+	const char *end;	// The entry's terminating newline
+	unsigned uses;		// Times replayed
+} cassette_entry_t;
+
+#if defined(UNIT_TEST)
+uint64_t request_key(config_t *config, const char *prompt,
+    int history_length);
+void escape_append(string_t *s, const char *str);
+char *unescape(const char *begin, const char *end);
+size_t cassette_index(const char *map, size_t size,
+    cassette_entry_t **entries);
+cassette_entry_t *cassette_lookup(cassette_entry_t *entries, size_t n,
+    uint64_t key);
+void replay_shutdown(void);
+#endif
+
+char *acl_fetch_replay(config_t *config, const char *prompt, int history_length);
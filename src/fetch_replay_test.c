@@ -0,0 +1,135 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test the recording and replaying of responses.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "backend.h"
+#include "config.h"
+#include "fetch_replay.h"
+#include "support.h"
+
+static void
+test_request_key(CuTest *tc)
+{
+	config_t config = {"bash"};
+	config_t other = {"sqlite3"};
+
+	uint64_t key = request_key(&config, "list   files\t", 0);
+	CuAssertTrue(tc, key == request_key(&config, " list files", 0));
+	CuAssertTrue(tc, key != request_key(&config, "list file", 0));
+	CuAssertTrue(tc, key != request_key(&other, "list files", 0));
+}
+
+static void
+test_escape(CuTest *tc)
+{
+	const char *text = "printf 'a\\tb'\t|\nwc";
+	string_t s;
+
+	acl_string_init(&s, "");
+	escape_append(&s, text);
+	CuAssertStrEquals(tc, "printf 'a\\\\tb'\\t|\\nwc", s.ptr);
+	char *copy = unescape(s.ptr, s.ptr + s.len);
+	CuAssertStrEquals(tc, text, copy);
+	free(copy);
+	free(s.ptr);
+}
+
+static void
+test_cassette_index(CuTest *tc)
+{
+	const char map[] =
+	    "# key ms response [candidate ...]\n"
+	    "00000000000000b2\t10.0\tls\n"
+	    "00000000000000a1\t20.0\tpwd\tpwd -P\n"
+	    "damaged\n"
+	    "00000000000000b2\t30.0\tls -l\n"
+	    "00000000000000c3\t40.0\tpartial";
+	cassette_entry_t *entries;
+
+	size_t n = cassette_index(map, sizeof(map) - 1, &entries);
+	CuAssertIntEquals(tc, 3, n);
+	CuAssertTrue(tc, entries[0].key == 0xa1);
+	CuAssertTrue(tc, strncmp(entries[0].fields, "20.0\tpwd\tpwd -P\n",
+	    16) == 0);
+	CuAssertTrue(tc, *entries[0].end == '\n');
+
+	// Repeated requests obtain their responses in turn
+	cassette_entry_t *e = cassette_lookup(entries, n, 0xb2);
+	CuAssertTrue(tc, strncmp(e->fields, "10.0", 4) == 0);
+	e = cassette_lookup(entries, n, 0xb2);
+	CuAssertTrue(tc, strncmp(e->fields, "30.0", 4) == 0);
+	e = cassette_lookup(entries, n, 0xb2);
+	CuAssertTrue(tc, strncmp(e->fields, "10.0", 4) == 0);
+	CuAssertPtrEquals(tc, NULL, cassette_lookup(entries, n, 0xc3));
+	CuAssertPtrEquals(tc, NULL, cassette_lookup(entries, n, 0));
+	free(entries);
+}
+
+static void
+test_record_replay(CuTest *tc)
+{
+	config_t config = {"bash"};
+
+	config.replay_file = "test-replay.cassette";
+	config.replay_file_set = true;
+	config.replay_api = "hal";
+	config.replay_api_set = true;
+	config.hal_latency = "0";
+	config.hal_latency_set = true;
+	config.replay_mode = "record";
+	config.replay_mode_set = true;
+	unlink(config.replay_file);
+
+	fetch_t fetch = acl_backend_load(&config, "replay");
+	CuAssertPtrNotNull(tc, fetch);
+	char *recorded = fetch(&config, "open the doors", 0);
+	CuAssertPtrNotNull(tc, recorded);
+	acl_backend_shutdown();
+
+	config.replay_mode = "replay";
+	fetch = acl_backend_load(&config, "replay");
+	CuAssertPtrNotNull(tc, fetch);
+	char *replayed = fetch(&config, "open  the doors ", 0);
+	CuAssertStrEquals(tc, recorded, replayed);
+	CuAssertPtrEquals(tc, NULL, fetch(&config, "close the doors", 0));
+	acl_backend_shutdown();
+
+	free(recorded);
+	free(replayed);
+	unlink(config.replay_file);
+}
+
+CuSuite*
+cu_fetch_replay_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_request_key);
+	SUITE_ADD_TEST(suite, test_escape);
+	SUITE_ADD_TEST(suite, test_cassette_index);
+	SUITE_ADD_TEST(suite, test_record_replay);
+
+	return suite;
+}
@@ -0,0 +1,613 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Built-in HTTP/1.1 client for local servers.
+ *  Requests to servers on the loopback interface or on Unix-domain
+ *  sockets are made without loading libcurl and its TLS libraries.
+ *  Connections are kept alive across requests; responses with
+ *  chunked transfer encoding are decoded.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "candidates.h"
+#include "http.h"
+#include "support.h"
+#include "trace.h"
+#include "unit_test.h"
+
+// Interval (ms) at which blocked reads check for cancellation
+#define POLL_INTERVAL 100
+
+// Maximum length of a response's status or header line
+#define MAX_LINE 8192
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0	// SO_NOSIGPIPE is set instead
+#endif
+
+// Connections kept alive, one for each concurrently requested candidate
+static __thread struct {
+	char *key;		// Socket address to which fd is connected
+	int fd;
+} connections[MAX_CANDIDATES];
+
+/*
+ * Parse the specified URL into u.
+ * Supported are http://host[:port][/path] URLs, where host is on the
+ * loopback interface, and unix:socket-path[:/path] URLs.
+ * Return false if the URL isn't supported.
+ */
+STATIC bool
+parse_url(const char *url, url_t *u)
+{
+	memset(u, 0, sizeof(*u));
+
+	if (strncmp(url, "unix:", 5) == 0) {
+		const char *socket = url + 5;
+		const char *path = strstr(socket, ":/");
+		size_t len = path ? (size_t)(path - socket) : strlen(socket);
+		if (len == 0 || len >= sizeof(u->socket))
+			return false;
+		memcpy(u->socket, socket, len);
+		strcpy(u->host, "localhost");
+		snprintf(u->path, sizeof(u->path), "%s", path ? path + 1 : "/");
+		return true;
+	}
+
+	if (strncmp(url, "http://", 7) != 0)
+		return false;
+	const char *host = url + 7;
+	const char *path = strchr(host, '/');
+	size_t len = path ? (size_t)(path - host) : strlen(host);
+	if (len == 0 || len >= sizeof(u->host) || memchr(host, '@', len))
+		return false;
+	memcpy(u->host, host, len);
+	snprintf(u->path, sizeof(u->path), "%s", path ? path : "/");
+
+	// Separate the port from the host name
+	char name[sizeof(u->host)];
+	strcpy(name, u->host);
+	char *port = strrchr(name, ':');
+	if (port && !strchr(port, ']')) {
+		*port++ = '\0';
+		u->port = acl_strtocard(port);
+		if (u->port <= 0 || u->port > 65535)
+			return false;
+	} else
+		u->port = 80;
+
+	struct in_addr a4;
+	if (strcmp(name, "localhost") == 0)
+		strcpy(u->address, "127.0.0.1");
+	else if (strcmp(name, "[::1]") == 0)
+		strcpy(u->address, "::1");
+	else if (inet_pton(AF_INET, name, &a4) == 1
+	    && (ntohl(a4.s_addr) >> 24) == 127)
+		strcpy(u->address, name);
+	else
+		return false;
+	return true;
+}
+
+/*
+ * Return true if requests to the specified URL can be made through
+ * the built-in client.
+ */
+bool
+acl_http_supported(config_t *config, const char *url)
+{
+	url_t u;
+
+	if (config->general_builtin_http_set && !config->general_builtin_http)
+		return false;
+	return parse_url(url, &u);
+}
+
+// Return a socket connected to the server of u, or -1 on error
+static int
+connect_url(const url_t *u)
+{
+	int fd;
+
+	if (*u->socket) {
+		struct sockaddr_un sa = {.sun_family = AF_UNIX};
+		strcpy(sa.sun_path, u->socket);
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd != -1 && connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0)
+			return fd;
+	} else if (strchr(u->address, ':')) {
+		struct sockaddr_in6 sa = {.sin6_family = AF_INET6,
+		    .sin6_port = htons(u->port)};
+		inet_pton(AF_INET6, u->address, &sa.sin6_addr);
+		fd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd != -1 && connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0)
+			goto tcp;
+	} else {
+		struct sockaddr_in sa = {.sin_family = AF_INET,
+		    .sin_port = htons(u->port)};
+		inet_pton(AF_INET, u->address, &sa.sin_addr);
+		fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd != -1 && connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0)
+			goto tcp;
+	}
+	if (fd != -1)
+		close(fd);
+	return -1;
+
+tcp:
+	{
+		// Send the small requests without delay
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	return fd;
+}
+
+// Close the connection used for candidate i
+static void
+close_connection(int i)
+{
+	if (connections[i].key) {
+		close(connections[i].fd);
+		free(connections[i].key);
+		connections[i].key = NULL;
+	}
+}
+
+/*
+ * Return a connection to the server of u for candidate i, reusing
+ * a kept-alive one, if available; set reused accordingly.
+ * Return -1 on error.
+ */
+static int
+get_connection(int i, const url_t *u, bool *reused)
+{
+	char *key;
+
+	acl_safe_asprintf(&key, "%s %s:%d", u->socket, u->address, u->port);
+	if (connections[i].key && strcmp(connections[i].key, key) == 0) {
+		free(key);
+		*reused = true;
+		return connections[i].fd;
+	}
+	close_connection(i);
+	*reused = false;
+
+	double start = TRACE_NOW();
+	int fd = connect_url(u);
+	if (fd == -1) {
+		free(key);
+		return -1;
+	}
+	if (i == 0)
+		TRACE_SPAN("connect", start);
+#if defined(SO_NOSIGPIPE)
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+	connections[i].key = key;
+	connections[i].fd = fd;
+	return fd;
+}
+
+// Write all len bytes of data to fd; return false on error
+static bool
+send_all(int fd, const char *data, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+/*
+ * Send the request for candidate i, reconnecting once if a kept-alive
+ * connection has been closed by the server.
+ * Return the connection's descriptor or -1 on error.
+ */
+static int
+send_request(int i, const url_t *u, const string_t *request, bool *reused)
+{
+	for (int attempt = 0; attempt < 2; attempt++) {
+		double start = TRACE_NOW();
+		int fd = get_connection(i, u, reused);
+		if (fd == -1)
+			return -1;
+		if (send_all(fd, request->ptr, request->len)) {
+			if (i == 0)
+				TRACE_SPAN("send", start);
+			return fd;
+		}
+		close_connection(i);
+		if (!*reused)
+			break;
+	}
+	return -1;
+}
+
+/*
+ * Ensure that the reader has buffered data, waiting for it if needed.
+ * Return the number of available bytes, 0 on end of file, or -1 on
+ * error or cancellation.
+ */
+static ssize_t
+fill(reader_t *r)
+{
+	if (r->start < r->end)
+		return r->end - r->start;
+
+	struct pollfd pfd = {.fd = r->fd, .events = POLLIN};
+	for (;;) {
+		if (acl_cancelled())
+			return -1;
+		int ready = poll(&pfd, 1, POLL_INTERVAL);
+		if (ready == -1 && errno != EINTR)
+			return -1;
+		if (ready > 0)
+			break;
+	}
+
+	ssize_t n = recv(r->fd, r->buffer, sizeof(r->buffer), 0);
+	if (n > 0) {
+		if (!r->first_byte)
+			r->first_byte = TRACE_NOW();
+		r->start = 0;
+		r->end = n;
+	}
+	return n;
+}
+
+/*
+ * Read a CRLF or LF-terminated line into the dynamically allocated
+ * line, without its terminator.
+ * Return false on error.
+ */
+static bool
+read_line(reader_t *r, string_t *line)
+{
+	acl_string_init(line, "");
+	for (;;) {
+		if (fill(r) <= 0 || line->len > MAX_LINE) {
+			free(line->ptr);
+			return false;
+		}
+		char *start = r->buffer + r->start;
+		char *nl = memchr(start, '\n', r->end - r->start);
+		size_t len = nl ? (size_t)(nl - start) : r->end - r->start;
+		acl_string_write(start, 1, len, line);
+		r->start += len;
+		if (nl) {
+			r->start++;
+			if (line->len && line->ptr[line->len - 1] == '\r')
+				line->ptr[--line->len] = '\0';
+			return true;
+		}
+	}
+}
+
+/*
+ * Pass the next len bytes to the consume function.
+ * Return false on error, or if the consume function stopped the transfer,
+ * setting stopped.
+ */
+static bool
+read_bytes(reader_t *r, size_t len, http_write_t consume, void *arg,
+    bool *stopped)
+{
+	while (len > 0) {
+		ssize_t available = fill(r);
+		if (available <= 0)
+			return false;
+		size_t n = (size_t)available < len ? (size_t)available : len;
+		const char *data = r->buffer + r->start;
+		r->start += n;
+		len -= n;
+		if (!consume(data, n, arg)) {
+			*stopped = true;
+			return false;
+		}
+	}
+	return true;
+}
+
+// Append the specified data to the string arg
+static bool
+string_write(const char *data, size_t len, void *arg)
+{
+	acl_string_write((void *)data, 1, len, arg);
+	return true;
+}
+
+// Return the value of the specified header in line, or NULL
+static const char *
+header_value(const char *line, const char *name)
+{
+	size_t len = strlen(name);
+
+	if (strncasecmp(line, name, len) != 0 || line[len] != ':')
+		return NULL;
+	line += len + 1;
+	while (*line == ' ' || *line == '\t')
+		line++;
+	return line;
+}
+
+/*
+ * Read an HTTP response, passing its body to the consume function.
+ * Set keep_alive to whether the connection can be used for further
+ * requests.
+ * Return the response's status code or HTTP_FAILED.
+ */
+STATIC int
+read_response(reader_t *r, http_write_t consume, void *arg, bool *keep_alive)
+{
+	string_t line;
+	int minor, status;
+	bool stopped = false;
+
+	if (!read_line(r, &line))
+		return HTTP_FAILED;
+	if (sscanf(line.ptr, "HTTP/1.%d %d", &minor, &status) != 2) {
+		free(line.ptr);
+		return HTTP_FAILED;
+	}
+	free(line.ptr);
+	*keep_alive = minor >= 1;
+
+	long long content_length = -1;
+	bool chunked = false;
+	for (;;) {
+		if (!read_line(r, &line))
+			return HTTP_FAILED;
+		if (line.len == 0)
+			break;
+		const char *value;
+		if ((value = header_value(line.ptr, "Content-Length")))
+			content_length = atoll(value);
+		else if ((value = header_value(line.ptr, "Transfer-Encoding")))
+			chunked = strcasestr(value, "chunked") != NULL;
+		else if ((value = header_value(line.ptr, "Connection"))) {
+			if (strcasestr(value, "close"))
+				*keep_alive = false;
+			else if (strcasestr(value, "keep-alive"))
+				*keep_alive = true;
+		}
+		free(line.ptr);
+	}
+	free(line.ptr);
+
+	if (chunked) {
+		for (;;) {
+			if (!read_line(r, &line))
+				return HTTP_FAILED;
+			char *end;
+			unsigned long size = strtoul(line.ptr, &end, 16);
+			bool valid = end != line.ptr;
+			free(line.ptr);
+			if (!valid)
+				return HTTP_FAILED;
+			if (size == 0)
+				break;
+			if (!read_bytes(r, size, consume, arg, &stopped)
+			    || !read_line(r, &line))
+				goto stop;
+			free(line.ptr);
+		}
+		// Skip any trailer fields
+		do {
+			if (!read_line(r, &line))
+				return HTTP_FAILED;
+			size_t len = line.len;
+			free(line.ptr);
+			if (len == 0)
+				break;
+		} while (true);
+	} else if (content_length >= 0) {
+		if (!read_bytes(r, content_length, consume, arg, &stopped))
+			goto stop;
+	} else {
+		// The body extends to the end of the connection
+		ssize_t n;
+		while ((n = fill(r)) > 0)
+			if (!read_bytes(r, n, consume, arg, &stopped))
+				goto stop;
+		if (n < 0)
+			return HTTP_FAILED;
+		*keep_alive = false;
+	}
+	return status;
+
+stop:
+	// The rest of the response remains unread
+	*keep_alive = false;
+	return stopped ? status : HTTP_FAILED;
+}
+
+/*
+ * Receive the response for candidate i, passing its body to the
+ * consume function, and dispose of
+ * the connection accordingly.
+ * Return the response's status code, HTTP_FAILED, or HTTP_CANCELLED.
+ */
+static int
+receive_response(int i, http_write_t consume, void *arg)
+{
+	reader_t r = {.fd = connections[i].fd};
+	bool keep_alive = false;
+
+	double start = TRACE_NOW();
+	int status = read_response(&r, consume, arg, &keep_alive);
+	if (i == 0 && r.first_byte) {
+		// Time to the first byte: queueing and generation
+		if (acl_trace_enabled) {
+			acl_trace_span("wait", start, r.first_byte);
+			acl_trace_span("receive", r.first_byte, acl_now_ms());
+		}
+		PROBE_FIRST_BYTE(connections[i].key, start, r.first_byte);
+	}
+	// Pipelined data isn't expected; discard the connection if any
+	if (status == HTTP_FAILED || !keep_alive || r.start < r.end)
+		close_connection(i);
+	if (acl_cancelled()) {
+		close_connection(i);
+		return HTTP_CANCELLED;
+	}
+	return status;
+}
+
+// Set request to a request posting the specified JSON body to u
+static void
+format_request(const url_t *u, const char *body, string_t *request)
+{
+	acl_string_init(request, "");
+	acl_string_appendf(request, "POST %s HTTP/1.1\r\n"
+	    "Host: %s\r\n"
+	    "Content-Type: application/json\r\n"
+	    "Content-Length: %zu\r\n"
+	    "\r\n", u->path, u->host, strlen(body));
+	acl_string_append(request, body);
+}
+
+/*
+ * Post the specified JSON body to url and append the server's response
+ * to response.  If more candidate responses are configured, the
+ * request is also sent over additional connections, so that the server
+ * can process the requests concurrently, and the content that
+ * get_content extracts from their responses is added to the query's
+ * candidates.
+ * Return the response's status code, HTTP_FAILED, or HTTP_CANCELLED.
+ */
+int
+acl_http_post(config_t *config, const char *url, const char *body,
+    string_t *response, char *(*get_content)(const char *))
+{
+	url_t u;
+
+	if (!parse_url(url, &u))
+		return HTTP_FAILED;
+
+	string_t request;
+	format_request(&u, body, &request);
+
+	// Send all requests before reading any response
+	int n = acl_candidates_wanted(config);
+	bool reused[MAX_CANDIDATES] = {false};
+	for (int i = 0; i < n; i++)
+		if (send_request(i, &u, &request, &reused[i]) == -1) {
+			if (i == 0) {
+				free(request.ptr);
+				return HTTP_FAILED;
+			}
+			n = i;
+		}
+
+	int status = receive_response(0, string_write, response);
+	if (status == HTTP_FAILED && reused[0] && response->len == 0
+	    && send_request(0, &u, &request, &reused[0]) != -1)
+		// The server closed the kept-alive connection; try afresh
+		status = receive_response(0, string_write, response);
+
+	for (int i = 1; i < n; i++) {
+		string_t extra;
+		acl_string_init(&extra, "");
+		if (status != HTTP_CANCELLED && receive_response(i, string_write, &extra) / 100 == 2
+		    && status / 100 == 2) {
+			char *content = get_content(extra.ptr);
+			acl_candidates_add(content);
+			free(content);
+		} else
+			close_connection(i);
+		free(extra.ptr);
+	}
+	free(request.ptr);
+	return status;
+}
+
+// Write function recording whether any data was passed on
+typedef struct {
+	http_write_t consume;
+	void *arg;
+	bool received;
+} tracker_t;
+
+static bool
+tracked_write(const char *data, size_t len, void *arg)
+{
+	tracker_t *t = arg;
+
+	t->received = true;
+	return t->consume(data, len, t->arg);
+}
+
+/*
+ * Post the specified JSON body to url, passing the server's response
+ * to the consume function as it arrives.  The function can stop
+ * the transfer, e.g. when it has obtained the data it requires.
+ * Return the response's status code, HTTP_FAILED, or HTTP_CANCELLED.
+ */
+int
+acl_http_post_stream(config_t *config, const char *url, const char *body,
+    http_write_t consume, void *arg)
+{
+	url_t u;
+
+	if (!parse_url(url, &u))
+		return HTTP_FAILED;
+
+	string_t request;
+	format_request(&u, body, &request);
+
+	bool reused;
+	tracker_t tracker = {consume, arg, false};
+	int status = HTTP_FAILED;
+	if (send_request(0, &u, &request, &reused) != -1) {
+		status = receive_response(0, tracked_write, &tracker);
+		if (status == HTTP_FAILED && reused && !tracker.received
+		    && send_request(0, &u, &request, &reused) != -1)
+			// The server closed the kept-alive connection; try afresh
+			status = receive_response(0, tracked_write, &tracker);
+	}
+	free(request.ptr);
+	return status;
+}
+
+// Close the calling thread's kept-alive connections
+void
+acl_http_close(void)
+{
+	for (int i = 0; i < MAX_CANDIDATES; i++)
+		close_connection(i);
+}
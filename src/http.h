@@ -0,0 +1,70 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Built-in HTTP/1.1 client for local servers
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <limits.h>
+#include <stdbool.h>
+#include <sys/un.h>
+
+#include "config.h"
+#include "support.h"
+
+// Outcome of a request, other than an HTTP status code
+typedef enum {
+	HTTP_CANCELLED = -1,	// The query was cancelled
+	HTTP_FAILED = 0,	// The request could not be completed
+} http_result_t;
+
+/*
+ * Consumer of a response body's data.
+ * Returns false to stop the transfer.
+ */
+typedef bool (*http_write_t)(const char *data, size_t len, void *arg);
+
+// Parsed URL
+typedef struct {
+	char socket[sizeof(((struct sockaddr_un *)0)->sun_path)]; // Unix socket
+	char address[64];	// Numeric loopback address
+	int port;
+	char host[128];		// Value of the Host header
+	char path[PATH_MAX];	// Request path
+} url_t;
+
+// Buffered reader of a connection
+typedef struct {
+	int fd;
+	char buffer[4096];
+	size_t start, end;	// Unread data in buffer
+	double first_byte;	// Arrival time of the first data if tracing
+} reader_t;
+
+#if defined(UNIT_TEST)
+bool parse_url(const char *url, url_t *u);
+int read_response(reader_t *r, http_write_t consume, void *arg,
+    bool *keep_alive);
+#endif
+
+bool acl_http_supported(config_t *config, const char *url);
+int acl_http_post(config_t *config, const char *url, const char *body,
+    string_t *response, char *(*get_content)(const char *));
+int acl_http_post_stream(config_t *config, const char *url,
+    const char *body, http_write_t consume, void *arg);
+void acl_http_close(void);
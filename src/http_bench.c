@@ -0,0 +1,271 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Compare the latency and memory use of llama.cpp queries made
+ *  through libcurl with those made through the built-in HTTP client
+ *  over TCP and Unix-domain sockets, using a local mock server.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <arpa/inet.h>
+#include <dlfcn.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <readline/readline.h>
+#include <readline/history.h>
+
+#include "config.h"
+#include "support.h"
+
+// Number of timed queries for each transport
+#define QUERIES 200
+
+static const char response_body[] = "{\"content\":\"Assistant: ls\"}";
+
+// Serve canned responses to the requests arriving on fd
+static void
+serve_connection(int fd)
+{
+	char buffer[65536], response[256];
+	size_t len = 0;
+
+	int response_len = snprintf(response, sizeof(response),
+	    "HTTP/1.1 200 OK\r\n"
+	    "Content-Type: application/json\r\n"
+	    "Content-Length: %zu\r\n"
+	    "\r\n%s", sizeof(response_body) - 1, response_body);
+
+	for (;;) {
+		ssize_t n = read(fd, buffer + len, sizeof(buffer) - len - 1);
+		if (n <= 0)
+			exit(0);
+		len += n;
+		buffer[len] = '\0';
+
+		// Respond to each complete request in the buffer
+		char *end;
+		while ((end = strstr(buffer, "\r\n\r\n")) != NULL) {
+			char *cl = strstr(buffer, "Content-Length: ");
+			size_t body = cl && cl < end ? atol(cl + 16) : 0;
+			size_t request = end + 4 - buffer + body;
+			if (len < request)
+				break;
+			if (write(fd, response, response_len) < 0)
+				exit(0);
+			memmove(buffer, buffer + request, len - request + 1);
+			len -= request;
+		}
+	}
+}
+
+// Accept connections on the specified sockets, forever
+static void
+serve(int tcp, int unix_socket)
+{
+	struct pollfd pfd[2] = {{tcp, POLLIN}, {unix_socket, POLLIN}};
+
+	signal(SIGCHLD, SIG_IGN);
+	for (;;) {
+		poll(pfd, 2, -1);
+		for (int i = 0; i < 2; i++) {
+			if (!(pfd[i].revents & POLLIN))
+				continue;
+			int fd = accept(pfd[i].fd, NULL, NULL);
+			if (fd == -1)
+				continue;
+			if (fork() == 0)
+				serve_connection(fd);
+			close(fd);
+		}
+	}
+}
+
+// Return the process's resident set size in kB
+static long
+rss_kb(void)
+{
+	FILE *f = fopen("/proc/self/status", "r");
+	char line[256];
+	long kb = -1;
+
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "VmRSS: %ld", &kb) == 1)
+			break;
+	fclose(f);
+	return kb;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+	double da = *(const double *)a, db = *(const double *)b;
+
+	return da < db ? -1 : da > db;
+}
+
+static double
+now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * Load the library and time queries to the specified endpoint,
+ * reporting the results under the given name.
+ */
+static void
+measure(const char *library, const char *name, const char *endpoint,
+    const char *builtin)
+{
+	setenv("AI_CLI_general_api", "llamacpp", 1);
+	setenv("AI_CLI_general_builtin_http", builtin, 1);
+	setenv("AI_CLI_llamacpp_endpoint", endpoint, 1);
+
+	long rss_before = rss_kb();
+	// The backend module binds to the library's global symbols
+	void *handle = dlopen(library, RTLD_LAZY | RTLD_GLOBAL);
+	if (!handle) {
+		fprintf(stderr, "%s\n", dlerror());
+		exit(1);
+	}
+	void (*read_config)(config_t *) = dlsym(handle, "acl_read_config");
+	fetch_t (*backend_load)(config_t *, const char *) =
+		dlsym(handle, "acl_backend_load");
+	if (!read_config || !backend_load) {
+		fprintf(stderr, "%s\n", dlerror());
+		exit(1);
+	}
+
+	static config_t config;
+	read_config(&config);
+	fetch_t fetch = backend_load(&config, "llamacpp");
+	if (!fetch)
+		exit(1);
+
+	// The first query loads the libraries and establishes the connection
+	double start = now_ms();
+	free(fetch(&config, "list files", 0));
+	double first = now_ms() - start;
+
+	double latency[QUERIES];
+	for (int i = 0; i < QUERIES; i++) {
+		start = now_ms();
+		char *r = fetch(&config, "list files", 0);
+		latency[i] = now_ms() - start;
+		if (!r) {
+			fprintf(stderr, "%s: query failed\n", name);
+			exit(1);
+		}
+		free(r);
+	}
+	qsort(latency, QUERIES, sizeof(double), compare_double);
+	double sum = 0;
+	for (int i = 0; i < QUERIES; i++)
+		sum += latency[i];
+
+	printf("%-14s %9.3f %9.3f %9.3f %9.3f %9ld\n", name, first,
+	    sum / QUERIES, latency[QUERIES / 2], latency[QUERIES * 99 / 100],
+	    rss_kb() - rss_before);
+	exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s library-path\n", argv[0]);
+		exit(1);
+	}
+
+	// Use readline, so that the library sets itself up
+	using_history();
+
+	// Listen on an ephemeral loopback port and a Unix-domain socket
+	int tcp = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in sin = {.sin_family = AF_INET};
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(sin);
+	if (bind(tcp, (struct sockaddr *)&sin, sizeof(sin)) == -1
+	    || getsockname(tcp, (struct sockaddr *)&sin, &len) == -1
+	    || listen(tcp, 16) == -1) {
+		perror("TCP socket");
+		exit(1);
+	}
+
+	char path[] = "/tmp/ai-cli-bench-XXXXXX";
+	if (!mkdtemp(path)) {
+		perror(path);
+		exit(1);
+	}
+	struct sockaddr_un sun = {.sun_family = AF_UNIX};
+	snprintf(sun.sun_path, sizeof(sun.sun_path), "%s/llama.sock", path);
+	int unix_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (bind(unix_socket, (struct sockaddr *)&sun, sizeof(sun)) == -1
+	    || listen(unix_socket, 16) == -1) {
+		perror(sun.sun_path);
+		exit(1);
+	}
+
+	pid_t server = fork();
+	if (server == 0)
+		serve(tcp, unix_socket);
+
+	char tcp_endpoint[64], unix_endpoint[sizeof(sun.sun_path) + 20];
+	snprintf(tcp_endpoint, sizeof(tcp_endpoint),
+	    "http://127.0.0.1:%d/completion", ntohs(sin.sin_port));
+	snprintf(unix_endpoint, sizeof(unix_endpoint), "unix:%s:/completion",
+	    sun.sun_path);
+
+	printf("%d queries; times in ms; RSS growth in kB\n", QUERIES);
+	printf("%-14s %9s %9s %9s %9s %9s\n", "Transport", "First", "Mean",
+	    "Median", "P99", "RSS");
+	fflush(stdout);
+
+	// Measure each transport in a fresh process
+	const char *names[] = {"libcurl", "built-in TCP", "built-in Unix"};
+	const char *endpoints[] = {tcp_endpoint, tcp_endpoint, unix_endpoint};
+	const char *builtin[] = {"false", "true", "true"};
+	int status = 0;
+	for (int i = 0; i < 3; i++) {
+		pid_t pid = fork();
+		if (pid == 0)
+			measure(argv[1], names[i], endpoints[i], builtin[i]);
+		int s;
+		waitpid(pid, &s, 0);
+		if (s != 0)
+			status = 1;
+	}
+
+	kill(server, SIGTERM);
+	unlink(sun.sun_path);
+	rmdir(path);
+	return status;
+}
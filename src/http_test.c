@@ -0,0 +1,145 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test the built-in HTTP client.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "http.h"
+
+static void
+test_parse_url(CuTest* tc)
+{
+	url_t u;
+
+	CuAssertTrue(tc, parse_url("http://localhost:8080/completion", &u));
+	CuAssertStrEquals(tc, "127.0.0.1", u.address);
+	CuAssertIntEquals(tc, 8080, u.port);
+	CuAssertStrEquals(tc, "localhost:8080", u.host);
+	CuAssertStrEquals(tc, "/completion", u.path);
+
+	CuAssertTrue(tc, parse_url("http://[::1]", &u));
+	CuAssertStrEquals(tc, "::1", u.address);
+	CuAssertIntEquals(tc, 80, u.port);
+	CuAssertStrEquals(tc, "/", u.path);
+
+	CuAssertTrue(tc, parse_url("unix:/run/llama.sock:/completion", &u));
+	CuAssertStrEquals(tc, "/run/llama.sock", u.socket);
+	CuAssertStrEquals(tc, "/completion", u.path);
+
+	// Remote and encrypted connections are left to libcurl
+	CuAssertTrue(tc, !parse_url("https://localhost/", &u));
+	CuAssertTrue(tc, !parse_url("http://example.com/", &u));
+	CuAssertTrue(tc, !parse_url("http://user@localhost/", &u));
+	CuAssertTrue(tc, !parse_url("http://localhost:99999/", &u));
+}
+
+// Append the specified data to the string arg
+static bool
+append(const char *data, size_t len, void *arg)
+{
+	acl_string_write((void *)data, 1, len, arg);
+	return true;
+}
+
+// Stop the transfer after the first data
+static bool
+first(const char *data, size_t len, void *arg)
+{
+	append(data, len, arg);
+	return false;
+}
+
+// Return the body of the specified response, setting status and keep_alive
+static char *
+response_body(const char *response, http_write_t consume, int *status,
+    bool *keep_alive)
+{
+	int sv[2];
+	reader_t r = {0};
+	string_t body;
+
+	socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+	write(sv[1], response, strlen(response));
+	close(sv[1]);
+	r.fd = sv[0];
+	acl_string_init(&body, "");
+	*status = read_response(&r, consume, &body, keep_alive);
+	close(sv[0]);
+	return body.ptr;
+}
+
+static void
+test_read_response(CuTest* tc)
+{
+	int status;
+	bool keep_alive;
+	char *body;
+
+	body = response_body("HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello",
+	    append, &status, &keep_alive);
+	CuAssertIntEquals(tc, 200, status);
+	CuAssertTrue(tc, keep_alive);
+	CuAssertStrEquals(tc, "hello", body);
+	free(body);
+
+	body = response_body("HTTP/1.1 200 OK\r\n"
+	    "transfer-encoding: chunked\r\n\r\n"
+	    "3\r\nhel\r\n2;ext=1\r\nlo\r\n0\r\nTrailer: x\r\n\r\n",
+	    append, &status, &keep_alive);
+	CuAssertIntEquals(tc, 200, status);
+	CuAssertStrEquals(tc, "hello", body);
+	free(body);
+
+	body = response_body("HTTP/1.1 503 Busy\r\nConnection: close\r\n\r\nlater",
+	    append, &status, &keep_alive);
+	CuAssertIntEquals(tc, 503, status);
+	CuAssertTrue(tc, !keep_alive);
+	CuAssertStrEquals(tc, "later", body);
+	free(body);
+
+	body = response_body("HTTP/1.0 200 OK\r\nContent-Length: 10\r\n\r\nshort",
+	    append, &status, &keep_alive);
+	CuAssertIntEquals(tc, HTTP_FAILED, status);
+	free(body);
+
+	// Transfers stopped by the consumer leave the connection unusable
+	body = response_body("HTTP/1.1 200 OK\r\n"
+	    "transfer-encoding: chunked\r\n\r\n"
+	    "3\r\nhel\r\n2\r\nlo\r\n0\r\n\r\n",
+	    first, &status, &keep_alive);
+	CuAssertIntEquals(tc, 200, status);
+	CuAssertTrue(tc, !keep_alive);
+	CuAssertStrEquals(tc, "hel", body);
+	free(body);
+}
+
+CuSuite*
+cu_http_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_parse_url);
+	SUITE_ADD_TEST(suite, test_read_response);
+
+	return suite;
+}
@@ -0,0 +1,63 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Shim between the in-process backend and the llama.cpp library.
+ *  The llama.cpp functions that pass structures by value are wrapped
+ *  in ones taking only pointers and scalars, so that the backend can
+ *  call them through dlsym(3) without knowing the structures' layout,
+ *  which changes across llama.cpp releases.
+ *  Build it against the installed llama.h with make llama-shim.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <llama.h>
+
+// Return the model loaded from the specified GGUF file, or NULL on error
+struct llama_model *
+acl_llama_model_load(const char *path)
+{
+	return llama_model_load_from_file(path, llama_model_default_params());
+}
+
+/*
+ * Return a new inference context for the model with the specified
+ * context size, or NULL on error.
+ * A number of threads of 0 uses llama.cpp's default.
+ * Evaluation is aborted when aborted(data) returns true.
+ */
+struct llama_context *
+acl_llama_context_new(struct llama_model *model, uint32_t n_ctx,
+    int32_t n_threads, bool (*aborted)(void *), void *data)
+{
+	struct llama_context_params params = llama_context_default_params();
+
+	params.n_ctx = n_ctx;
+	if (n_threads > 0)
+		params.n_threads = params.n_threads_batch = n_threads;
+	params.abort_callback = aborted;
+	params.abort_callback_data = data;
+	return llama_init_from_model(model, params);
+}
+
+// Evaluate the n specified tokens; return 0 on success
+int32_t
+acl_llama_decode(struct llama_context *ctx, llama_token *tokens, int32_t n)
+{
+	return llama_decode(ctx, llama_batch_get_one(tokens, n));
+}
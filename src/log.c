@@ -0,0 +1,570 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Asynchronous request and response logging.
+ *  Entries are passed through a lock-free ring buffer to a writer
+ *  thread, which appends each one, with its timestamp, through a
+ *  single write(2) to a file opened with O_APPEND, so that the entries
+ *  of concurrently running programs stay intact.
+ *  A request's static prefix (settings, system prompt, and n-shot
+ *  prompts) is logged in full once per file; subsequent requests
+ *  refer to it by its hash and contain only their remaining part.
+ *  The writer rotates the file when it exceeds the configured size,
+ *  optionally compressing the older rotated files with zstd.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "support.h"
+#include "unit_test.h"
+
+// Number of entries the ring buffer holds; a power of two
+#define RING_SIZE 256
+
+// Number of rotated files kept by default
+#define DEFAULT_MAX_FILES 5
+
+// Number of distinct request prefixes remembered for each file
+#define MAX_PREFIXES 16
+
+// zstd compression level of rotated files
+#define ZSTD_LEVEL 3
+
+typedef struct {
+	struct timeval time;
+	char *message;		// Dynamically allocated
+	size_t prefix_len;	// Length of the request's static prefix
+} entry_t;
+
+/*
+ * Bounded multi-producer queue (D. Vyukov's design).  A slot's
+ * sequence equals its position when it is free for that position's
+ * producer, and the position plus one when it holds an entry.
+ */
+static struct {
+	atomic_size_t sequence;
+	entry_t entry;
+} ring[RING_SIZE];
+static atomic_size_t enqueue_pos;
+static size_t dequeue_pos;	// Protected by lock
+
+// Set while a log file is open
+static atomic_bool enabled;
+
+// Serializes the consumers of the ring and the file's state
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Log file state, protected by lock
+static int log_fd = -1;
+static char *log_path;
+static bool log_timestamp;
+static const char *program_name;
+static off_t max_size;		// Rotate beyond this size; 0 for never
+static int max_files;
+static bool compress;
+static bool compress_pending;	// Compress rotated files after writing
+static uint64_t prefixes[MAX_PREFIXES];	// Hashes logged in this file
+static int nprefixes;
+
+// Writer thread state; the pipe wakes the writer
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool writer_started;
+static int wake_fd[2] = {-1, -1};
+
+// Functions of the dynamically loaded zstd library
+static struct {
+	size_t (*compress_bound)(size_t size);
+	size_t (*compress)(void *dst, size_t capacity, const void *src,
+	    size_t size, int level);
+	unsigned (*is_error)(size_t code);
+} zstd;
+
+static void
+ring_reset(void)
+{
+	for (size_t i = 0; i < RING_SIZE; i++)
+		atomic_store(&ring[i].sequence, i);
+	atomic_store(&enqueue_pos, 0);
+	dequeue_pos = 0;
+}
+
+// Add the entry to the ring; return false if the ring is full
+static bool
+enqueue(const entry_t *e)
+{
+	size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+
+	for (;;) {
+		size_t seq = atomic_load_explicit(
+		    &ring[pos & (RING_SIZE - 1)].sequence, memory_order_acquire);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&enqueue_pos,
+			    &pos, pos + 1, memory_order_relaxed,
+			    memory_order_relaxed))
+				break;
+		} else if (diff < 0)
+			return false;
+		else
+			pos = atomic_load_explicit(&enqueue_pos,
+			    memory_order_relaxed);
+	}
+	ring[pos & (RING_SIZE - 1)].entry = *e;
+	atomic_store_explicit(&ring[pos & (RING_SIZE - 1)].sequence, pos + 1,
+	    memory_order_release);
+	return true;
+}
+
+// Remove the oldest entry from the ring; call with lock held
+static bool
+dequeue(entry_t *e)
+{
+	size_t pos = dequeue_pos;
+	size_t seq = atomic_load_explicit(&ring[pos & (RING_SIZE - 1)].sequence,
+	    memory_order_acquire);
+
+	if (seq != pos + 1)
+		return false;
+	*e = ring[pos & (RING_SIZE - 1)].entry;
+	atomic_store_explicit(&ring[pos & (RING_SIZE - 1)].sequence,
+	    pos + RING_SIZE, memory_order_release);
+	dequeue_pos = pos + 1;
+	return true;
+}
+
+// (Re)open the log file; prefixes are defined afresh in a new file
+static void
+log_open(void)
+{
+	if (log_fd != -1)
+		close(log_fd);
+	log_fd = open(log_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	nprefixes = 0;
+}
+
+/*
+ * Shift the rotated files path.1 to path.(max_files - 1), compressed
+ * or not, up by one, dropping the oldest, and rename path to path.1.
+ */
+STATIC void
+rotate_names(const char *path, int max_files)
+{
+	static const char *suffixes[] = { "", ".zst" };
+	char *from, *to;
+
+	for (int i = max_files; i >= 1; i--)
+		for (int j = 0; j < 2; j++) {
+			acl_safe_asprintf(&to, "%s.%d%s", path, i, suffixes[j]);
+			if (i == max_files)
+				unlink(to);
+			else {
+				acl_safe_asprintf(&from, "%s.%d%s", path, i,
+				    suffixes[j]);
+				free(to);
+				acl_safe_asprintf(&to, "%s.%d%s", path, i + 1,
+				    suffixes[j]);
+				rename(from, to);
+				free(from);
+			}
+			free(to);
+		}
+	acl_safe_asprintf(&to, "%s.1", path);
+	rename(path, to);
+	free(to);
+}
+
+/*
+ * Before writing, reopen the file if another process has rotated it,
+ * and rotate it if it has grown beyond the configured size.
+ * Call with lock held.
+ */
+static void
+log_check(void)
+{
+	struct stat fst, pst;
+
+	if (log_fd == -1 || fstat(log_fd, &fst) != 0) {
+		log_open();
+		return;
+	}
+	if (stat(log_path, &pst) != 0 || pst.st_ino != fst.st_ino ||
+	    pst.st_dev != fst.st_dev) {
+		log_open();
+		return;
+	}
+	if (!max_size || fst.st_size < max_size)
+		return;
+
+	// Serialize with other processes rotating the same file
+	flock(log_fd, LOCK_EX);
+	if (stat(log_path, &pst) == 0 && pst.st_ino == fst.st_ino) {
+		rotate_names(log_path, max_files);
+		compress_pending = compress;
+	}
+	flock(log_fd, LOCK_UN);
+	log_open();
+}
+
+// Return true if the prefix with the specified hash was logged in this file
+static bool
+prefix_logged(uint64_t hash)
+{
+	for (int i = 0; i < nprefixes; i++)
+		if (prefixes[i] == hash)
+			return true;
+	if (nprefixes == MAX_PREFIXES)
+		nprefixes = 0;
+	prefixes[nprefixes++] = hash;
+	return false;
+}
+
+// Write the specified entry to the log file; call with lock held
+static void
+write_entry(const entry_t *e)
+{
+	log_check();
+	if (log_fd == -1)
+		return;
+
+	string_t s;
+	acl_string_init(&s, "");
+
+	bool reference = false;
+	uint64_t hash = 0;
+	if (e->prefix_len) {
+		hash = acl_hash(e->message, e->prefix_len);
+		reference = prefix_logged(hash);
+		// The request that follows starts with the prefix
+		if (!reference)
+			acl_string_appendf(&s, "{ \"prefix\": \"%016llx\", "
+			    "\"length\": %zu }\n", (unsigned long long)hash,
+			    e->prefix_len);
+	}
+
+	if (log_timestamp) {
+		char buffer[30];
+		struct tm tm;
+
+		localtime_r(&e->time.tv_sec, &tm);
+		strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &tm);
+		acl_string_appendf(&s, "{ \"timestamp\": \"%s.%06ld\", "
+		    "\"program\": \"%s\", \"pid\": %d }\n", buffer,
+		    (long)e->time.tv_usec, program_name, (int)getpid());
+	}
+
+	if (reference) {
+		acl_string_appendf(&s, "{ \"request\": \"%016llx\", "
+		    "\"suffix\": ", (unsigned long long)hash);
+		acl_string_append_json(&s, e->message + e->prefix_len);
+		acl_string_append(&s, " }\n");
+	} else
+		acl_string_append(&s, e->message);
+
+	// A single write keeps the entry intact; continue after a short one
+	for (size_t written = 0; written < s.len; ) {
+		ssize_t n = write(log_fd, s.ptr + written, s.len - written);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		written += n;
+	}
+	free(s.ptr);
+}
+
+// Write the entries waiting in the ring; call with lock held
+static void
+drain(void)
+{
+	entry_t e;
+
+	while (dequeue(&e)) {
+		write_entry(&e);
+		free(e.message);
+	}
+}
+
+// Load the zstd library; return false if it isn't available
+static bool
+zstd_initialize(void)
+{
+	static int result;	// 0: not tried, 1: loaded, -1: unavailable
+
+	if (result)
+		return result == 1;
+	result = -1;
+	void *handle = dlopen("libzstd." DLL_EXTENSION, RTLD_LAZY | RTLD_LOCAL);
+#if defined(__linux__)
+	// Installed without the development package
+	if (!handle)
+		handle = dlopen("libzstd.so.1", RTLD_LAZY | RTLD_LOCAL);
+#endif
+	if (!handle)
+		return false;
+	zstd.compress_bound = dlsym(handle, "ZSTD_compressBound");
+	zstd.compress = dlsym(handle, "ZSTD_compress");
+	zstd.is_error = dlsym(handle, "ZSTD_isError");
+	if (!zstd.compress_bound || !zstd.compress || !zstd.is_error)
+		return false;
+	result = 1;
+	return true;
+}
+
+// Replace the specified file with its zstd-compressed version
+static void
+compress_file(const char *path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return;
+
+	struct stat st;
+	char *data = NULL, *compressed = NULL;
+	if (fstat(fd, &st) != 0 || (data = malloc(st.st_size + 1)) == NULL ||
+	    read(fd, data, st.st_size) != st.st_size)
+		goto out;
+
+	size_t capacity = zstd.compress_bound(st.st_size);
+	if ((compressed = malloc(capacity)) == NULL)
+		goto out;
+	size_t len = zstd.compress(compressed, capacity, data, st.st_size,
+	    ZSTD_LEVEL);
+	if (zstd.is_error(len))
+		goto out;
+
+	char *tmp, *target;
+	acl_safe_asprintf(&tmp, "%s.zst.tmp", path);
+	acl_safe_asprintf(&target, "%s.zst", path);
+	int dst = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (dst != -1) {
+		bool ok = write(dst, compressed, len) == (ssize_t)len;
+		if (close(dst) == 0 && ok && rename(tmp, target) == 0)
+			unlink(path);
+		else
+			unlink(tmp);
+	}
+	free(tmp);
+	free(target);
+out:
+	close(fd);
+	free(data);
+	free(compressed);
+}
+
+/*
+ * Compress the rotated files other than the most recent one,
+ * to which processes that haven't yet noticed the rotation may
+ * still be appending.
+ */
+static void
+compress_rotated(const char *path, int max_files)
+{
+	if (!zstd_initialize())
+		return;
+	for (int i = 2; i <= max_files; i++) {
+		char *name;
+		acl_safe_asprintf(&name, "%s.%d", path, i);
+		if (access(name, F_OK) == 0)
+			compress_file(name);
+		free(name);
+	}
+}
+
+// Writer thread: write the entries added to the ring
+static void *
+writer(void *arg)
+{
+	char buffer[64];
+
+	for (;;) {
+		ssize_t n = read(wake_fd[0], buffer, sizeof(buffer));
+		if (n == 0 || (n < 0 && errno != EINTR))
+			return NULL;
+
+		pthread_mutex_lock(&lock);
+		drain();
+		char *path = compress_pending ? acl_safe_strdup(log_path) : NULL;
+		int files = max_files;
+		compress_pending = false;
+		pthread_mutex_unlock(&lock);
+
+		// Compression takes long; don't hold back the producers
+		if (path) {
+			compress_rotated(path, files);
+			free(path);
+		}
+	}
+	return NULL;
+}
+
+// Start the writer thread if needed; return false if it isn't running
+static bool
+writer_start(void)
+{
+	pthread_mutex_lock(&start_lock);
+	if (!writer_started && pipe(wake_fd) == 0) {
+		fcntl(wake_fd[0], F_SETFD, FD_CLOEXEC);
+		fcntl(wake_fd[1], F_SETFD, FD_CLOEXEC);
+		// Producers never block on a full pipe; the writer is awake
+		fcntl(wake_fd[1], F_SETFL, O_NONBLOCK);
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, writer, NULL) == 0) {
+			pthread_detach(thread);
+			writer_started = true;
+		} else {
+			close(wake_fd[0]);
+			close(wake_fd[1]);
+		}
+	}
+	bool started = writer_started;
+	pthread_mutex_unlock(&start_lock);
+	return started;
+}
+
+// Keep the log consistent across fork(2)
+static void
+fork_prepare(void)
+{
+	pthread_mutex_lock(&start_lock);
+	pthread_mutex_lock(&lock);
+}
+
+static void
+fork_parent(void)
+{
+	pthread_mutex_unlock(&lock);
+	pthread_mutex_unlock(&start_lock);
+}
+
+// The child lacks the writer thread; its entries start afresh
+static void
+fork_child(void)
+{
+	if (writer_started) {
+		close(wake_fd[0]);
+		close(wake_fd[1]);
+		writer_started = false;
+	}
+	ring_reset();
+	pthread_mutex_unlock(&lock);
+	pthread_mutex_unlock(&start_lock);
+}
+
+/*
+ * Log the specified request, whose first prefix_len bytes are the
+ * same for all requests made with the current configuration.
+ * The call returns without waiting for the entry to be written.
+ */
+void
+acl_write_log_request(config_t *config, const char *request,
+    size_t prefix_len)
+{
+	if (!atomic_load(&enabled))
+		return;
+
+	entry_t e;
+	gettimeofday(&e.time, NULL);
+	e.message = acl_safe_strdup(request);
+	e.prefix_len = prefix_len < strlen(request) ? prefix_len : 0;
+
+	if (writer_start() && enqueue(&e)) {
+		// A full pipe already holds wakeups the writer has yet to read
+		ssize_t n = write(wake_fd[1], "", 1);
+		(void)n;
+		return;
+	}
+
+	// No writer or the ring is full: write synchronously, in order
+	pthread_mutex_lock(&lock);
+	drain();
+	write_entry(&e);
+	pthread_mutex_unlock(&lock);
+	free(e.message);
+}
+
+// Log the specified string, if logging is enabled
+void
+acl_write_log(config_t *config, const char *message)
+{
+	acl_write_log_request(config, message, 0);
+}
+
+// Write all entries logged so far
+void
+acl_log_flush(void)
+{
+	pthread_mutex_lock(&lock);
+	drain();
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Start logging as specified by the configuration, writing out
+ * any entries logged under a previous one.
+ */
+void
+acl_log_initialize(config_t *config)
+{
+	static bool registered;
+
+	pthread_mutex_lock(&lock);
+	if (!registered) {
+		registered = true;
+		ring_reset();
+		pthread_atfork(fork_prepare, fork_parent, fork_child);
+		atexit(acl_log_flush);
+	}
+	drain();
+	atomic_store(&enabled, false);
+	if (log_fd != -1)
+		close(log_fd);
+	log_fd = -1;
+	free(log_path);
+	log_path = NULL;
+
+	if (config->general_logfile) {
+		log_path = acl_safe_strdup(config->general_logfile);
+		log_timestamp = config->general_timestamp;
+		program_name = config->program_name;
+		max_size = (off_t)config->general_log_max_size * 1024;
+		max_files = config->general_log_max_files_set ?
+		    config->general_log_max_files : DEFAULT_MAX_FILES;
+		if (max_files < 1)
+			max_files = 1;
+		compress = config->general_log_compress;
+		log_open();
+		if (log_fd == -1)
+			fprintf(stderr, "Unable to open log file %s: %s\n",
+			    log_path, strerror(errno));
+		else
+			atomic_store(&enabled, true);
+	}
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,35 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Asynchronous request and response logging
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include "config.h"
+
+#if defined(UNIT_TEST)
+void rotate_names(const char *path, int max_files);
+#endif
+
+void acl_log_initialize(config_t *config);
+void acl_write_log(config_t *config, const char *message);
+void acl_write_log_request(config_t *config, const char *request,
+    size_t prefix_len);
+void acl_log_flush(void);
@@ -0,0 +1,153 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test asynchronous request and response logging.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "config.h"
+#include "log.h"
+
+static const char log_file[] = "test-log.log";
+
+// Return the contents of the specified file
+static char *
+file_contents(const char *path)
+{
+	static char buffer[4096];
+
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return NULL;
+	size_t n = fread(buffer, 1, sizeof(buffer) - 1, f);
+	buffer[n] = '\0';
+	fclose(f);
+	return buffer;
+}
+
+// Remove the log file and its rotated versions
+static void
+log_remove(void)
+{
+	char name[64];
+
+	unlink(log_file);
+	for (int i = 1; i <= 3; i++) {
+		snprintf(name, sizeof(name), "%s.%d", log_file, i);
+		unlink(name);
+	}
+}
+
+static void
+test_log(CuTest* tc)
+{
+	config_t config = {"bash"};
+
+	log_remove();
+	config.general_logfile = log_file;
+	config.general_logfile_set = true;
+	acl_log_initialize(&config);
+
+	acl_write_log(&config, "hello\n");
+	acl_write_log_request(&config, "{\"system\": 1, \"user\": \"ls\"}\n", 13);
+	acl_write_log_request(&config, "{\"system\": 1, \"user\": \"\\\"pwd\"}\n", 13);
+	// A different prefix is defined anew
+	acl_write_log_request(&config, "{\"system\": 2, \"user\": \"ls\"}\n", 13);
+	acl_log_flush();
+
+	char *log = file_contents(log_file);
+	CuAssertPtrNotNull(tc, log);
+	CuAssertTrue(tc, strncmp(log, "hello\n{ \"prefix\": \"", 19) == 0);
+	char *p = strstr(log, "\", \"length\": 13 }\n{\"system\": 1, \"user\": \"ls\"}\n");
+	CuAssertPtrNotNull(tc, p);
+	p = strstr(p, "{ \"request\": \"");
+	CuAssertPtrNotNull(tc, p);
+	// The reference uses the hash of the prefix's definition
+	CuAssertTrue(tc, strncmp(p + 14, log + 19, 16) == 0);
+	// Only the rest of the request follows, as a JSON string
+	static const char suffix[] =
+	    "\", \"suffix\": \" \\\"user\\\": \\\"\\\\\\\"pwd\\\"}\\n\" }\n";
+	CuAssertTrue(tc, strncmp(p + 30, suffix, sizeof(suffix) - 1) == 0);
+	CuAssertPtrNotNull(tc, strstr(p, "{\"system\": 2, \"user\": \"ls\"}\n"));
+
+	// Timestamps identify the program and process
+	config.general_timestamp = true;
+	acl_log_initialize(&config);
+	acl_write_log(&config, "bye\n");
+	acl_log_flush();
+	log = file_contents(log_file);
+	char pid[64];
+	snprintf(pid, sizeof(pid), "\"program\": \"bash\", \"pid\": %d }\nbye\n",
+	    (int)getpid());
+	CuAssertPtrNotNull(tc, strstr(log, pid));
+
+	config.general_logfile_set = false;
+	config.general_logfile = NULL;
+	acl_log_initialize(&config);
+	log_remove();
+}
+
+static void
+test_rotate(CuTest* tc)
+{
+	config_t config = {"bash"};
+
+	log_remove();
+	config.general_logfile = log_file;
+	config.general_logfile_set = true;
+	config.general_log_max_size = 1;
+	config.general_log_max_size_set = true;
+	config.general_log_max_files = 2;
+	config.general_log_max_files_set = true;
+	acl_log_initialize(&config);
+
+	char entry[600];
+	for (int i = 0; i < 8; i++) {
+		memset(entry, '0' + i, sizeof(entry) - 2);
+		entry[sizeof(entry) - 2] = '\n';
+		entry[sizeof(entry) - 1] = '\0';
+		acl_write_log(&config, entry);
+	}
+	acl_log_flush();
+
+	// Each file is rotated after exceeding 1kB; two are kept
+	CuAssertTrue(tc, file_contents(log_file)[0] == '6');
+	CuAssertTrue(tc, file_contents("test-log.log.1")[0] == '4');
+	CuAssertTrue(tc, file_contents("test-log.log.2")[0] == '2');
+	CuAssertPtrEquals(tc, NULL, file_contents("test-log.log.3"));
+
+	config.general_logfile_set = false;
+	config.general_logfile = NULL;
+	acl_log_initialize(&config);
+	log_remove();
+}
+
+CuSuite*
+cu_log_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_log);
+	SUITE_ADD_TEST(suite, test_rotate);
+
+	return suite;
+}
@@ -0,0 +1,779 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Measure the cost of the string, request building, and response
+ *  parsing functions, and compare it against a stored baseline.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <readline/history.h>
+#include <jansson.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "backend.h"
+#include "config.h"
+#include "fetch_llama_inproc.h"
+#include "mock_server.h"
+#include "support.h"
+#include "usage.h"
+
+// Maximum number of benchmark results
+#define MAX_RESULTS 256
+
+// Prompt and response sizes in bytes
+static const size_t sizes[] = {10, 100, 1024, 4096, 16384, 65536};
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+// History entries supplied as context
+static const int depths[] = {0, 10, 50, 200};
+#define NDEPTHS (sizeof(depths) / sizeof(depths[0]))
+
+// Hardware counters read when the kernel allows it
+static const struct {
+	const char *name;
+	unsigned long long config;
+} counters[] = {
+#if defined(__linux__)
+	{"cycles", PERF_COUNT_HW_CPU_CYCLES},
+	{"instructions", PERF_COUNT_HW_INSTRUCTIONS},
+	{"branch_misses", PERF_COUNT_HW_BRANCH_MISSES},
+#endif
+};
+#define NCOUNTERS (sizeof(counters) / sizeof(counters[0]))
+
+typedef struct {
+	char name[64];
+	long iterations;
+	double ns;			// Per operation
+	double bytes;			// Allocated per operation
+	double allocs;			// Allocations per operation
+	double counter[NCOUNTERS + 1];	// Per operation
+} result_t;
+
+static result_t results[MAX_RESULTS];
+static int nresults;
+
+static config_t config = {"bash"};
+
+// Backends whose request building and response parsing is measured
+extern const backend_t acl_backend_anthropic;
+extern const backend_t acl_backend_llamacpp;
+extern const backend_t acl_backend_ollama;
+extern const backend_t acl_backend_openai;
+
+// Options
+static const char *filter;
+static double target_ns = 100e6;
+
+// Captured API responses
+static const char openai_response[] = "{\n"
+	"  \"id\": \"chatcmpl-7lg1IuegIknbhVaP00yWmdOeCeWi1\",\n"
+	"  \"object\": \"chat.completion\",\n"
+	"  \"created\": 1691597296,\n"
+	"  \"model\": \"gpt-3.5-turbo-0613\",\n"
+	"  \"choices\": [\n"
+	"    {\n"
+	"      \"index\": 0,\n"
+	"      \"message\": {\n"
+	"        \"role\": \"assistant\",\n"
+	"        \"content\": \"find . -name '*.c' -mtime -1 | xargs wc -l\"\n"
+	"      },\n"
+	"      \"finish_reason\": \"stop\"\n"
+	"    }\n"
+	"  ],\n"
+	"  \"usage\": {\n"
+	"    \"prompt_tokens\": 116,\n"
+	"    \"completion_tokens\": 16,\n"
+	"    \"total_tokens\": 132\n"
+	"  }\n"
+	"}\n";
+
+static const char anthropic_response[] = "{"
+	"\"id\":\"msg_013Zva2CMHLNnXjNJJKqJ2EF\","
+	"\"type\":\"message\","
+	"\"role\":\"assistant\","
+	"\"content\":[{\"type\":\"text\",\"text\":\"shutdown -h now\"}],"
+	"\"model\":\"claude-3-opus-20240229\","
+	"\"stop_reason\":\"end_turn\","
+	"\"stop_sequence\":null,"
+	"\"usage\":{\"input_tokens\":172,\"output_tokens\":8}"
+	"}";
+
+static const char llamacpp_response[] = "{"
+	"\"content\":\"Assistant: shutdown -h now\","
+	"\"generation_settings\":{\"frequency_penalty\":0,\"grammar\":\"\","
+	"\"ignore_eos\":false,\"logit_bias\":[],\"mirostat\":0,"
+	"\"mirostat_eta\":0.10000000149011612,\"mirostat_tau\":5,"
+	"\"model\":\"models/llama-2-13b-chat/ggml-model-q4_0.gguf\","
+	"\"n_ctx\":2048,\"n_keep\":0,\"n_predict\":-1,\"n_probs\":0,"
+	"\"penalize_nl\":true,\"presence_penalty\":0,\"repeat_last_n\":64,"
+	"\"repeat_penalty\":1.100000023841858,\"seed\":4294967295,\"stop\":[],"
+	"\"stream\":false,\"temp\":0.800000011920929,\"tfs_z\":1,\"top_k\":40,"
+	"\"top_p\":0.949999988079071,\"typical_p\":1},"
+	"\"model\":\"models/llama-2-13b-chat/ggml-model-q4_0.gguf\","
+	"\"stop\":true,\"stopped_eos\":true,\"stopped_limit\":false,"
+	"\"stopped_word\":false,\"stopping_word\":\"\","
+	"\"timings\":{\"predicted_ms\":116.577,\"predicted_n\":8,"
+	"\"predicted_per_second\":68.62417114868285,"
+	"\"predicted_per_token_ms\":14.572125,\"prompt_ms\":228.5,"
+	"\"prompt_n\":172,\"prompt_per_second\":752.7352297592998,"
+	"\"prompt_per_token_ms\":1.3284883720930232},"
+	"\"tokens_cached\":179,\"tokens_evaluated\":172,\"tokens_predicted\":8,"
+	"\"truncated\":false}";
+
+static const char ollama_response[] =
+	"{\"model\":\"llama3\",\"created_at\":\"2024-05-01T10:00:00.1Z\","
+	"\"message\":{\"role\":\"assistant\",\"content\":\"shutdown\"},"
+	"\"done\":false}\n"
+	"{\"model\":\"llama3\",\"created_at\":\"2024-05-01T10:00:00.2Z\","
+	"\"message\":{\"role\":\"assistant\",\"content\":\" -h\"},"
+	"\"done\":false}\n"
+	"{\"model\":\"llama3\",\"created_at\":\"2024-05-01T10:00:00.3Z\","
+	"\"message\":{\"role\":\"assistant\",\"content\":\" now\"},"
+	"\"done\":false}\n"
+	"{\"model\":\"llama3\",\"created_at\":\"2024-05-01T10:00:00.4Z\","
+	"\"message\":{\"role\":\"assistant\",\"content\":\"\"},"
+	"\"done_reason\":\"stop\",\"done\":true,\"total_duration\":480532125,"
+	"\"load_duration\":21052750,\"prompt_eval_count\":172,"
+	"\"prompt_eval_duration\":229514000,\"eval_count\":4,"
+	"\"eval_duration\":58322000}\n";
+
+/*
+ * Allocation accounting through the interposition of the C library's
+ * allocation functions.
+ */
+static bool counting;
+static unsigned long long alloc_count, alloc_bytes;
+
+#if defined(__GLIBC__)
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *
+malloc(size_t size)
+{
+	if (counting) {
+		alloc_count++;
+		alloc_bytes += size;
+	}
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	if (counting) {
+		alloc_count++;
+		alloc_bytes += nmemb * size;
+	}
+	return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	if (counting) {
+		alloc_count++;
+		alloc_bytes += size;
+	}
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+#if defined(__linux__)
+static int counter_fd[NCOUNTERS] = {-1};
+
+// Open the hardware counters as a group; return false if unavailable
+static bool
+counters_open(void)
+{
+	for (size_t i = 0; i < NCOUNTERS; i++) {
+		struct perf_event_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = counters[i].config;
+		attr.disabled = i == 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+		counter_fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1,
+		    i ? counter_fd[0] : -1, 0);
+		if (counter_fd[i] == -1) {
+			while (i-- > 0)
+				close(counter_fd[i]);
+			counter_fd[0] = -1;
+			return false;
+		}
+	}
+	return true;
+}
+
+static void
+counters_start(void)
+{
+	if (counter_fd[0] == -1)
+		return;
+	ioctl(counter_fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(counter_fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+// Store the counted events divided by n into value
+static void
+counters_stop(long n, double *value)
+{
+	struct {
+		unsigned long long nr;
+		unsigned long long value[NCOUNTERS];
+	} group;
+
+	if (counter_fd[0] == -1)
+		return;
+	ioctl(counter_fd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	if (read(counter_fd[0], &group, sizeof(group)) != sizeof(group))
+		return;
+	for (size_t i = 0; i < NCOUNTERS; i++)
+		value[i] = (double)group.value[i] / n;
+}
+
+static bool
+counters_available(void)
+{
+	return counter_fd[0] != -1;
+}
+#else
+static bool counters_open(void) { return false; }
+static void counters_start(void) {}
+static void counters_stop(long n, double *value) {}
+static bool counters_available(void) { return false; }
+#endif
+
+static double
+now_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/*
+ * Run the operation op on arg for about the target time and record
+ * its cost under the specified name.
+ */
+static void
+measure(const char *name, void (*op)(const void *), const void *arg)
+{
+	if (filter && !strstr(name, filter))
+		return;
+	if (nresults == MAX_RESULTS) {
+		fprintf(stderr, "Too many benchmarks; increase MAX_RESULTS\n");
+		exit(2);
+	}
+
+	// Warm the caches and find the iterations for a tenth of the time
+	op(arg);
+	long n = 1;
+	double elapsed;
+	for (;;) {
+		double start = now_ns();
+		for (long i = 0; i < n; i++)
+			op(arg);
+		elapsed = now_ns() - start;
+		if (elapsed >= target_ns / 10)
+			break;
+		n *= 2;
+	}
+	n = n * (target_ns / elapsed);
+	if (n < 1)
+		n = 1;
+
+	result_t *r = &results[nresults++];
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	r->iterations = n;
+	alloc_count = alloc_bytes = 0;
+	counting = true;
+	counters_start();
+	double start = now_ns();
+	for (long i = 0; i < n; i++)
+		op(arg);
+	r->ns = (now_ns() - start) / n;
+	counters_stop(n, r->counter);
+	counting = false;
+	r->bytes = (double)alloc_bytes / n;
+	r->allocs = (double)alloc_count / n;
+
+	fprintf(stderr, "%-32s %12.1f %10.0f %8.1f", r->name, r->ns, r->bytes,
+	    r->allocs);
+	if (counters_available())
+		fprintf(stderr, " %12.0f", r->counter[1]);
+	fputc('\n', stderr);
+}
+
+/*
+ * Return an allocated shell-like text of the specified size,
+ * containing characters that require JSON escaping.
+ */
+static char *
+text_make(size_t size)
+{
+	static const char line[] = "find . -name \"*.c\" | xargs grep -l 'main\\b'\n";
+	char *text = malloc(size + 1);
+
+	if (!text)
+		acl_errorf("memory allocation failed.");
+	for (size_t i = 0; i < size; i++)
+		text[i] = line[i % (sizeof(line) - 1)];
+	text[size] = '\0';
+	return text;
+}
+
+static void
+string_append(const void *text)
+{
+	string_t s;
+
+	acl_string_init(&s, "");
+	acl_string_append(&s, text);
+	free(s.ptr);
+}
+
+static void
+string_appendf(const void *text)
+{
+	string_t s;
+
+	acl_string_init(&s, "");
+	acl_string_appendf(&s, "%s\n", (const char *)text);
+	free(s.ptr);
+}
+
+// Write the text in the pieces a network transfer delivers
+static void
+string_write(const void *text)
+{
+	string_t s;
+	size_t len = strlen(text);
+
+	acl_string_init(&s, "");
+	for (size_t i = 0; i < len; i += 1024)
+		acl_string_write((char *)text + i, 1, len - i < 1024 ?
+		    len - i : 1024, &s);
+	free(s.ptr);
+}
+
+static void
+string_append_json(const void *text)
+{
+	string_t s;
+
+	acl_string_init(&s, "");
+	acl_string_append_json(&s, text);
+	free(s.ptr);
+}
+
+static void
+json_escape(const void *text)
+{
+	acl_json_escape(text);
+}
+
+// Build a request through the specified backend's entry
+static void
+build(const backend_t *b, const char *prompt)
+{
+	string_t s;
+
+	b->build_request(&config, prompt, history_length, &s);
+	free(s.ptr);
+}
+
+static void
+build_openai(const void *prompt)
+{
+	build(&acl_backend_openai, prompt);
+}
+
+static void
+build_anthropic(const void *prompt)
+{
+	build(&acl_backend_anthropic, prompt);
+}
+
+static void
+build_llamacpp(const void *prompt)
+{
+	build(&acl_backend_llamacpp, prompt);
+}
+
+static void
+build_ollama(const void *prompt)
+{
+	build(&acl_backend_ollama, prompt);
+}
+
+static void
+build_llama_inproc(const void *prompt)
+{
+	free(inproc_prompt(&config, prompt, history_length));
+}
+
+static void
+parse_openai(const void *response)
+{
+	free(acl_backend_openai.parse_response(response));
+}
+
+static void
+parse_anthropic(const void *response)
+{
+	free(acl_backend_anthropic.parse_response(response));
+}
+
+static void
+parse_llamacpp(const void *response)
+{
+	free(acl_backend_llamacpp.parse_response(response));
+}
+
+static void
+parse_ollama(const void *response)
+{
+	const backend_t *b = &acl_backend_ollama;
+	void *stream = b->stream_new();
+
+	b->stream_chunk(response, strlen(response), stream);
+	free(b->stream_end(stream));
+}
+
+static const struct {
+	const char *name;
+	void (*op)(const void *);
+} string_ops[] = {
+	{"string_append", string_append},
+	{"string_appendf", string_appendf},
+	{"string_write", string_write},
+	{"string_append_json", string_append_json},
+	{"json_escape", json_escape},
+};
+
+static const struct {
+	const char *name;
+	void (*op)(const void *);
+} builders[] = {
+	{"openai", build_openai},
+	{"anthropic", build_anthropic},
+	{"llamacpp", build_llamacpp},
+	{"ollama", build_ollama},
+	{"llama_inproc", build_llama_inproc},
+};
+
+static const struct {
+	const char *name;
+	void (*op)(const void *);
+	enum protocol protocol;
+	const char *captured;
+} parsers[] = {
+	{"openai", parse_openai, PROTO_OPENAI, openai_response},
+	{"anthropic", parse_anthropic, PROTO_ANTHROPIC, anthropic_response},
+	{"llamacpp", parse_llamacpp, PROTO_LLAMACPP, llamacpp_response},
+	{"ollama", parse_ollama, PROTO_NONE, ollama_response},
+};
+
+#define ELEMENTS(x) (sizeof(x) / sizeof(x[0]))
+
+/*
+ * Return an allocated streamed Ollama response delivering the
+ * text in word tokens.
+ */
+static char *
+ollama_stream_make(const char *text)
+{
+	string_t s;
+
+	acl_string_init(&s, "");
+	while (*text) {
+		size_t n = strcspn(text + 1, " \n") + 1;
+		char *token = acl_range_strdup(text, text + n);
+		acl_string_append(&s, "{\"model\":\"llama3\",\"message\":"
+		    "{\"role\":\"assistant\",\"content\":");
+		acl_string_append_json(&s, token);
+		acl_string_append(&s, "},\"done\":false}\n");
+		free(token);
+		text += n;
+	}
+	acl_string_append(&s, "{\"model\":\"llama3\",\"message\":"
+	    "{\"role\":\"assistant\",\"content\":\"\"},\"done\":true}\n");
+	return s.ptr;
+}
+
+static void
+run_benchmarks(void)
+{
+	char name[64];
+
+	for (size_t i = 0; i < NSIZES; i++) {
+		char *text = text_make(sizes[i]);
+		for (size_t j = 0; j < ELEMENTS(string_ops); j++) {
+			snprintf(name, sizeof(name), "%s/%zu", string_ops[j].name,
+			    sizes[i]);
+			measure(name, string_ops[j].op, text);
+		}
+		free(text);
+	}
+
+	// Prompt sizes with the configured context depth
+	for (size_t i = 0; i < NSIZES; i++) {
+		char *prompt = text_make(sizes[i]);
+		for (size_t j = 0; j < ELEMENTS(builders); j++) {
+			snprintf(name, sizeof(name), "build/%s/p%zu/h%d",
+			    builders[j].name, sizes[i], config.prompt_context);
+			measure(name, builders[j].op, prompt);
+		}
+		free(prompt);
+	}
+
+	// Context depths with a typical prompt
+	int context = config.prompt_context;
+	char *prompt = text_make(100);
+	for (size_t i = 0; i < NDEPTHS; i++) {
+		config.prompt_context = depths[i];
+		for (size_t j = 0; j < ELEMENTS(builders); j++) {
+			snprintf(name, sizeof(name), "build/%s/p100/h%d",
+			    builders[j].name, depths[i]);
+			measure(name, builders[j].op, prompt);
+		}
+	}
+	free(prompt);
+	config.prompt_context = context;
+
+	// Captured responses and ones with responses of increasing size
+	for (size_t j = 0; j < ELEMENTS(parsers); j++) {
+		snprintf(name, sizeof(name), "parse/%s/captured",
+		    parsers[j].name);
+		measure(name, parsers[j].op, parsers[j].captured);
+		for (size_t i = 0; i < NSIZES; i++) {
+			char *text = text_make(sizes[i]);
+			char *response = parsers[j].protocol == PROTO_NONE ?
+			    ollama_stream_make(text) :
+			    response_body(parsers[j].protocol, text, 172);
+			snprintf(name, sizeof(name), "parse/%s/r%zu",
+			    parsers[j].name, sizes[i]);
+			measure(name, parsers[j].op, response);
+			free(response);
+			free(text);
+		}
+	}
+	// Discard the usage of the parsed responses
+	acl_usage_record(&config, "bench", NULL);
+}
+
+static void
+results_write(FILE *f)
+{
+	fprintf(f, "{\n  \"benchmarks\": [\n");
+	for (int i = 0; i < nresults; i++) {
+		result_t *r = &results[i];
+		fprintf(f, "    {\"name\": \"%s\", \"iterations\": %ld, "
+		    "\"ns_per_op\": %.2f, \"bytes_per_op\": %.1f, "
+		    "\"allocs_per_op\": %.2f", r->name, r->iterations, r->ns,
+		    r->bytes, r->allocs);
+		if (counters_available())
+			for (size_t j = 0; j < NCOUNTERS; j++)
+				fprintf(f, ", \"%s_per_op\": %.1f",
+				    counters[j].name, r->counter[j]);
+		fprintf(f, "}%s\n", i == nresults - 1 ? "" : ",");
+	}
+	fprintf(f, "  ]\n}\n");
+}
+
+/*
+ * Report a regression of the named metric if its value exceeds the
+ * baseline b's one by more than threshold percent.
+ * Return true if a regression was found.
+ */
+static bool
+regressed(const char *name, const char *metric, double value, json_t *b,
+    double threshold)
+{
+	json_t *base = json_object_get(b, metric);
+
+	if (!json_is_number(base))
+		return false;
+	double base_value = json_number_value(base);
+	if (value <= base_value * (1 + threshold / 100) ||
+	    (base_value == 0 && value < 0.5))
+		return false;
+	fprintf(stderr, "Regression: %s %s %.1f -> %.1f (%+.1f%%)\n", name,
+	    metric, base_value, value,
+	    base_value ? (value - base_value) / base_value * 100 : 100.0);
+	return true;
+}
+
+/*
+ * Compare the results against the baseline stored in the specified file.
+ * Return the number of regressed benchmarks or -1 on error.
+ */
+static int
+baseline_compare(const char *path, double threshold)
+{
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	string_t s;
+	char buff[4096];
+	size_t n;
+	acl_string_init(&s, "");
+	while ((n = fread(buff, 1, sizeof(buff), f)) > 0)
+		acl_string_write(buff, 1, n, &s);
+	fclose(f);
+
+	json_error_t error;
+	json_t *root = json_loadb(s.ptr, s.len, 0, &error);
+	free(s.ptr);
+	if (!root) {
+		fprintf(stderr, "%s:%d: %s\n", path, error.line, error.text);
+		return -1;
+	}
+	json_t *benchmarks = json_object_get(root, "benchmarks");
+	int regressions = 0, compared = 0;
+	for (int i = 0; i < nresults; i++) {
+		result_t *r = &results[i];
+		json_t *b = NULL;
+		for (size_t j = 0; j < json_array_size(benchmarks); j++) {
+			json_t *e = json_array_get(benchmarks, j);
+			const char *name = json_string_value(json_object_get(e,
+			    "name"));
+			if (name && strcmp(name, r->name) == 0) {
+				b = e;
+				break;
+			}
+		}
+		if (!b)
+			continue;
+		compared++;
+		// Evaluate all metrics to report each one that regressed
+		bool found = regressed(r->name, "ns_per_op", r->ns, b, threshold);
+		found |= regressed(r->name, "bytes_per_op", r->bytes, b, threshold);
+		found |= regressed(r->name, "allocs_per_op", r->allocs, b,
+		    threshold);
+		if (counters_available())
+			found |= regressed(r->name, "instructions_per_op",
+			    r->counter[1], b, threshold);
+		regressions += found;
+	}
+	json_decref(root);
+	fprintf(stderr, "%d of %d benchmarks compared with %s regressed "
+	    "by more than %g%%\n", regressions, compared, path, threshold);
+	return regressions;
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-b baseline] [-f filter] [-o file] "
+	    "[-t threshold] [-T ms]\n"
+	    "-b baseline\tCompare the results with the specified JSON file\n"
+	    "-f filter\tRun only the benchmarks whose name contains filter\n"
+	    "-o file\t\tWrite the JSON results to file (default stdout)\n"
+	    "-t threshold\tRegression threshold percentage (default 10)\n"
+	    "-T ms\t\tTime spent on each benchmark (default 100)\n", name);
+	exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *baseline = NULL, *output = NULL;
+	double threshold = 10;
+	int c;
+
+	while ((c = getopt(argc, argv, "b:f:o:t:T:")) != -1)
+		switch (c) {
+		case 'b':
+			baseline = optarg;
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 't':
+			threshold = atof(optarg);
+			break;
+		case 'T':
+			target_ns = atof(optarg) * 1e6;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	if (optind != argc || target_ns <= 0)
+		usage(argv[0]);
+
+	// The shipped configuration, without context providers
+	read_file_config(&config, "ai-cli-config");
+
+	// History entries of varying length for the context
+	clear_history();
+	for (int i = 0; i < depths[NDEPTHS - 1]; i++) {
+		char *line;
+		acl_safe_asprintf(&line, "grep -rn 'pattern %d' src/%.*s | "
+		    "head -%d", i, i % 40, "lib/include/test/doc/tools/x/y/z/w/",
+		    i);
+		add_history(line);
+		free(line);
+	}
+
+	bool have_counters = counters_open();
+	fprintf(stderr, "Times in ns; allocations in bytes and calls%s\n",
+	    have_counters ? "; counts in instructions" :
+	    "; hardware counters unavailable");
+	fprintf(stderr, "%-32s %12s %10s %8s%s\n", "Benchmark", "Time/op",
+	    "Bytes/op", "Allocs", have_counters ? "  Instr/op" : "");
+	run_benchmarks();
+
+	FILE *f = output ? fopen(output, "w") : stdout;
+	if (!f) {
+		perror(output);
+		return 2;
+	}
+	results_write(f);
+	if (output)
+		fclose(f);
+
+	if (baseline) {
+		int regressions = baseline_compare(baseline, threshold);
+		if (regressions)
+			return regressions < 0 ? 2 : 1;
+	}
+	return 0;
+}
@@ -0,0 +1,858 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Mock server for the OpenAI, Anthropic and llama.cpp protocols,
+ *  with latency and fault injection, for offline testing and
+ *  benchmarking of the backends' transport path.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE	// memmem
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mock_server.h"
+#include "unit_test.h"
+
+// Server behavior, as set through the command-line options
+static struct {
+	latency_t latency;	// Delay before each response
+	double token_rate;	// Generated tokens per second; 0 for no pacing
+	double p429, p500;	// Probability of these error responses
+	double preset;		// Probability of resetting the connection
+	double pslow;		// Probability of trickling the response body
+	int slow_ms;		// Delay between the bytes of a trickled body
+	const char *text;	// Content of the responses
+	long max_requests;	// Exit after serving these; 0 for no limit
+	long seed;
+	bool verbose;
+} opt = {
+	.latency = {DIST_FIXED, 0, 0},
+	.slow_ms = 50,
+	.text = "ls -l",
+	.seed = 1,
+};
+
+// Prefix of llama.cpp responses, which continue the backend's prompt
+static const char assistant[] = "Assistant: ";
+
+/*
+ * Set l to the latency distribution specified as fixed:MS,
+ * uniform:MIN:MAX, normal:MEAN:SD, exp:MEAN, or plain MS.
+ * Return false if the specification is invalid.
+ */
+STATIC bool
+latency_parse(const char *spec, latency_t *l)
+{
+	static const struct {
+		const char *name;
+		int type;
+		int nargs;
+	} dist[] = {
+		{"fixed:", DIST_FIXED, 1},
+		{"uniform:", DIST_UNIFORM, 2},
+		{"normal:", DIST_NORMAL, 2},
+		{"exp:", DIST_EXP, 1},
+	};
+	int nargs = 1;
+
+	l->type = DIST_FIXED;
+	for (size_t i = 0; i < sizeof(dist) / sizeof(dist[0]); i++)
+		if (strncmp(spec, dist[i].name, strlen(dist[i].name)) == 0) {
+			spec += strlen(dist[i].name);
+			l->type = dist[i].type;
+			nargs = dist[i].nargs;
+			break;
+		}
+
+	char *end;
+	l->a = strtod(spec, &end);
+	if (end == spec || l->a < 0)
+		return false;
+	l->b = 0;
+	if (nargs == 2) {
+		if (*end != ':')
+			return false;
+		spec = end + 1;
+		l->b = strtod(spec, &end);
+		if (end == spec || l->b < 0)
+			return false;
+	}
+	if (l->type == DIST_UNIFORM && l->b < l->a)
+		return false;
+	return *end == '\0';
+}
+
+// Return a delay (ms) drawn from the specified distribution
+STATIC double
+latency_sample(const latency_t *l, unsigned short xsubi[3])
+{
+	double ms;
+
+	switch (l->type) {
+	case DIST_FIXED:
+		return l->a;
+	case DIST_UNIFORM:
+		return l->a + (l->b - l->a) * erand48(xsubi);
+	case DIST_NORMAL:
+		// Box-Muller transform, truncated at zero
+		ms = l->a + l->b * sqrt(-2 * log(1 - erand48(xsubi))) *
+		    cos(2 * M_PI * erand48(xsubi));
+		return ms < 0 ? 0 : ms;
+	case DIST_EXP:
+		return -l->a * log(1 - erand48(xsubi));
+	}
+	return 0;
+}
+
+// Return the protocol served at the specified request path
+STATIC enum protocol
+protocol_of(const char *path)
+{
+	static const struct {
+		const char *suffix;
+		enum protocol protocol;
+	} endpoints[] = {
+		{"/chat/completions", PROTO_OPENAI},
+		{"/messages", PROTO_ANTHROPIC},
+		{"/completion", PROTO_LLAMACPP},
+	};
+	size_t len = strcspn(path, "?");
+
+	for (size_t i = 0; i < sizeof(endpoints) / sizeof(endpoints[0]); i++) {
+		size_t slen = strlen(endpoints[i].suffix);
+		if (len >= slen && memcmp(path + len - slen,
+		    endpoints[i].suffix, slen) == 0)
+			return endpoints[i].protocol;
+	}
+	return PROTO_NONE;
+}
+
+// Return true if the header line at s has the specified name
+static bool
+header_is(const char *s, const char *name)
+{
+	size_t len = strlen(name);
+
+	return strncasecmp(s, name, len) == 0 && s[len] == ':';
+}
+
+/*
+ * Parse the framing of the request at the start of the NUL-terminated
+ * buffer of length len into r.
+ * Return 1 if the request's headers are complete, 0 if more data
+ * is needed, or -1 if the request cannot be served.
+ */
+STATIC int
+request_parse(const char *buffer, size_t len, request_t *r)
+{
+	if (len == 0)
+		return 0;
+	const char *end = memmem(buffer, len, "\r\n\r\n", 4);
+	if (!end)
+		return 0;
+
+	int minor;
+	if (sscanf(buffer, "%*15s %255s HTTP/1.%d", r->path, &minor) != 2)
+		return -1;
+	r->header_length = end + 4 - buffer;
+	r->body_length = 0;
+	r->expect_continue = false;
+	r->keep_alive = minor >= 1;
+
+	for (const char *s = strstr(buffer, "\r\n") + 2; s < end;
+	    s = strstr(s, "\r\n") + 2) {
+		const char *value = strchr(s, ':');
+		if (!value || value > end)
+			return -1;
+		value += 1 + strspn(value + 1, " \t");
+		if (header_is(s, "Content-Length"))
+			r->body_length = strtoul(value, NULL, 10);
+		else if (header_is(s, "Expect"))
+			r->expect_continue = strncasecmp(value,
+			    "100-continue", 12) == 0;
+		else if (header_is(s, "Connection"))
+			r->keep_alive = strncasecmp(value, "close", 5) != 0;
+		else if (header_is(s, "Transfer-Encoding"))
+			return -1;	// Chunked request bodies are not needed
+	}
+	return 1;
+}
+
+// Return the length of the token at s: leading space and a word
+STATIC size_t
+token_length(const char *s)
+{
+	size_t n = strspn(s, " \t\n");
+
+	return n + strcspn(s + n, " \t\n");
+}
+
+// Return the number of tokens in s
+STATIC long
+token_count(const char *s)
+{
+	long n = 0;
+
+	for (; *s; s += token_length(s))
+		n++;
+	return n;
+}
+
+// Output the specified characters escaped for a JSON string
+static void
+json_put_chars(FILE *f, const char *s, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = s[i];
+		if (c == '"' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if (c == '\n')
+			fputs("\\n", f);
+		else if (c < 0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			fputc(c, f);
+	}
+}
+
+// Output the specified string as a JSON string value
+static void
+json_put(FILE *f, const char *s, size_t len)
+{
+	fputc('"', f);
+	json_put_chars(f, s, len);
+	fputc('"', f);
+}
+
+// Output llama.cpp's token counts and generation timings
+static void
+llamacpp_put_usage(FILE *f, long tokens_in, long tokens_out)
+{
+	double ms = opt.token_rate > 0 ? tokens_out * 1e3 / opt.token_rate : 0;
+
+	fprintf(f, "\"tokens_evaluated\":%ld,\"tokens_predicted\":%ld,"
+	    "\"timings\":{\"prompt_n\":%ld,\"predicted_n\":%ld,"
+	    "\"predicted_ms\":%.3f}", tokens_in, tokens_out, tokens_in,
+	    tokens_out, ms);
+}
+
+/*
+ * Return an allocated complete (not streamed) response body of
+ * the specified protocol with the specified text.
+ */
+STATIC char *
+response_body(enum protocol p, const char *text, long tokens_in)
+{
+	char *body;
+	size_t len;
+	FILE *f = open_memstream(&body, &len);
+	long tokens_out = token_count(text);
+
+	switch (p) {
+	case PROTO_OPENAI:
+		fputs("{\"id\":\"chatcmpl-mock\",\"object\":\"chat.completion\","
+		    "\"model\":\"mock\",\"choices\":[{\"index\":0,"
+		    "\"message\":{\"role\":\"assistant\",\"content\":", f);
+		json_put(f, text, strlen(text));
+		fprintf(f, "},\"finish_reason\":\"stop\"}],\"usage\":{"
+		    "\"prompt_tokens\":%ld,\"completion_tokens\":%ld,"
+		    "\"total_tokens\":%ld,"
+		    "\"prompt_tokens_details\":{\"cached_tokens\":0}}}",
+		    tokens_in, tokens_out, tokens_in + tokens_out);
+		break;
+	case PROTO_ANTHROPIC:
+		fputs("{\"id\":\"msg_mock\",\"type\":\"message\","
+		    "\"role\":\"assistant\",\"model\":\"mock\","
+		    "\"content\":[{\"type\":\"text\",\"text\":", f);
+		json_put(f, text, strlen(text));
+		fprintf(f, "}],\"stop_reason\":\"end_turn\",\"usage\":{"
+		    "\"input_tokens\":%ld,\"output_tokens\":%ld,"
+		    "\"cache_read_input_tokens\":0}}", tokens_in, tokens_out);
+		break;
+	case PROTO_LLAMACPP:
+		fputs("{\"content\":\"", f);
+		json_put_chars(f, assistant, sizeof(assistant) - 1);
+		json_put_chars(f, text, strlen(text));
+		fputs("\",\"stop\":true,", f);
+		llamacpp_put_usage(f, tokens_in, tokens_out);
+		fputc('}', f);
+		break;
+	case PROTO_NONE:
+		break;
+	}
+	fclose(f);
+	return body;
+}
+
+// Return an allocated error response body of the specified protocol
+STATIC char *
+error_body(enum protocol p, int status)
+{
+	char *body;
+	size_t len;
+	FILE *f = open_memstream(&body, &len);
+	bool limit = status == 429;
+	const char *message = limit ? "Mock rate limit reached" :
+	    "Mock server error";
+
+	switch (p) {
+	case PROTO_OPENAI:
+		fprintf(f, "{\"error\":{\"message\":\"%s\",\"type\":\"%s\","
+		    "\"code\":null}}", message,
+		    limit ? "rate_limit_exceeded" : "server_error");
+		break;
+	case PROTO_ANTHROPIC:
+		fprintf(f, "{\"type\":\"error\",\"error\":{\"type\":\"%s\","
+		    "\"message\":\"%s\"}}",
+		    limit ? "rate_limit_error" : "api_error", message);
+		break;
+	case PROTO_LLAMACPP:
+		fprintf(f, "{\"error\":{\"code\":%d,\"message\":\"%s\","
+		    "\"type\":\"%s\"}}", status, message,
+		    limit ? "unavailable_error" : "server_error");
+		break;
+	case PROTO_NONE:
+		fputs("{\"error\":\"Not found\"}", f);
+		break;
+	}
+	fclose(f);
+	return body;
+}
+
+/*
+ * Return an allocated server-sent event of the specified protocol
+ * for the start, a token, or the end of a streamed response.
+ */
+STATIC char *
+stream_event(enum protocol p, enum event e, const char *token,
+    size_t token_len, long tokens_in, long tokens_out)
+{
+	char *event;
+	size_t len;
+	FILE *f = open_memstream(&event, &len);
+	static const char openai_chunk[] = "data: {\"id\":\"chatcmpl-mock\","
+	    "\"object\":\"chat.completion.chunk\",\"model\":\"mock\","
+	    "\"choices\":[{\"index\":0,";
+
+	switch (p) {
+	case PROTO_OPENAI:
+		fputs(openai_chunk, f);
+		if (e == EVENT_START)
+			fputs("\"delta\":{\"role\":\"assistant\","
+			    "\"content\":\"\"},\"finish_reason\":null}]}\n\n", f);
+		else if (e == EVENT_TOKEN) {
+			fputs("\"delta\":{\"content\":", f);
+			json_put(f, token, token_len);
+			fputs("},\"finish_reason\":null}]}\n\n", f);
+		} else
+			fprintf(f, "\"delta\":{},\"finish_reason\":\"stop\"}],"
+			    "\"usage\":{\"prompt_tokens\":%ld,"
+			    "\"completion_tokens\":%ld,\"total_tokens\":%ld}}"
+			    "\n\ndata: [DONE]\n\n",
+			    tokens_in, tokens_out, tokens_in + tokens_out);
+		break;
+	case PROTO_ANTHROPIC:
+		if (e == EVENT_START)
+			fprintf(f, "event: message_start\n"
+			    "data: {\"type\":\"message_start\",\"message\":{"
+			    "\"id\":\"msg_mock\",\"type\":\"message\","
+			    "\"role\":\"assistant\",\"model\":\"mock\","
+			    "\"content\":[],\"stop_reason\":null,\"usage\":{"
+			    "\"input_tokens\":%ld,\"output_tokens\":0}}}\n\n"
+			    "event: content_block_start\n"
+			    "data: {\"type\":\"content_block_start\","
+			    "\"index\":0,\"content_block\":{\"type\":\"text\","
+			    "\"text\":\"\"}}\n\n", tokens_in);
+		else if (e == EVENT_TOKEN) {
+			fputs("event: content_block_delta\n"
+			    "data: {\"type\":\"content_block_delta\","
+			    "\"index\":0,\"delta\":{\"type\":\"text_delta\","
+			    "\"text\":", f);
+			json_put(f, token, token_len);
+			fputs("}}\n\n", f);
+		} else
+			fprintf(f, "event: content_block_stop\n"
+			    "data: {\"type\":\"content_block_stop\","
+			    "\"index\":0}\n\n"
+			    "event: message_delta\n"
+			    "data: {\"type\":\"message_delta\",\"delta\":{"
+			    "\"stop_reason\":\"end_turn\"},\"usage\":{"
+			    "\"output_tokens\":%ld}}\n\n"
+			    "event: message_stop\n"
+			    "data: {\"type\":\"message_stop\"}\n\n", tokens_out);
+		break;
+	case PROTO_LLAMACPP:
+		fputs("data: {\"content\":", f);
+		if (e == EVENT_START)
+			json_put(f, assistant, sizeof(assistant) - 1);
+		else if (e == EVENT_TOKEN)
+			json_put(f, token, token_len);
+		else
+			fputs("\"\"", f);
+		if (e == EVENT_END) {
+			fputs(",\"stop\":true,", f);
+			llamacpp_put_usage(f, tokens_in, tokens_out);
+			fputs("}\n\n", f);
+		} else
+			fputs(",\"stop\":false}\n\n", f);
+		break;
+	case PROTO_NONE:
+		break;
+	}
+	fclose(f);
+	return event;
+}
+
+#if !defined(UNIT_TEST)
+// Number of requests served
+static atomic_long served;
+
+// A client connection
+typedef struct {
+	int fd;
+	unsigned short xsubi[3];	// Random state of its fault injection
+} connection_t;
+
+static void
+sleep_ms(double ms)
+{
+	struct timespec ts = {ms / 1000, fmod(ms, 1000) * 1e6};
+
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+		;
+}
+
+/*
+ * Send the specified data, one byte at a time if slow is true.
+ * Return false on a write error.
+ */
+static bool
+send_data(connection_t *c, const char *data, size_t len, bool slow)
+{
+	while (len > 0) {
+		ssize_t n = write(c->fd, data, slow ? 1 : len);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		len -= n;
+		if (slow && len > 0)
+			sleep_ms(opt.slow_ms);
+	}
+	return true;
+}
+
+// Send data as a chunk of a chunked transfer encoding body
+static bool
+send_chunk(connection_t *c, const char *data, bool slow)
+{
+	char header[32];
+	size_t len = strlen(data);
+
+	snprintf(header, sizeof(header), "%zx\r\n", len);
+	return send_data(c, header, strlen(header), false)
+	    && send_data(c, data, len, slow)
+	    && send_data(c, "\r\n", 2, false);
+}
+
+/*
+ * Send the response's status line and headers.
+ * A negative length signifies a chunked body.
+ */
+static bool
+send_headers(connection_t *c, int status, const char *type, long length,
+    bool keep_alive)
+{
+	char headers[512];
+	const char *reason = status == 200 ? "OK" :
+	    status == 400 ? "Bad Request" :
+	    status == 404 ? "Not Found" :
+	    status == 429 ? "Too Many Requests" : "Internal Server Error";
+	char length_header[64];
+
+	if (length < 0)
+		strcpy(length_header, "Transfer-Encoding: chunked");
+	else
+		snprintf(length_header, sizeof(length_header),
+		    "Content-Length: %ld", length);
+	int len = snprintf(headers, sizeof(headers),
+	    "HTTP/1.1 %d %s\r\n"
+	    "Content-Type: %s\r\n"
+	    "%s\r\n"
+	    "%s"
+	    "%s"
+	    "\r\n", status, reason, type, length_header,
+	    status == 429 ? "Retry-After: 1\r\n" : "",
+	    keep_alive ? "" : "Connection: close\r\n");
+	return send_data(c, headers, len, false);
+}
+
+// Abort the connection with a TCP reset when it is closed
+static bool
+reset(connection_t *c)
+{
+	struct linger l = {1, 0};
+
+	setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+	return false;
+}
+
+/*
+ * Respond to the request r with the specified body, injecting
+ * the configured latency and faults.
+ * Return false if the connection cannot be used further.
+ */
+static bool
+respond(connection_t *c, const request_t *r, const char *body)
+{
+	enum protocol p = protocol_of(r->path);
+	bool stream = memmem(body, r->body_length, "\"stream\":true", 13)
+	    || memmem(body, r->body_length, "\"stream\": true", 14);
+	// About four bytes per token
+	long tokens_in = r->body_length / 4 + 1;
+	long tokens_out = token_count(opt.text);
+
+	double u = erand48(c->xsubi);
+	int status = p == PROTO_NONE ? 404 :
+	    u < opt.p429 ? 429 :
+	    u < opt.p429 + opt.p500 ? 500 : 200;
+	bool aborted = erand48(c->xsubi) < opt.preset;
+	bool slow = erand48(c->xsubi) < opt.pslow;
+
+	if (opt.verbose)
+		fprintf(stderr, "%s %d%s%s%s\n", r->path, status,
+		    stream ? " stream" : "", aborted ? " reset" : "",
+		    slow ? " slow" : "");
+
+	sleep_ms(latency_sample(&opt.latency, c->xsubi));
+
+	if (status != 200 || !stream) {
+		char *response;
+		if (status != 200)
+			response = error_body(p, status);
+		else {
+			// The time the model would take to generate the text
+			if (opt.token_rate > 0)
+				sleep_ms(tokens_out * 1e3 / opt.token_rate);
+			response = response_body(p, opt.text, tokens_in);
+		}
+		bool ok = send_headers(c, status, "application/json",
+		    strlen(response), r->keep_alive)
+		    && (aborted ? reset(c) :
+		    send_data(c, response, strlen(response), slow));
+		free(response);
+		return ok;
+	}
+
+	if (!send_headers(c, status, "text/event-stream", -1, r->keep_alive))
+		return false;
+	if (aborted)
+		return reset(c);
+	char *event = stream_event(p, EVENT_START, NULL, 0, tokens_in, 0);
+	bool ok = send_chunk(c, event, slow);
+	free(event);
+	for (const char *s = opt.text; ok && *s; s += token_length(s)) {
+		if (opt.token_rate > 0)
+			sleep_ms(1e3 / opt.token_rate);
+		event = stream_event(p, EVENT_TOKEN, s, token_length(s),
+		    tokens_in, 0);
+		ok = send_chunk(c, event, slow);
+		free(event);
+	}
+	if (!ok)
+		return false;
+	event = stream_event(p, EVENT_END, NULL, 0, tokens_in, tokens_out);
+	ok = send_chunk(c, event, slow) && send_data(c, "0\r\n\r\n", 5, false);
+	free(event);
+	return ok;
+}
+
+// Serve the requests arriving on a connection until it is closed
+static void *
+serve_connection(void *arg)
+{
+	connection_t *c = arg;
+	char *buffer = NULL;
+	size_t size = 0, len = 0;
+
+	for (;;) {
+		request_t r;
+		bool continued = false;
+		int status;
+
+		// Read the request's headers and body
+		while ((status = request_parse(buffer, len, &r)) == 0
+		    || (status == 1 && len < r.header_length + r.body_length)) {
+			if (status == 1 && r.expect_continue && !continued) {
+				static const char cont[] =
+				    "HTTP/1.1 100 Continue\r\n\r\n";
+				if (!send_data(c, cont, sizeof(cont) - 1,
+				    false))
+					goto done;
+				continued = true;
+			}
+			if (size - len < 4096) {
+				size = size ? size * 2 : 65536;
+				buffer = realloc(buffer, size);
+				if (!buffer)
+					goto done;
+			}
+			ssize_t n = read(c->fd, buffer + len, size - len - 1);
+			if (n == -1 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				goto done;
+			len += n;
+			buffer[len] = '\0';
+		}
+		if (status == -1) {
+			send_headers(c, 400, "text/plain", 0, false);
+			goto done;
+		}
+
+		bool ok = respond(c, &r, buffer + r.header_length);
+		if (opt.max_requests && atomic_fetch_add(&served, 1) + 1
+		    >= opt.max_requests)
+			exit(0);
+		if (!ok || !r.keep_alive)
+			goto done;
+
+		// Keep any pipelined data that follows
+		size_t request_len = r.header_length + r.body_length;
+		memmove(buffer, buffer + request_len, len - request_len + 1);
+		len -= request_len;
+	}
+done:
+	close(c->fd);
+	free(buffer);
+	free(c);
+	return NULL;
+}
+
+// Serve each connection arriving on the listening socket in a thread
+static void *
+accept_loop(void *arg)
+{
+	int listener = *(int *)arg;
+
+	for (unsigned short n = 0;; n++) {
+		int fd = accept(listener, NULL, NULL);
+		if (fd == -1)
+			continue;
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		connection_t *c = malloc(sizeof(*c));
+		if (!c) {
+			close(fd);
+			continue;
+		}
+		c->fd = fd;
+		c->xsubi[0] = opt.seed & 0xffff;
+		c->xsubi[1] = (opt.seed >> 16) & 0xffff;
+		c->xsubi[2] = n;
+
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, serve_connection, c) != 0) {
+			close(fd);
+			free(c);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+	return NULL;
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-v] [-a address] [-d ms] [-e status:probability]\n"
+	    "\t[-l latency] [-n requests] [-p port] [-r probability]\n"
+	    "\t[-S seed] [-s probability] [-T text] [-t tokens/s]\n"
+	    "\t[-- command [argument ...]]\n"
+	    "-a\tAddress to listen on (default 127.0.0.1)\n"
+	    "-d\tDelay between the bytes of a trickled body (default 50)\n"
+	    "-e\tRespond with the HTTP status 429 or 500 with this probability\n"
+	    "-l\tResponse latency (ms): fixed:MS, uniform:MIN:MAX,\n"
+	    "\tnormal:MEAN:SD, or exp:MEAN\n"
+	    "-n\tExit after serving the specified number of requests\n"
+	    "-p\tPort to listen on (default any free one)\n"
+	    "-r\tReset the connection after the headers with this probability\n"
+	    "-S\tSeed of the fault injection\n"
+	    "-s\tTrickle the response body with this probability\n"
+	    "-T\tResponse text (default \"ls -l\")\n"
+	    "-t\tPace the generated tokens at this rate\n"
+	    "-v\tReport each request on the standard error\n"
+	    "Without a command, the server's URL is output and it runs\n"
+	    "until killed.  A command is run with the backends' endpoints\n"
+	    "set to the server, and its exit status is returned.\n", name);
+	exit(2);
+}
+
+// Return the probability specified in s or exit with an error
+static double
+probability(const char *s, const char *name)
+{
+	char *end;
+	double p = strtod(s, &end);
+
+	if (end == s || *end || p < 0 || p > 1) {
+		fprintf(stderr, "Invalid probability: %s\n", s);
+		usage(name);
+	}
+	return p;
+}
+
+// Set the environment variable to base followed by path
+static void
+set_endpoint(const char *name, const char *base, const char *path)
+{
+	char url[512];
+
+	snprintf(url, sizeof(url), "%s%s", base, path);
+	setenv(name, url, 1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *address = "127.0.0.1";
+	int port = 0;
+	int opt_char;
+
+	while ((opt_char = getopt(argc, argv, "a:d:e:l:n:p:r:S:s:T:t:v")) != -1)
+		switch (opt_char) {
+		case 'a':
+			address = optarg;
+			break;
+		case 'd':
+			opt.slow_ms = atoi(optarg);
+			break;
+		case 'e':
+			if (strncmp(optarg, "429:", 4) == 0)
+				opt.p429 = probability(optarg + 4, argv[0]);
+			else if (strncmp(optarg, "500:", 4) == 0)
+				opt.p500 = probability(optarg + 4, argv[0]);
+			else
+				usage(argv[0]);
+			break;
+		case 'l':
+			if (!latency_parse(optarg, &opt.latency)) {
+				fprintf(stderr, "Invalid latency: %s\n", optarg);
+				usage(argv[0]);
+			}
+			break;
+		case 'n':
+			opt.max_requests = atol(optarg);
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'r':
+			opt.preset = probability(optarg, argv[0]);
+			break;
+		case 'S':
+			opt.seed = atol(optarg);
+			break;
+		case 's':
+			opt.pslow = probability(optarg, argv[0]);
+			break;
+		case 'T':
+			opt.text = optarg;
+			break;
+		case 't':
+			opt.token_rate = atof(optarg);
+			break;
+		case 'v':
+			opt.verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	argc -= optind;
+	argv += optind;
+
+	struct sockaddr_in sa = {.sin_family = AF_INET, .sin_port = htons(port)};
+	if (inet_pton(AF_INET, address, &sa.sin_addr) != 1) {
+		fprintf(stderr, "Invalid address: %s\n", address);
+		return 1;
+	}
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	socklen_t salen = sizeof(sa);
+	if (listener == -1
+	    || bind(listener, (struct sockaddr *)&sa, sizeof(sa)) == -1
+	    || listen(listener, 128) == -1
+	    || getsockname(listener, (struct sockaddr *)&sa, &salen) == -1) {
+		perror("mock server socket");
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	char base[128];
+	snprintf(base, sizeof(base), "http://%s:%d", address,
+	    ntohs(sa.sin_port));
+	if (argc == 0) {
+		printf("%s\n", base);
+		fflush(stdout);
+		accept_loop(&listener);
+	}
+
+	set_endpoint("AI_CLI_openai_endpoint", base, "/v1/chat/completions");
+	set_endpoint("AI_CLI_anthropic_endpoint", base, "/v1/messages");
+	set_endpoint("AI_CLI_llamacpp_endpoint", base, "/completion");
+	setenv("AI_CLI_openai_key", "mock", 0);
+	setenv("AI_CLI_anthropic_key", "mock", 0);
+
+	// Fork before starting threads; connections queue until accepted
+	pid_t pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0) {
+		close(listener);
+		execvp(argv[0], argv);
+		perror(argv[0]);
+		_exit(127);
+	}
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, accept_loop, &listener);
+	int wstatus;
+	while (waitpid(pid, &wstatus, 0) == -1 && errno == EINTR)
+		;
+	return WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 1;
+}
+#endif
@@ -0,0 +1,63 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Mock server for the OpenAI, Anthropic and llama.cpp protocols
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// The wire protocols served, selected by the request's path
+enum protocol {
+	PROTO_NONE,
+	PROTO_OPENAI,		// .../chat/completions
+	PROTO_ANTHROPIC,	// .../messages
+	PROTO_LLAMACPP,		// .../completion
+};
+
+// Distribution of the delay before a response
+typedef struct {
+	enum { DIST_FIXED, DIST_UNIFORM, DIST_NORMAL, DIST_EXP } type;
+	double a, b;		// Value, min/max, mean/sd, mean (ms)
+} latency_t;
+
+// The framing of a received HTTP request
+typedef struct {
+	size_t header_length;	// Including the terminating empty line
+	size_t body_length;
+	bool expect_continue;	// Client awaits a 100 response for the body
+	bool keep_alive;
+	char path[256];
+} request_t;
+
+// Parts of a streamed response
+enum event { EVENT_START, EVENT_TOKEN, EVENT_END };
+
+#if defined(UNIT_TEST)
+bool latency_parse(const char *spec, latency_t *l);
+double latency_sample(const latency_t *l, unsigned short xsubi[3]);
+enum protocol protocol_of(const char *path);
+int request_parse(const char *buffer, size_t len, request_t *r);
+size_t token_length(const char *s);
+long token_count(const char *s);
+char *response_body(enum protocol p, const char *text, long tokens_in);
+char *error_body(enum protocol p, int status);
+char *stream_event(enum protocol p, enum event e, const char *token,
+    size_t token_len, long tokens_in, long tokens_out);
+#endif
@@ -0,0 +1,209 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test the mock server's protocol handling.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "CuTest.h"
+#include "config.h"
+#include "fetch_anthropic.h"
+#include "fetch_llamacpp.h"
+#include "fetch_openai.h"
+#include "mock_server.h"
+#include "usage.h"
+
+static void
+test_latency(CuTest *tc)
+{
+	latency_t l;
+	unsigned short xsubi[3] = {1, 2, 3};
+
+	CuAssertTrue(tc, latency_parse("20", &l));
+	CuAssertDblEquals(tc, 20, latency_sample(&l, xsubi), 0);
+	CuAssertTrue(tc, latency_parse("fixed:7.5", &l));
+	CuAssertDblEquals(tc, 7.5, latency_sample(&l, xsubi), 0);
+
+	CuAssertTrue(tc, latency_parse("uniform:10:20", &l));
+	double sum = 0;
+	for (int i = 0; i < 1000; i++) {
+		double ms = latency_sample(&l, xsubi);
+		CuAssertTrue(tc, ms >= 10 && ms <= 20);
+		sum += ms;
+	}
+	CuAssertDblEquals(tc, 15, sum / 1000, 0.5);
+
+	CuAssertTrue(tc, latency_parse("normal:100:10", &l));
+	sum = 0;
+	for (int i = 0; i < 1000; i++)
+		sum += latency_sample(&l, xsubi);
+	CuAssertDblEquals(tc, 100, sum / 1000, 2);
+
+	CuAssertTrue(tc, latency_parse("exp:50", &l));
+	sum = 0;
+	for (int i = 0; i < 10000; i++) {
+		double ms = latency_sample(&l, xsubi);
+		CuAssertTrue(tc, ms >= 0);
+		sum += ms;
+	}
+	CuAssertDblEquals(tc, 50, sum / 10000, 3);
+
+	CuAssertTrue(tc, !latency_parse("", &l));
+	CuAssertTrue(tc, !latency_parse("uniform:10", &l));
+	CuAssertTrue(tc, !latency_parse("uniform:20:10", &l));
+	CuAssertTrue(tc, !latency_parse("fixed:-1", &l));
+	CuAssertTrue(tc, !latency_parse("gamma:1", &l));
+	CuAssertTrue(tc, !latency_parse("10ms", &l));
+}
+
+static void
+test_request_parse(CuTest *tc)
+{
+	request_t r;
+	const char *s;
+
+	CuAssertIntEquals(tc, 0, request_parse("", 0, &r));
+	s = "POST /v1/messages HTTP/1.1\r\nHost: x\r\n";
+	CuAssertIntEquals(tc, 0, request_parse(s, strlen(s), &r));
+
+	s = "POST /v1/messages HTTP/1.1\r\nHost: x\r\n"
+	    "content-length: 12\r\nExpect: 100-continue\r\n\r\n{}";
+	CuAssertIntEquals(tc, 1, request_parse(s, strlen(s), &r));
+	CuAssertStrEquals(tc, "/v1/messages", r.path);
+	CuAssertIntEquals(tc, strlen(s) - 2, r.header_length);
+	CuAssertIntEquals(tc, 12, r.body_length);
+	CuAssertTrue(tc, r.expect_continue);
+	CuAssertTrue(tc, r.keep_alive);
+
+	s = "POST /completion HTTP/1.1\r\nConnection: close\r\n\r\n";
+	CuAssertIntEquals(tc, 1, request_parse(s, strlen(s), &r));
+	CuAssertTrue(tc, !r.keep_alive);
+	CuAssertIntEquals(tc, 0, r.body_length);
+
+	s = "POST /completion HTTP/1.0\r\n\r\n";
+	CuAssertIntEquals(tc, 1, request_parse(s, strlen(s), &r));
+	CuAssertTrue(tc, !r.keep_alive);
+
+	s = "POST /completion HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+	CuAssertIntEquals(tc, -1, request_parse(s, strlen(s), &r));
+	s = "garbage\r\n\r\n";
+	CuAssertIntEquals(tc, -1, request_parse(s, strlen(s), &r));
+}
+
+static void
+test_protocol_of(CuTest *tc)
+{
+	CuAssertIntEquals(tc, PROTO_OPENAI, protocol_of("/v1/chat/completions"));
+	CuAssertIntEquals(tc, PROTO_ANTHROPIC, protocol_of("/v1/messages?beta=1"));
+	CuAssertIntEquals(tc, PROTO_LLAMACPP, protocol_of("/completion"));
+	CuAssertIntEquals(tc, PROTO_NONE, protocol_of("/v1/models"));
+}
+
+static void
+test_tokens(CuTest *tc)
+{
+	const char *s = "ls  -l\t*.c";
+
+	CuAssertIntEquals(tc, 2, token_length(s));
+	CuAssertIntEquals(tc, 4, token_length(s + 2));
+	CuAssertIntEquals(tc, 4, token_length(s + 6));
+	CuAssertIntEquals(tc, 3, token_count(s));
+	CuAssertIntEquals(tc, 0, token_count(""));
+}
+
+// The mock's responses are accepted by the backends
+static void
+test_responses(CuTest *tc)
+{
+	config_t config = {"bash"};
+	const char *text = "echo \"hi\"";
+	char *body, *response;
+
+	body = response_body(PROTO_OPENAI, text, 10);
+	response = openai_get_response_content(body);
+	CuAssertStrEquals(tc, text, response);
+	free(response);
+	free(body);
+
+	body = response_body(PROTO_ANTHROPIC, text, 10);
+	response = anthropic_get_response_content(body);
+	CuAssertStrEquals(tc, text, response);
+	free(response);
+	free(body);
+
+	body = response_body(PROTO_LLAMACPP, text, 10);
+	response = llamacpp_get_response_content(body);
+	CuAssertStrEquals(tc, text, response);
+	free(response);
+	free(body);
+
+	body = error_body(PROTO_ANTHROPIC, 429);
+	CuAssertPtrEquals(tc, NULL, anthropic_get_response_content(body));
+	CuAssertTrue(tc, strstr(body, "rate_limit_error") != NULL);
+	free(body);
+
+	// Discard the usage of the parsed responses
+	acl_usage_record(&config, "mock", NULL);
+}
+
+static void
+test_stream_event(CuTest *tc)
+{
+	char *e;
+
+	e = stream_event(PROTO_OPENAI, EVENT_TOKEN, " -l", 3, 5, 0);
+	CuAssertTrue(tc, strncmp(e, "data: {", 7) == 0);
+	CuAssertTrue(tc, strstr(e, "\"delta\":{\"content\":\" -l\"}") != NULL);
+	CuAssertTrue(tc, strcmp(e + strlen(e) - 2, "\n\n") == 0);
+	free(e);
+
+	e = stream_event(PROTO_OPENAI, EVENT_END, NULL, 0, 5, 2);
+	CuAssertTrue(tc, strstr(e, "\"completion_tokens\":2") != NULL);
+	CuAssertTrue(tc, strstr(e, "data: [DONE]\n\n") != NULL);
+	free(e);
+
+	e = stream_event(PROTO_ANTHROPIC, EVENT_START, NULL, 0, 5, 0);
+	CuAssertTrue(tc, strncmp(e, "event: message_start\n", 21) == 0);
+	CuAssertTrue(tc, strstr(e, "event: content_block_start\n") != NULL);
+	free(e);
+
+	e = stream_event(PROTO_ANTHROPIC, EVENT_TOKEN, "\"x\"", 3, 5, 0);
+	CuAssertTrue(tc, strstr(e, "\"text\":\"\\\"x\\\"\"") != NULL);
+	free(e);
+
+	e = stream_event(PROTO_LLAMACPP, EVENT_END, NULL, 0, 5, 2);
+	CuAssertTrue(tc, strstr(e, "\"stop\":true") != NULL);
+	CuAssertTrue(tc, strstr(e, "\"tokens_predicted\":2") != NULL);
+	free(e);
+}
+
+CuSuite*
+cu_mock_server_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_latency);
+	SUITE_ADD_TEST(suite, test_request_parse);
+	SUITE_ADD_TEST(suite, test_protocol_of);
+	SUITE_ADD_TEST(suite, test_tokens);
+	SUITE_ADD_TEST(suite, test_responses);
+	SUITE_ADD_TEST(suite, test_stream_event);
+
+	return suite;
+}
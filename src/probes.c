@@ -0,0 +1,113 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  USDT static probes on the query path, for tools such as bpftrace.
+ *  The probes of the ai_cli provider carry the backend, program name,
+ *  byte counts, and durations (in microseconds) of the query phases.
+ *  They don't use semaphores, so that a tool attaching to the library
+ *  file observes all processes on the host that map it.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "probes.h"
+
+#if defined(ACL_PROBES)
+
+#include <string.h>
+#include <sys/sdt.h>
+
+#include "backend.h"
+#include "support.h"
+
+// Return the microseconds elapsed since the specified acl_now_ms() time
+static long
+elapsed_us(double start)
+{
+	return (long)((acl_now_ms() - start) * 1e3);
+}
+
+void
+acl_probe_query_start(const char *kind, const char *program,
+    const char *prompt)
+{
+	DTRACE_PROBE3(ai_cli, query_start, kind, program, strlen(prompt));
+}
+
+void
+acl_probe_query_end(const char *kind, fetch_t fetch, const char *program,
+    const char *status, double start)
+{
+	DTRACE_PROBE5(ai_cli, query_end, kind, acl_backend_name(fetch),
+	    program, status, elapsed_us(start));
+}
+
+void
+acl_probe_request_built(const char *backend, const char *request,
+    double start)
+{
+	DTRACE_PROBE3(ai_cli, request_built, backend, strlen(request),
+	    elapsed_us(start));
+}
+
+void
+acl_probe_first_byte(const char *endpoint, double start, double first_byte)
+{
+	DTRACE_PROBE2(ai_cli, first_byte, endpoint,
+	    (long)((first_byte - start) * 1e3));
+}
+
+// Time to the first byte: request upload, queueing, generation
+void
+acl_probe_first_byte_curl(CURL *curl)
+{
+	curl_off_t pretransfer = 0, first_byte = 0;
+	char *url = NULL;
+
+	curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url);
+	curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+	curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+	DTRACE_PROBE2(ai_cli, first_byte, url ? url : "",
+	    (long)(first_byte - pretransfer));
+}
+
+void
+acl_probe_response_parsed(const char *backend, const char *response,
+    double start)
+{
+	DTRACE_PROBE3(ai_cli, response_parsed, backend,
+	    response ? strlen(response) : 0, elapsed_us(start));
+}
+
+void
+acl_probe_context_cache(const char *provider, bool hit)
+{
+	DTRACE_PROBE2(ai_cli, context_cache, provider, (int)hit);
+}
+
+void
+acl_probe_prompt_cache(const char *backend, long tokens_in,
+    long tokens_cached)
+{
+	DTRACE_PROBE3(ai_cli, prompt_cache, backend, tokens_in, tokens_cached);
+}
+
+void
+acl_probe_config_load(const char *program, double start)
+{
+	DTRACE_PROBE2(ai_cli, config_load, program, elapsed_us(start));
+}
+
+#endif
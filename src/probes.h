@@ -0,0 +1,99 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  USDT static probes
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <curl/curl.h>
+
+#include "support.h"
+
+/*
+ * Probes are compiled in when <sys/sdt.h> is available, unless
+ * ACL_NO_PROBES is defined.  Otherwise the PROBE_ macros expand
+ * to nothing and their arguments are not evaluated, apart from
+ * the start times, which are only kept for the probes.
+ * All probes are placed in the core library, so that a single
+ * attachment point covers the backend modules.
+ * Durations are in microseconds, measured from a TRACE_NOW() time.
+ */
+#if !defined(ACL_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define ACL_PROBES
+#endif
+#endif
+
+#if defined(ACL_PROBES)
+
+// A query of the specified kind (query or background) starts
+#define PROBE_QUERY_START(kind, program, prompt) \
+	acl_probe_query_start(kind, program, prompt)
+// The query ends with the specified status (ok, error, or cancelled)
+#define PROBE_QUERY_END(kind, fetch, program, status, start) \
+	acl_probe_query_end(kind, fetch, program, status, start)
+// The backend's request has been built
+#define PROBE_REQUEST_BUILT(backend, request, start) \
+	acl_probe_request_built(backend, request, start)
+// The first byte of a response has arrived from the specified endpoint
+#define PROBE_FIRST_BYTE(endpoint, start, first_byte) \
+	acl_probe_first_byte(endpoint, start, first_byte)
+#define PROBE_FIRST_BYTE_CURL(curl) acl_probe_first_byte_curl(curl)
+// The backend's response has been parsed
+#define PROBE_RESPONSE_PARSED(backend, response, start) \
+	acl_probe_response_parsed(backend, response, start)
+// A context provider's cached value was (not) used
+#define PROBE_CONTEXT_CACHE(provider, hit) \
+	acl_probe_context_cache(provider, hit)
+// The backend served the specified prompt tokens from its cache
+#define PROBE_PROMPT_CACHE(backend, tokens_in, tokens_cached) \
+	acl_probe_prompt_cache(backend, tokens_in, tokens_cached)
+// The configuration has been read
+#define PROBE_CONFIG_LOAD(program, start) acl_probe_config_load(program, start)
+
+void acl_probe_query_start(const char *kind, const char *program,
+    const char *prompt);
+void acl_probe_query_end(const char *kind, fetch_t fetch, const char *program,
+    const char *status, double start);
+void acl_probe_request_built(const char *backend, const char *request,
+    double start);
+void acl_probe_first_byte(const char *endpoint, double start,
+    double first_byte);
+void acl_probe_first_byte_curl(CURL *curl);
+void acl_probe_response_parsed(const char *backend, const char *response,
+    double start);
+void acl_probe_context_cache(const char *provider, bool hit);
+void acl_probe_prompt_cache(const char *backend, long tokens_in,
+    long tokens_cached);
+void acl_probe_config_load(const char *program, double start);
+
+#else
+
+#define PROBE_QUERY_START(kind, program, prompt) do {} while (0)
+#define PROBE_QUERY_END(kind, fetch, program, status, start) ((void)(start))
+#define PROBE_REQUEST_BUILT(backend, request, start) do {} while (0)
+#define PROBE_FIRST_BYTE(endpoint, start, first_byte) do {} while (0)
+#define PROBE_FIRST_BYTE_CURL(curl) do {} while (0)
+#define PROBE_RESPONSE_PARSED(backend, response, start) do {} while (0)
+#define PROBE_CONTEXT_CACHE(provider, hit) do {} while (0)
+#define PROBE_PROMPT_CACHE(backend, tokens_in, tokens_cached) do {} while (0)
+#define PROBE_CONFIG_LOAD(program, start) ((void)(start))
+
+#endif
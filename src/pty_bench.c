@@ -0,0 +1,268 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Measure the latency from the query keystrokes to the appearance
+ *  of the suggestion, by driving a readline program through a pty.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(MACOS)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+// Options
+static int runs = 100;
+static int queries = 5;
+static const char *keys = "\030a";
+static const char *marker = "Dave";
+static const char *prompt = "list files";
+static double timeout_ms = 10000;
+
+// Output of the program not yet matched
+static char output[65536];
+static size_t output_len;
+
+static pid_t child;
+
+static double
+now_ms(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+	double da = *(const double *)a, db = *(const double *)b;
+
+	return da < db ? -1 : da > db;
+}
+
+// Terminate the program and exit reporting the failure to see s
+static void
+fail(const char *s)
+{
+	fprintf(stderr, "Timed out waiting for \"%s\"; program output:\n%.*s\n",
+	    s, (int)output_len, output);
+	kill(child, SIGKILL);
+	exit(1);
+}
+
+/*
+ * Read the program's output from fd until it contains s,
+ * discarding the output read up to that point.
+ */
+static void
+expect(int fd, const char *s)
+{
+	double deadline = now_ms() + timeout_ms;
+	size_t len = strlen(s);
+
+	for (;;) {
+		char *match = memmem(output, output_len, s, len);
+		if (match) {
+			size_t consumed = match + len - output;
+			memmove(output, output + consumed, output_len - consumed);
+			output_len -= consumed;
+			return;
+		}
+
+		double remaining = deadline - now_ms();
+		struct pollfd pfd = {fd, POLLIN, 0};
+		if (remaining <= 0 || poll(&pfd, 1, (int)remaining + 1) <= 0)
+			fail(s);
+
+		// Keep the output's tail, which may hold a partial match
+		if (output_len == sizeof(output)) {
+			memmove(output, output + output_len - len, len);
+			output_len = len;
+		}
+		ssize_t n = read(fd, output + output_len,
+		    sizeof(output) - output_len);
+		if (n <= 0)
+			fail(s);
+		output_len += n;
+	}
+}
+
+static void
+send_keys(int fd, const char *s)
+{
+	if (write(fd, s, strlen(s)) != (ssize_t)strlen(s)) {
+		perror("pty write");
+		exit(1);
+	}
+}
+
+/*
+ * Run the program in a new pty with the library preloaded through
+ * the specified environment variable and issue the queries.
+ * Store the time to the first prompt in startup, the latency of the
+ * first query in cold, and those of the subsequent ones in warm.
+ */
+static void
+run(char *program[], const char *preload_var, const char *library,
+    double *startup, double *cold, double *warm)
+{
+	struct winsize ws = {.ws_row = 24, .ws_col = 200};
+	int fd;
+
+	output_len = 0;
+	double start = now_ms();
+	child = forkpty(&fd, NULL, NULL, &ws);
+	if (child == -1) {
+		perror("forkpty");
+		exit(1);
+	}
+	if (child == 0) {
+		setenv(preload_var, library, 1);
+		setenv("TERM", "xterm", 0);
+		execvp(program[0], program);
+		perror(program[0]);
+		_exit(1);
+	}
+	expect(fd, "> ");
+	*startup = now_ms() - start;
+
+	for (int i = 0; i < queries; i++) {
+		// Distinct queries, identical across runs for replaying
+		char line[256];
+		snprintf(line, sizeof(line), "%s %d", prompt, i + 1);
+		send_keys(fd, line);
+		expect(fd, line);
+
+		start = now_ms();
+		send_keys(fd, keys);
+		expect(fd, marker);
+		double latency = now_ms() - start;
+		if (i == 0)
+			*cold = latency;
+		else
+			warm[i - 1] = latency;
+
+		send_keys(fd, "\r");
+		expect(fd, "Read [");
+		expect(fd, "> ");
+	}
+
+	// End of file
+	send_keys(fd, "\004");
+	int status;
+	waitpid(child, &status, 0);
+	close(fd);
+}
+
+// Print the distribution of the n values in ms
+static void
+report(const char *name, double *value, int n)
+{
+	double sum = 0;
+
+	if (n == 0)
+		return;
+	qsort(value, n, sizeof(double), compare_double);
+	for (int i = 0; i < n; i++)
+		sum += value[i];
+	printf("%-10s %6d %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n", name, n,
+	    sum / n, value[0], value[n / 2], value[n * 9 / 10],
+	    value[n * 99 / 100], value[n - 1]);
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-k keys] [-m marker] [-n runs] "
+	    "[-p prompt] [-q queries] [-t timeout]\n"
+	    "\tpreload-variable library program [argument ...]\n"
+	    "-k keys\t\tKeys that issue the query (default ^Xa)\n"
+	    "-m marker\tText of the suggestion awaited (default Dave)\n"
+	    "-n runs\t\tNumber of program runs (default 100)\n"
+	    "-p prompt\tQuery prompt; its number is appended "
+	    "(default \"list files\")\n"
+	    "-q queries\tQueries issued in each run (default 5)\n"
+	    "-t timeout\tTime in ms to wait for each output (default 10000)\n",
+	    name);
+	exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "+k:m:n:p:q:t:")) != -1)
+		switch (c) {
+		case 'k':
+			keys = optarg;
+			break;
+		case 'm':
+			marker = optarg;
+			break;
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		case 'p':
+			prompt = optarg;
+			break;
+		case 'q':
+			queries = atoi(optarg);
+			break;
+		case 't':
+			timeout_ms = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	if (argc - optind < 3 || runs < 1 || queries < 1)
+		usage(argv[0]);
+
+	double *startup = malloc(runs * sizeof(double));
+	double *cold = malloc(runs * sizeof(double));
+	double *warm = malloc(runs * queries * sizeof(double));
+	if (!startup || !cold || !warm) {
+		perror("malloc");
+		exit(1);
+	}
+	for (int i = 0; i < runs; i++)
+		run(argv + optind + 2, argv[optind], argv[optind + 1],
+		    &startup[i], &cold[i], &warm[i * (queries - 1)]);
+
+	printf("%d runs of %d queries; times in ms\n", runs, queries);
+	printf("%-10s %6s %9s %9s %9s %9s %9s %9s\n", "Phase", "N", "Mean",
+	    "Min", "Median", "p90", "p99", "Max");
+	report("startup", startup, runs);
+	report("cold", cold, runs);
+	report("warm", warm, runs * (queries - 1));
+	return 0;
+}
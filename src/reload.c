@@ -0,0 +1,290 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Reload the configuration when its files change, so that changes
+ *  take effect in long-running programs, such as shells.
+ *  Files are watched with inotify(7) where available and otherwise
+ *  through their metadata, and reread lazily at the next query.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+
+#include "balance.h"
+#include "config.h"
+#include "context.h"
+#include "ini.h"
+#include "reload.h"
+#include "router.h"
+#include "support.h"
+#include "unit_test.h"
+
+// Sections of the configuration in use and of the one it replaced
+static sections_t current, previous;
+
+// Metadata of the configuration files, when inotify is unavailable
+static char *signature[MAX_CONFIG_FILES];
+
+#if defined(__linux__)
+static int inotify_fd = -1;
+// Watch descriptors of each file's directory and of the file itself
+static int dir_wd[MAX_CONFIG_FILES];
+static int file_wd[MAX_CONFIG_FILES];
+#endif
+
+// Callback for the .ini file reader, appending the entry to its section
+static int
+section_handler(void *user, const char *section, const char *name,
+    const char *value)
+{
+	sections_t *s = user;
+	int i;
+
+	for (i = 0; i < s->n; i++)
+		if (strcmp(s->section[i].name, section) == 0)
+			break;
+	if (i == s->n) {
+		s->section = realloc(s->section, (s->n + 1) * sizeof(section_t));
+		if (!s->section)
+			acl_errorf("memory allocation failed.");
+		s->section[i].name = acl_safe_strdup(section);
+		acl_string_init(&s->section[i].text, "");
+		s->n++;
+	}
+	acl_string_appendf(&s->section[i].text, "%s=%s\n", name, value);
+	return 1;
+}
+
+// Read into s the sections of the NULL-terminated array of files
+STATIC void
+sections_read(sections_t *s, const char * const *files)
+{
+	s->section = NULL;
+	s->n = 0;
+	for (; *files; files++)
+		(void)ini_parse(*files, section_handler, s);
+}
+
+STATIC void
+sections_free(sections_t *s)
+{
+	for (int i = 0; i < s->n; i++) {
+		free(s->section[i].name);
+		free(s->section[i].text.ptr);
+	}
+	free(s->section);
+	s->section = NULL;
+	s->n = 0;
+}
+
+static const section_t *
+section_find(const sections_t *s, const char *name)
+{
+	for (int i = 0; i < s->n; i++)
+		if (strcmp(s->section[i].name, name) == 0)
+			return &s->section[i];
+	return NULL;
+}
+
+// Return true if the named section differs between a and b
+STATIC bool
+section_changed(const sections_t *a, const sections_t *b, const char *name)
+{
+	const section_t *sa = section_find(a, name);
+	const section_t *sb = section_find(b, name);
+
+	if (!sa || !sb)
+		return sa != sb;
+	return strcmp(sa->text.ptr, sb->text.ptr) != 0;
+}
+
+// Record the metadata of the files; return true if it changed
+static bool
+signatures_update(const char * const *files)
+{
+	bool changed = false;
+
+	for (int i = 0; files[i]; i++) {
+		char *key = acl_stat_key(files[i]);
+		if (!key != !signature[i]
+		    || (key && strcmp(key, signature[i]) != 0))
+			changed = true;
+		free(signature[i]);
+		signature[i] = key;
+	}
+	return changed;
+}
+
+#if defined(__linux__)
+/*
+ * Watch the files and their directories, where editors replace them.
+ * Watching the files follows symbolic links, e.g. to a dotfiles
+ * repository.  Watches of replaced files are added again on each call.
+ */
+static void
+watch_files(const char * const *files)
+{
+	for (int i = 0; files[i]; i++) {
+		char *dir = acl_safe_strdup(files[i]);
+		char *slash = strrchr(dir, '/');
+		// Keep the slash of the root directory
+		slash[slash == dir] = '\0';
+		dir_wd[i] = inotify_add_watch(inotify_fd, dir, IN_CLOSE_WRITE
+		    | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+		free(dir);
+		file_wd[i] = inotify_add_watch(inotify_fd, files[i],
+		    IN_CLOSE_WRITE);
+	}
+}
+
+// Return true if the inotify event e concerns one of the files
+static bool
+event_matches(const char * const *files, const struct inotify_event *e)
+{
+	if (e->mask & IN_Q_OVERFLOW)
+		return true;
+	for (int i = 0; files[i]; i++) {
+		if (e->wd == file_wd[i])
+			return true;
+		if (e->wd == dir_wd[i] && e->len
+		    && strcmp(e->name, strrchr(files[i], '/') + 1) == 0)
+			return true;
+	}
+	return false;
+}
+#endif
+
+/*
+ * Start watching the configuration files for changes.
+ * Call after reading the configuration.
+ */
+void
+acl_reload_watch(void)
+{
+	const char * const *files = acl_config_files();
+
+	sections_read(&current, files);
+#if defined(__linux__)
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd != -1) {
+		watch_files(files);
+		return;
+	}
+#endif
+	// E.g. beyond the limit of inotify instances of a user
+	signatures_update(files);
+}
+
+/*
+ * Return true if a configuration file changed since the last call.
+ * This is cheap: a non-blocking read or a few stat(2) calls.
+ */
+bool
+acl_reload_pending(void)
+{
+	const char * const *files = acl_config_files();
+
+#if defined(__linux__)
+	if (inotify_fd != -1) {
+		char buf[4096]
+		    __attribute__((aligned(__alignof__(struct inotify_event))));
+		bool pending = false;
+		ssize_t n;
+
+		while ((n = read(inotify_fd, buf, sizeof(buf))) > 0)
+			for (char *p = buf; p < buf + n; ) {
+				struct inotify_event *e = (struct inotify_event *)p;
+				pending |= event_matches(files, e);
+				p += sizeof(*e) + e->len;
+			}
+		if (pending)
+			watch_files(files);
+		return pending;
+	}
+#endif
+	return signatures_update(files);
+}
+
+/*
+ * Return true if the specified configuration is valid.
+ * Backends validate their settings only when loaded, so the settings
+ * whose errors would terminate the process are checked here.
+ */
+static bool
+config_valid(config_t *config)
+{
+	bool llamacpp = config->general_api
+	    && strcmp(config->general_api, "llamacpp") == 0;
+
+	if (config->router_tiers_set) {
+		router_t router;
+		if (!acl_router_init(&router, config->router_tiers))
+			return false;
+		for (int i = 0; i < router.n; i++)
+			if (strcmp(router.tiers[i].api, "llamacpp") == 0)
+				llamacpp = true;
+		acl_router_free(&router);
+	}
+	return !llamacpp || acl_balancer_check(config);
+}
+
+/*
+ * Read the changed configuration into config, which should be zeroed,
+ * and record the sections that changed.
+ * Return false, leaving config empty, if the configuration is invalid.
+ */
+bool
+acl_reload_read(config_t *config)
+{
+	if (!acl_read_config_checked(config) || !config_valid(config)) {
+		acl_config_free(config);
+		fprintf(stderr, "\nai_cli: Keeping the previous configuration.\n");
+		return false;
+	}
+	sections_free(&previous);
+	previous = current;
+	sections_read(&current, acl_config_files());
+	return true;
+}
+
+// Return true if the named section changed in the last reload
+bool
+acl_reload_changed(const char *section)
+{
+	return section_changed(&previous, &current, section);
+}
+
+/*
+ * Restore the sections of the configuration replaced by the last
+ * reload, after failing to apply it.
+ */
+void
+acl_reload_revert(void)
+{
+	sections_free(&current);
+	current = previous;
+	previous.section = NULL;
+	previous.n = 0;
+}
@@ -0,0 +1,51 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Reload the configuration when its files change
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "config.h"
+#include "support.h"
+
+// The entries of a configuration file section, as name=value lines
+typedef struct {
+	char *name;
+	string_t text;
+} section_t;
+
+// All sections of the configuration files
+typedef struct {
+	section_t *section;
+	int n;
+} sections_t;
+
+#if defined(UNIT_TEST)
+void sections_read(sections_t *s, const char * const *files);
+void sections_free(sections_t *s);
+bool section_changed(const sections_t *a, const sections_t *b,
+    const char *name);
+#endif
+
+void acl_reload_watch(void);
+bool acl_reload_pending(void);
+bool acl_reload_read(config_t *config);
+bool acl_reload_changed(const char *section);
+void acl_reload_revert(void);
@@ -0,0 +1,83 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test the detection of changed configuration sections.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "reload.h"
+
+static const char system_file[] = "test-reload-system.ini";
+static const char user_file[] = "test-reload-user.ini";
+
+static void
+write_file(const char *name, const char *content)
+{
+	FILE *f = fopen(name, "w");
+	fputs(content, f);
+	fclose(f);
+}
+
+static void
+test_sections(CuTest *tc)
+{
+	const char *files[] = {system_file, user_file, "nonexistent.ini", NULL};
+	sections_t a, b;
+
+	write_file(system_file, "[general]\napi = openai\n"
+	    "[openai]\nmodel = gpt-4o\n[prompt]\ncontext = 3\n");
+	write_file(user_file, "; Personal settings\n[openai]\nkey = k1\n");
+	sections_read(&a, files);
+	CuAssertIntEquals(tc, 3, a.n);
+	CuAssertStrEquals(tc, "openai", a.section[1].name);
+	CuAssertStrEquals(tc, "model=gpt-4o\nkey=k1\n", a.section[1].text.ptr);
+
+	// Comments and spacing don't change a section
+	write_file(user_file, "[openai]\nkey=k1\n");
+	sections_read(&b, files);
+	CuAssertTrue(tc, !section_changed(&a, &b, "general"));
+	CuAssertTrue(tc, !section_changed(&a, &b, "openai"));
+	sections_free(&b);
+
+	write_file(user_file, "[openai]\nkey = k2\n[router]\ntiers = hal\n");
+	sections_read(&b, files);
+	CuAssertTrue(tc, !section_changed(&a, &b, "general"));
+	CuAssertTrue(tc, !section_changed(&a, &b, "prompt"));
+	CuAssertTrue(tc, section_changed(&a, &b, "openai"));
+	CuAssertTrue(tc, section_changed(&a, &b, "router"));
+	CuAssertTrue(tc, section_changed(&b, &a, "router"));
+	CuAssertTrue(tc, !section_changed(&a, &b, "anthropic"));
+	sections_free(&b);
+	sections_free(&a);
+	CuAssertIntEquals(tc, 0, a.n);
+
+	unlink(system_file);
+	unlink(user_file);
+}
+
+CuSuite*
+cu_reload_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_sections);
+
+	return suite;
+}
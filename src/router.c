@@ -0,0 +1,275 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Routing of queries to model tiers.
+ *  Simple prompts are sent to fast (small) models and complex ones
+ *  to more capable (large) models, taking into account the observed
+ *  latency and acceptance rate of each tier.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "log.h"
+#include "router.h"
+#include "support.h"
+#include "unit_test.h"
+
+// Weight of the newest sample in the latency moving average
+#define EWMA_ALPHA 0.3
+
+// Outcomes required before a tier's acceptance rate is trusted
+#define MIN_OUTCOMES 5
+
+// Demoted tiers are still used once per this many queries to track them
+#define EXPLORE_INTERVAL 10
+
+// Default length of a prompt considered simple
+#define SHORT_PROMPT 40
+
+// Terms suggesting the composition of several commands
+static const char *pipe_terms[] = {
+	"|", " pipe", " then ", " and count", " and sort", " for each", NULL
+};
+
+// Terms suggesting the need for regular expressions
+static const char *regex_terms[] = {
+	"regex", "regular expression", "pattern", "match", "wildcard",
+	"\\", "[", "*", "^", "$", NULL
+};
+
+// Return true if the string s contains any of the specified terms
+static bool
+contains_any(const char *s, const char **terms)
+{
+	for (const char **t = terms; *t; t++)
+		if (strcasestr(s, *t))
+			return true;
+	return false;
+}
+
+/*
+ * Return an estimate of the prompt's complexity as a number of
+ * cheaply-obtained features that suggest a more capable model is needed.
+ */
+STATIC int
+prompt_complexity(config_t *config, const char *prompt)
+{
+	int short_prompt = config->router_short_prompt_set ?
+	    config->router_short_prompt : SHORT_PROMPT;
+	size_t len = strlen(prompt);
+	int complexity = 0;
+
+	if (len > (size_t)short_prompt)
+		complexity++;
+	if (len > 3 * (size_t)short_prompt)
+		complexity++;
+	if (contains_any(prompt, pipe_terms))
+		complexity++;
+	if (contains_any(prompt, regex_terms))
+		complexity++;
+	// Programs without n-shot examples get less guidance
+	if (!config->prompt_user[0])
+		complexity++;
+	return complexity;
+}
+
+// Free the tiers of the router r, leaving it without any
+void
+acl_router_free(router_t *r)
+{
+	for (int i = 0; i < r->n; i++) {
+		free(r->tiers[i].name);
+		free(r->tiers[i].api);
+		free(r->tiers[i].model);
+	}
+	memset(r, 0, sizeof(*r));
+}
+
+/*
+ * Initialize the router r with the tiers listed in tier_list.
+ * Each tier is an API, optionally followed by a colon and the
+ * model to use with it, e.g. openai:gpt-4o.
+ * Return false, reporting the problem and leaving r without tiers,
+ * if the list is invalid.
+ */
+bool
+acl_router_init(router_t *r, const char *tier_list)
+{
+	memset(r, 0, sizeof(*r));
+
+	char *list = acl_safe_strdup(tier_list);
+	char *saveptr;
+	const char *error = NULL;
+	for (char *name = strtok_r(list, ", \t", &saveptr); name && !error;
+	    name = strtok_r(NULL, ", \t", &saveptr)) {
+		if (r->n == MAX_TIERS) {
+			error = "more than " MAX_TIERS_STRING " tiers specified";
+			break;
+		}
+		tier_t *t = &r->tiers[r->n++];
+		t->name = acl_safe_strdup(name);
+		char *colon = strchr(name, ':');
+		if (colon) {
+			t->api = acl_range_strdup(name, colon);
+			t->model = acl_safe_strdup(colon + 1);
+			config_t trial;
+			if (!*t->model)
+				error = "no model specified after a colon";
+			else if (!acl_config_model_set(&trial, t->api, t->model))
+				error = "a model specified for an API without "
+				    "a model option";
+		} else
+			t->api = acl_safe_strdup(name);
+	}
+	free(list);
+	if (!error && r->n == 0)
+		error = "no tiers specified";
+	if (error) {
+		fprintf(stderr, "\nInvalid [router] configuration: %s.\n",
+		    error);
+		acl_router_free(r);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Return the configuration for queries through the specified tier:
+ * the supplied one or, for tiers that name a model, a copy of it
+ * using that model, set up in copy.
+ */
+config_t *
+acl_router_config(router_t *r, int tier, config_t *config, config_t *copy)
+{
+	if (!r->tiers[tier].model)
+		return config;
+	*copy = *config;
+	acl_config_model_set(copy, r->tiers[tier].api, r->tiers[tier].model);
+	return copy;
+}
+
+// Return true if tier t is known to violate the configured latency SLO
+static bool
+too_slow(config_t *config, tier_t *t)
+{
+	return config->router_slo_set && t->ewma_latency > config->router_slo;
+}
+
+// Return true if tier t's responses are known to be often rejected
+static bool
+poorly_accepted(config_t *config, tier_t *t)
+{
+	return config->router_min_acceptance_set && t->outcomes >= MIN_OUTCOMES
+	    && (double)t->accepted / t->outcomes < config->router_min_acceptance;
+}
+
+/*
+ * Return the index of the tier to use for the specified prompt.
+ * The prompt's complexity determines the initial tier.
+ * Tiers whose responses are often rejected are escalated to more
+ * capable ones, as long as these satisfy the latency SLO.
+ * Tiers violating the SLO are demoted to faster ones, except
+ * for occasional queries that keep their latency record current.
+ */
+int
+acl_router_select(router_t *r, config_t *config, const char *prompt)
+{
+	int complexity = prompt_complexity(config, prompt);
+	int tier = complexity < r->n ? complexity : r->n - 1;
+	const char *reason = "complexity";
+
+	while (tier + 1 < r->n && poorly_accepted(config, &r->tiers[tier])
+	    && !too_slow(config, &r->tiers[tier + 1])) {
+		tier++;
+		reason = "acceptance";
+	}
+
+	while (tier > 0 && too_slow(config, &r->tiers[tier])) {
+		if (++r->tiers[tier].demotions % EXPLORE_INTERVAL == 0) {
+			reason = "explore";
+			break;
+		}
+		tier--;
+		reason = "slo";
+	}
+
+	string_t entry;
+	acl_string_init(&entry, "{\"route\": {\"program\": ");
+	acl_string_append_json(&entry, config->program_name);
+	acl_string_appendf(&entry, ", \"length\": %zu, \"complexity\": %d, "
+	    "\"tier\": %d, \"api\": ", strlen(prompt), complexity, tier);
+	acl_string_append_json(&entry, r->tiers[tier].name);
+	acl_string_appendf(&entry, ", \"reason\": \"%s\", \"latency\": %.0f}}\n",
+	    reason, r->tiers[tier].ewma_latency);
+	acl_write_log(config, entry.ptr);
+	free(entry.ptr);
+
+	if (config->general_verbose)
+		fprintf(stderr, "\nRouting to %s (complexity %d, %s)\n",
+		    r->tiers[tier].name, complexity, reason);
+	return tier;
+}
+
+// Record the latency of a response obtained through the specified tier
+void
+acl_router_record_latency(router_t *r, config_t *config, int tier,
+    double latency_ms)
+{
+	tier_t *t = &r->tiers[tier];
+
+	if (t->ewma_latency == 0)
+		t->ewma_latency = latency_ms;
+	else
+		t->ewma_latency = EWMA_ALPHA * latency_ms +
+		    (1 - EWMA_ALPHA) * t->ewma_latency;
+
+	string_t entry;
+	acl_string_init(&entry, "{\"route_latency\": {\"api\": ");
+	acl_string_append_json(&entry, t->name);
+	acl_string_appendf(&entry, ", \"latency\": %.0f, \"ewma\": %.0f}}\n",
+	    latency_ms, t->ewma_latency);
+	acl_write_log(config, entry.ptr);
+	free(entry.ptr);
+}
+
+/*
+ * Record whether the response obtained through the specified tier
+ * was accepted, i.e. executed without modifications.
+ */
+void
+acl_router_record_acceptance(router_t *r, config_t *config, int tier,
+    bool accepted)
+{
+	tier_t *t = &r->tiers[tier];
+
+	t->outcomes++;
+	if (accepted)
+		t->accepted++;
+
+	string_t entry;
+	acl_string_init(&entry, "{\"route_outcome\": {\"api\": ");
+	acl_string_append_json(&entry, t->name);
+	acl_string_appendf(&entry, ", \"accepted\": %s, \"acceptance\": %.2f}}\n",
+	    accepted ? "true" : "false", (double)t->accepted / t->outcomes);
+	acl_write_log(config, entry.ptr);
+	free(entry.ptr);
+}
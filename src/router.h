@@ -0,0 +1,59 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Routing of queries to model tiers
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "config.h"
+
+// Maximum number of routing tiers
+#define MAX_TIERS 8
+#define MAX_TIERS_STRING "8"
+
+// Online record of a tier's observed behavior
+typedef struct {
+	char *name;			// As listed, e.g. openai:gpt-4o
+	char *api;			// Backend used for this tier
+	char *model;			// Model overriding the API's; NULL if none
+	double ewma_latency;		// Smoothed latency (ms); 0 if unknown
+	int outcomes;			// Responses with a known outcome
+	int accepted;			// Responses executed as suggested
+	int demotions;			// Queries demoted due to latency
+} tier_t;
+
+typedef struct {
+	tier_t tiers[MAX_TIERS];	// From fastest to most capable
+	int n;
+} router_t;
+
+bool acl_router_init(router_t *r, const char *tier_list);
+void acl_router_free(router_t *r);
+config_t *acl_router_config(router_t *r, int tier, config_t *config,
+    config_t *copy);
+int acl_router_select(router_t *r, config_t *config, const char *prompt);
+void acl_router_record_latency(router_t *r, config_t *config, int tier,
+    double latency_ms);
+void acl_router_record_acceptance(router_t *r, config_t *config, int tier,
+    bool accepted);
+
+#if defined(UNIT_TEST)
+int prompt_complexity(config_t *config, const char *prompt);
+#endif
@@ -0,0 +1,156 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test routing of queries to model tiers.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "CuTest.h"
+#include "config.h"
+#include "router.h"
+
+static void
+test_complexity(CuTest* tc)
+{
+	config_t config = {"bash"};
+	config.prompt_user[0] = "List files in current directory";
+
+	CuAssertIntEquals(tc, 0, prompt_complexity(&config, "undo last commit"));
+	CuAssertIntEquals(tc, 1, prompt_complexity(&config, "list files | sort"));
+	CuAssertIntEquals(tc, 1, prompt_complexity(&config, "find lines matching a pattern"));
+	CuAssertIntEquals(tc, 2, prompt_complexity(&config, "grep a pattern then count"));
+	CuAssertIntEquals(tc, 1, prompt_complexity(&config, "show the ten largest files in my home directory tree"));
+
+	// Programs without examples are considered more demanding
+	config.prompt_user[0] = NULL;
+	CuAssertIntEquals(tc, 1, prompt_complexity(&config, "undo last commit"));
+}
+
+static void
+test_select(CuTest* tc)
+{
+	config_t config = {"bash"};
+	router_t r;
+
+	config.prompt_user[0] = "List files in current directory";
+	acl_router_init(&r, "hal, llamacpp openai");
+	CuAssertIntEquals(tc, 3, r.n);
+	CuAssertStrEquals(tc, "llamacpp", r.tiers[1].api);
+
+	CuAssertIntEquals(tc, 0, acl_router_select(&r, &config, "undo last commit"));
+	CuAssertIntEquals(tc, 1, acl_router_select(&r, &config, "list files | sort"));
+	CuAssertIntEquals(tc, 2, acl_router_select(&r, &config,
+	    "find the lines matching a regular expression in all files "
+	    "changed over the past week then count them by author"));
+}
+
+static void
+test_model_tiers(CuTest* tc)
+{
+	config_t config = {"bash"}, copy;
+	router_t r;
+
+	config.openai_model = "gpt-4o";
+	acl_router_init(&r, "llamacpp openai:gpt-4o-mini openai");
+	CuAssertIntEquals(tc, 3, r.n);
+	CuAssertStrEquals(tc, "openai", r.tiers[1].api);
+	CuAssertStrEquals(tc, "gpt-4o-mini", r.tiers[1].model);
+	CuAssertStrEquals(tc, "openai:gpt-4o-mini", r.tiers[1].name);
+	CuAssertTrue(tc, r.tiers[2].model == NULL);
+
+	CuAssertPtrEquals(tc, &config, acl_router_config(&r, 0, &config, &copy));
+	CuAssertPtrEquals(tc, &copy, acl_router_config(&r, 1, &config, &copy));
+	CuAssertStrEquals(tc, "gpt-4o-mini", copy.openai_model);
+	CuAssertStrEquals(tc, "gpt-4o", config.openai_model);
+	CuAssertPtrEquals(tc, &config, acl_router_config(&r, 2, &config, &copy));
+	acl_router_free(&r);
+	CuAssertIntEquals(tc, 0, r.n);
+}
+
+static void
+test_invalid_tiers(CuTest* tc)
+{
+	router_t r;
+
+	CuAssertTrue(tc, !acl_router_init(&r, ", "));
+	CuAssertTrue(tc, !acl_router_init(&r, "openai:"));
+	CuAssertTrue(tc, !acl_router_init(&r, "hal llamacpp:model"));
+	CuAssertIntEquals(tc, 0, r.n);
+	CuAssertTrue(tc, !acl_router_init(&r, "a b c d e f g h i"));
+	CuAssertTrue(tc, acl_router_init(&r, "a b c d e f g h"));
+	CuAssertIntEquals(tc, MAX_TIERS, r.n);
+	acl_router_free(&r);
+}
+
+static void
+test_slo(CuTest* tc)
+{
+	config_t config = {"bash"};
+	router_t r;
+
+	config.prompt_user[0] = "List files in current directory";
+	config.router_slo = 1000;
+	config.router_slo_set = true;
+	acl_router_init(&r, "llamacpp openai");
+
+	CuAssertIntEquals(tc, 1, acl_router_select(&r, &config, "list files | sort"));
+	acl_router_record_latency(&r, &config, 1, 3000);
+	CuAssertIntEquals(tc, 0, acl_router_select(&r, &config, "list files | sort"));
+	for (int i = 0; i < 8; i++)
+		CuAssertIntEquals(tc, 0, acl_router_select(&r, &config, "list files | sort"));
+
+	// Explore the demoted tier, which is now fast
+	CuAssertIntEquals(tc, 1, acl_router_select(&r, &config, "list files | sort"));
+	for (int i = 0; i < 4; i++)
+		acl_router_record_latency(&r, &config, 1, 200);
+	CuAssertIntEquals(tc, 1, acl_router_select(&r, &config, "list files | sort"));
+}
+
+static void
+test_acceptance(CuTest* tc)
+{
+	config_t config = {"bash"};
+	router_t r;
+
+	config.prompt_user[0] = "List files in current directory";
+	config.router_min_acceptance = 0.5;
+	config.router_min_acceptance_set = true;
+	acl_router_init(&r, "llamacpp openai");
+
+	for (int i = 0; i < 4; i++) {
+		CuAssertIntEquals(tc, 0, acl_router_select(&r, &config, "undo last commit"));
+		acl_router_record_acceptance(&r, &config, 0, i == 0);
+	}
+	// Not enough outcomes yet
+	CuAssertIntEquals(tc, 0, acl_router_select(&r, &config, "undo last commit"));
+	acl_router_record_acceptance(&r, &config, 0, false);
+	CuAssertIntEquals(tc, 1, acl_router_select(&r, &config, "undo last commit"));
+}
+
+CuSuite*
+cu_router_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_complexity);
+	SUITE_ADD_TEST(suite, test_select);
+	SUITE_ADD_TEST(suite, test_model_tiers);
+	SUITE_ADD_TEST(suite, test_invalid_tiers);
+	SUITE_ADD_TEST(suite, test_slo);
+	SUITE_ADD_TEST(suite, test_acceptance);
+
+	return suite;
+}
@@ -0,0 +1,462 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Sessions of background queries.
+ *  Each session has a worker thread that performs its queries in turn,
+ *  reusing its connections, so that at most one request is in flight.
+ *  The worker queues the queries' progress and signals it through a
+ *  pipe, which hosts add to their event loop.  The callbacks are then
+ *  called in the host's thread by acl_session_process.
+ *  Cancelled queries are aborted at the transport level.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "candidates.h"
+#include "config.h"
+#include "http.h"
+#include "log.h"
+#include "session.h"
+#include "support.h"
+#include "trace.h"
+#include "usage.h"
+
+// Nice value of the worker thread (Linux schedules threads individually)
+#define WORKER_NICE 10
+
+// A query waiting to be performed
+typedef struct query {
+	int id;
+	fetch_t fetch;
+	config_t *config;
+	char *prompt;
+	int history_length;
+	acl_callback_t callback;
+	void *arg;		// Argument passed to the callback
+	struct query *next;
+} query_t;
+
+// Progress of a query waiting to be reported to its callback
+typedef struct event {
+	int id;
+	acl_status_t status;
+	char *response;
+	acl_callback_t callback;
+	void *arg;
+	struct event *next;
+} event_t;
+
+struct acl_session {
+	config_t *config;	// Configuration of acl_query_async
+	fetch_t fetch;		// Backend of acl_query_async
+	pthread_t thread;
+	int fd[2];		// Readable when events are queued
+
+	// Set to abort the query being processed by the worker
+	atomic_bool cancel_requested;
+
+	// State shared with the worker, protected by lock
+	pthread_mutex_t lock;
+	pthread_cond_t request_cond;
+	pthread_cond_t idle_cond;
+	query_t *queue;		// Queries waiting to be performed
+	int running;		// Query being performed; 0 if none
+	acl_callback_t running_callback;
+	void *running_arg;
+	event_t *events;	// Events to report, in order
+	int last_id;		// Identifier of the last query
+	bool quit;		// The worker shall exit
+};
+
+// Session of the worker running in this thread
+static __thread acl_session_t *worker_session;
+
+/*
+ * Serializes the queries of all sessions and the synchronous ones,
+ * because the backends keep process-wide state, such as cached
+ * headers and endpoints.
+ */
+static pthread_mutex_t fetch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Queue an event and make the descriptor readable; call with lock held
+static void
+post_locked(acl_session_t *s, int id, acl_status_t status,
+    const char *response, acl_callback_t callback, void *arg)
+{
+	event_t **pp;
+
+	for (pp = &s->events; *pp; pp = &(*pp)->next)
+		;
+	event_t *e = malloc(sizeof(event_t));
+	if (!e)
+		acl_errorf("memory allocation failed.");
+	e->id = id;
+	e->status = status;
+	e->response = response ? acl_safe_strdup(response) : NULL;
+	e->callback = callback;
+	e->arg = arg;
+	e->next = NULL;
+	*pp = e;
+	// A pending byte already reports earlier events
+	if (pp == &s->events) {
+		char c = 0;
+		if (write(s->fd[1], &c, 1) == -1)
+			return;	// The descriptor is already readable
+	}
+}
+
+// Report the response received so far while it is streamed
+static void
+partial(const char *response)
+{
+	acl_session_t *s = worker_session;
+
+	pthread_mutex_lock(&s->lock);
+	if (!atomic_load(&s->cancel_requested)) {
+		// Replace a partial response that wasn't reported yet
+		event_t *e = s->events;
+		while (e && e->next)
+			e = e->next;
+		if (e && e->id == s->running && e->status == ACL_QUERY_PARTIAL) {
+			free(e->response);
+			e->response = acl_safe_strdup(response);
+		} else
+			post_locked(s, s->running, ACL_QUERY_PARTIAL, response,
+			    s->running_callback, s->running_arg);
+	}
+	pthread_mutex_unlock(&s->lock);
+}
+
+// Worker thread: perform the queries it is given
+static void *
+worker(void *arg)
+{
+	acl_session_t *s = arg;
+
+	worker_session = s;
+	acl_cancel_flag = &s->cancel_requested;
+	acl_partial = partial;
+#if defined(__linux__)
+	// Yield the processor to the interactive thread
+	setpriority(PRIO_PROCESS, syscall(SYS_gettid), WORKER_NICE);
+#endif
+
+	pthread_mutex_lock(&s->lock);
+	for (;;) {
+		while (!s->queue && !s->quit)
+			pthread_cond_wait(&s->request_cond, &s->lock);
+		if (s->quit)
+			break;
+		query_t *q = s->queue;
+		s->queue = q->next;
+		s->running = q->id;
+		s->running_callback = q->callback;
+		s->running_arg = q->arg;
+		atomic_store(&s->cancel_requested, false);
+		pthread_mutex_unlock(&s->lock);
+
+		TRACE_BEGIN("background");
+		double start = TRACE_NOW();
+		PROBE_QUERY_START("background", q->config->program_name,
+		    q->prompt);
+		pthread_mutex_lock(&fetch_lock);
+		// Skip queries cancelled while other sessions' ones ran
+		char *response = atomic_load(&s->cancel_requested) ? NULL :
+		    q->fetch(q->config, q->prompt, q->history_length);
+		pthread_mutex_unlock(&fetch_lock);
+		// Background queries use only the first response
+		acl_candidates_clear();
+		bool cancelled = atomic_load(&s->cancel_requested);
+		const char *status = cancelled ? "cancelled" :
+		    response ? "ok" : "error";
+		TRACE_END(q->fetch, status);
+		PROBE_QUERY_END("background", q->fetch,
+		    q->config->program_name, status, start);
+
+		pthread_mutex_lock(&s->lock);
+		post_locked(s, q->id, cancelled ? ACL_QUERY_CANCELLED :
+		    response ? ACL_QUERY_DONE : ACL_QUERY_FAILED,
+		    cancelled ? NULL : response, q->callback, q->arg);
+		s->running = 0;
+		pthread_cond_broadcast(&s->idle_cond);
+		free(response);
+		free(q->prompt);
+		free(q);
+	}
+	pthread_mutex_unlock(&s->lock);
+	acl_http_close();
+	if (acl_curl)
+		curl_easy_cleanup(acl_curl);
+	return NULL;
+}
+
+/*
+ * Return a new session that performs queries with the specified
+ * fetch function and configuration, or NULL on error.
+ */
+acl_session_t *
+acl_session_open(config_t *config, fetch_t fetch)
+{
+	acl_session_t *s = calloc(1, sizeof(acl_session_t));
+	if (!s)
+		return NULL;
+	s->config = config;
+	s->fetch = fetch;
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->request_cond, NULL);
+	pthread_cond_init(&s->idle_cond, NULL);
+	if (pipe(s->fd) == -1) {
+		free(s);
+		return NULL;
+	}
+	for (int i = 0; i < 2; i++) {
+		fcntl(s->fd[i], F_SETFD, FD_CLOEXEC);
+		fcntl(s->fd[i], F_SETFL, O_NONBLOCK);
+	}
+	if (pthread_create(&s->thread, NULL, worker, s) != 0) {
+		close(s->fd[0]);
+		close(s->fd[1]);
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+/*
+ * Return a new session that performs queries through the backend of
+ * the general.api configuration option, or NULL on error.
+ * The configuration is read once, when the first session is created.
+ */
+acl_session_t *
+acl_session_new(void)
+{
+	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	static config_t config;
+	static fetch_t fetch;
+
+	pthread_mutex_lock(&lock);
+	if (!fetch && !config.program_name) {
+		acl_read_config(&config);
+		if (config.prompt_system && config.general_api_set) {
+			acl_log_initialize(&config);
+			acl_usage_initialize(&config);
+			acl_trace_initialize(&config);
+			fetch = acl_backend_load(&config, config.general_api);
+		} else
+			fprintf(stderr, "ai_cli: Missing [general] api or "
+			    "[prompt] system configuration.\n");
+	}
+	pthread_mutex_unlock(&lock);
+	return fetch ? acl_session_open(&config, fetch) : NULL;
+}
+
+/*
+ * Cancel the session's queries, without calling their callbacks,
+ * and release its resources.
+ */
+void
+acl_session_free(acl_session_t *s)
+{
+	pthread_mutex_lock(&s->lock);
+	s->quit = true;
+	atomic_store(&s->cancel_requested, true);
+	pthread_cond_signal(&s->request_cond);
+	pthread_mutex_unlock(&s->lock);
+	pthread_join(s->thread, NULL);
+
+	while (s->queue) {
+		query_t *q = s->queue;
+		s->queue = q->next;
+		free(q->prompt);
+		free(q);
+	}
+	while (s->events) {
+		event_t *e = s->events;
+		s->events = e->next;
+		free(e->response);
+		free(e);
+	}
+	close(s->fd[0]);
+	close(s->fd[1]);
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->request_cond);
+	pthread_cond_destroy(&s->idle_cond);
+	free(s);
+}
+
+/*
+ * Return a file descriptor that becomes readable when the session has
+ * progress to report through acl_session_process, e.g. for poll(2).
+ */
+int
+acl_session_fd(acl_session_t *s)
+{
+	return s->fd[0];
+}
+
+/*
+ * Report the progress of the session's queries by calling their
+ * callbacks in the calling thread.  Never blocks.
+ * Return the number of callbacks called.
+ */
+int
+acl_session_process(acl_session_t *s)
+{
+	char buf[64];
+	int n = 0;
+
+	while (read(s->fd[0], buf, sizeof(buf)) > 0)
+		;
+	pthread_mutex_lock(&s->lock);
+	event_t *e = s->events;
+	s->events = NULL;
+	pthread_mutex_unlock(&s->lock);
+
+	while (e) {
+		event_t *next = e->next;
+		if (e->callback)
+			e->callback(s, e->id, e->status, e->response, e->arg);
+		free(e->response);
+		free(e);
+		e = next;
+		n++;
+	}
+	return n;
+}
+
+// Return true if a query is waiting or being performed
+bool
+acl_session_busy(acl_session_t *s)
+{
+	pthread_mutex_lock(&s->lock);
+	bool busy = s->queue || s->running;
+	pthread_mutex_unlock(&s->lock);
+	return busy;
+}
+
+/*
+ * Wait for the session's queries to complete.
+ * Their progress is then reported by acl_session_process.
+ */
+void
+acl_session_wait(acl_session_t *s)
+{
+	pthread_mutex_lock(&s->lock);
+	while (s->queue || s->running)
+		pthread_cond_wait(&s->idle_cond, &s->lock);
+	pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * Queue a query of the specified prompt through the given fetch
+ * function and configuration, reporting its progress to callback,
+ * which is passed arg.
+ * Return its identifier, a positive number.
+ */
+int
+acl_query_start(acl_session_t *s, fetch_t fetch, config_t *config,
+    const char *prompt, int history_length, acl_callback_t callback,
+    void *arg)
+{
+	query_t *q = malloc(sizeof(query_t));
+	if (!q)
+		acl_errorf("memory allocation failed.");
+	q->fetch = fetch;
+	q->config = config;
+	q->prompt = acl_safe_strdup(prompt);
+	q->history_length = history_length;
+	q->callback = callback;
+	q->arg = arg;
+	q->next = NULL;
+
+	pthread_mutex_lock(&s->lock);
+	q->id = ++s->last_id;
+	query_t **pp;
+	for (pp = &s->queue; *pp; pp = &(*pp)->next)
+		;
+	*pp = q;
+	pthread_cond_signal(&s->request_cond);
+	pthread_mutex_unlock(&s->lock);
+	return q->id;
+}
+
+/*
+ * Queue a query of the specified prompt, providing as context the
+ * specified number of entries at the end of the history(3) list.
+ * Return its identifier, a positive number, or -1 on error.
+ */
+int
+acl_query_async(acl_session_t *s, const char *prompt, int context,
+    acl_callback_t callback, void *arg)
+{
+	if (!prompt || context < 0)
+		return -1;
+	return acl_query_start(s, s->fetch, s->config, prompt, context,
+	    callback, arg);
+}
+
+/*
+ * Perform a query of the specified prompt in the calling thread,
+ * after the query being performed by any session.
+ * Return the response in dynamically allocated memory, or NULL on error.
+ */
+char *
+acl_query_sync(fetch_t fetch, config_t *config, const char *prompt,
+    int history_length)
+{
+	pthread_mutex_lock(&fetch_lock);
+	char *response = fetch(config, prompt, history_length);
+	pthread_mutex_unlock(&fetch_lock);
+	return response;
+}
+
+/*
+ * Cancel the specified query, or all queries if it is 0.
+ * A query being performed reports its cancellation when the transport
+ * notices it.
+ */
+void
+acl_query_cancel(acl_session_t *s, int id)
+{
+	pthread_mutex_lock(&s->lock);
+	for (query_t **pp = &s->queue; *pp; ) {
+		query_t *q = *pp;
+		if (id && q->id != id) {
+			pp = &q->next;
+			continue;
+		}
+		*pp = q->next;
+		post_locked(s, q->id, ACL_QUERY_CANCELLED, NULL, q->callback,
+		    q->arg);
+		free(q->prompt);
+		free(q);
+	}
+	if (s->running && (!id || s->running == id))
+		atomic_store(&s->cancel_requested, true);
+	if (!s->queue && !s->running)
+		pthread_cond_broadcast(&s->idle_cond);
+	pthread_mutex_unlock(&s->lock);
+}
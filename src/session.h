@@ -0,0 +1,32 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Sessions of background queries
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include "ai_cli.h"
+#include "config.h"
+#include "support.h"
+
+acl_session_t *acl_session_open(config_t *config, fetch_t fetch);
+int acl_query_start(acl_session_t *session, fetch_t fetch, config_t *config,
+    const char *prompt, int history_length, acl_callback_t callback,
+    void *arg);
+char *acl_query_sync(fetch_t fetch, config_t *config, const char *prompt,
+    int history_length);
@@ -0,0 +1,212 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test the sessions of background queries.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "session.h"
+#include "support.h"
+
+// Progress reported to the callback, one line per call
+static char reported[256];
+
+static void
+report(acl_session_t *session, int query, acl_status_t status,
+    const char *response, void *arg)
+{
+	static const char *name[] = {"partial", "done", "failed", "cancelled"};
+	size_t len = strlen(reported);
+
+	snprintf(reported + len, sizeof(reported) - len, "%d %s %s\n", query,
+	    name[status], response ? response : "-");
+}
+
+// Respond with the prompt, streaming its prefixes
+static char *
+fetch_echo(config_t *config, const char *prompt, int history_length)
+{
+	for (size_t i = 1; i < strlen(prompt); i++) {
+		char *part = acl_range_strdup(prompt, prompt + i);
+		acl_partial(part);
+		free(part);
+	}
+	return *prompt ? acl_safe_strdup(prompt) : NULL;
+}
+
+// Respond only after the query is cancelled
+static char *
+fetch_slow(config_t *config, const char *prompt, int history_length)
+{
+	while (!acl_cancelled())
+		usleep(1000);
+	return acl_safe_strdup(prompt);
+}
+
+// Number of fetch_count calls in progress and their maximum
+static int in_flight, max_in_flight;
+
+// Respond after a while, recording the concurrent calls
+static char *
+fetch_count(config_t *config, const char *prompt, int history_length)
+{
+	int n = __atomic_add_fetch(&in_flight, 1, __ATOMIC_SEQ_CST);
+	if (n > max_in_flight)
+		max_in_flight = n;
+	usleep(10000);
+	__atomic_sub_fetch(&in_flight, 1, __ATOMIC_SEQ_CST);
+	return acl_safe_strdup(prompt);
+}
+
+static void
+test_process(CuTest *tc)
+{
+	static config_t config;
+	acl_session_t *s = acl_session_open(&config, fetch_echo);
+	struct pollfd fd = {.fd = acl_session_fd(s), .events = POLLIN};
+
+	CuAssertTrue(tc, s != NULL);
+	CuAssertIntEquals(tc, 0, poll(&fd, 1, 0));
+	CuAssertIntEquals(tc, 0, acl_session_process(s));
+
+	CuAssertIntEquals(tc, 1, acl_query_async(s, "ls", 0, report, NULL));
+	CuAssertIntEquals(tc, 2, acl_query_async(s, "", 0, report, NULL));
+	CuAssertIntEquals(tc, -1, acl_query_async(s, "ls", -1, report, NULL));
+	acl_session_wait(s);
+	CuAssertTrue(tc, !acl_session_busy(s));
+	CuAssertIntEquals(tc, 1, poll(&fd, 1, 1000));
+	reported[0] = '\0';
+	CuAssertIntEquals(tc, 3, acl_session_process(s));
+	CuAssertStrEquals(tc, "1 partial l\n1 done ls\n2 failed -\n", reported);
+	CuAssertIntEquals(tc, 0, poll(&fd, 1, 0));
+
+	// Partial responses not yet processed are replaced
+	acl_query_async(s, "pwd", 0, report, NULL);
+	acl_session_wait(s);
+	reported[0] = '\0';
+	CuAssertIntEquals(tc, 2, acl_session_process(s));
+	CuAssertStrEquals(tc, "3 partial pw\n3 done pwd\n", reported);
+	acl_session_free(s);
+}
+
+static void
+test_cancel(CuTest *tc)
+{
+	static config_t config;
+	acl_session_t *s = acl_session_open(&config, fetch_echo);
+
+	int slow = acl_query_start(s, fetch_slow, &config, "sleep", 0, report, NULL);
+	int queued = acl_query_async(s, "ls", 0, report, NULL);
+	acl_query_async(s, "pwd", 0, report, NULL);
+	CuAssertTrue(tc, acl_session_busy(s));
+	acl_query_cancel(s, queued);
+	acl_query_cancel(s, slow);
+	acl_session_wait(s);
+	reported[0] = '\0';
+	acl_session_process(s);
+	CuAssertStrEquals(tc, "2 cancelled -\n1 cancelled -\n"
+	    "3 partial pw\n3 done pwd\n", reported);
+
+	// Cancel all; freeing doesn't report pending progress
+	acl_query_start(s, fetch_slow, &config, "sleep", 0, report, NULL);
+	acl_query_async(s, "ls", 0, report, NULL);
+	acl_query_cancel(s, 0);
+	acl_session_wait(s);
+	reported[0] = '\0';
+	CuAssertIntEquals(tc, 2, acl_session_process(s));
+	CuAssertPtrNotNull(tc, strstr(reported, "4 cancelled -\n"));
+	CuAssertPtrNotNull(tc, strstr(reported, "5 cancelled -\n"));
+	acl_query_start(s, fetch_slow, &config, "sleep", 0, report, NULL);
+	acl_session_free(s);
+}
+
+static void
+test_sessions_serialized(CuTest *tc)
+{
+	static config_t config;
+	acl_session_t *s[3];
+
+	for (int i = 0; i < 3; i++)
+		s[i] = acl_session_open(&config, fetch_count);
+	for (int i = 0; i < 3; i++) {
+		acl_query_async(s[i], "ls", 0, report, NULL);
+		acl_query_async(s[i], "pwd", 0, report, NULL);
+	}
+	for (int i = 0; i < 3; i++) {
+		acl_session_wait(s[i]);
+		reported[0] = '\0';
+		CuAssertIntEquals(tc, 2, acl_session_process(s[i]));
+		CuAssertStrEquals(tc, "1 done ls\n2 done pwd\n", reported);
+		acl_session_free(s[i]);
+	}
+	CuAssertIntEquals(tc, 1, max_in_flight);
+
+	// Synchronous queries wait for those of the sessions
+	s[0] = acl_session_open(&config, fetch_count);
+	acl_query_async(s[0], "ls", 0, report, NULL);
+	acl_query_async(s[0], "pwd", 0, report, NULL);
+	char *response = acl_query_sync(fetch_count, &config, "date", 0);
+	CuAssertStrEquals(tc, "date", response);
+	free(response);
+	acl_session_free(s[0]);
+	CuAssertIntEquals(tc, 1, max_in_flight);
+}
+
+// Count the calls that end a query through the counter in arg
+static void
+count_done(acl_session_t *session, int query, acl_status_t status,
+    const char *response, void *arg)
+{
+	if (status != ACL_QUERY_PARTIAL)
+		(*(int *)arg)++;
+}
+
+static void
+test_callback_arg(CuTest *tc)
+{
+	static config_t config;
+	acl_session_t *s = acl_session_open(&config, fetch_echo);
+	int done[2] = {0, 0};
+
+	acl_query_async(s, "ls", 0, count_done, &done[0]);
+	acl_query_async(s, "pwd", 0, count_done, &done[1]);
+	acl_query_async(s, "", 0, count_done, &done[1]);
+	acl_session_wait(s);
+	acl_session_process(s);
+	CuAssertIntEquals(tc, 1, done[0]);
+	CuAssertIntEquals(tc, 2, done[1]);
+	acl_session_free(s);
+}
+
+CuSuite*
+cu_session_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_process);
+	SUITE_ADD_TEST(suite, test_cancel);
+	SUITE_ADD_TEST(suite, test_sessions_serialized);
+	SUITE_ADD_TEST(suite, test_callback_arg);
+
+	return suite;
+}
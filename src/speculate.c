@@ -0,0 +1,157 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Speculative queries for fixing failed commands.
+ *  After a command fails, a query for fixing it is issued in the
+ *  background, so that its response is ready if the user asks for help.
+ *  Such queries are recorded in the usage ledger under a marker of
+ *  their own, which is used to limit their tokens to a daily budget.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "speculate.h"
+#include "support.h"
+#include "usage.h"
+
+// Default daily token budget
+#define DEFAULT_BUDGET 20000
+
+// Approximate number of characters per token
+#define CHARS_PER_TOKEN 4
+
+// Last history entry seen by acl_speculate_new_entry
+static bool entry_seen;
+static int entry_number;
+static char *entry_line;	// NULL if the history was empty
+
+// Events of this session's speculative queries
+static speculate_stats_t session;
+
+/*
+ * Return true if the last history entry, with the specified history
+ * number and line (NULL if the history is empty), was added since
+ * the previous call, i.e. it is the command executed in between.
+ * A command kept out of the history through HISTCONTROL leaves the
+ * entry unchanged, while erasedups can give a repeated command the
+ * number of the entry it follows, so both are compared.
+ */
+bool
+acl_speculate_new_entry(int number, const char *line)
+{
+	bool added = entry_seen && line && (number != entry_number
+	    || !entry_line || strcmp(line, entry_line) != 0);
+
+	entry_seen = true;
+	entry_number = number;
+	free(entry_line);
+	entry_line = line ? acl_safe_strdup(line) : NULL;
+	return added;
+}
+
+// Return the prompt for fixing the specified failed command
+char *
+acl_speculate_prompt(const char *command, int status)
+{
+	char *prompt;
+
+	acl_safe_asprintf(&prompt, "Fix the command `%s', which failed "
+	    "with exit status %d.", command, status);
+	return prompt;
+}
+
+// Return an estimate of the tokens of a query's request with the prompt
+int
+acl_speculate_tokens(config_t *config, const char *prompt)
+{
+	size_t len = strlen(prompt);
+
+	if (config->prompt_system)
+		len += strlen(config->prompt_system);
+	for (int i = 0; i < NPROMPTS; i++) {
+		if (config->prompt_user[i])
+			len += strlen(config->prompt_user[i]);
+		if (config->prompt_assistant[i])
+			len += strlen(config->prompt_assistant[i]);
+	}
+	return (len + CHARS_PER_TOKEN - 1) / CHARS_PER_TOKEN;
+}
+
+/*
+ * Obtain the speculation statistics: the tokens spent today,
+ * as recorded in the usage ledger, and this session's event counts.
+ */
+void
+acl_speculate_stats(config_t *config, speculate_stats_t *stats)
+{
+	*stats = session;
+	stats->tokens = acl_usage_today_tokens(config, SPECULATE_MARK);
+}
+
+/*
+ * Return true if the daily token budget allows a speculative query.
+ * The budget can only be tracked when the usage ledger is enabled.
+ */
+bool
+acl_speculate_allowed(config_t *config)
+{
+	int budget = config->speculate_budget_set ? config->speculate_budget :
+	    DEFAULT_BUDGET;
+
+	return config->usage_enabled
+	    && acl_usage_today_tokens(config, SPECULATE_MARK) < budget;
+}
+
+/*
+ * Record the specified event of a speculative query.
+ * Completed queries are recorded in the usage ledger by their
+ * backend; a cancelled one is recorded here with the specified
+ * estimate of the tokens of its request.
+ */
+void
+acl_speculate_record(config_t *config, speculate_event_t event, int tokens)
+{
+	switch (event) {
+	case SPECULATE_ISSUED:
+		session.issued++;
+		break;
+	case SPECULATE_COMPLETED:
+		session.completed++;
+		break;
+	case SPECULATE_USED:
+		session.used++;
+		break;
+	case SPECULATE_CANCELLED:
+		session.cancelled++;
+		acl_usage_add(&(usage_t){.tokens_in = tokens});
+		acl_usage_record(config, SPECULATE_MARK,
+		    acl_config_model_get(config, config->general_api));
+		break;
+	}
+
+	if (config->general_verbose)
+		fprintf(stderr, "\nSpeculation: %ld tokens today; this session "
+		    "%d issued, %d completed, %d used, %d cancelled\n",
+		    acl_usage_today_tokens(config, SPECULATE_MARK),
+		    session.issued, session.completed, session.used,
+		    session.cancelled);
+}
@@ -0,0 +1,53 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Speculative queries for fixing failed commands
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "config.h"
+
+// Events in the life of a speculative query
+typedef enum {
+	SPECULATE_ISSUED,	// Query started
+	SPECULATE_COMPLETED,	// Response obtained
+	SPECULATE_USED,		// Response shown to the user
+	SPECULATE_CANCELLED,	// Query abandoned while in flight
+} speculate_event_t;
+
+// Usage ledger marker under which speculative queries are recorded
+#define SPECULATE_MARK "speculative"
+
+// Speculation accounting
+typedef struct {
+	long tokens;		// Tokens spent today, by all sessions
+	int issued;		// This session's event counts
+	int completed;
+	int used;
+	int cancelled;
+} speculate_stats_t;
+
+bool acl_speculate_new_entry(int number, const char *line);
+char *acl_speculate_prompt(const char *command, int status);
+int acl_speculate_tokens(config_t *config, const char *prompt);
+bool acl_speculate_allowed(config_t *config);
+void acl_speculate_record(config_t *config, speculate_event_t event,
+    int tokens);
+void acl_speculate_stats(config_t *config, speculate_stats_t *stats);
@@ -0,0 +1,120 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test speculative queries.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "config.h"
+#include "speculate.h"
+#include "usage.h"
+
+static const char ledger_file[] = "test-speculate.ledger";
+
+static void
+test_prompt(CuTest* tc)
+{
+	config_t config = {"bash"};
+
+	char *prompt = acl_speculate_prompt("gti status", 127);
+	CuAssertStrEquals(tc, "Fix the command `gti status', which failed "
+	    "with exit status 127.", prompt);
+	free(prompt);
+
+	CuAssertIntEquals(tc, 2, acl_speculate_tokens(&config, "ls -l"));
+	config.prompt_system = "1234";
+	CuAssertIntEquals(tc, 2, acl_speculate_tokens(&config, "5678"));
+}
+
+static void
+test_budget(CuTest* tc)
+{
+	config_t config = {"bash"};
+	speculate_stats_t stats;
+
+	config.general_api = "openai";
+	config.openai_model = "gpt-4o";
+	config.usage_file = ledger_file;
+	config.usage_file_set = true;
+	config.usage_prices = "gpt-4o:10000/10000";
+	config.usage_prices_set = true;
+	config.speculate_budget = 100;
+	config.speculate_budget_set = true;
+	unlink(ledger_file);
+
+	// The budget is tracked through the usage ledger
+	CuAssertTrue(tc, !acl_speculate_allowed(&config));
+	config.usage_enabled = true;
+	CuAssertTrue(tc, acl_speculate_allowed(&config));
+
+	// A completed query, recorded by its backend under the marker
+	acl_speculate_record(&config, SPECULATE_ISSUED, 0);
+	acl_usage_mark(SPECULATE_MARK);
+	acl_usage_add(&(usage_t){.tokens_in = 50, .tokens_out = 10});
+	acl_usage_record(&config, "openai", "gpt-4o");
+	acl_usage_mark(NULL);
+	acl_speculate_record(&config, SPECULATE_COMPLETED, 0);
+	acl_speculate_record(&config, SPECULATE_USED, 0);
+	// A foreground query does not count
+	acl_usage_add(&(usage_t){.tokens_in = 500});
+	acl_usage_record(&config, "openai", "gpt-4o");
+	CuAssertTrue(tc, acl_speculate_allowed(&config));
+
+	acl_speculate_record(&config, SPECULATE_ISSUED, 0);
+	acl_speculate_record(&config, SPECULATE_CANCELLED, 60);
+	CuAssertTrue(tc, !acl_speculate_allowed(&config));
+
+	acl_speculate_stats(&config, &stats);
+	CuAssertIntEquals(tc, 120, stats.tokens);
+	CuAssertIntEquals(tc, 2, stats.issued);
+	CuAssertIntEquals(tc, 1, stats.completed);
+	CuAssertIntEquals(tc, 1, stats.used);
+	CuAssertIntEquals(tc, 1, stats.cancelled);
+	// Speculative queries count toward the spending budgets
+	CuAssertDblEquals(tc, 6.2, acl_usage_today_cost(&config), 1e-9);
+	unlink(ledger_file);
+}
+
+static void
+test_new_entry(CuTest* tc)
+{
+	// The first call only notes the last entry
+	CuAssertTrue(tc, !acl_speculate_new_entry(0, NULL));
+	CuAssertTrue(tc, acl_speculate_new_entry(1, "ls /nonexistent"));
+	// An empty line or a command kept out of the history
+	CuAssertTrue(tc, !acl_speculate_new_entry(1, "ls /nonexistent"));
+	CuAssertTrue(tc, acl_speculate_new_entry(2, "echo a"));
+	// A repeated command moved to the end by erasedups
+	CuAssertTrue(tc, acl_speculate_new_entry(2, "ls /nonexistent"));
+	// A repeated command without duplicate removal
+	CuAssertTrue(tc, acl_speculate_new_entry(3, "ls /nonexistent"));
+}
+
+CuSuite*
+cu_speculate_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_prompt);
+	SUITE_ADD_TEST(suite, test_budget);
+	SUITE_ADD_TEST(suite, test_new_entry);
+
+	return suite;
+}
@@ -0,0 +1,122 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Compare the size and the startup cost of preloaded libraries,
+ *  by running a readline program with each one of them.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Number of timed program runs for each library
+#define RUNS 200
+
+static double
+now_ms(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+	double da = *(const double *)a, db = *(const double *)b;
+
+	return da < db ? -1 : da > db;
+}
+
+/*
+ * Run the program with the library preloaded through the specified
+ * environment variable.  Return the elapsed time in ms and set
+ * maxrss to the program's peak RSS in kB.
+ */
+static double
+run(const char *program, const char *preload_var, const char *library,
+    long *maxrss)
+{
+	double start = now_ms();
+	pid_t pid = fork();
+	if (pid == 0) {
+		// Read an immediate end of file; discard the output
+		int null = open("/dev/null", O_RDWR);
+		dup2(null, STDIN_FILENO);
+		dup2(null, STDOUT_FILENO);
+		setenv(preload_var, library, 1);
+		execl(program, program, (char *)NULL);
+		perror(program);
+		_exit(1);
+	}
+	int status;
+	struct rusage usage;
+	if (wait4(pid, &status, 0, &usage) == -1 || status != 0) {
+		fprintf(stderr, "%s failed with %s\n", program, library);
+		exit(1);
+	}
+	*maxrss = usage.ru_maxrss;
+#if defined(MACOS)
+	*maxrss /= 1024;	// Reported in bytes
+#endif
+	return now_ms() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (argc < 4) {
+		fprintf(stderr, "Usage: %s preload-variable program library ...\n",
+		    argv[0]);
+		exit(1);
+	}
+
+	printf("%d runs; times in ms; sizes in kB\n", RUNS);
+	printf("%-30s %9s %9s %9s %9s\n", "Library", "Size", "Mean",
+	    "Median", "Max RSS");
+	for (int i = 3; i < argc; i++) {
+		struct stat sb;
+		if (stat(argv[i], &sb) == -1) {
+			perror(argv[i]);
+			exit(1);
+		}
+
+		double elapsed[RUNS], sum = 0;
+		long maxrss = 0, rss;
+		// Warm the page cache
+		run(argv[2], argv[1], argv[i], &rss);
+		for (int j = 0; j < RUNS; j++) {
+			elapsed[j] = run(argv[2], argv[1], argv[i], &rss);
+			sum += elapsed[j];
+			if (rss > maxrss)
+				maxrss = rss;
+		}
+		qsort(elapsed, RUNS, sizeof(double), compare_double);
+
+		const char *name = strrchr(argv[i], '/');
+		printf("%-30s %9ld %9.3f %9.3f %9ld\n", name ? name + 1 : argv[i],
+		    (long)(sb.st_size / 1024), sum / RUNS, elapsed[RUNS / 2], maxrss);
+	}
+	return 0;
+}
@@ -0,0 +1,910 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Offline aggregator of the latency, token, and error statistics
+ *  recorded in the log and trace files.
+ *  Files are mapped into memory and split at record boundaries into
+ *  chunks, which are parsed in parallel.  The parsed records are then
+ *  combined in their original order, pairing each response with the
+ *  request of the process that made it.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <jansson.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stats.h"
+#include "unit_test.h"
+
+// Size of the blocks in which piped input is read
+#define BLOCK_SIZE (64 * 1024 * 1024)
+
+// Minimum size of the chunk given to each parsing thread
+#define MIN_CHUNK (1024 * 1024)
+
+// Copy the string src into the array dst
+#define COPY(dst, src) snprintf(dst, sizeof(dst), "%s", src)
+
+static void *
+safe_realloc(void *ptr, size_t size)
+{
+	void *p = realloc(ptr, size);
+	if (p == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+// Return a pointer just past the JSON string starting at p, or NULL
+static const char *
+string_end(const char *p, const char *end)
+{
+	const char *q;
+
+	for (p++; (q = memchr(p, '"', end - p)) != NULL; p = q + 1) {
+		// The quote is escaped by an odd number of backslashes
+		const char *b = q;
+		while (b > p && b[-1] == '\\')
+			b--;
+		if ((q - b) % 2 == 0)
+			return q + 1;
+	}
+	return NULL;
+}
+
+/*
+ * Return a pointer just past the JSON object or array starting at p,
+ * or NULL if it doesn't end before end or the start of the next record.
+ */
+STATIC const char *
+value_end(const char *p, const char *end)
+{
+	int depth = 0;
+
+	for (; p < end; p++)
+		if (*p == '"') {
+			if ((p = string_end(p, end)) == NULL)
+				return NULL;
+			p--;
+		} else if (*p == '\n' && p + 1 < end && p[1] == '{')
+			return NULL;
+		else if (*p == '{' || *p == '[')
+			depth++;
+		else if ((*p == '}' || *p == ']') && --depth == 0)
+			return p + 1;
+	return NULL;
+}
+
+/*
+ * Return a pointer to the start of the first record after p, or end.
+ * Records start with a brace at the beginning of a line; the nested
+ * objects of logged JSON requests and responses are indented.
+ */
+STATIC const char *
+next_record(const char *p, const char *end)
+{
+	while (p < end && (p = memchr(p, '\n', end - p)) != NULL)
+		if (++p < end && *p == '{')
+			return p;
+	return end;
+}
+
+/*
+ * Return the seconds since the epoch of the specified local ISO
+ * time, e.g. 2024-03-01T10:20:30.123456, or 0 if it is invalid.
+ */
+STATIC double
+parse_timestamp(const char *s)
+{
+	// The time of the hour last converted, as mktime(3) is slow
+	static __thread char hour[14];
+	static __thread time_t hour_time;
+	struct tm tm = {0};
+	long usec = 0;
+
+	if (sscanf(s, "%d-%d-%dT%d:%d:%d.%ld", &tm.tm_year, &tm.tm_mon,
+	    &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &usec) < 6)
+		return 0;
+	int min = tm.tm_min, sec = tm.tm_sec;
+	if (strncmp(s, hour, sizeof(hour) - 1) != 0) {
+		tm.tm_year -= 1900;
+		tm.tm_mon--;
+		tm.tm_min = tm.tm_sec = 0;
+		tm.tm_isdst = -1;
+		hour_time = mktime(&tm);
+		snprintf(hour, sizeof(hour), "%.13s", s);
+	}
+	return hour_time + min * 60 + sec + usec / 1e6;
+}
+
+// Return the string value of the object's specified member, or ""
+static const char *
+member_string(json_t *object, const char *key)
+{
+	json_t *v = json_object_get(object, key);
+	return json_is_string(v) ? json_string_value(v) : "";
+}
+
+// Return the numeric value of the object's specified member, or 0
+static long
+member_number(json_t *object, const char *key)
+{
+	json_t *v = json_object_get(object, key);
+	return json_is_number(v) ? (long)json_number_value(v) : 0;
+}
+
+// Return a pointer just past the JSON scalar starting at p
+static const char *
+scalar_end(const char *p, const char *end)
+{
+	while (p < end && *p != ',' && *p != '}' && !isspace((unsigned char)*p))
+		p++;
+	return p;
+}
+
+static const char *
+skip_space(const char *p, const char *end)
+{
+	while (p < end && isspace((unsigned char)*p))
+		p++;
+	return p;
+}
+
+// Return true if the range holds the string key, including its quotes
+#define KEY_IS(begin, end, key) \
+	((end) - (begin) == sizeof(key) + 1 && \
+	 memcmp((begin) + 1, key, sizeof(key) - 1) == 0)
+
+/*
+ * If the JSON object starting at p is a logged request, or a request
+ * prefix definition, set e to the corresponding event and return a
+ * pointer just past it; otherwise return NULL.
+ * Requests are the bulk of the log, so rather than parsing them, only
+ * their top-level members are scanned.
+ */
+STATIC const char *
+request_scan(const char *p, const char *end, event_t *e)
+{
+	bool messages = false, prompt = false, system = false;
+	bool max_tokens = false, stream = false;
+	char model[sizeof(e->model)] = "";
+	const char *prefix = NULL, *reference = NULL;
+
+	for (p++; ; p++) {
+		p = skip_space(p, end);
+		if (p == end || *p != '"')
+			break;
+		const char *key = p;
+		if ((p = string_end(p, end)) == NULL)
+			return NULL;
+		const char *key_end = p;
+		p = skip_space(p, end);
+		if (p == end || *p != ':')
+			return NULL;
+		const char *value = skip_space(p + 1, end);
+		if (value == end)
+			return NULL;
+		if (*value == '"')
+			p = string_end(value, end);
+		else if (*value == '{' || *value == '[')
+			p = value_end(value, end);
+		else
+			p = scalar_end(value, end);
+		if (p == NULL)
+			return NULL;
+
+		if (KEY_IS(key, key_end, "messages"))
+			messages = true;
+		else if (KEY_IS(key, key_end, "prompt"))
+			prompt = true;
+		else if (KEY_IS(key, key_end, "system"))
+			system = true;
+		else if (KEY_IS(key, key_end, "max_tokens"))
+			max_tokens = true;
+		else if (KEY_IS(key, key_end, "stream"))
+			stream = true;
+		else if (KEY_IS(key, key_end, "model") && *value == '"')
+			snprintf(model, sizeof(model), "%.*s",
+			    (int)(p - value - 2), value + 1);
+		else if (KEY_IS(key, key_end, "prefix") && *value == '"')
+			prefix = value + 1;
+		else if (KEY_IS(key, key_end, "request") && *value == '"')
+			reference = value + 1;
+
+		p = skip_space(p, end);
+		if (p == end || *p != ',')
+			break;
+	}
+	if (p == end || *p != '}')
+		return NULL;
+
+	// Prefix definitions and requests referring to them
+	if (prefix || reference) {
+		memset(e, 0, sizeof(*e));
+		e->type = prefix ? EV_PREFIX : EV_REQUEST;
+		e->hash = strtoull(prefix ? prefix : reference, NULL, 16);
+		return p + 1;
+	}
+	if (!messages && !prompt)
+		return NULL;
+
+	memset(e, 0, sizeof(*e));
+	e->type = EV_REQUEST;
+	if (prompt)
+		COPY(e->backend, "llamacpp");
+	else if (system && max_tokens)
+		COPY(e->backend, "anthropic");
+	else if (stream)
+		COPY(e->backend, "ollama");
+	else
+		COPY(e->backend, "openai");
+	COPY(e->model, model);
+	return p + 1;
+}
+
+// Set the event's token counts and errors from the specified API response
+static void
+response_parse(json_t *response, event_t *e)
+{
+	json_t *error = json_object_get(response, "error");
+	if (error) {
+		e->error = true;
+		e->rate_limited = member_number(error, "code") == 429 ||
+		    strstr(member_string(error, "code"), "rate_limit") ||
+		    strstr(member_string(error, "type"), "rate_limit");
+	}
+
+	json_t *usage = json_object_get(response, "usage");
+	const char *type = member_string(response, "type");
+	if (strcmp(member_string(response, "object"), "chat.completion") == 0) {
+		e->tokens_in = member_number(usage, "prompt_tokens");
+		e->tokens_out = member_number(usage, "completion_tokens");
+		e->tokens_cached = member_number(json_object_get(usage,
+		    "prompt_tokens_details"), "cached_tokens");
+	} else if (strcmp(type, "message") == 0 || strcmp(type, "error") == 0) {
+		// Input tokens exclude those read from and written to the cache
+		e->tokens_cached = member_number(usage, "cache_read_input_tokens");
+		e->tokens_in = member_number(usage, "input_tokens") +
+		    e->tokens_cached +
+		    member_number(usage, "cache_creation_input_tokens");
+		e->tokens_out = member_number(usage, "output_tokens");
+	} else if (json_object_get(response, "tokens_predicted")) {
+		e->tokens_in = member_number(response, "tokens_evaluated");
+		e->tokens_out = member_number(response, "tokens_predicted");
+		// Prompt tokens not processed were found in the KV cache
+		json_t *timings = json_object_get(response, "timings");
+		if (json_object_get(timings, "prompt_n")) {
+			long processed = member_number(timings, "prompt_n");
+			if (e->tokens_in > processed)
+				e->tokens_cached = e->tokens_in - processed;
+		}
+	}
+}
+
+/*
+ * Set e to the event corresponding to the specified JSON record.
+ * Return false if the record doesn't matter for the statistics.
+ */
+static bool
+record_parse(const char *s, size_t len, event_t *e)
+{
+	json_error_t error;
+	json_t *root = json_loadb(s, len, 0, &error);
+
+	if (!json_is_object(root)) {
+		json_decref(root);
+		return false;
+	}
+	memset(e, 0, sizeof(*e));
+	bool keep = true;
+	if (json_object_get(root, "timestamp")) {
+		e->type = EV_TIMESTAMP;
+		e->time = parse_timestamp(member_string(root, "timestamp"));
+		e->pid = member_number(root, "pid");
+		COPY(e->program, member_string(root, "program"));
+	} else if (json_object_get(root, "spans")) {
+		const char *status = member_string(root, "status");
+
+		e->type = EV_TRACE;
+		COPY(e->backend, member_string(root, "api"));
+		COPY(e->program, member_string(root, "program"));
+		e->error = strcmp(status, "error") == 0;
+		e->cancelled = strcmp(status, "cancelled") == 0;
+		e->ms = json_number_value(json_object_get(root, "ms"));
+	} else if (json_object_get(root, "route") ||
+	    json_object_get(root, "route_latency") ||
+	    json_object_get(root, "route_outcome"))
+		keep = false;
+	else {
+		e->type = EV_RESPONSE;
+		response_parse(root, e);
+	}
+	json_decref(root);
+	return keep;
+}
+
+static void
+events_append(events_t *events, const event_t *e)
+{
+	if (events->n == events->allocated) {
+		events->allocated = events->allocated ? events->allocated * 2 : 256;
+		events->ev = safe_realloc(events->ev,
+		    events->allocated * sizeof(event_t));
+	}
+	events->ev[events->n++] = *e;
+}
+
+// Append to events those of the records in the specified range
+STATIC void
+parse_records(const char *p, const char *end, events_t *events)
+{
+	event_t e;
+
+	for (;;) {
+		while (p < end && isspace((unsigned char)*p))
+			p++;
+		if (p == end)
+			return;
+
+		const char *record_end;
+		if (*p == '{' && (record_end = request_scan(p, end, &e)) != NULL) {
+			events_append(events, &e);
+			p = record_end;
+			continue;
+		}
+		if (*p == '{' && (record_end = value_end(p, end)) != NULL) {
+			if (record_parse(p, record_end - p, &e))
+				events_append(events, &e);
+			p = record_end;
+			continue;
+		}
+
+		// Plain text response, as logged by Ollama, or a damaged record
+		if (*p != '{') {
+			memset(&e, 0, sizeof(e));
+			e.type = EV_RESPONSE;
+			events_append(events, &e);
+		}
+		p = next_record(p, end);
+	}
+}
+
+// Return the named group of the specified dimension, creating it if needed
+STATIC group_t *
+group_get(stats_t *s, enum dimension d, const char *name)
+{
+	if (!*name)
+		name = "unknown";
+	for (size_t i = 0; i < s->ngroups[d]; i++)
+		if (strcmp(s->groups[d][i].name, name) == 0)
+			return &s->groups[d][i];
+
+	s->groups[d] = safe_realloc(s->groups[d],
+	    (s->ngroups[d] + 1) * sizeof(group_t));
+	group_t *g = &s->groups[d][s->ngroups[d]++];
+	memset(g, 0, sizeof(*g));
+	COPY(g->name, name);
+	return g;
+}
+
+/*
+ * Return the groups to which a query made through the specified
+ * backend and model by the specified program belongs.
+ */
+static void
+groups_get(stats_t *s, group_t *groups[NDIMENSIONS], const char *backend,
+    const char *model, const char *program)
+{
+	groups[DIM_ALL] = group_get(s, DIM_ALL, "all");
+	groups[DIM_BACKEND] = group_get(s, DIM_BACKEND, backend);
+	groups[DIM_MODEL] = group_get(s, DIM_MODEL, model);
+	groups[DIM_PROGRAM] = group_get(s, DIM_PROGRAM, program);
+}
+
+static void
+latency_add(group_t *g, double ms)
+{
+	if (g->nlatency == g->alatency) {
+		g->alatency = g->alatency ? g->alatency * 2 : 64;
+		g->latency = safe_realloc(g->latency,
+		    g->alatency * sizeof(double));
+	}
+	g->latency[g->nlatency++] = ms;
+}
+
+// Return the pending request slot of the specified process
+static pending_t *
+pending_get(stats_t *s, int pid)
+{
+	for (int i = 0; i < s->npending; i++)
+		if (s->pending[i].pid == pid)
+			return &s->pending[i];
+	// Reuse slots when too many processes have logged
+	pending_t *p = s->npending < MAX_PROCESSES ?
+	    &s->pending[s->npending++] : &s->pending[pid % MAX_PROCESSES];
+	memset(p, 0, sizeof(*p));
+	p->pid = pid;
+	return p;
+}
+
+/*
+ * Set the event of a request referring to a logged prefix to the
+ * backend and model of the prefix's request.
+ */
+static void
+prefix_resolve(stats_t *s, event_t *e)
+{
+	for (int i = 0; i < s->nprefixes; i++)
+		if (s->prefixes[i].hash == e->hash) {
+			COPY(e->backend, s->prefixes[i].backend);
+			COPY(e->model, s->prefixes[i].model);
+			return;
+		}
+}
+
+// Remember the backend and model of the request defining a prefix
+static void
+prefix_add(stats_t *s, unsigned long long hash, const event_t *e)
+{
+	prefix_t *p = NULL;
+
+	for (int i = 0; i < s->nprefixes; i++)
+		if (s->prefixes[i].hash == hash)
+			p = &s->prefixes[i];
+	if (!p)
+		p = s->nprefixes < MAX_PREFIXES ?
+		    &s->prefixes[s->nprefixes++] :
+		    &s->prefixes[hash % MAX_PREFIXES];
+	p->hash = hash;
+	COPY(p->backend, e->backend);
+	COPY(p->model, e->model);
+}
+
+// Add to the statistics the specified event, in log order
+STATIC void
+stats_add(stats_t *s, const event_t *e)
+{
+	group_t *groups[NDIMENSIONS];
+	event_t resolved;
+	pending_t *p;
+
+	switch (e->type) {
+	case EV_TIMESTAMP:
+		s->time = e->time;
+		s->pid = e->pid;
+		COPY(s->program, e->program);
+		return;
+	case EV_PREFIX:
+		// The timestamp and the request follow
+		s->prefix = e->hash;
+		return;
+	case EV_REQUEST:
+		if (e->hash) {
+			resolved = *e;
+			prefix_resolve(s, &resolved);
+			e = &resolved;
+		} else if (s->prefix)
+			prefix_add(s, s->prefix, e);
+		// A previous unanswered request failed or was cancelled
+		p = pending_get(s, s->pid);
+		p->active = true;
+		p->time = s->time;
+		COPY(p->backend, e->backend);
+		COPY(p->model, e->model);
+		COPY(p->program, s->program);
+		groups_get(s, groups, p->backend, p->model, p->program);
+		for (int d = 0; d < NDIMENSIONS; d++)
+			groups[d]->queries++;
+		break;
+	case EV_RESPONSE:
+		p = pending_get(s, s->pid);
+		if (!p->active)
+			break;
+		p->active = false;
+		groups_get(s, groups, p->backend, p->model, p->program);
+		for (int d = 0; d < NDIMENSIONS; d++) {
+			group_t *g = groups[d];
+
+			g->responses++;
+			g->errors += e->error;
+			g->rate_limited += e->rate_limited;
+			g->tokens_in += e->tokens_in;
+			g->tokens_out += e->tokens_out;
+			g->tokens_cached += e->tokens_cached;
+			// Latency requires timestamps
+			if (!e->error && p->time && s->time)
+				latency_add(g, (s->time - p->time) * 1e3);
+		}
+		break;
+	case EV_TRACE:
+		groups_get(s, groups, e->backend, "", e->program);
+		for (int d = 0; d < NDIMENSIONS; d++) {
+			group_t *g = groups[d];
+
+			g->queries++;
+			g->errors += e->error;
+			if (!e->error && !e->cancelled) {
+				g->responses++;
+				latency_add(g, e->ms);
+			}
+		}
+		break;
+	}
+	// A timestamp or prefix applies only to the record following it
+	s->prefix = 0;
+	s->time = 0;
+	s->pid = 0;
+	*s->program = '\0';
+}
+
+// Thread parsing a chunk of the input
+typedef struct {
+	const char *begin, *end;
+	events_t events;
+} chunk_t;
+
+static void *
+chunk_parse(void *arg)
+{
+	chunk_t *c = arg;
+
+	parse_records(c->begin, c->end, &c->events);
+	return NULL;
+}
+
+/*
+ * Add to the statistics the records of the specified data, parsing
+ * them with up to nthreads threads.
+ */
+STATIC void
+stats_process(stats_t *s, const char *data, size_t len, int nthreads)
+{
+	const char *end = data + len;
+
+	if ((size_t)nthreads > len / MIN_CHUNK)
+		nthreads = len / MIN_CHUNK;
+	if (nthreads < 1)
+		nthreads = 1;
+
+	chunk_t *chunks = calloc(nthreads, sizeof(chunk_t));
+	pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+	bool *started = calloc(nthreads, sizeof(bool));
+	if (!chunks || !threads || !started) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	// Split the data at record boundaries
+	const char *p = data;
+	for (int i = 0; i < nthreads; i++) {
+		chunks[i].begin = p;
+		if (i == nthreads - 1)
+			p = end;
+		else if (p < data + len / nthreads * (i + 1))
+			p = next_record(data + len / nthreads * (i + 1) - 1, end);
+		chunks[i].end = p;
+	}
+
+	for (int i = 1; i < nthreads; i++)
+		started[i] = pthread_create(&threads[i], NULL, chunk_parse,
+		    &chunks[i]) == 0;
+	chunk_parse(&chunks[0]);
+	for (int i = 1; i < nthreads; i++)
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			chunk_parse(&chunks[i]);
+
+	for (int i = 0; i < nthreads; i++) {
+		for (size_t j = 0; j < chunks[i].events.n; j++)
+			stats_add(s, &chunks[i].events.ev[j]);
+		free(chunks[i].events.ev);
+	}
+	free(chunks);
+	free(threads);
+	free(started);
+}
+
+// Return the p-th percentile of the n sorted values
+STATIC double
+percentile(const double *sorted, size_t n, int p)
+{
+	size_t rank = (p * n + 99) / 100;
+	return sorted[rank ? rank - 1 : 0];
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// Order groups by decreasing number of queries
+static int
+compare_queries(const void *a, const void *b)
+{
+	const group_t *x = a, *y = b;
+	return (y->queries > x->queries) - (y->queries < x->queries);
+}
+
+// Output the value as a percentage of the total, or - if it is unknown
+static void
+print_rate(FILE *f, long value, long total)
+{
+	if (total)
+		fprintf(f, " %7.1f%%", 100.0 * value / total);
+	else
+		fprintf(f, " %8s", "-");
+}
+
+// Output a table with the statistics of the specified dimension
+static void
+report_dimension(stats_t *s, enum dimension d, const char *title, FILE *f)
+{
+	static const int percentiles[] = { 50, 90, 99 };
+
+	qsort(s->groups[d], s->ngroups[d], sizeof(group_t), compare_queries);
+	fprintf(f, "%-24s %8s %8s %8s %8s %8s %8s %11s %11s %8s\n", title,
+	    "queries", "errors", "429", "p50 ms", "p90 ms", "p99 ms",
+	    "tokens in", "tokens out", "cached");
+	for (size_t i = 0; i < s->ngroups[d]; i++) {
+		group_t *g = &s->groups[d][i];
+
+		fprintf(f, "%-24.24s %8ld", g->name, g->queries);
+		print_rate(f, g->errors, g->queries);
+		print_rate(f, g->rate_limited, g->queries);
+		qsort(g->latency, g->nlatency, sizeof(double), compare_double);
+		for (int j = 0; j < 3; j++)
+			if (g->nlatency)
+				fprintf(f, " %8.0f", percentile(g->latency,
+				    g->nlatency, percentiles[j]));
+			else
+				fprintf(f, " %8s", "-");
+		fprintf(f, " %11ld %11ld", g->tokens_in, g->tokens_out);
+		// Share of the input tokens served from the prompt cache
+		print_rate(f, g->tokens_cached, g->tokens_in);
+		fputc('\n', f);
+	}
+}
+
+// Output the statistics broken down by backend, model, and program
+STATIC void
+stats_report(stats_t *s, FILE *f)
+{
+	static const char *titles[] = { "all", "backend", "model", "program" };
+
+	for (int d = 0; d < NDIMENSIONS; d++) {
+		if (d)
+			fputc('\n', f);
+		report_dimension(s, d, titles[d], f);
+	}
+}
+
+STATIC void
+stats_free(stats_t *s)
+{
+	for (int d = 0; d < NDIMENSIONS; d++) {
+		for (size_t i = 0; i < s->ngroups[d]; i++)
+			free(s->groups[d][i].latency);
+		free(s->groups[d]);
+	}
+}
+
+#if !defined(UNIT_TEST)
+// Programs for decompressing rotated logs, by file name suffix
+static const struct {
+	const char *suffix;
+	const char *program;
+} decompressors[] = {
+	{ ".gz", "gzip" },
+	{ ".bz2", "bzip2" },
+	{ ".xz", "xz" },
+	{ ".zst", "zstd" },
+};
+
+// Return a pointer to the start of the last record in the range, or begin
+static const char *
+last_record(const char *begin, const char *end)
+{
+	for (const char *p = end - 1; p > begin; p--)
+		if (*p == '{' && p[-1] == '\n')
+			return p;
+	return begin;
+}
+
+/*
+ * Add to the statistics the records read from fd, processing them
+ * in blocks ending at record boundaries.
+ * Return false on a read error.
+ */
+static bool
+process_stream(stats_t *s, int fd, int nthreads)
+{
+	size_t size = BLOCK_SIZE, len = 0;
+	char *buffer = safe_realloc(NULL, size);
+	bool ok = true;
+
+	for (;;) {
+		ssize_t n = read(fd, buffer + len, size - len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("read");
+			ok = false;
+			n = 0;
+		}
+		len += n;
+		if (n == 0) {
+			stats_process(s, buffer, len, nthreads);
+			break;
+		}
+		if (len < size)
+			continue;
+
+		const char *complete = last_record(buffer, buffer + len);
+		if (complete == buffer) {
+			// A record longer than the buffer
+			size *= 2;
+			buffer = safe_realloc(buffer, size);
+			continue;
+		}
+		stats_process(s, buffer, complete - buffer, nthreads);
+		len -= complete - buffer;
+		memmove(buffer, complete, len);
+	}
+	free(buffer);
+	return ok;
+}
+
+// Return the decompressor of the specified file, or NULL
+static const char *
+decompressor(const char *path)
+{
+	size_t len = strlen(path);
+
+	for (size_t i = 0; i < sizeof(decompressors) / sizeof(decompressors[0]); i++) {
+		size_t slen = strlen(decompressors[i].suffix);
+		if (len > slen &&
+		    strcmp(path + len - slen, decompressors[i].suffix) == 0)
+			return decompressors[i].program;
+	}
+	return NULL;
+}
+
+// Add to the statistics the output of the specified decompressor
+static bool
+process_compressed(stats_t *s, const char *program, const char *path,
+    int nthreads)
+{
+	int fd[2];
+
+	if (pipe(fd) == -1) {
+		perror("pipe");
+		return false;
+	}
+	pid_t pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		return false;
+	}
+	if (pid == 0) {
+		close(fd[0]);
+		dup2(fd[1], STDOUT_FILENO);
+		close(fd[1]);
+		execlp(program, program, "-dc", "--", path, (char *)NULL);
+		fprintf(stderr, "Unable to run %s: %s\n", program,
+		    strerror(errno));
+		_exit(1);
+	}
+	close(fd[1]);
+	bool ok = process_stream(s, fd[0], nthreads);
+	close(fd[0]);
+
+	int status;
+	if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "Unable to decompress %s\n", path);
+		ok = false;
+	}
+	return ok;
+}
+
+// Add to the statistics the records of the specified file
+static bool
+process_file(stats_t *s, const char *path, int nthreads)
+{
+	const char *program = decompressor(path);
+	if (program)
+		return process_compressed(s, program, path, nthreads);
+
+	int fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+	if (fd == -1) {
+		fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	struct stat st;
+	bool ok;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			fprintf(stderr, "Unable to map %s: %s\n", path,
+			    strerror(errno));
+			ok = false;
+		} else {
+			madvise(data, st.st_size, MADV_WILLNEED);
+			stats_process(s, data, st.st_size, nthreads);
+			munmap(data, st.st_size);
+			ok = true;
+		}
+	} else
+		ok = process_stream(s, fd, nthreads);
+	if (fd != STDIN_FILENO)
+		close(fd);
+	return ok;
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-j threads] [file ...]\n", name);
+	exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	int opt;
+
+	while ((opt = getopt(argc, argv, "j:")) != -1)
+		switch (opt) {
+		case 'j':
+			nthreads = atoi(optarg);
+			if (nthreads < 1)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	if (nthreads < 1)
+		nthreads = 1;
+
+	stats_t s = {0};
+	bool ok = true;
+	if (optind == argc)
+		ok = process_file(&s, "-", nthreads);
+	for (int i = optind; i < argc; i++)
+		ok &= process_file(&s, argv[i], nthreads);
+
+	stats_report(&s, stdout);
+	stats_free(&s);
+	return ok ? 0 : 1;
+}
+#endif
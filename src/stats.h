@@ -0,0 +1,115 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Offline aggregator of logged query statistics
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// Maximum number of concurrently logging processes tracked
+#define MAX_PROCESSES 64
+
+// Maximum number of distinct logged request prefixes tracked
+#define MAX_PREFIXES 64
+
+// The log records that matter for the statistics
+enum event_type {
+	EV_TIMESTAMP,		// Time and origin of the following record
+	EV_REQUEST,
+	EV_RESPONSE,
+	EV_TRACE,		// A query traced through the [trace] file
+	EV_PREFIX,		// Defines the prefix of the following request
+};
+
+typedef struct {
+	enum event_type type;
+	double time;		// Timestamp: seconds since the epoch
+	int pid;		// Timestamp: logging process; 0 if unknown
+	char program[32];	// Timestamp, trace
+	char backend[16];	// Request, trace
+	char model[64];		// Request
+	unsigned long long hash;	// Prefix; request referring to a prefix
+	long tokens_in, tokens_out, tokens_cached;	// Response
+	bool error, rate_limited;	// Response, trace
+	bool cancelled;		// Trace
+	double ms;		// Trace: query latency
+} event_t;
+
+// Events parsed from a part of the input, in input order
+typedef struct {
+	event_t *ev;
+	size_t n, allocated;
+} events_t;
+
+// Statistics of a backend, model, or program
+typedef struct {
+	char name[64];
+	long queries, responses, errors, rate_limited;
+	long tokens_in, tokens_out, tokens_cached;
+	double *latency;	// Response latencies (ms)
+	size_t nlatency, alatency;
+} group_t;
+
+enum dimension { DIM_ALL, DIM_BACKEND, DIM_MODEL, DIM_PROGRAM, NDIMENSIONS };
+
+// A process's request that awaits its response
+typedef struct {
+	int pid;
+	bool active;
+	double time;
+	char backend[16];
+	char model[64];
+	char program[32];
+} pending_t;
+
+// The backend and model of a request prefix logged once
+typedef struct {
+	unsigned long long hash;
+	char backend[16];
+	char model[64];
+} prefix_t;
+
+typedef struct {
+	group_t *groups[NDIMENSIONS];
+	size_t ngroups[NDIMENSIONS];
+	pending_t pending[MAX_PROCESSES];
+	int npending;
+	prefix_t prefixes[MAX_PREFIXES];
+	int nprefixes;
+	unsigned long long prefix;	// Hash of the following request's prefix
+	// Origin of the following record, from the last timestamp
+	double time;
+	int pid;
+	char program[32];
+} stats_t;
+
+#if defined(UNIT_TEST)
+const char *value_end(const char *p, const char *end);
+const char *next_record(const char *p, const char *end);
+double parse_timestamp(const char *s);
+void parse_records(const char *p, const char *end, events_t *events);
+const char *request_scan(const char *p, const char *end, event_t *e);
+void stats_add(stats_t *s, const event_t *e);
+group_t *group_get(stats_t *s, enum dimension d, const char *name);
+double percentile(const double *sorted, size_t n, int p);
+void stats_process(stats_t *s, const char *data, size_t len, int nthreads);
+void stats_report(stats_t *s, FILE *f);
+void stats_free(stats_t *s);
+#endif
@@ -0,0 +1,271 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test the offline aggregator of logged query statistics.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "CuTest.h"
+#include "stats.h"
+#include "support.h"
+
+// Two processes interleave their queries; the sqlite3 one is rate limited
+static const char log_data[] =
+	"{ \"timestamp\": \"2024-03-01T10:00:00.000000\", \"program\": \"bash\", \"pid\": 10 }\n"
+	"{\n  \"model\": \"gpt-4o\",\n  \"temperature\": 0.7,\n"
+	"  \"messages\": [\n    {\"role\": \"user\", \"content\": \"say \\\"}{\\\"\"}\n  ]\n}\n"
+	"{\"route\": {\"program\": \"bash\", \"api\": \"openai\"}}\n"
+	"{ \"timestamp\": \"2024-03-01T10:00:00.100000\", \"program\": \"sqlite3\", \"pid\": 20 }\n"
+	"{\n  \"model\": \"claude\",\n  \"max_tokens\": 256,\n  \"system\": \"x\",\n"
+	"  \"messages\": []\n}\n"
+	"{ \"timestamp\": \"2024-03-01T10:00:00.800000\", \"program\": \"bash\", \"pid\": 10 }\n"
+	"{\n  \"id\": \"x\",\n  \"object\": \"chat.completion\",\n"
+	"  \"usage\": {\n    \"prompt_tokens\": 100,\n    \"completion_tokens\": 10,\n"
+	"    \"prompt_tokens_details\": {\"cached_tokens\": 40}\n  }\n}\n"
+	"{ \"timestamp\": \"2024-03-01T10:00:01.000000\", \"program\": \"sqlite3\", \"pid\": 20 }\n"
+	"{\"type\":\"error\",\"error\":{\"type\":\"rate_limit_error\",\"message\":\"x\"}}"
+	"{ \"timestamp\": \"2024-03-01T10:00:02.000000\", \"program\": \"bash\", \"pid\": 10 }\n"
+	"{\n  \"model\": \"qwen\",\n  \"stream\": true,\n  \"messages\": []\n}\n"
+	"{ \"timestamp\": \"2024-03-01T10:00:02.300000\", \"program\": \"bash\", \"pid\": 10 }\n"
+	"ls -l\n";
+
+static void
+test_value_end(CuTest *tc)
+{
+	const char *s = "{\"a\": \"}{\\\"\\\\\", \"b\": [1, {}]} tail";
+	CuAssertStrEquals(tc, " tail", value_end(s, s + strlen(s)));
+
+	s = "{\"a\": 1";
+	CuAssertPtrEquals(tc, NULL, (void *)value_end(s, s + strlen(s)));
+
+	// A damaged record ends at the start of the next one
+	s = "{ damaged\n{\"a\": 1}";
+	CuAssertPtrEquals(tc, NULL, (void *)value_end(s, s + strlen(s)));
+	CuAssertStrEquals(tc, "{\"a\": 1}", next_record(s, s + strlen(s)));
+}
+
+static void
+test_request_scan(CuTest *tc)
+{
+	event_t e;
+	const char *s;
+
+	s = "{\n  \"model\": \"gpt-4o\",\n  \"messages\": [{\"content\": \"}\"}]\n} x";
+	CuAssertStrEquals(tc, " x", request_scan(s, s + strlen(s), &e));
+	CuAssertIntEquals(tc, EV_REQUEST, e.type);
+	CuAssertStrEquals(tc, "openai", e.backend);
+	CuAssertStrEquals(tc, "gpt-4o", e.model);
+
+	s = "{\"model\": \"claude\", \"max_tokens\": 9, \"system\": \"s\", \"messages\": []}";
+	CuAssertPtrNotNull(tc, request_scan(s, s + strlen(s), &e));
+	CuAssertStrEquals(tc, "anthropic", e.backend);
+
+	s = "{\"prompt\": \"User: ls\\n\"}";
+	CuAssertPtrNotNull(tc, request_scan(s, s + strlen(s), &e));
+	CuAssertStrEquals(tc, "llamacpp", e.backend);
+	CuAssertStrEquals(tc, "", e.model);
+
+	s = "{\"model\": \"qwen\", \"stream\": true, \"messages\": []}";
+	CuAssertPtrNotNull(tc, request_scan(s, s + strlen(s), &e));
+	CuAssertStrEquals(tc, "ollama", e.backend);
+
+	// Responses are not requests
+	s = "{\"id\": \"x\", \"object\": \"chat.completion\"}";
+	CuAssertPtrEquals(tc, NULL, (void *)request_scan(s, s + strlen(s), &e));
+}
+
+static void
+test_parse_timestamp(CuTest *tc)
+{
+	double t0 = parse_timestamp("2024-03-01T10:59:59.250000");
+	double t1 = parse_timestamp("2024-03-01T11:00:00.750000");
+
+	CuAssertTrue(tc, t0 > 0);
+	CuAssertDblEquals(tc, 1.5, t1 - t0, 1e-6);
+	CuAssertDblEquals(tc, 0, parse_timestamp("yesterday"), 0);
+}
+
+static void
+test_parse_records(CuTest *tc)
+{
+	static const enum event_type expected[] = {
+		EV_TIMESTAMP, EV_REQUEST, EV_TIMESTAMP, EV_REQUEST,
+		EV_TIMESTAMP, EV_RESPONSE, EV_TIMESTAMP, EV_RESPONSE,
+		EV_TIMESTAMP, EV_REQUEST, EV_TIMESTAMP, EV_RESPONSE,
+	};
+	events_t events = {0};
+
+	parse_records(log_data, log_data + sizeof(log_data) - 1, &events);
+	CuAssertIntEquals(tc, sizeof(expected) / sizeof(expected[0]), events.n);
+	for (size_t i = 0; i < events.n; i++)
+		CuAssertIntEquals(tc, expected[i], events.ev[i].type);
+	CuAssertIntEquals(tc, 20, events.ev[2].pid);
+	CuAssertStrEquals(tc, "sqlite3", events.ev[2].program);
+	CuAssertIntEquals(tc, 100, events.ev[5].tokens_in);
+	CuAssertIntEquals(tc, 40, events.ev[5].tokens_cached);
+	CuAssertTrue(tc, events.ev[7].error);
+	CuAssertTrue(tc, events.ev[7].rate_limited);
+	free(events.ev);
+}
+
+static void
+test_stats(CuTest *tc)
+{
+	stats_t s = {0};
+	group_t *g;
+
+	stats_process(&s, log_data, sizeof(log_data) - 1, 1);
+
+	g = group_get(&s, DIM_ALL, "all");
+	CuAssertIntEquals(tc, 3, g->queries);
+	CuAssertIntEquals(tc, 3, g->responses);
+	CuAssertIntEquals(tc, 1, g->errors);
+	CuAssertIntEquals(tc, 1, g->rate_limited);
+	// Error responses don't count toward the latency
+	CuAssertIntEquals(tc, 2, g->nlatency);
+
+	g = group_get(&s, DIM_BACKEND, "openai");
+	CuAssertIntEquals(tc, 1, g->queries);
+	CuAssertIntEquals(tc, 100, g->tokens_in);
+	CuAssertIntEquals(tc, 10, g->tokens_out);
+	CuAssertIntEquals(tc, 40, g->tokens_cached);
+	CuAssertIntEquals(tc, 1, g->nlatency);
+	CuAssertDblEquals(tc, 800, g->latency[0], 1e-3);
+
+	g = group_get(&s, DIM_MODEL, "qwen");
+	CuAssertDblEquals(tc, 300, g->latency[0], 1e-3);
+
+	g = group_get(&s, DIM_PROGRAM, "sqlite3");
+	CuAssertIntEquals(tc, 1, g->queries);
+	CuAssertIntEquals(tc, 1, g->rate_limited);
+	g = group_get(&s, DIM_PROGRAM, "bash");
+	CuAssertIntEquals(tc, 2, g->queries);
+	stats_free(&s);
+}
+
+static void
+test_trace(CuTest *tc)
+{
+	static const char trace[] =
+	    "{\"time\": 1.0, \"program\": \"bash\", \"kind\": \"query\", "
+	    "\"api\": \"llamacpp\", \"status\": \"ok\", \"ms\": 120.5, \"spans\": []}\n"
+	    "{\"time\": 2.0, \"program\": \"bash\", \"kind\": \"query\", "
+	    "\"api\": \"llamacpp\", \"status\": \"error\", \"ms\": 3, \"spans\": []}\n";
+	stats_t s = {0};
+
+	stats_process(&s, trace, sizeof(trace) - 1, 1);
+	group_t *g = group_get(&s, DIM_BACKEND, "llamacpp");
+	CuAssertIntEquals(tc, 2, g->queries);
+	CuAssertIntEquals(tc, 1, g->errors);
+	CuAssertIntEquals(tc, 1, g->nlatency);
+	CuAssertDblEquals(tc, 120.5, g->latency[0], 1e-3);
+	stats_free(&s);
+}
+
+// Requests referring to a logged prefix take its backend and model
+static void
+test_prefix(CuTest *tc)
+{
+	static const char prefixed[] =
+	    "{ \"prefix\": \"00000000000000ab\", \"length\": 30 }\n"
+	    "{ \"timestamp\": \"2024-03-01T10:00:00.000000\", \"program\": \"bash\", \"pid\": 10 }\n"
+	    "{\n  \"model\": \"claude\",\n  \"max_tokens\": 256,\n  \"system\": \"x\",\n"
+	    "  \"messages\": []\n}\n"
+	    "{ \"timestamp\": \"2024-03-01T10:00:00.500000\", \"program\": \"bash\", \"pid\": 10 }\n"
+	    "{\"id\": \"x\", \"type\": \"message\"}\n"
+	    "{ \"timestamp\": \"2024-03-01T10:00:01.000000\", \"program\": \"bash\", \"pid\": 10 }\n"
+	    "{ \"request\": \"00000000000000ab\", \"suffix\": \"]}\\n\" }\n"
+	    "{ \"timestamp\": \"2024-03-01T10:00:01.250000\", \"program\": \"bash\", \"pid\": 10 }\n"
+	    "{\"id\": \"y\", \"type\": \"message\"}\n";
+	stats_t s = {0};
+	event_t e;
+
+	const char *p = prefixed;
+	CuAssertPtrNotNull(tc, request_scan(p, p + strlen(p), &e));
+	CuAssertIntEquals(tc, EV_PREFIX, e.type);
+	CuAssertTrue(tc, e.hash == 0xab);
+
+	stats_process(&s, prefixed, sizeof(prefixed) - 1, 1);
+	group_t *g = group_get(&s, DIM_MODEL, "claude");
+	CuAssertIntEquals(tc, 2, g->queries);
+	CuAssertIntEquals(tc, 2, g->nlatency);
+	CuAssertDblEquals(tc, 250, g->latency[1], 1e-3);
+	g = group_get(&s, DIM_BACKEND, "anthropic");
+	CuAssertIntEquals(tc, 2, g->responses);
+	stats_free(&s);
+}
+
+static void
+test_percentile(CuTest *tc)
+{
+	double v[100];
+
+	for (int i = 0; i < 100; i++)
+		v[i] = i + 1;
+	CuAssertDblEquals(tc, 50, percentile(v, 100, 50), 0);
+	CuAssertDblEquals(tc, 99, percentile(v, 100, 99), 0);
+	CuAssertDblEquals(tc, 1, percentile(v, 1, 0), 0);
+	CuAssertDblEquals(tc, 2, percentile(v, 3, 50), 0);
+}
+
+// Parallel parsing yields the same statistics as sequential parsing
+static void
+test_threads(CuTest *tc)
+{
+	string_t data;
+	stats_t s1 = {0}, s4 = {0};
+
+	acl_string_init(&data, "");
+	while (data.len < 4 * 1024 * 1024)
+		acl_string_append(&data, log_data);
+
+	stats_process(&s1, data.ptr, data.len, 1);
+	stats_process(&s4, data.ptr, data.len, 4);
+	for (int d = 0; d < NDIMENSIONS; d++) {
+		CuAssertIntEquals(tc, s1.ngroups[d], s4.ngroups[d]);
+		for (size_t i = 0; i < s1.ngroups[d]; i++) {
+			group_t *g = group_get(&s4, d, s1.groups[d][i].name);
+			CuAssertIntEquals(tc, s1.groups[d][i].queries, g->queries);
+			CuAssertIntEquals(tc, s1.groups[d][i].errors, g->errors);
+			CuAssertIntEquals(tc, s1.groups[d][i].tokens_in, g->tokens_in);
+			CuAssertIntEquals(tc, s1.groups[d][i].nlatency, g->nlatency);
+		}
+	}
+	stats_free(&s1);
+	stats_free(&s4);
+	free(data.ptr);
+}
+
+CuSuite*
+cu_stats_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_value_end);
+	SUITE_ADD_TEST(suite, test_request_scan);
+	SUITE_ADD_TEST(suite, test_parse_timestamp);
+	SUITE_ADD_TEST(suite, test_parse_records);
+	SUITE_ADD_TEST(suite, test_stats);
+	SUITE_ADD_TEST(suite, test_trace);
+	SUITE_ADD_TEST(suite, test_prefix);
+	SUITE_ADD_TEST(suite, test_percentile);
+	SUITE_ADD_TEST(suite, test_threads);
+
+	return suite;
+}
@@ -25,6 +25,7 @@
 #include <errno.h>
 #include <dlfcn.h>
 #include <jansson.h>
+#include <pthread.h>
 #include <readline/readline.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -33,11 +34,26 @@
 #include <string.h>
 #include <sys/time.h>
 #include <time.h>
+#include <unistd.h>
 
+#include "candidates.h"
 #include "support.h"
+#include "trace.h"
 
-static FILE *logfile;
-CURL *acl_curl;
+// Each thread uses its own connection handle
+__thread CURL *acl_curl;
+
+/*
+ * Set in threads performing background queries to the flag through
+ * which they are cancelled.  Messages from these threads are suppressed.
+ */
+__thread atomic_bool *acl_cancel_flag;
+
+/*
+ * Set in threads performing background queries to a function that
+ * streaming backends call with the response received so far.
+ */
+__thread void (*acl_partial)(const char *response);
 
 // Exit with the specified formatted error message
 void
@@ -124,6 +140,29 @@ acl_strtocard(const char *string)
 	return (int)value;
 }
 
+// Return the value of a monotonic clock in milliseconds
+double
+acl_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Return the 64-bit FNV-1a hash of the specified data
+uint64_t
+acl_hash(const char *data, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (size_t i = 0; i < len; i++) {
+		h ^= (unsigned char)data[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
 // Initialize s as the specified string
 void
 acl_string_init(string_t *s, const char *value)
@@ -182,6 +221,36 @@ acl_string_appendf(string_t *s, const char *fmt, ...)
 	return result;
 }
 
+/*
+ * Append to s the specified string as a JSON string.
+ * Unlike acl_json_escape, this doesn't require Jansson, which not all
+ * backends load.
+ */
+void
+acl_string_append_json(string_t *s, const char *str)
+{
+	acl_string_append(s, "\"");
+	for (;;) {
+		// Copy verbatim the run of characters needing no escape
+		size_t n = 0;
+		while (str[n] && str[n] != '"' && str[n] != '\\' &&
+		    (unsigned char)str[n] >= ' ')
+			n++;
+		acl_string_write((void *)str, 1, n, s);
+		str += n;
+		if (!*str)
+			break;
+		if (*str == '"' || *str == '\\')
+			acl_string_appendf(s, "\\%c", *str);
+		else if (*str == '\n')
+			acl_string_append(s, "\\n");
+		else
+			acl_string_appendf(s, "\\u%04x", *str);
+		str++;
+	}
+	acl_string_append(s, "\"");
+}
+
 // Return the short name of the program being used
 const char *
 acl_short_program_name(void)
@@ -199,6 +268,13 @@ acl_short_program_name(void)
 	return name;
 }
 
+// Return true if the calling thread's query has been cancelled
+bool
+acl_cancelled(void)
+{
+	return acl_cancel_flag && atomic_load(acl_cancel_flag);
+}
+
 // Show a message during readline processing
 int
 acl_readline_printf(const char *fmt, ...)
@@ -206,6 +282,10 @@ acl_readline_printf(const char *fmt, ...)
 	int result;
 	va_list args;
 
+	// Don't disturb the user with messages of background queries
+	if (acl_cancel_flag)
+		return 0;
+
 	va_start(args, fmt);
 	rl_save_prompt();
 	result = vprintf(fmt, args);
@@ -224,8 +304,8 @@ acl_readline_printf(const char *fmt, ...)
 char *
 acl_json_escape(const char *s)
 {
-	static json_t *string;
-	static char *result;
+	static __thread json_t *string;
+	static __thread char *result;
 
 	if (string)
 		json_decref(string);
@@ -237,28 +317,32 @@ acl_json_escape(const char *s)
 	return result;
 }
 
-// Output an ISO timestamp (with microseconds) to the specified file
-static void
-timestamp(FILE *f)
+/*
+ * Abort the transfer of a cancelled query.
+ * Called by libcurl at least once per second and whenever data arrives.
+ */
+static int
+transfer_progress(void *data, curl_off_t dltotal, curl_off_t dlnow,
+    curl_off_t ultotal, curl_off_t ulnow)
 {
-	struct timeval tv;
-	char buffer[30];
-	struct tm *tm_info;
-
-	gettimeofday(&tv, NULL);
-	tm_info = localtime(&tv.tv_sec);
-
-	strftime(buffer, 26, "%Y-%m-%dT%H:%M:%S", tm_info);
-	fprintf(f, "{ \"timestamp\": \"%s.%06ld\" }\n", buffer, (long)tv.tv_usec);
+	return acl_cancelled();
 }
 
 /*
- * Initialize Curl connections
+ * Load the JSON library and open the log file.
+ * Can be called before each query; only the first call performs
+ * the initialization.
  * Return 0 on success -1 on error
  */
 int
-curl_initialize(config_t *config)
+acl_json_initialize(config_t *config)
 {
+	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	static int result = 1;
+
+	pthread_mutex_lock(&lock);
+	if (result == 1) {
+		result = 0;
 /*
  * Under Linux link at runtime (late binding) to minimize linking cost
  * (binding will only be performed by programs that use readline)
@@ -266,36 +350,137 @@ curl_initialize(config_t *config)
  *
  * Under Cygwin link at compile time, because late binding isn't supported.
  */
+#if !defined(__CYGWIN__)
+		if (!dlopen("libjansson." DLL_EXTENSION, RTLD_NOW | RTLD_GLOBAL)) {
+			acl_readline_printf("\nError loading libjansson: %s\n", dlerror());
+			result = -1;
+		}
+#endif
+	}
+	pthread_mutex_unlock(&lock);
+	return result;
+}
+
+/*
+ * Load and initialize the libraries used for Curl connections.
+ * Return 0 on success -1 on error
+ */
+static int
+curl_global_initialize(config_t *config)
+{
+	// See acl_json_initialize regarding late binding
 #if !defined(__CYGWIN__)
 	if (!dlopen("libcurl." DLL_EXTENSION, RTLD_NOW | RTLD_GLOBAL)) {
 		acl_readline_printf("\nError loading libcurl: %s\n", dlerror());
 		return -1;
 	}
-	if (!dlopen("libjansson." DLL_EXTENSION, RTLD_NOW | RTLD_GLOBAL)) {
-		acl_readline_printf("\nError loading libjansson: %s\n", dlerror());
-		return -1;
-	}
 #endif
-
-	if (config->general_logfile)
-		logfile = fopen(config->general_logfile, "a");
+	if (acl_json_initialize(config) < 0)
+		return -1;
 
 	curl_global_init(CURL_GLOBAL_DEFAULT);
+	return 0;
+}
+
+/*
+ * Initialize Curl connections for the calling thread.
+ * Can be called before each query; only the first call in
+ * a thread performs the initialization.
+ * Return 0 on success -1 on error
+ */
+int
+curl_initialize(config_t *config)
+{
+	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	static bool loaded;
+
+	if (acl_curl)
+		return 0;
+
+	pthread_mutex_lock(&lock);
+	if (!loaded)
+		loaded = curl_global_initialize(config) == 0;
+	pthread_mutex_unlock(&lock);
+	if (!loaded)
+		return -1;
 
 	acl_curl = curl_easy_init();
-	if (!acl_curl)
+	if (!acl_curl) {
 		acl_readline_printf("\nCURL initialization failed.\n");
-	return acl_curl ? 0 : -1;
+		return -1;
+	}
+	curl_easy_setopt(acl_curl, CURLOPT_XFERINFOFUNCTION, transfer_progress);
+	curl_easy_setopt(acl_curl, CURLOPT_NOPROGRESS, 0L);
+	return 0;
 }
 
-// Write the specified string to the logfile, if enabled
-void
-acl_write_log(config_t *config, const char *message)
+/*
+ * Perform the request set up in acl_curl.  If more candidate responses
+ * are configured, concurrently perform copies of the request and add
+ * the content that get_content extracts from their responses to the
+ * query's candidates.
+ * Return the result of the request set up in acl_curl.
+ */
+CURLcode
+acl_curl_perform(config_t *config, char *(*get_content)(const char *))
 {
-	if (!logfile)
-		return;
-	if (config->general_timestamp)
-		timestamp(logfile);
-	fputs(message, logfile);
-	fflush(logfile);
+	int n = acl_candidates_wanted(config);
+	CURLM *multi = n > 1 ? curl_multi_init() : NULL;
+	if (!multi) {
+		CURLcode res = curl_easy_perform(acl_curl);
+		TRACE_CURL(acl_curl);
+		return res;
+	}
+
+	CURL *copy[MAX_CANDIDATES];
+	string_t response[MAX_CANDIDATES];
+	curl_multi_add_handle(multi, acl_curl);
+	for (int i = 1; i < n; i++) {
+		// Obtain fewer candidates if the request cannot be copied
+		if ((copy[i] = curl_easy_duphandle(acl_curl)) == NULL) {
+			n = i;
+			break;
+		}
+		acl_string_init(&response[i], "");
+		curl_easy_setopt(copy[i], CURLOPT_WRITEDATA, &response[i]);
+		curl_multi_add_handle(multi, copy[i]);
+	}
+
+	int running;
+	do {
+		if (curl_multi_perform(multi, &running) != CURLM_OK)
+			break;
+		if (running)
+			curl_multi_poll(multi, NULL, 0, 1000, NULL);
+	} while (running);
+
+	CURLcode res = CURLE_RECV_ERROR;
+	bool ok[MAX_CANDIDATES] = {false};
+	CURLMsg *msg;
+	int left;
+	while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+		if (msg->easy_handle == acl_curl)
+			res = msg->data.result;
+		for (int i = 1; i < n; i++)
+			if (msg->easy_handle == copy[i])
+				ok[i] = msg->data.result == CURLE_OK;
+	}
+
+	curl_multi_remove_handle(multi, acl_curl);
+	TRACE_CURL(acl_curl);
+	for (int i = 1; i < n; i++) {
+		curl_multi_remove_handle(multi, copy[i]);
+		curl_easy_cleanup(copy[i]);
+		if (ok[i] && res == CURLE_OK) {
+			char *content = get_content(response[i].ptr);
+			acl_candidates_add(content);
+			free(content);
+		}
+		free(response[i].ptr);
+	}
+	curl_multi_cleanup(multi);
+	return res;
 }
+
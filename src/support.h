@@ -20,12 +20,21 @@
  *  limitations under the License.
  */
 
+#pragma once
+
 #include <curl/curl.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #include "config.h"
 
-extern CURL *acl_curl;
+extern __thread CURL *acl_curl;
+extern __thread atomic_bool *acl_cancel_flag;
+extern __thread void (*acl_partial)(const char *response);
+
+// Backend function returning a response to the specified prompt
+typedef char *(*fetch_t)(config_t *config, const char *prompt, int history_length);
 
 int acl_safe_asprintf(char **strp, const char *fmt, ...);
 char *acl_safe_strdup(const char *s);
@@ -33,6 +42,8 @@ char *acl_range_strdup(const char *begin, const char *end);
 const char *acl_short_program_name(void);
 
 int acl_strtocard(const char *string);
+double acl_now_ms(void);
+uint64_t acl_hash(const char *data, size_t len);
 
 // Extendable string
 typedef struct string {
@@ -47,6 +58,9 @@ void acl_string_init(string_t *s, const char *value);
 size_t acl_string_write(void *data, size_t size, size_t nmemb, string_t *s);
 size_t acl_string_append(string_t *s, const char *data);
 int acl_string_appendf(string_t *s, const char *fmt, ...);
+void acl_string_append_json(string_t *s, const char *str);
+int acl_json_initialize(config_t *config);
 int curl_initialize(config_t *config);
-void acl_write_log(config_t *config, const char *message);
+CURLcode acl_curl_perform(config_t *config, char *(*get_content)(const char *));
 void acl_errorf(const char *format, ...);
+bool acl_cancelled(void);
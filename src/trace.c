@@ -0,0 +1,251 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Per-query latency tracing.
+ *  The spans of each query, such as request building, the phases of
+ *  the HTTP transfer, and response parsing, are written as a JSON
+ *  line and as Chrome trace events, which can be viewed in Perfetto.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "config.h"
+#include "support.h"
+#include "trace.h"
+
+// Maximum number of spans recorded for a query
+#define MAX_SPANS 32
+
+// Set when a trace file is configured
+bool acl_trace_enabled;
+
+// Trace output files; -1 if not configured
+static int jsonl_fd = -1;
+static int chrome_fd = -1;
+
+typedef struct {
+	const char *name;	// Static string
+	double start, end;	// Monotonic clock time (ms)
+} span_t;
+
+// The query being traced by the calling thread
+static __thread struct {
+	bool active;
+	const char *kind;	// E.g. query or background
+	double start;		// Monotonic clock time (ms)
+	double epoch_start;	// Wall clock time (ms since the epoch)
+	int nspans;
+	span_t spans[MAX_SPANS];
+} t;
+
+// Open the specified trace file for appending; return -1 on error
+static int
+open_trace(const char *path, bool chrome)
+{
+	// Only the file's creator starts the Chrome event array
+	int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd != -1) {
+		if (chrome && write(fd, "[\n", 2) != 2) {
+			close(fd);
+			fd = -1;
+		}
+	} else if (errno == EEXIST)
+		fd = open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+	if (fd == -1)
+		fprintf(stderr, "Unable to open trace file %s: %s\n", path,
+		    strerror(errno));
+	return fd;
+}
+
+/*
+ * Enable tracing if trace files are configured, closing any files
+ * previously used.  Call while no tracing takes place.
+ */
+void
+acl_trace_initialize(config_t *config)
+{
+	acl_trace_enabled = false;
+	if (jsonl_fd != -1)
+		close(jsonl_fd);
+	if (chrome_fd != -1)
+		close(chrome_fd);
+	jsonl_fd = chrome_fd = -1;
+
+	if (config->trace_file_set)
+		jsonl_fd = open_trace(config->trace_file, false);
+	if (config->trace_chrome_set)
+		chrome_fd = open_trace(config->trace_chrome, true);
+	acl_trace_enabled = jsonl_fd != -1 || chrome_fd != -1;
+}
+
+/*
+ * Start tracing a query of the specified kind in the calling thread.
+ * The kind must be a static string.
+ */
+void
+acl_trace_begin(const char *kind)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	t.active = true;
+	t.kind = kind;
+	t.start = acl_now_ms();
+	t.epoch_start = ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+	t.nspans = 0;
+}
+
+/*
+ * Record the named span of the query being traced, which took place
+ * between the specified monotonic clock times.
+ * The name must be a static string.
+ */
+void
+acl_trace_span(const char *name, double start, double end)
+{
+	if (!t.active || t.nspans == MAX_SPANS)
+		return;
+	t.spans[t.nspans].name = name;
+	t.spans[t.nspans].start = start;
+	t.spans[t.nspans].end = end;
+	t.nspans++;
+}
+
+// Return the curl transfer time specified by info in ms
+static double
+curl_time(CURL *curl, CURLINFO info)
+{
+	curl_off_t us = 0;
+
+	curl_easy_getinfo(curl, info, &us);
+	return us / 1e3;
+}
+
+/*
+ * Record the phases of the transfer just completed by the specified
+ * curl handle.  The times curl reports are relative to the
+ * transfer's start; phases not taking place, such as the lookup and
+ * connection of a reused connection, are reported as zero.
+ */
+void
+acl_trace_curl(CURL *curl)
+{
+	double end = acl_now_ms();
+	double lookup = curl_time(curl, CURLINFO_NAMELOOKUP_TIME_T);
+	double connect = curl_time(curl, CURLINFO_CONNECT_TIME_T);
+	double tls = curl_time(curl, CURLINFO_APPCONNECT_TIME_T);
+	double pretransfer = curl_time(curl, CURLINFO_PRETRANSFER_TIME_T);
+	double first_byte = curl_time(curl, CURLINFO_STARTTRANSFER_TIME_T);
+	double total = curl_time(curl, CURLINFO_TOTAL_TIME_T);
+	double start = end - total;
+
+	if (lookup > 0)
+		acl_trace_span("dns", start, start + lookup);
+	if (connect > lookup)
+		acl_trace_span("connect", start + lookup, start + connect);
+	if (tls > connect)
+		acl_trace_span("tls", start + connect, start + tls);
+	// Time to the first byte: request upload, queueing, generation
+	if (first_byte > pretransfer)
+		acl_trace_span("wait", start + pretransfer, start + first_byte);
+	acl_trace_span("receive", start + first_byte, end);
+}
+
+// Return the operating system's identifier of the calling thread
+static long
+thread_id(void)
+{
+#if defined(__linux__)
+	return syscall(SYS_gettid);
+#else
+	return (long)(uintptr_t)pthread_self() & 0x7fffffff;
+#endif
+}
+
+/*
+ * Write out the trace of the calling thread's query, which was
+ * served by the specified fetch function and completed with the
+ * given status, e.g. "ok".
+ */
+void
+acl_trace_end(fetch_t fetch, const char *status)
+{
+	if (!t.active)
+		return;
+	t.active = false;
+
+	double end = acl_now_ms();
+	const char *api = fetch ? acl_backend_name(fetch) : "none";
+	string_t s;
+
+	if (jsonl_fd != -1) {
+		acl_string_init(&s, "");
+		acl_string_appendf(&s, "{\"time\": %.3f, \"program\": ",
+		    t.epoch_start);
+		acl_string_append_json(&s, acl_short_program_name());
+		acl_string_appendf(&s, ", \"pid\": %d, \"kind\": \"%s\", "
+		    "\"api\": \"%s\", \"status\": \"%s\", \"ms\": %.3f, "
+		    "\"spans\": [", (int)getpid(), t.kind, api, status,
+		    end - t.start);
+		for (int i = 0; i < t.nspans; i++)
+			acl_string_appendf(&s, "%s{\"name\": \"%s\", "
+			    "\"start\": %.3f, \"ms\": %.3f}", i ? ", " : "",
+			    t.spans[i].name, t.spans[i].start - t.start,
+			    t.spans[i].end - t.spans[i].start);
+		acl_string_append(&s, "]}\n");
+		// A single append keeps the lines of concurrent writers intact
+		if (write(jsonl_fd, s.ptr, s.len) != (ssize_t)s.len)
+			acl_trace_enabled = false;
+		free(s.ptr);
+	}
+
+	if (chrome_fd != -1) {
+		// Complete events; times are in microseconds since the epoch
+		const char *event = "{\"name\": \"%s\", \"cat\": \"ai-cli\", "
+		    "\"ph\": \"X\", \"ts\": %.0f, \"dur\": %.0f, "
+		    "\"pid\": %d, \"tid\": %ld";
+		double base = t.epoch_start * 1e3;
+		long tid = thread_id();
+
+		acl_string_init(&s, "");
+		acl_string_appendf(&s, event, t.kind, base,
+		    (end - t.start) * 1e3, (int)getpid(), tid);
+		acl_string_appendf(&s, ", \"args\": {\"api\": \"%s\", "
+		    "\"status\": \"%s\"}},\n", api, status);
+		for (int i = 0; i < t.nspans; i++) {
+			acl_string_appendf(&s, event, t.spans[i].name,
+			    base + (t.spans[i].start - t.start) * 1e3,
+			    (t.spans[i].end - t.spans[i].start) * 1e3,
+			    (int)getpid(), tid);
+			acl_string_append(&s, "},\n");
+		}
+		if (write(chrome_fd, s.ptr, s.len) != (ssize_t)s.len)
+			acl_trace_enabled = false;
+		free(s.ptr);
+	}
+}
@@ -0,0 +1,79 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Per-query latency tracing
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <curl/curl.h>
+
+#include "config.h"
+#include "probes.h"
+#include "support.h"
+
+extern bool acl_trace_enabled;
+
+/*
+ * Tracing is performed through the following macros, so that
+ * when it is disabled its cost is a test of a flag.
+ */
+
+// Start tracing a query of the specified kind in the calling thread
+#define TRACE_BEGIN(kind) do { \
+	if (acl_trace_enabled) \
+		acl_trace_begin(kind); \
+} while (0)
+
+/*
+ * Return the starting time of a span, or 0 if tracing is disabled.
+ * Probes report durations, so then the time is always obtained.
+ */
+#if defined(ACL_PROBES)
+#define TRACE_NOW() acl_now_ms()
+#else
+#define TRACE_NOW() (acl_trace_enabled ? acl_now_ms() : 0)
+#endif
+
+// Record a span that started at the specified time and ends now
+#define TRACE_SPAN(name, start) do { \
+	if (acl_trace_enabled) \
+		acl_trace_span(name, start, acl_now_ms()); \
+} while (0)
+
+/*
+ * Record the phases of the transfer just completed by a curl handle,
+ * and fire the first_byte probe.
+ */
+#define TRACE_CURL(curl) do { \
+	if (acl_trace_enabled) \
+		acl_trace_curl(curl); \
+	PROBE_FIRST_BYTE_CURL(curl); \
+} while (0)
+
+// Write out the query's trace, attributing it to the fetch function
+#define TRACE_END(fetch, status) do { \
+	if (acl_trace_enabled) \
+		acl_trace_end(fetch, status); \
+} while (0)
+
+void acl_trace_initialize(config_t *config);
+void acl_trace_begin(const char *kind);
+void acl_trace_span(const char *name, double start, double end);
+void acl_trace_curl(CURL *curl);
+void acl_trace_end(fetch_t fetch, const char *status);
@@ -0,0 +1,125 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test per-query latency tracing.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <jansson.h>
+
+#include "CuTest.h"
+#include "config.h"
+#include "trace.h"
+
+static const char jsonl_file[] = "test-trace.jsonl";
+static const char chrome_file[] = "test-trace.json";
+
+// Return the contents of the specified file
+static char *
+file_contents(const char *path)
+{
+	static char buffer[4096];
+
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return NULL;
+	size_t n = fread(buffer, 1, sizeof(buffer) - 1, f);
+	buffer[n] = '\0';
+	fclose(f);
+	return buffer;
+}
+
+static void
+test_trace(CuTest* tc)
+{
+	config_t config = {"bash"};
+
+	unlink(jsonl_file);
+	unlink(chrome_file);
+
+	// Nothing is recorded when tracing is disabled
+	acl_trace_initialize(&config);
+	CuAssertTrue(tc, !acl_trace_enabled);
+#if !defined(ACL_PROBES)
+	CuAssertTrue(tc, TRACE_NOW() == 0);
+#endif
+
+	config.trace_file = jsonl_file;
+	config.trace_file_set = true;
+	config.trace_chrome = chrome_file;
+	config.trace_chrome_set = true;
+	acl_trace_initialize(&config);
+	CuAssertTrue(tc, acl_trace_enabled);
+
+	TRACE_BEGIN("query");
+	double start = TRACE_NOW();
+	CuAssertTrue(tc, start > 0);
+	TRACE_SPAN("build", start);
+	acl_trace_span("wait", start + 1, start + 3);
+	TRACE_END(NULL, "ok");
+	// Spans outside a query are ignored
+	TRACE_SPAN("parse", start);
+	TRACE_END(NULL, "ok");
+
+	json_error_t error;
+	json_t *root = json_loads(file_contents(jsonl_file), 0, &error);
+	CuAssertPtrNotNull(tc, root);
+	CuAssertStrEquals(tc, "query", json_string_value(json_object_get(root, "kind")));
+	CuAssertStrEquals(tc, "none", json_string_value(json_object_get(root, "api")));
+	CuAssertStrEquals(tc, "ok", json_string_value(json_object_get(root, "status")));
+	json_t *spans = json_object_get(root, "spans");
+	CuAssertIntEquals(tc, 2, json_array_size(spans));
+	json_t *wait = json_array_get(spans, 1);
+	CuAssertStrEquals(tc, "wait", json_string_value(json_object_get(wait, "name")));
+	CuAssertDblEquals(tc, 2, json_real_value(json_object_get(wait, "ms")), 1e-9);
+	json_decref(root);
+
+	// The Chrome trace is an array of complete events, left open
+	char *chrome = file_contents(chrome_file);
+	CuAssertTrue(tc, strncmp(chrome, "[\n{\"name\": \"query\"", 18) == 0);
+	CuAssertTrue(tc, strstr(chrome, "\"ph\": \"X\"") != NULL);
+	strcpy(strrchr(chrome, ','), "]");
+	root = json_loads(chrome, 0, &error);
+	CuAssertIntEquals(tc, 3, json_array_size(root));
+	json_decref(root);
+
+	// Appending to an existing trace doesn't restart the array
+	acl_trace_initialize(&config);
+	TRACE_BEGIN("background");
+	TRACE_END(NULL, "cancelled");
+	chrome = file_contents(chrome_file);
+	CuAssertTrue(tc, strchr(chrome + 1, '[') == NULL);
+
+	// Disable tracing, closing the files
+	config.trace_file_set = config.trace_chrome_set = false;
+	acl_trace_initialize(&config);
+	unlink(jsonl_file);
+	unlink(chrome_file);
+}
+
+CuSuite*
+cu_trace_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_trace);
+
+	return suite;
+}
@@ -0,0 +1,431 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Token usage and cost accounting.
+ *  The backends report the token usage of each response they parse.
+ *  When a query completes, its usage and cost are added to the day's
+ *  entry for the API and model in a ledger file shared by all the
+ *  user's sessions.  Spending beyond the configured daily budgets
+ *  degrades queries to a cheaper model and then to local suggestions.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "probes.h"
+#include "support.h"
+#include "unit_test.h"
+#include "usage.h"
+
+static const char ledger_name[] = ".aicli-usage";
+
+static const char ledger_header[] = "# date api model queries tokens_in "
+    "tokens_out tokens_cached timed_tokens timed_ms cost tokens/s\n";
+
+// Usage of the responses of the query being made by this thread
+static __thread usage_t query_usage;
+
+// Ledger API under which this thread's queries are recorded, if not NULL
+static __thread const char *query_mark;
+
+/*
+ * Record this thread's subsequent queries under the specified marker,
+ * e.g. "speculative", instead of their API, or under their API if
+ * the marker is NULL.
+ */
+void
+acl_usage_mark(const char *marker)
+{
+	query_mark = marker;
+}
+
+// Add the usage reported in a response to that of the current query
+void
+acl_usage_add(const usage_t *u)
+{
+	query_usage.tokens_in += u->tokens_in;
+	query_usage.tokens_out += u->tokens_out;
+	query_usage.tokens_cached += u->tokens_cached;
+	query_usage.timed_tokens += u->timed_tokens;
+	query_usage.timed_ms += u->timed_ms;
+}
+
+/*
+ * Parse a price list entry "model:input/output" in place, setting
+ * the prices in USD per million input and output tokens.
+ * Return the entry's model, or NULL if the entry is invalid.
+ */
+static const char *
+price_parse(char *entry, double *in, double *out)
+{
+	char *colon = strrchr(entry, ':');
+
+	if (!colon || colon == entry ||
+	    sscanf(colon + 1, "%lf/%lf", in, out) != 2)
+		return NULL;
+	*colon = '\0';
+	return entry;
+}
+
+/*
+ * Return the cost in USD of the specified usage of the model, given
+ * the list of model prices, e.g. "gpt-4o:2.5/10, gpt-4o-mini:0.15/0.6".
+ * Unlisted models cost nothing.
+ */
+STATIC double
+price_cost(const char *prices, const char *model, const usage_t *u)
+{
+	double cost = 0;
+
+	if (!prices)
+		return 0;
+	char *list = acl_safe_strdup(prices);
+	char *saveptr;
+	for (char *p = strtok_r(list, ", \t", &saveptr); p;
+	    p = strtok_r(NULL, ", \t", &saveptr)) {
+		double in, out;
+		const char *name = price_parse(p, &in, &out);
+		if (name && strcmp(name, model) == 0) {
+			cost = (u->tokens_in * in + u->tokens_out * out) / 1e6;
+			break;
+		}
+	}
+	free(list);
+	return cost;
+}
+
+/*
+ * Verify the usage accounting configuration, warning about invalid
+ * prices, which are ignored.
+ */
+void
+acl_usage_initialize(config_t *config)
+{
+	if (!config->usage_prices_set)
+		return;
+	char *list = acl_safe_strdup(config->usage_prices);
+	char *saveptr;
+	for (char *p = strtok_r(list, ", \t", &saveptr); p;
+	    p = strtok_r(NULL, ", \t", &saveptr)) {
+		double in, out;
+		if (!price_parse(p, &in, &out))
+			fprintf(stderr, "\nai_cli: Ignoring invalid price `%s' "
+			    "in [usage] prices; expected model:input/output.\n",
+			    p);
+	}
+	free(list);
+}
+
+/*
+ * Parse the ledger's contents s into at most max entries.
+ * Return the number of entries parsed.
+ */
+STATIC int
+ledger_parse(const char *s, ledger_entry_t *entries, int max)
+{
+	int n = 0;
+
+	for (; *s && n < max; s += strcspn(s, "\n"), s += *s == '\n') {
+		ledger_entry_t *e = &entries[n];
+		memset(e, 0, sizeof(*e));
+		if (sscanf(s, "%10s %15s %63s %ld %ld %ld %ld %ld %lf %lf",
+		    e->date, e->api, e->model, &e->queries,
+		    &e->usage.tokens_in, &e->usage.tokens_out,
+		    &e->usage.tokens_cached, &e->usage.timed_tokens,
+		    &e->usage.timed_ms, &e->cost) == 10 && *s != '#')
+			n++;
+	}
+	return n;
+}
+
+// Return the ledger file's path in dynamically allocated memory, or NULL
+static char *
+ledger_path(config_t *config)
+{
+	char *path;
+
+	if (config->usage_file_set)
+		path = acl_safe_strdup(config->usage_file);
+	else if (getenv("HOME"))
+		acl_safe_asprintf(&path, "%s/%s", getenv("HOME"), ledger_name);
+	else
+		return NULL;
+	return path;
+}
+
+/*
+ * Open the ledger file at path and lock it through the specified
+ * flock operation.  Retry if the file was replaced while waiting
+ * for the lock.  Return its descriptor or -1 on failure.
+ */
+static int
+open_ledger(const char *path, int operation)
+{
+	for (;;) {
+		int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		if (fd == -1)
+			return -1;
+		if (flock(fd, operation) == -1) {
+			close(fd);
+			return -1;
+		}
+
+		struct stat fd_st, path_st;
+		if (fstat(fd, &fd_st) == -1 || stat(path, &path_st) == -1
+		    || (fd_st.st_dev == path_st.st_dev
+		    && fd_st.st_ino == path_st.st_ino))
+			return fd;
+		close(fd);
+	}
+}
+
+/*
+ * Read the ledger from the open file descriptor fd into entries.
+ * Return the number of entries read.
+ */
+static int
+read_ledger(int fd, ledger_entry_t *entries)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) != 0)
+		return 0;
+	char *buff = malloc(st.st_size + 1);
+	if (!buff)
+		return 0;
+	ssize_t n = pread(fd, buff, st.st_size, 0);
+	buff[n > 0 ? n : 0] = '\0';
+	int result = ledger_parse(buff, entries, MAX_LEDGER);
+	free(buff);
+	return result;
+}
+
+/*
+ * Replace the ledger file at path with one holding the n entries.
+ * The entries are written to a temporary file renamed over the
+ * ledger, so that a crash cannot leave it empty.
+ * Return true on success.
+ */
+static bool
+write_ledger(const char *path, const ledger_entry_t *entries, int n)
+{
+	string_t s;
+
+	acl_string_init(&s, ledger_header);
+	for (int i = 0; i < n; i++) {
+		const ledger_entry_t *e = &entries[i];
+		const usage_t *u = &e->usage;
+		acl_string_appendf(&s, "%s %s %s %ld %ld %ld %ld %ld %.1f %.6f "
+		    "%.1f\n", e->date, e->api, e->model, e->queries,
+		    u->tokens_in, u->tokens_out, u->tokens_cached,
+		    u->timed_tokens, u->timed_ms, e->cost,
+		    u->timed_ms ? u->timed_tokens * 1e3 / u->timed_ms : 0);
+	}
+	char *tmp_path;
+	acl_safe_asprintf(&tmp_path, "%s.XXXXXX", path);
+	int fd = mkstemp(tmp_path);
+	bool result = fd != -1 && write(fd, s.ptr, s.len) == (ssize_t)s.len
+	    && fsync(fd) == 0;
+	if (fd != -1 && close(fd) != 0)
+		result = false;
+	if (result)
+		result = rename(tmp_path, path) == 0;
+	if (!result && fd != -1)
+		unlink(tmp_path);
+	free(tmp_path);
+	free(s.ptr);
+	return result;
+}
+
+// Set today to the current date as YYYY-MM-DD
+static void
+get_today(char today[11])
+{
+	time_t now = time(NULL);
+	struct tm tm;
+
+	strftime(today, 11, "%Y-%m-%d", localtime_r(&now, &tm));
+}
+
+/*
+ * Add the usage of the query just completed through the specified API
+ * (or the thread's marker) and model to the ledger, and reset it for
+ * the next query.
+ */
+void
+acl_usage_record(config_t *config, const char *api, const char *model)
+{
+	usage_t u = query_usage;
+
+	memset(&query_usage, 0, sizeof(query_usage));
+	if (query_mark)
+		api = query_mark;
+	PROBE_PROMPT_CACHE(api, u.tokens_in, u.tokens_cached);
+	if (!config->usage_enabled)
+		return;
+	if (!model || !*model)
+		model = "-";
+
+	char *path = ledger_path(config);
+	int fd = path ? open_ledger(path, LOCK_EX) : -1;
+	ledger_entry_t *entries = fd == -1 ? NULL :
+	    calloc(MAX_LEDGER, sizeof(ledger_entry_t));
+	if (!entries) {
+		if (path)
+			acl_readline_printf("\nUnable to record the query's "
+			    "usage in %s.\n", path);
+		if (fd != -1)
+			close(fd);
+		free(path);
+		return;
+	}
+
+	int n = read_ledger(fd, entries);
+	char today[11];
+	get_today(today);
+	ledger_entry_t *e = NULL;
+	for (int i = 0; i < n; i++)
+		if (strcmp(entries[i].date, today) == 0 &&
+		    strcmp(entries[i].api, api) == 0 &&
+		    strcmp(entries[i].model, model) == 0)
+			e = &entries[i];
+	if (!e) {
+		// Drop the oldest entry when the ledger is full
+		if (n == MAX_LEDGER)
+			memmove(entries, entries + 1, --n * sizeof(*entries));
+		e = &entries[n++];
+		memset(e, 0, sizeof(*e));
+		snprintf(e->date, sizeof(e->date), "%s", today);
+		snprintf(e->api, sizeof(e->api), "%s", api);
+		snprintf(e->model, sizeof(e->model), "%s", model);
+	}
+	e->queries++;
+	e->usage.tokens_in += u.tokens_in;
+	e->usage.tokens_out += u.tokens_out;
+	e->usage.tokens_cached += u.tokens_cached;
+	e->usage.timed_tokens += u.timed_tokens;
+	e->usage.timed_ms += u.timed_ms;
+	e->cost += price_cost(config->usage_prices_set ?
+	    config->usage_prices : NULL, model, &u);
+	if (!write_ledger(path, entries, n))
+		acl_readline_printf("\nUnable to update the usage ledger %s.\n",
+		    path);
+	// Closing the descriptor releases the lock
+	close(fd);
+	free(path);
+
+	if (config->general_verbose)
+		fprintf(stderr, "\n%s %s: %ld tokens in, %ld out, %ld cached; "
+		    "%.1f tokens/s; %.4f USD today\n", api, model,
+		    u.tokens_in, u.tokens_out, u.tokens_cached,
+		    u.timed_ms ? u.timed_tokens * 1e3 / u.timed_ms : 0, e->cost);
+	free(entries);
+}
+
+/*
+ * Add to u the usage of the queries recorded today through the
+ * specified API, or all APIs if it is NULL, and return their cost in USD.
+ */
+static double
+today_usage(config_t *config, const char *api, usage_t *u)
+{
+	char *path = ledger_path(config);
+	int fd = path ? open_ledger(path, LOCK_SH) : -1;
+	free(path);
+	if (fd == -1)
+		return 0;
+	ledger_entry_t *entries = calloc(MAX_LEDGER, sizeof(ledger_entry_t));
+	if (!entries) {
+		close(fd);
+		return 0;
+	}
+	int n = read_ledger(fd, entries);
+	close(fd);
+
+	char today[11];
+	get_today(today);
+	double cost = 0;
+	for (int i = 0; i < n; i++)
+		if (strcmp(entries[i].date, today) == 0
+		    && (!api || strcmp(entries[i].api, api) == 0)) {
+			u->tokens_in += entries[i].usage.tokens_in;
+			u->tokens_out += entries[i].usage.tokens_out;
+			cost += entries[i].cost;
+		}
+	free(entries);
+	return cost;
+}
+
+// Return the cost in USD of all queries recorded today
+double
+acl_usage_today_cost(config_t *config)
+{
+	usage_t u = {0};
+
+	return today_usage(config, NULL, &u);
+}
+
+// Return the input and output tokens recorded today through the API
+long
+acl_usage_today_tokens(config_t *config, const char *api)
+{
+	usage_t u = {0};
+
+	today_usage(config, api, &u);
+	return u.tokens_in + u.tokens_out;
+}
+
+// Return the state of today's spending relative to the daily budgets
+budget_t
+acl_usage_budget(config_t *config)
+{
+	if (!config->usage_enabled ||
+	    (!config->usage_soft_budget_set && !config->usage_hard_budget_set))
+		return BUDGET_OK;
+
+	double cost = acl_usage_today_cost(config);
+	if (config->usage_hard_budget_set && cost >= config->usage_hard_budget)
+		return BUDGET_HARD;
+	if (config->usage_soft_budget_set && cost >= config->usage_soft_budget)
+		return BUDGET_SOFT;
+	return BUDGET_OK;
+}
+
+/*
+ * Return the configuration for a query through the specified API
+ * beyond the soft budget: the supplied one with the API's model
+ * replaced by the cheaper one, set up in copy.
+ */
+config_t *
+acl_usage_degrade(config_t *config, config_t *copy, const char *api)
+{
+	if (!config->usage_soft_model_set)
+		return config;
+	*copy = *config;
+	if (!acl_config_model_set(copy, api, config->usage_soft_model))
+		return config;
+	return copy;
+}
@@ -0,0 +1,69 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Token usage and cost accounting
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "config.h"
+
+// Maximum number of ledger entries (day, API, and model combinations)
+#define MAX_LEDGER 1024
+
+// Token usage reported in an API response
+typedef struct {
+	long tokens_in;		// Prompt tokens, including cached ones
+	long tokens_out;	// Generated tokens
+	long tokens_cached;	// Prompt tokens served from a cache
+	long timed_tokens;	// Generated tokens with a known duration
+	double timed_ms;	// Time spent generating them
+} usage_t;
+
+// A day's usage of an API's model, as kept in the ledger file
+typedef struct {
+	char date[11];		// YYYY-MM-DD
+	char api[16];
+	char model[64];
+	long queries;
+	usage_t usage;
+	double cost;		// USD
+} ledger_entry_t;
+
+// State of the daily spending relative to the configured budgets
+typedef enum {
+	BUDGET_OK,
+	BUDGET_SOFT,		// Use the cheaper model
+	BUDGET_HARD,		// Answer queries only locally
+} budget_t;
+
+#if defined(UNIT_TEST)
+double price_cost(const char *prices, const char *model, const usage_t *u);
+int ledger_parse(const char *s, ledger_entry_t *entries, int max);
+#endif
+
+void acl_usage_initialize(config_t *config);
+void acl_usage_add(const usage_t *u);
+void acl_usage_mark(const char *marker);
+void acl_usage_record(config_t *config, const char *api, const char *model);
+budget_t acl_usage_budget(config_t *config);
+double acl_usage_today_cost(config_t *config);
+long acl_usage_today_tokens(config_t *config, const char *api);
+config_t *acl_usage_degrade(config_t *config, config_t *copy,
+    const char *api);
@@ -0,0 +1,141 @@
+/*-
+ *
+ *  ai-cli - readline wrapper to obtain a generative AI suggestion
+ *  Test token usage and cost accounting.
+ *
+ *  Copyright 2024 Diomidis Spinellis
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+#include "config.h"
+#include "usage.h"
+
+static const char ledger_file[] = "test-usage.ledger";
+
+static void
+test_price(CuTest* tc)
+{
+	usage_t u = { .tokens_in = 1000000, .tokens_out = 100000 };
+	const char *prices = "gpt-4o:2.5/10, gpt-4o-mini:0.15/0.6";
+
+	CuAssertDblEquals(tc, 3.5, price_cost(prices, "gpt-4o", &u), 1e-9);
+	CuAssertDblEquals(tc, 0.21, price_cost(prices, "gpt-4o-mini", &u), 1e-9);
+	CuAssertDblEquals(tc, 0, price_cost(prices, "qwen", &u), 0);
+	CuAssertDblEquals(tc, 0, price_cost(NULL, "gpt-4o", &u), 0);
+	// Model names can contain colons
+	CuAssertDblEquals(tc, 1.1, price_cost("qwen:7b:1/1", "qwen:7b", &u), 1e-9);
+}
+
+static void
+test_ledger_parse(CuTest* tc)
+{
+	ledger_entry_t e[4];
+
+	int n = ledger_parse("# date api model ...\n"
+	    "2024-03-01 openai gpt-4o 3 300 30 100 0 0.0 0.001050 0.0\n"
+	    "damaged\n"
+	    "2024-03-02 llamacpp - 1 198 9 136 8 116.6 0.000000 68.6\n",
+	    e, 4);
+	CuAssertIntEquals(tc, 2, n);
+	CuAssertStrEquals(tc, "gpt-4o", e[0].model);
+	CuAssertIntEquals(tc, 3, e[0].queries);
+	CuAssertIntEquals(tc, 100, e[0].usage.tokens_cached);
+	CuAssertDblEquals(tc, 0.00105, e[0].cost, 1e-9);
+	CuAssertStrEquals(tc, "llamacpp", e[1].api);
+	CuAssertIntEquals(tc, 8, e[1].usage.timed_tokens);
+	CuAssertDblEquals(tc, 116.6, e[1].usage.timed_ms, 1e-9);
+}
+
+static void
+test_budget(CuTest* tc)
+{
+	config_t config = {"bash"};
+	config_t copy;
+
+	unlink(ledger_file);
+	config.usage_enabled = true;
+	config.usage_file = ledger_file;
+	config.usage_file_set = true;
+	config.usage_prices = "gpt-4o:2.5/10";
+	config.usage_prices_set = true;
+	config.usage_soft_budget = 1;
+	config.usage_soft_budget_set = true;
+	config.usage_hard_budget = 2;
+	config.usage_hard_budget_set = true;
+	config.usage_soft_model = "gpt-4o-mini";
+	config.usage_soft_model_set = true;
+	config.openai_model = "gpt-4o";
+
+	// Each response costs 0.75 USD
+	usage_t u = { .tokens_in = 100000, .tokens_out = 50000 };
+	CuAssertIntEquals(tc, BUDGET_OK, acl_usage_budget(&config));
+	acl_usage_add(&u);
+	acl_usage_record(&config, "openai", "gpt-4o");
+	CuAssertIntEquals(tc, BUDGET_OK, acl_usage_budget(&config));
+	// A query's multiple responses are accounted together
+	acl_usage_add(&u);
+	acl_usage_add(&u);
+	acl_usage_record(&config, "openai", "gpt-4o");
+	CuAssertDblEquals(tc, 2.25, acl_usage_today_cost(&config), 1e-9);
+	CuAssertIntEquals(tc, BUDGET_HARD, acl_usage_budget(&config));
+	// Unpriced models are free
+	acl_usage_add(&u);
+	acl_usage_record(&config, "llamacpp", NULL);
+	CuAssertDblEquals(tc, 2.25, acl_usage_today_cost(&config), 1e-9);
+
+	config.usage_hard_budget = 3;
+	CuAssertIntEquals(tc, BUDGET_SOFT, acl_usage_budget(&config));
+	config_t *c = acl_usage_degrade(&config, &copy, "openai");
+	CuAssertPtrEquals(tc, &copy, c);
+	CuAssertStrEquals(tc, "gpt-4o-mini", c->openai_model);
+	CuAssertStrEquals(tc, "gpt-4o", config.openai_model);
+	CuAssertPtrEquals(tc, &config, acl_usage_degrade(&config, &copy,
+	    "llamacpp"));
+
+	// The ledger is replaced rather than rewritten in place
+	struct stat before, after;
+	CuAssertIntEquals(tc, 0, stat(ledger_file, &before));
+	acl_usage_record(&config, "openai", "gpt-4o");
+	CuAssertIntEquals(tc, 0, stat(ledger_file, &after));
+	CuAssertTrue(tc, before.st_ino != after.st_ino);
+	CuAssertDblEquals(tc, 2.25, acl_usage_today_cost(&config), 1e-9);
+
+	// Invalid prices are ignored
+	config.usage_prices = "gpt-4o:2.5/10, gpt-4o";
+	acl_usage_initialize(&config);
+	CuAssertDblEquals(tc, 0.75, price_cost(config.usage_prices, "gpt-4o",
+	    &u), 1e-9);
+
+	// Accounting can be disabled
+	config.usage_enabled = false;
+	CuAssertIntEquals(tc, BUDGET_OK, acl_usage_budget(&config));
+	unlink(ledger_file);
+}
+
+CuSuite*
+cu_usage_suite(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, test_price);
+	SUITE_ADD_TEST(suite, test_ledger_parse);
+	SUITE_ADD_TEST(suite, test_budget);
+
+	return suite;
+}